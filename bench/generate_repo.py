@@ -0,0 +1,145 @@
+"""
+Generate a synthetic git repository of a given shape for benchmarks.
+
+The same arguments and seed always produce the same tree, commits and reflog, so
+results of different commits of git-live can be compared.
+"""
+
+import argparse
+import random
+import subprocess
+import time
+from dataclasses import dataclass
+from pathlib import Path
+from typing import List
+
+AUTHOR = "bench <bench@localhost>"
+# a fixed date keeps commit ids stable between runs
+EPOCH = 1600000000
+DIRS_PER_LEVEL = 8
+FILES_PER_COMMIT = 3
+
+
+@dataclass
+class RepoShape:
+    files: int = 2000
+    depth: int = 3
+    untracked: int = 50
+    commits: int = 500
+    reflog: int = 200
+    submodules: int = 0
+    seed: int = 0
+
+
+def git(repo: Path, *args: str, stdin: bytes = b"") -> None:
+    subprocess.run(
+        ["git", "-c", "protocol.file.allow=always", *args],
+        cwd=repo,
+        input=stdin,
+        check=True,
+        stdout=subprocess.DEVNULL,
+        env={
+            "GIT_AUTHOR_NAME": "bench",
+            "GIT_AUTHOR_EMAIL": "bench@localhost",
+            "GIT_COMMITTER_NAME": "bench",
+            "GIT_COMMITTER_EMAIL": "bench@localhost",
+            "GIT_AUTHOR_DATE": f"{EPOCH} +0000",
+            "GIT_COMMITTER_DATE": f"{EPOCH} +0000",
+            "HOME": str(repo),
+            "PATH": "/usr/bin:/bin:/usr/local/bin",
+        },
+    )
+
+
+def get_file_paths(shape: RepoShape, rand: random.Random) -> List[str]:
+    paths = []
+    for i in range(shape.files):
+        parts = [f"dir{rand.randrange(DIRS_PER_LEVEL)}" for _ in range(shape.depth)]
+        paths.append("/".join(parts + [f"file_{i:06d}.txt"]))
+    return paths
+
+
+def get_fast_import_stream(shape: RepoShape, paths: List[str]) -> bytes:
+    """all commits go through a single fast-import, committing one by one is too slow"""
+    rand = random.Random(shape.seed)
+    lines = []
+    for commit in range(max(shape.commits, 1)):
+        message = f"commit {commit}"
+        lines += [
+            "commit refs/heads/master",
+            f"mark :{commit + 1}",
+            f"committer {AUTHOR} {EPOCH + commit * 60} +0000",
+            f"data {len(message)}",
+            message,
+        ]
+        changed = paths if commit == 0 else rand.sample(paths, FILES_PER_COMMIT)
+        for path in changed:
+            content = f"{path} {commit}\n"
+            lines += [f"M 644 inline {path}", f"data {len(content)}", content]
+        lines.append("")
+    lines += ["reset refs/heads/other", f"from :{max(shape.commits - 1, 1)}", ""]
+    return "\n".join(lines).encode()
+
+
+def write_reflog(repo: Path, length: int) -> None:
+    """write the checkouts straight to the reflog, running git checkout for each is slow"""
+    head = (repo / ".git" / "refs" / "heads" / "master").read_text().strip()
+    branches = ["master", "other"] + [f"topic{i}" for i in range(min(length, 64))]
+    entries = []
+    for i in range(length):
+        source, target = branches[i % len(branches)], branches[(i + 1) % len(branches)]
+        entries.append(
+            f"{head} {head} {AUTHOR} {EPOCH + i} +0000"
+            f"\tcheckout: moving from {source} to {target}\n"
+        )
+    logs = repo / ".git" / "logs"
+    logs.mkdir(exist_ok=True)
+    with open(logs / "HEAD", "a") as reflog:
+        reflog.writelines(entries)
+
+
+def add_submodules(repo: Path, count: int) -> None:
+    modules = repo.parent / f"{repo.name}-modules"
+    for i in range(count):
+        module = modules / f"module{i}"
+        module.mkdir(parents=True)
+        git(module, "init", "-q")
+        (module / "README").write_text(f"module {i}\n")
+        git(module, "add", ".")
+        git(module, "commit", "-q", "-m", "initial")
+        git(repo, "submodule", "add", "-q", str(module), f"modules/module{i}")
+    if count:
+        git(repo, "commit", "-q", "-m", "add submodules")
+
+
+def generate_repo(path: Path, shape: RepoShape) -> None:
+    rand = random.Random(shape.seed)
+    paths = get_file_paths(shape, rand)
+
+    path.mkdir(parents=True)
+    git(path, "init", "-q", "-b", "master")
+    git(path, "fast-import", "--quiet", stdin=get_fast_import_stream(shape, paths))
+    git(path, "checkout", "-q", "-f", "master")
+    write_reflog(path, shape.reflog)
+    add_submodules(path, shape.submodules)
+
+    for i in range(shape.untracked):
+        untracked = path / paths[i % len(paths)]
+        untracked.with_name(f"untracked_{i:06d}.txt").write_text("untracked\n")
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("path", type=Path)
+    for field, default in vars(RepoShape()).items():
+        parser.add_argument(f"--{field}", type=int, default=default)
+    args = parser.parse_args()
+
+    started = time.monotonic()
+    shape = RepoShape(**{field: getattr(args, field) for field in vars(RepoShape())})
+    generate_repo(args.path, shape)
+    print(f"generated {args.path} in {time.monotonic() - started:.1f}s: {shape}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,154 @@
+"""
+Measure how long the dashboard takes to show a change in the work tree.
+
+A synthetic repository is created, the dashboard is started in a pseudo terminal and
+then files are written one by one, each time waiting for the new file name to show up
+in the dashboard's output. The dashboard's own measurement (from seeing the inotify
+event to the wrefresh) is read from its stats file.
+"""
+
+import argparse
+import os
+import pty
+import select
+import signal
+import statistics
+import subprocess
+import tempfile
+import time
+from pathlib import Path
+from typing import List, Optional
+
+SCREEN_ROWS = 50
+SCREEN_COLS = 200
+STARTUP_TIMEOUT = 10.0
+CHANGE_TIMEOUT = 5.0
+SETTLE_TIME = 0.3
+
+
+def git(repo: Path, *args: str) -> None:
+    subprocess.run(
+        ["git", "-c", "user.name=bench", "-c", "user.email=bench@localhost", *args],
+        cwd=repo,
+        check=True,
+        stdout=subprocess.DEVNULL,
+    )
+
+
+def create_repo(path: Path, files: int) -> None:
+    git(path, "init", "-q")
+    for i in range(files):
+        (path / f"file_{i:05d}.txt").write_text(f"line {i}\n")
+    git(path, "add", ".")
+    git(path, "commit", "-q", "-m", "initial")
+
+
+class Dashboard:
+    def __init__(self, binary: Path, repo: Path, stats_path: Path) -> None:
+        self.output = b""
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            os.chdir(repo)
+            # the caches, snapshots and sockets of a throwaway repository stay with it
+            os.environ["HOME"] = str(repo.parent)
+            os.environ["XDG_RUNTIME_DIR"] = str(repo.parent)
+            os.environ["TERM"] = "xterm"
+            os.environ["LINES"] = str(SCREEN_ROWS)
+            os.environ["COLUMNS"] = str(SCREEN_COLS)
+            os.execv(binary, [str(binary), "--stats-file", str(stats_path)])
+
+    def wait_for(self, text: bytes, timeout: float) -> bool:
+        deadline = time.monotonic() + timeout
+        while text not in self.output:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return False
+            ready, _, _ = select.select([self.fd], [], [], remaining)
+            if ready:
+                self.output += os.read(self.fd, 65536)
+        return True
+
+    def drain(self) -> None:
+        while select.select([self.fd], [], [], 0)[0]:
+            os.read(self.fd, 65536)
+        self.output = b""
+
+    def stop(self) -> None:
+        os.kill(self.pid, signal.SIGINT)
+        try:
+            while select.select([self.fd], [], [], 1)[0]:
+                os.read(self.fd, 65536)
+        except OSError:
+            pass
+        os.waitpid(self.pid, 0)
+
+
+def read_dashboard_latency(stats_path: Path) -> Optional[List[str]]:
+    if not stats_path.exists():
+        return None
+    for line in stats_path.read_text().splitlines():
+        if line.startswith("event_to_screen"):
+            return line.split()
+    return None
+
+
+def format_ms(seconds: float) -> str:
+    return f"{seconds * 1000:.1f}ms"
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--binary", type=Path, default=Path("git-live").absolute())
+    parser.add_argument(
+        "--files", type=int, default=1000, help="files in the synthetic repository"
+    )
+    parser.add_argument(
+        "--changes", type=int, default=20, help="how many changes to measure"
+    )
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        repo = Path(tmp) / "repo"
+        repo.mkdir()
+        stats_path = Path(tmp) / "stats"
+        create_repo(repo, args.files)
+
+        dashboard = Dashboard(args.binary, repo, stats_path)
+        latencies = []
+        try:
+            if not dashboard.wait_for(b"Git Live", STARTUP_TIMEOUT):
+                raise SystemExit("the dashboard did not start")
+            for i in range(args.changes):
+                time.sleep(SETTLE_TIME)
+                dashboard.drain()
+                name = f"bench_{i:05d}.txt"
+                started = time.monotonic()
+                (repo / name).write_text("changed\n")
+                if not dashboard.wait_for(name.encode(), CHANGE_TIMEOUT):
+                    print(f"{name} did not show up within {CHANGE_TIMEOUT}s")
+                    continue
+                latencies.append(time.monotonic() - started)
+                (repo / name).unlink()
+        finally:
+            dashboard.stop()
+
+        if latencies:
+            latencies.sort()
+            p95 = latencies[min(len(latencies) - 1, int(len(latencies) * 0.95))]
+            print(
+                f"change to screen ({len(latencies)} changes): "
+                f"p50 {format_ms(statistics.median(latencies))} "
+                f"p95 {format_ms(p95)} max {format_ms(latencies[-1])}"
+            )
+
+        row = read_dashboard_latency(stats_path)
+        if row:
+            _, _, count, p50, p95, max_us = row
+            print(
+                f"event to screen as measured by the dashboard ({count} events): "
+                f"p50 {p50}us p95 {p95}us max {max_us}us"
+            )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,290 @@
+"""
+Benchmark the headless dashboard against generated repositories.
+
+Each scenario starts `git-live --headless` in a repository created by
+generate_repo.py and reads the "frame <n> <frame_us> <event_us> <changes> <stale>"
+lines it prints:
+
+  cold start     - time from spawning the dashboard until its first computed frame
+                   (not the saved status of the last run, every run gets an empty HOME)
+  idle           - frames and CPU time while nothing changes
+  edit           - single file edits, from the write until a frame showed it (the
+                   number of changes grew)
+  checkout storm - back to back checkouts between two branches
+
+Results can be saved with --json and compared to a previous run with --compare, the
+repositories are generated from a fixed seed so numbers are comparable across commits.
+The dashboards run with HOME and XDG_RUNTIME_DIR in a temporary directory, so their
+caches, snapshots and sockets stay out of the real ~/.cache and runtime directory.
+"""
+
+import argparse
+import json
+import os
+import select
+import signal
+import statistics
+import subprocess
+import tempfile
+import time
+from pathlib import Path
+from typing import Callable, Dict, List, NamedTuple, Optional
+
+from generate_repo import RepoShape, generate_repo
+
+STARTUP_TIMEOUT = 30.0
+# the dashboard stretches its tick when over its cpu budget, nested edits wait for it
+FRAME_TIMEOUT = 10.0
+SETTLE_TIME = 0.5
+CLOCK_TICKS = os.sysconf("SC_CLK_TCK")
+
+
+class Frame(NamedTuple):
+    arrived: float
+    frame_us: int
+    event_us: int
+    changes: int
+    # the saved status of the last run, shown before the first frame is computed
+    stale: int
+
+
+class HeadlessDashboard:
+    def __init__(self, binary: Path, repo: Path, home: Path) -> None:
+        self.spawned = time.monotonic()
+        self.process = subprocess.Popen(
+            [str(binary), "--headless"],
+            cwd=repo,
+            env={**os.environ, "HOME": str(home), "XDG_RUNTIME_DIR": str(home)},
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+        )
+        self.buffer = b""
+        self.frames: List[Frame] = []
+
+    def read_frames(self, timeout: float) -> int:
+        """read whatever frames arrive within the timeout, returns how many were read"""
+        count = 0
+        deadline = time.monotonic() + timeout
+        while (remaining := deadline - time.monotonic()) > 0:
+            ready, _, _ = select.select([self.process.stdout], [], [], remaining)
+            if not ready:
+                break
+            data = os.read(self.process.stdout.fileno(), 4096)
+            if not data:
+                raise RuntimeError("dashboard exited")
+            now = time.monotonic()
+            self.buffer += data
+            *lines, self.buffer = self.buffer.split(b"\n")
+            for line in lines:
+                _, _, *values = line.split()
+                self.frames.append(Frame(now, *map(int, values)))
+                count += 1
+        return count
+
+    def wait_frame(
+        self, timeout: float, matches: Callable[[Frame], bool] = lambda frame: True
+    ) -> Optional[Frame]:
+        """wait for the next frame that matches"""
+        checked = len(self.frames)
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            for frame in self.frames[checked:]:
+                if matches(frame):
+                    return frame
+            checked = len(self.frames)
+            self.read_frames(min(0.05, deadline - time.monotonic()))
+        return None
+
+    def settle(self) -> None:
+        """
+        drop the frames of earlier changes so they are not attributed to the next one,
+        idle ticks keep drawing so this waits until the number of changes is stable.
+        """
+        while True:
+            start = len(self.frames)
+            self.read_frames(SETTLE_TIME)
+            if start and all(
+                frame.changes == self.frames[start - 1].changes and not frame.event_us
+                for frame in self.frames[start:]
+            ):
+                return
+
+    def cpu_seconds(self) -> float:
+        fields = Path(f"/proc/{self.process.pid}/stat").read_text().rsplit(")", 1)[1]
+        utime, stime = fields.split()[11:13]
+        return (int(utime) + int(stime)) / CLOCK_TICKS
+
+    def close(self) -> None:
+        # SIGTERM has no handler and would kill it before it saves its snapshot and caches
+        self.process.send_signal(signal.SIGINT)
+        try:
+            self.process.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            self.process.kill()
+            self.process.wait()
+
+
+def git(repo: Path, *args: str) -> None:
+    subprocess.run(["git", *args], cwd=repo, check=True, capture_output=True)
+
+
+def percentile(samples: List[float], fraction: float) -> float:
+    ordered = sorted(samples)
+    return ordered[min(int(len(ordered) * fraction), len(ordered) - 1)]
+
+
+def summarize(prefix: str, samples: List[float]) -> Dict[str, float]:
+    if not samples:
+        return {}
+    return {
+        f"{prefix}_p50": statistics.median(samples),
+        f"{prefix}_p95": percentile(samples, 0.95),
+        f"{prefix}_max": max(samples),
+    }
+
+
+def bench_cold_start(binary: Path, repo: Path, runs: int) -> Dict[str, float]:
+    samples = []
+    for _ in range(runs):
+        # nothing saved by the previous run, no daemon to connect to
+        with tempfile.TemporaryDirectory() as home:
+            dashboard = HeadlessDashboard(binary, repo, Path(home))
+            try:
+                frame = dashboard.wait_frame(
+                    STARTUP_TIMEOUT, lambda frame: not frame.stale
+                )
+                if frame is None:
+                    raise RuntimeError("no frame at startup")
+                samples.append((frame.arrived - dashboard.spawned) * 1000)
+            finally:
+                dashboard.close()
+    return summarize("cold_start_ms", samples)
+
+
+def bench_idle(dashboard: HeadlessDashboard, seconds: float) -> Dict[str, float]:
+    dashboard.settle()
+    first = len(dashboard.frames)
+    cpu = dashboard.cpu_seconds()
+    dashboard.read_frames(seconds)
+    frames = dashboard.frames[first:]
+    return {
+        "idle_frames_per_s": len(frames) / seconds,
+        "idle_cpu_percent": (dashboard.cpu_seconds() - cpu) / seconds * 100,
+        **summarize("idle_frame_ms", [frame.frame_us / 1000 for frame in frames]),
+    }
+
+
+def bench_edits(dashboard: HeadlessDashboard, repo: Path, edits: int) -> Dict[str, float]:
+    # only the generated files, appending to .gitmodules would break its syntax
+    tracked = subprocess.run(
+        ["git", "ls-files", "*.txt"],
+        cwd=repo,
+        check=True,
+        capture_output=True,
+        text=True,
+    ).stdout.split()
+    latencies, frame_times = [], []
+    dashboard.settle()
+    for i in range(edits):
+        changes = dashboard.frames[-1].changes
+        # a different clean file every time, so each edit adds a change
+        path = repo / tracked[i * 7919 % len(tracked)]
+        written = time.monotonic()
+        with open(path, "a") as file:
+            file.write(f"edit {i}\n")
+        frame = dashboard.wait_frame(
+            FRAME_TIMEOUT, lambda frame: frame.changes > changes
+        )
+        if frame is not None:
+            latencies.append((frame.arrived - written) * 1000)
+            frame_times.append(frame.frame_us / 1000)
+        dashboard.settle()
+    git(repo, "checkout", "-q", "--", ".")
+    return {
+        "edit_missed": edits - len(latencies),
+        **summarize("edit_latency_ms", latencies),
+        **summarize("edit_frame_ms", frame_times),
+    }
+
+
+def bench_checkout_storm(
+    dashboard: HeadlessDashboard, repo: Path, checkouts: int
+) -> Dict[str, float]:
+    dashboard.settle()
+    first = len(dashboard.frames)
+    cpu = dashboard.cpu_seconds()
+    started = time.monotonic()
+    for i in range(checkouts):
+        git(repo, "checkout", "-q", "other" if i % 2 == 0 else "master")
+    if checkouts % 2:
+        git(repo, "checkout", "-q", "master")
+    dashboard.settle()
+    elapsed = time.monotonic() - started
+    frames = dashboard.frames[first:]
+    return {
+        "storm_frames": len(frames),
+        "storm_cpu_percent": (dashboard.cpu_seconds() - cpu) / elapsed * 100,
+        **summarize("storm_frame_ms", [frame.frame_us / 1000 for frame in frames]),
+    }
+
+
+def run_benchmarks(args: argparse.Namespace, repo: Path, home: Path) -> Dict[str, float]:
+    results = bench_cold_start(args.binary, repo, args.cold_runs)
+    dashboard = HeadlessDashboard(args.binary, repo, home)
+    try:
+        if dashboard.wait_frame(STARTUP_TIMEOUT) is None:
+            raise RuntimeError("no frame at startup")
+        results.update(bench_idle(dashboard, args.idle_seconds))
+        results.update(bench_edits(dashboard, repo, args.edits))
+        results.update(bench_checkout_storm(dashboard, repo, args.checkouts))
+    finally:
+        dashboard.close()
+    return results
+
+
+def print_results(results: Dict[str, float], previous: Dict[str, float]) -> None:
+    for name, value in results.items():
+        line = f"{name:<24} {value:>10.2f}"
+        if previous.get(name):
+            change = (value - previous[name]) / previous[name] * 100
+            line += f"   {previous[name]:>10.2f} ({change:+.1f}%)"
+        print(line)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter
+    )
+    parser.add_argument("--binary", type=Path, default=Path("git-live"))
+    parser.add_argument("--repo", type=Path, help="reuse an already generated repo")
+    parser.add_argument("--json", type=Path, help="save the results to this file")
+    parser.add_argument("--compare", type=Path, help="results of a previous --json")
+    parser.add_argument("--cold-runs", type=int, default=5)
+    parser.add_argument("--idle-seconds", type=float, default=5.0)
+    parser.add_argument("--edits", type=int, default=20)
+    parser.add_argument("--checkouts", type=int, default=20)
+    for field, default in vars(RepoShape()).items():
+        parser.add_argument(f"--{field}", type=int, default=default)
+    args = parser.parse_args()
+    args.binary = args.binary.resolve()
+
+    shape = RepoShape(**{field: getattr(args, field) for field in vars(RepoShape())})
+    previous = json.loads(args.compare.read_text())["results"] if args.compare else {}
+
+    with tempfile.TemporaryDirectory() as tmp:
+        repo = args.repo
+        if repo is None:
+            repo = Path(tmp) / "repo"
+            generate_repo(repo, shape)
+        home = Path(tmp) / "home"
+        home.mkdir()
+        results = run_benchmarks(args, repo, home)
+
+    print(f"shape: {shape}")
+    print_results(results, previous)
+    if args.json:
+        args.json.write_text(json.dumps({"shape": vars(shape), "results": results}))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,206 @@
+// Microbenchmarks for draw_layout, run with `make bench` or `./layout_bench [min_seconds] [scenario]`.
+//
+// Every scenario builds a synthetic tree once and then draws it into a no-op backend over and over, so only the
+// layout itself is measured. Results are reported per draw and per node so trees of different sizes are comparable.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../err.h"
+#include "layout.h"
+
+#define SCREEN_WIDTH (200)
+#define SCREEN_HEIGHT (50)
+
+#define DEFAULT_MIN_SECONDS (0.5)
+#define WARMUP_DRAWS (3)
+
+#define WIDE_COLUMNS (6)
+#define WIDE_ROWS (40)
+#define DEEP_LEVELS (12)
+#define GRID_ENTRIES (300)
+#define LONG_TEXT_LINES (500)
+#define TEXT_LEN (128)
+
+struct scenario {
+    const char *name;
+    err_t (*build)(struct node *root);
+};
+
+static err_t noop_draw_text(void *arg, const char *text, uint32_t len, uint32_t col, uint32_t row, int color,
+                            int attrs) {
+    (void)arg, (void)text, (void)len, (void)col, (void)row, (void)color, (void)attrs;
+    return NO_ERROR;
+}
+
+static err_t noop_draw_color(void *arg, uint32_t col, uint32_t row, uint32_t width, uint32_t height, int color) {
+    (void)arg, (void)col, (void)row, (void)width, (void)height, (void)color;
+    return NO_ERROR;
+}
+
+// columns of short texts, like the refs and commits panels
+static err_t build_wide(struct node *root) {
+    err_t err = NO_ERROR;
+    struct node *column = NULL;
+    char text[TEXT_LEN];
+
+    root->nodes_direction = nodes_direction_columns;
+    for (uint32_t i = 0; i < WIDE_COLUMNS; i++) {
+        RETHROW(append_child(root, &column));
+        column->nodes_direction = nodes_direction_rows;
+        if (i % 2) {
+            column->expand = 1;
+        } else {
+            column->fit_content = true;
+        }
+        for (uint32_t j = 0; j < WIDE_ROWS; j++) {
+            snprintf(text, sizeof(text), "column %u row %u", i, j);
+            RETHROW(append_text(column, text));
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+// nested padded boxes, each with a title and the next level
+static err_t build_deep(struct node *root) {
+    err_t err = NO_ERROR;
+    struct node *parent = root;
+    struct node *child = NULL;
+    char text[TEXT_LEN];
+
+    for (uint32_t i = 0; i < DEEP_LEVELS; i++) {
+        parent->nodes_direction = i % 2 ? nodes_direction_columns : nodes_direction_rows;
+        snprintf(text, sizeof(text), "level %u", i);
+        RETHROW(append_text(parent, text));
+        RETHROW(append_child(parent, &child));
+        child->fit_content = true;
+        child->padding_left = 1;
+        parent = child;
+    }
+    RETHROW(append_text(parent, "leaf"));
+
+cleanup:
+    return err;
+}
+
+// a wrapped list of status lines, like the status panel of a busy repository
+static err_t build_grid(struct node *root) {
+    err_t err = NO_ERROR;
+    struct node *grid = NULL;
+    char text[TEXT_LEN];
+
+    root->nodes_direction = nodes_direction_rows;
+    RETHROW(append_child(root, &grid));
+    grid->expand = 1;
+    grid->nodes_direction = nodes_direction_rows;
+    grid->wrap = node_wrap_wrap;
+    grid->fit_content = true;
+    for (uint32_t i = 0; i < GRID_ENTRIES; i++) {
+        if (i % 100 == 0) {
+            RETHROW(append_text(grid, " changed:"));
+        }
+        snprintf(text, sizeof(text), "   modified: src/module_%u/file_%u.c +%u -%u", i % 7, i, i % 13, i % 5);
+        RETHROW(append_text(grid, text));
+    }
+
+cleanup:
+    return err;
+}
+
+// a single text node with many lines
+static err_t build_long_text(struct node *root) {
+    err_t err = NO_ERROR;
+    char *text = NULL;
+    size_t len = 0;
+
+    text = malloc(LONG_TEXT_LINES * TEXT_LEN);
+    ASSERT(text);
+    for (uint32_t i = 0; i < LONG_TEXT_LINES; i++) {
+        len += snprintf(text + len, TEXT_LEN, "line %u of a long multi-line text\n", i);
+    }
+    RETHROW(append_text(root, text));
+
+cleanup:
+    free(text);
+    return err;
+}
+
+static const struct scenario scenarios[] = {
+    {"wide", build_wide},
+    {"deep", build_deep},
+    {"grid", build_grid},
+    {"long_text", build_long_text},
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t count_nodes(struct node *node) {
+    struct node *child = NULL;
+    uint64_t count = 1;
+    LIST_FOREACH(child, &node->nodes, entry) {
+        count += count_nodes(child);
+    }
+    return count;
+}
+
+static err_t run_scenario(const struct scenario *scenario, double min_seconds) {
+    err_t err = NO_ERROR;
+    struct layout *layout = NULL;
+    struct rect screen = {0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    uint64_t nodes = 0;
+    uint64_t draws = 0;
+    uint64_t started = 0;
+    uint64_t elapsed = 0;
+
+    RETHROW(init_layout(&layout, noop_draw_text, noop_draw_color, NULL));
+    RETHROW(scenario->build(&layout->root));
+    nodes = count_nodes(&layout->root);
+
+    for (uint32_t i = 0; i < WARMUP_DRAWS; i++) {
+        RETHROW(draw_layout(layout, screen));
+    }
+
+    started = now_ns();
+    do {
+        RETHROW(draw_layout(layout, screen));
+        draws++;
+        elapsed = now_ns() - started;
+    } while (elapsed < min_seconds * 1e9);
+
+    printf("%-12s %8lu %10lu %14.0f %12.1f\n", scenario->name, nodes, draws, (double)elapsed / draws,
+           (double)elapsed / draws / nodes);
+
+cleanup:
+    if (layout) {
+        RETHROW_PRINT(free_layout(layout));
+    }
+    return err;
+}
+
+int main(int argc, char **argv) {
+    err_t err = NO_ERROR;
+    double min_seconds = DEFAULT_MIN_SECONDS;
+
+    if (argc > 1) {
+        min_seconds = atof(argv[1]);
+        ASSERT(min_seconds > 0);
+    }
+
+    printf("%-12s %8s %10s %14s %12s\n", "scenario", "nodes", "draws", "ns/draw", "ns/node");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (argc > 2 && strcmp(argv[2], scenarios[i].name)) {
+            continue;
+        }
+        RETHROW(run_scenario(&scenarios[i], min_seconds));
+    }
+
+cleanup:
+    return err;
+}
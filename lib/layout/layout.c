@@ -23,6 +23,24 @@ struct size {
     uint32_t height;
 };
 
+static struct layout_counters counters = {0};
+
+static void *counted_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (ptr) {
+        counters.allocations++;
+        counters.live_bytes += size;
+    }
+    return ptr;
+}
+
+static void counted_free(void *ptr, size_t size) {
+    if (ptr) {
+        counters.live_bytes -= size;
+    }
+    free(ptr);
+}
+
 static uint32_t get_width(struct node *node, struct size max_size);
 static uint32_t get_height(struct node *node, struct size max_size);
 static err_t print_node(struct layout *layout, struct node *node, struct rect rect, short color_top);
@@ -56,6 +74,7 @@ static uint32_t get_str_height(const char *str) {
 static uint32_t get_overflow_min_height(struct node *node, struct size max_size) {
     struct node *curr;
     uint32_t sz = 0;
+    counters.overflow_measure_calls++;
     if (node->nodes_direction == nodes_direction_columns) {
         // a b c |
         // d     |
@@ -97,6 +116,9 @@ static uint32_t get_overflow_min_height(struct node *node, struct size max_size)
                 }
                 column_width = MAX(column_width, get_width(curr, (struct size){max_size.width, height}));
                 column_height += height;
+                // the columns so far are already too wide for sz, the rest can't make it fit
+                if (columns_width + column_width > max_size.width)
+                    break;
             }
             columns_width += column_width;
             if (columns_width <= max_size.width)
@@ -109,6 +131,7 @@ static uint32_t get_overflow_min_height(struct node *node, struct size max_size)
 static uint32_t get_overflow_min_width(struct node *node, struct size max_size) {
     struct node *curr;
     uint32_t sz = 0;
+    counters.overflow_measure_calls++;
     if (node->nodes_direction == nodes_direction_rows) {
         // a d
         // b
@@ -153,6 +176,9 @@ static uint32_t get_overflow_min_width(struct node *node, struct size max_size)
                 }
                 row_height = MAX(row_height, get_height(curr, (struct size){width, max_size.height}));
                 row_width += width;
+                // the rows so far are already too high for sz, the rest can't make it fit
+                if (rows_height + row_height > max_size.height)
+                    break;
             }
             rows_height += row_height;
             if (rows_height <= max_size.height)
@@ -165,6 +191,7 @@ static uint32_t get_overflow_min_width(struct node *node, struct size max_size)
 static uint32_t get_width(struct node *node, struct size max_size) {
     uint32_t sz = 0;
     struct node *curr;
+    counters.measure_calls++;
     if (node->content) {
         sz = get_str_width(node->content);
     } else if (node->wrap == node_wrap_wrap) {
@@ -193,6 +220,7 @@ static uint32_t get_width(struct node *node, struct size max_size) {
 static uint32_t get_height(struct node *node, struct size max_size) {
     uint32_t sz = 0;
     struct node *curr;
+    counters.measure_calls++;
     if (node->content) {
         sz = get_str_height(node->content);
     } else if (node->wrap == node_wrap_wrap) {
@@ -368,6 +396,8 @@ static err_t print_node(struct layout *layout, struct node *node, struct rect re
     ASSERT(layout);
     ASSERT(node);
 
+    counters.print_calls++;
+
     int color = node->color ? node->color : color_top;
     struct rect inner_rect = {
         .col = rect.col + node->padding_left,
@@ -398,8 +428,9 @@ static err_t alloc_node(struct node **node) {
 
     ASSERT(node);
 
-    *node = malloc(sizeof(**node));
+    *node = counted_malloc(sizeof(**node));
     ASSERT(*node);
+    counters.live_nodes++;
 
 cleanup:
     return err;
@@ -411,9 +442,10 @@ static err_t free_node(struct node *node) {
     ASSERT(node);
 
     if (node->content != NULL) {
-        free(node->content);
+        counted_free(node->content, strlen(node->content) + 1);
     }
-    free(node);
+    counted_free(node, sizeof(*node));
+    counters.live_nodes--;
 
 cleanup:
     return err;
@@ -442,7 +474,7 @@ err_t init_layout(struct layout **out, draw_text_t *draw_text, draw_color_t *dra
 
     *out = NULL;
 
-    result = malloc(sizeof(*result));
+    result = counted_malloc(sizeof(*result));
     ASSERT(result);
 
     result->draw_text = draw_text;
@@ -492,7 +524,7 @@ err_t free_layout(struct layout *layout) {
     ASSERT(layout);
 
     RETHROW(clear_layout(layout));
-    free(layout);
+    counted_free(layout, sizeof(*layout));
 
 cleanup:
     return err;
@@ -521,6 +553,25 @@ cleanup:
     return err;
 }
 
+err_t get_layout_counters(struct layout_counters *out) {
+    err_t err = NO_ERROR;
+
+    ASSERT(out);
+
+    *out = counters;
+
+cleanup:
+    return err;
+}
+
+err_t reset_layout_counters(void) {
+    counters.measure_calls = 0;
+    counters.overflow_measure_calls = 0;
+    counters.print_calls = 0;
+    counters.allocations = 0;
+    return NO_ERROR;
+}
+
 err_t append_child(struct node *parent, struct node **child) {
     err_t err = NO_ERROR;
 
@@ -540,7 +591,7 @@ err_t append_styled_text(struct node *parent, const char *text, short color, att
     char *buff = NULL;
     struct node *node = NULL;
 
-    buff = malloc(strlen(text) + 1);
+    buff = counted_malloc(strlen(text) + 1);
     ASSERT(buff);
 
     strcpy(buff, text);
@@ -53,11 +53,25 @@ struct rect {
     uint32_t height;
 };
 
+// how much work draw_layout did and how much memory the layouts hold, for tests, benchmarks and the stats.
+// the counters are process-wide and not synchronized, so they only add up when a single thread uses layouts.
+struct layout_counters {
+    uint64_t measure_calls;
+    uint64_t overflow_measure_calls;
+    uint64_t print_calls;
+    uint64_t allocations;
+    // not cleared by reset_layout_counters
+    uint64_t live_nodes;
+    uint64_t live_bytes;
+};
+
 err_t init_layout(struct layout**, draw_text_t* draw_text, draw_color_t* draw_color, void* draw_arg);
 err_t free_layout(struct layout*);
 err_t clear_layout(struct layout*);
 err_t draw_layout(struct layout* layout, struct rect rect);
 err_t get_layout_root(struct layout* layout, struct node **);
+err_t get_layout_counters(struct layout_counters *);
+err_t reset_layout_counters(void);
 
 err_t append_text(struct node *, const char*);
 err_t append_styled_text(struct node *, const char*, short color, attr_t attrs);
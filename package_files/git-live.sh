@@ -1,3 +1,6 @@
 export GIT_LIVE_DIR=${GIT_LIVE_DIR:-~/.cache/git-live}
 export GIT_LIVE_TERMINAL_ID=$(xxd -ps -l8 /dev/urandom)
-export PROMPT_COMMAND="mkdir -p \$GIT_LIVE_DIR/terminals;echo \$PWD > \$GIT_LIVE_DIR/terminals/\$GIT_LIVE_TERMINAL_ID;$PROMPT_COMMAND"
+# only push the cwd when it changed and some dashboard is attached to this terminal, otherwise a prompt costs nothing.
+export PROMPT_COMMAND="if [ -f \$GIT_LIVE_DIR/terminals/\$GIT_LIVE_TERMINAL_ID ] && [ \"\$PWD\" != \"\$GIT_LIVE_PWD\" ]; then git-live notify; fi;GIT_LIVE_PWD=\$PWD;$PROMPT_COMMAND"
+# for PS1, e.g. PS1='\w $(__git_live_ps1)\$ ', reads what a running dashboard or daemon of the repository published.
+__git_live_ps1() { git-live prompt 2>/dev/null; }
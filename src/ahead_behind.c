@@ -0,0 +1,294 @@
+#include "ahead_behind.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../lib/err.h"
+#include "timing.h"
+#include "utils.h"
+
+#define AHEAD_BEHIND_CACHE_SIZE (128)
+#define AHEAD_BEHIND_CACHE_PROBE (4)
+
+// how many commits to walk between checks of the time budget
+#define BUDGET_CHECK_INTERVAL (256)
+
+// a failed or truncated count is retried after this long, doubled for every retry after it
+#define RETRY_BACKOFF_MS (5000)
+// every retry gets twice the budget of the try before it, a pair is given up on after this many
+#define MAX_RETRIES (4)
+
+enum entry_state {
+    entry_state_empty = 0,
+    entry_state_pending,
+    entry_state_done,
+    entry_state_failed,
+};
+
+struct cache_entry {
+    git_oid local;
+    git_oid upstream;
+    enum entry_state state;
+    // the last result, still shown while a truncated count is retried
+    struct ahead_behind result;
+    bool has_result;
+    uint32_t tries;
+    // on the monotonic clock
+    uint64_t retry_at;
+};
+
+struct ahead_behind_engine {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool thread_started;
+    bool stop;
+    char repo_path[PATH_MAX];
+    uint32_t budget_ms;
+    struct timer *timer;
+    struct cache_entry cache[AHEAD_BEHIND_CACHE_SIZE];
+};
+
+static size_t get_cache_index(const git_oid *local, const git_oid *upstream) {
+    size_t hash = 0;
+    for (size_t i = 0; i < sizeof(hash); i++) {
+        hash = (hash << 8) | (local->id[i] ^ upstream->id[GIT_OID_RAWSZ - 1 - i]);
+    }
+    return hash % AHEAD_BEHIND_CACHE_SIZE;
+}
+
+static bool is_entry_of(const struct cache_entry *entry, const git_oid *local, const git_oid *upstream) {
+    return entry->state != entry_state_empty && git_oid_equal(&entry->local, local) &&
+           git_oid_equal(&entry->upstream, upstream);
+}
+
+static struct cache_entry *find_entry(struct ahead_behind_engine *engine, const git_oid *local,
+                                      const git_oid *upstream, bool *found) {
+    size_t index = get_cache_index(local, upstream);
+    struct cache_entry *victim = &engine->cache[index];
+
+    *found = false;
+    for (size_t i = 0; i < AHEAD_BEHIND_CACHE_PROBE; i++) {
+        struct cache_entry *entry = &engine->cache[(index + i) % AHEAD_BEHIND_CACHE_SIZE];
+        if (is_entry_of(entry, local, upstream)) {
+            *found = true;
+            return entry;
+        }
+        if (entry->state == entry_state_empty && victim->state != entry_state_empty) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+/* count the commits reachable from `from` but not from `hide`, giving up when the deadline passes. */
+static err_t count_commits(git_revwalk *walker, const git_oid *from, const git_oid *hide, uint64_t deadline,
+                           size_t *count, bool *truncated) {
+    err_t err = NO_ERROR;
+    git_oid next;
+    int result = 0;
+
+    *count = 0;
+    git_revwalk_reset(walker);
+    ASSERT(!git_revwalk_push(walker, from));
+    ASSERT(!git_revwalk_hide(walker, hide));
+
+    while (!(result = git_revwalk_next(&next, walker))) {
+        (*count)++;
+        if (*count % BUDGET_CHECK_INTERVAL == 0 && get_monotonic_ms() > deadline) {
+            *truncated = true;
+            break;
+        }
+    }
+    // a missing commit (a shallow or broken history) would make the count wrong
+    ASSERT(!result || result == GIT_ITEROVER);
+
+cleanup:
+    return err;
+}
+
+static err_t compute_ahead_behind(git_repository *repo, const git_oid *local, const git_oid *upstream,
+                                  uint32_t budget_ms, struct ahead_behind *out) {
+    err_t err = NO_ERROR;
+    git_revwalk *walker = NULL;
+    uint64_t deadline = get_monotonic_ms() + budget_ms;
+
+    *out = (struct ahead_behind){0};
+
+    ASSERT(!git_revwalk_new(&walker, repo));
+    RETHROW(count_commits(walker, local, upstream, deadline, &out->ahead, &out->truncated));
+    RETHROW(count_commits(walker, upstream, local, deadline, &out->behind, &out->truncated));
+
+cleanup:
+    git_revwalk_free(walker);
+    return err;
+}
+
+static bool should_retry(const struct cache_entry *entry, uint64_t now) {
+    return (entry->state == entry_state_failed || (entry->state == entry_state_done && entry->result.truncated)) &&
+           entry->tries <= MAX_RETRIES && now >= entry->retry_at;
+}
+
+static struct cache_entry *get_pending_entry(struct ahead_behind_engine *engine) {
+    for (size_t i = 0; i < AHEAD_BEHIND_CACHE_SIZE; i++) {
+        if (engine->cache[i].state == entry_state_pending) {
+            return &engine->cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void *ahead_behind_worker(void *arg) {
+    err_t err = NO_ERROR;
+    struct ahead_behind_engine *engine = arg;
+    git_repository *repo = NULL;
+    struct cache_entry *entry = NULL;
+    git_oid local;
+    git_oid upstream;
+    uint32_t budget_ms = 0;
+    struct ahead_behind result;
+
+    ASSERT(!git_repository_open(&repo, engine->repo_path));
+
+    pthread_mutex_lock(&engine->lock);
+    while (!engine->stop) {
+        entry = get_pending_entry(engine);
+        if (!entry) {
+            pthread_cond_wait(&engine->cond, &engine->lock);
+            continue;
+        }
+        git_oid_cpy(&local, &entry->local);
+        git_oid_cpy(&upstream, &entry->upstream);
+        budget_ms = engine->budget_ms << MIN(entry->tries, MAX_RETRIES);
+        pthread_mutex_unlock(&engine->lock);
+
+        err = compute_ahead_behind(repo, &local, &upstream, budget_ms, &result);
+
+        pthread_mutex_lock(&engine->lock);
+        // the entry might have been evicted and reused for another pair while we were walking
+        if (is_entry_of(entry, &local, &upstream) && entry->state == entry_state_pending) {
+            // a failure keeps the last result, if any, rather than asking again on the next frame
+            if (err) {
+                entry->state = entry_state_failed;
+            } else {
+                entry->result = result;
+                entry->has_result = true;
+                entry->state = entry_state_done;
+            }
+            entry->retry_at = get_monotonic_ms() + ((uint64_t)RETRY_BACKOFF_MS << MIN(entry->tries, MAX_RETRIES));
+            entry->tries++;
+        }
+        pthread_mutex_unlock(&engine->lock);
+        RETHROW_PRINT(timing_notify(engine->timer));
+        pthread_mutex_lock(&engine->lock);
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+cleanup:
+    git_repository_free(repo);
+    return NULL;
+}
+
+err_t init_ahead_behind_engine(struct ahead_behind_engine **engine, const char *repo_path, uint32_t budget_ms,
+                               struct timer *timer) {
+    err_t err = NO_ERROR;
+    struct ahead_behind_engine *result = NULL;
+
+    ASSERT(engine);
+    ASSERT(repo_path);
+    ASSERT(timer);
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    strncpy(result->repo_path, repo_path, sizeof(result->repo_path) - 1);
+    result->budget_ms = budget_ms;
+    result->timer = timer;
+    ASSERT(!pthread_mutex_init(&result->lock, NULL));
+    ASSERT(!pthread_cond_init(&result->cond, NULL));
+    ASSERT(!pthread_create(&result->thread, NULL, ahead_behind_worker, result));
+    result->thread_started = true;
+
+    *engine = result;
+
+cleanup:
+    if (err && result) {
+        free(result);
+    }
+    return err;
+}
+
+err_t free_ahead_behind_engine(struct ahead_behind_engine *engine) {
+    err_t err = NO_ERROR;
+
+    ASSERT(engine);
+
+    if (engine->thread_started) {
+        pthread_mutex_lock(&engine->lock);
+        engine->stop = true;
+        pthread_cond_signal(&engine->cond);
+        pthread_mutex_unlock(&engine->lock);
+        pthread_join(engine->thread, NULL);
+    }
+    pthread_cond_destroy(&engine->cond);
+    pthread_mutex_destroy(&engine->lock);
+    free(engine);
+
+cleanup:
+    return err;
+}
+
+err_t ahead_behind_lookup(struct ahead_behind_engine *engine, const git_oid *local, const git_oid *upstream,
+                          struct ahead_behind *out, bool *ready) {
+    err_t err = NO_ERROR;
+    struct cache_entry *entry = NULL;
+    bool found = false;
+
+    ASSERT(engine);
+    ASSERT(local);
+    ASSERT(upstream);
+    ASSERT(out);
+    ASSERT(ready);
+
+    *ready = false;
+    *out = (struct ahead_behind){0};
+
+    if (git_oid_equal(local, upstream)) {
+        *ready = true;
+        goto cleanup;
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    entry = find_entry(engine, local, upstream, &found);
+    if (!found) {
+        *entry = (struct cache_entry){.state = entry_state_pending};
+        git_oid_cpy(&entry->local, local);
+        git_oid_cpy(&entry->upstream, upstream);
+        pthread_cond_signal(&engine->cond);
+    } else if (should_retry(entry, get_monotonic_ms())) {
+        entry->state = entry_state_pending;
+        pthread_cond_signal(&engine->cond);
+    }
+    if (entry->has_result) {
+        *out = entry->result;
+        *ready = true;
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+cleanup:
+    return err;
+}
+
+void format_ahead_behind(const struct ahead_behind *ahead_behind, bool ready, char *buff, size_t len) {
+    if (!ready) {
+        snprintf(buff, len, "+? -?");
+    } else if (ahead_behind->truncated) {
+        snprintf(buff, len, "+%zu+ -%zu+", ahead_behind->ahead, ahead_behind->behind);
+    } else {
+        snprintf(buff, len, "+%zu -%zu", ahead_behind->ahead, ahead_behind->behind);
+    }
+}
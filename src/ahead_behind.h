@@ -0,0 +1,43 @@
+#ifndef GIT_LIVE_AHEAD_BEHIND_H
+#define GIT_LIVE_AHEAD_BEHIND_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+#include "timing.h"
+
+/*
+ * This module counts how many commits a local ref is ahead/behind another ref (usually its upstream).
+ * Counting walks the history between the two commits which may be arbitrarily long, so it is done on a background
+ * thread with its own repository handle and a time budget per pair, the results are cached by the (local, upstream)
+ * oid pair so they are only recomputed when one of the refs moves. A count that failed or ran out of time is retried
+ * after a backoff (a truncated one with a bigger budget, showing the lower bound meanwhile) a few times at most.
+ */
+
+#define AHEAD_BEHIND_TEXT_LEN (32)
+
+struct ahead_behind {
+    size_t ahead;
+    size_t behind;
+    // the walk ran out of time, the counts are a lower bound
+    bool truncated;
+};
+
+struct ahead_behind_engine;
+
+err_t init_ahead_behind_engine(struct ahead_behind_engine **engine, const char *repo_path, uint32_t budget_ms,
+                               struct timer *timer);
+err_t free_ahead_behind_engine(struct ahead_behind_engine *engine);
+
+/*
+ * Get the cached counts of the pair, if they are not computed yet a computation is queued, *ready is set to false and
+ * the timer is notified once the result is available.
+ */
+err_t ahead_behind_lookup(struct ahead_behind_engine *engine, const git_oid *local, const git_oid *upstream,
+                          struct ahead_behind *out, bool *ready);
+
+void format_ahead_behind(const struct ahead_behind *ahead_behind, bool ready, char *buff, size_t len);
+
+#endif // GIT_LIVE_AHEAD_BEHIND_H
@@ -1,6 +1,5 @@
 #include "attach.h"
 #include <fcntl.h>
-#include <pwd.h>
 #include <linux/limits.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -8,28 +7,55 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include "../lib/err.h"
 #include "utils.h"
 #include "timing.h"
 
 #define TERMINAL_HASH_LEN (16)
 
+// a terminal is rarely attached to more than a few dashboards, each session id takes a line in its file
+#define TERMINAL_FILE_MAX_LEN (4096)
+
+#define MSG_ATTACH "attach"
+#define MSG_DETACH "detach"
+#define MSG_CWD "cwd"
+#define MSG_MAX_LEN (PATH_MAX + 64)
+
+// ids taken by live dashboards are skipped, this many in a row means something else is wrong
+#define SESSION_ID_TRIES (16)
+
+/*
+ * Every dashboard listens on a datagram socket named after its session id, the attach/detach commands and the shell
+ * hook push messages of the form "<command> <terminal hash> <cwd>" to it. The dashboard only reads the socket when
+ * the timer reports it readable, so there is no cost when nothing changes.
+ * The terminal file (named after the terminal hash) lists the sessions the terminal is attached to, one per line, so
+ * the shell hook knows where to push its cwd without asking anyone.
+ */
+
 struct attach_session {
     struct timer* timer;
     char session_id[SESSION_ID_LEN + 1];
-    watch_id_t session_file_watch;
-    watch_id_t terminal_file_watch;
-    char prev_session_file_path[PATH_MAX];
-    char prev_terminal_file_path[PATH_MAX];
+    int socket_fd;
+    char socket_path[PATH_MAX];
+    bool is_attached;
+    char terminal_hash[TERMINAL_HASH_LEN + 1];
+    char workdir[PATH_MAX];
 };
 
 static err_t gen_session_id(char *out, uint32_t out_len) {
     err_t err = NO_ERROR;
+    static bool seeded = false;
 
     ASSERT(out);
 
-    srand(time(NULL));
+    // seeded once so that a retry gets a new id, and with the pid so that dashboards started in the same second differ
+    if (!seeded) {
+        srand(time(NULL) ^ getpid());
+        seeded = true;
+    }
     snprintf(out, out_len, "%02x", rand());
 
     cleanup:
@@ -39,18 +65,18 @@ static err_t gen_session_id(char *out, uint32_t out_len) {
 static err_t get_cache_dir(char *buff, uint32_t buff_maxlen) {
     err_t err = NO_ERROR;
 
-    ASSERT(buff);
+    const char *homedir = NULL;
 
-    struct passwd *pw = getpwuid(getuid());
-    const char *homedir = pw->pw_dir;
+    ASSERT(buff);
 
+    RETHROW(get_home_dir(&homedir));
     RETHROW(join_paths(homedir, ".cache/git-live", buff, buff_maxlen));
 
 cleanup:
     return err;
 }
 
-static err_t get_sessions_dir(char *buff, uint32_t buff_maxlen) {
+static err_t get_terminals_dir(char *buff, uint32_t buff_maxlen) {
     err_t err = NO_ERROR;
     char cache_dir[PATH_MAX] = {0};
 
@@ -58,45 +84,55 @@ static err_t get_sessions_dir(char *buff, uint32_t buff_maxlen) {
 
     RETHROW(get_cache_dir(cache_dir, sizeof(cache_dir)));
 
-    RETHROW(join_paths(cache_dir, "sessions", buff, buff_maxlen));
+    RETHROW(join_paths(cache_dir, "terminals", buff, buff_maxlen));
 
 cleanup:
     return err;
 }
 
-static err_t get_terminals_dir(char *buff, uint32_t buff_maxlen) {
+err_t get_sockets_dir(char *buff, uint32_t buff_maxlen) {
     err_t err = NO_ERROR;
     char cache_dir[PATH_MAX] = {0};
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
 
     ASSERT(buff);
 
-    RETHROW(get_cache_dir(cache_dir, sizeof(cache_dir)));
-
-    RETHROW(join_paths(cache_dir, "terminals", buff, buff_maxlen));
+    if (runtime_dir && strlen(runtime_dir)) {
+        RETHROW(join_paths(runtime_dir, "git-live", buff, buff_maxlen));
+    } else {
+        RETHROW(get_cache_dir(cache_dir, sizeof(cache_dir)));
+        RETHROW(join_paths(cache_dir, "sockets", buff, buff_maxlen));
+    }
 
 cleanup:
     return err;
 }
 
-static err_t get_session_file_path(char *session_id, char *out, uint32_t out_len) {
+static err_t get_session_socket_addr(const char *session_id, struct sockaddr_un *addr) {
     err_t err = NO_ERROR;
-    char sessions_dir[PATH_MAX] = {0};
+    char sockets_dir[PATH_MAX] = {0};
+    char socket_path[PATH_MAX] = {0};
 
     ASSERT(session_id);
-    ASSERT(out);
+    ASSERT(addr);
 
-    RETHROW(get_sessions_dir(sessions_dir, sizeof(sessions_dir)));
+    RETHROW(get_sockets_dir(sockets_dir, sizeof(sockets_dir)));
+    RETHROW(join_paths(sockets_dir, session_id, socket_path, sizeof(socket_path)));
+    ASSERT(strlen(socket_path) < sizeof(addr->sun_path));
 
-    RETHROW(join_paths(sessions_dir, session_id, out, out_len));
+    memset(addr, '\0', sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, socket_path);
 
 cleanup:
     return err;
 }
 
-static err_t get_terminal_file_path(char* terminal_hash, char *out, uint32_t out_len) {
+static err_t get_terminal_file_path(const char *terminal_hash, char *out, uint32_t out_len) {
     err_t err = NO_ERROR;
     char terminals_dir[PATH_MAX] = {0};
 
+    ASSERT(terminal_hash);
     ASSERT(out);
 
     RETHROW(get_terminals_dir(terminals_dir, sizeof(terminals_dir)));
@@ -107,53 +143,256 @@ cleanup:
     return err;
 }
 
-err_t attach_terminal_to_session(char *session_id) {
+static err_t read_terminal_file(const char *terminal_hash, char *out, uint32_t out_len) {
     err_t err = NO_ERROR;
-    char sessions_dir[PATH_MAX] = {0};
-    char session_file[PATH_MAX] = {0};
-    char *terminal_hash = getenv("GIT_LIVE_TERMINAL_ID");
-    bool does_dir_exist = false;
+    char terminal_file[PATH_MAX] = {0};
     int fd = FD_INVALID;
+    ssize_t res = 0;
+
+    ASSERT(out);
+    ASSERT(out_len > 0);
+
+    out[0] = '\0';
+
+    RETHROW(get_terminal_file_path(terminal_hash, terminal_file, sizeof(terminal_file)));
+
+    fd = open(terminal_file, O_RDONLY);
+    if (fd == FD_INVALID) {
+        ASSERT(errno == ENOENT);
+        goto cleanup;
+    }
+
+    res = read(fd, out, out_len - 1);
+    ASSERT(res >= 0);
+    out[res] = '\0';
+
+cleanup:
+    RETHROW_PRINT(safe_close_fd(&fd));
+    return err;
+}
+
+static err_t write_terminal_file(const char *terminal_hash, const char *content) {
+    err_t err = NO_ERROR;
+    char terminals_dir[PATH_MAX] = {0};
+    char terminal_file[PATH_MAX] = {0};
+    int fd = FD_INVALID;
+
+    ASSERT(content);
+
+    RETHROW(get_terminal_file_path(terminal_hash, terminal_file, sizeof(terminal_file)));
+
+    if (!strlen(content)) {
+        ASSERT(!unlink(terminal_file) || errno == ENOENT);
+        goto cleanup;
+    }
+
+    RETHROW(get_terminals_dir(terminals_dir, sizeof(terminals_dir)));
+    RETHROW(make_dirs(terminals_dir));
+
+    fd = open(terminal_file, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+    ASSERT(fd != FD_INVALID);
+
+    ssize_t res = write(fd, content, strlen(content));
+    ASSERT(res == (int32_t)strlen(content));
+
+cleanup:
+    RETHROW_PRINT(safe_close_fd(&fd));
+    return err;
+}
+
+/* rewrite the terminal file with session_id added or removed. */
+static err_t update_terminal_file(const char *terminal_hash, const char *session_id, bool add) {
+    err_t err = NO_ERROR;
+    char content[TERMINAL_FILE_MAX_LEN] = {0};
+    char new_content[TERMINAL_FILE_MAX_LEN] = {0};
+    char *line = NULL;
+    char *saveptr = NULL;
 
-    ASSERT(session_id);
     ASSERT(terminal_hash);
+    ASSERT(session_id);
 
-    RETHROW(get_sessions_dir(sessions_dir, sizeof(sessions_dir)));
+    RETHROW(read_terminal_file(terminal_hash, content, sizeof(content)));
 
-    RETHROW(file_exists(sessions_dir, &does_dir_exist));
-    if (!does_dir_exist) {
-        mkdir(sessions_dir, S_IXUSR | S_IWUSR | S_IRUSR);
+    for (line = strtok_r(content, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        if (!strcmp(line, session_id))
+            continue;
+        ASSERT(strlen(new_content) + strlen(line) + 1 < sizeof(new_content));
+        strcat(new_content, line);
+        strcat(new_content, "\n");
+    }
+    if (add) {
+        ASSERT(strlen(new_content) + strlen(session_id) + 1 < sizeof(new_content));
+        strcat(new_content, session_id);
+        strcat(new_content, "\n");
     }
 
-    RETHROW(get_session_file_path(session_id, session_file, sizeof(session_file)));
+    RETHROW(write_terminal_file(terminal_hash, new_content));
+
+cleanup:
+    return err;
+}
+
+/* send a message to a session, *delivered is false if there is no dashboard listening on it. */
+static err_t send_session_message(const char *session_id, const char *command, const char *terminal_hash,
+                                  const char *path, bool *delivered) {
+    err_t err = NO_ERROR;
+    struct sockaddr_un addr = {0};
+    char msg[MSG_MAX_LEN] = {0};
+    int fd = FD_INVALID;
+    int len = 0;
 
-    fd = open(session_file, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+    ASSERT(session_id);
+    ASSERT(command);
+    ASSERT(terminal_hash);
+    ASSERT(path);
+    ASSERT(delivered);
+
+    RETHROW(get_session_socket_addr(session_id, &addr));
+
+    len = snprintf(msg, sizeof(msg), "%s %s %s", command, terminal_hash, path);
+    ASSERT(len > 0 && len < (int)sizeof(msg));
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
     ASSERT(fd != FD_INVALID);
 
-    ssize_t res = write(fd, terminal_hash, strlen(terminal_hash) + 1);
-    ASSERT(res == (int32_t)strlen(terminal_hash) + 1);
+    *delivered = sendto(fd, msg, len, 0, (struct sockaddr *)&addr, sizeof(addr)) == len;
+    ASSERT(*delivered || errno == ENOENT || errno == ECONNREFUSED);
 
 cleanup:
     RETHROW_PRINT(safe_close_fd(&fd));
     return err;
 }
 
+static err_t get_terminal_hash(const char **out) {
+    err_t err = NO_ERROR;
+
+    *out = getenv("GIT_LIVE_TERMINAL_ID");
+    ASSERT(*out);
+    ASSERT(strlen(*out) == TERMINAL_HASH_LEN);
+
+cleanup:
+    return err;
+}
+
+err_t attach_terminal_to_session(char *session_id) {
+    err_t err = NO_ERROR;
+    char cwd[PATH_MAX] = {0};
+    const char *terminal_hash = NULL;
+    bool delivered = false;
+
+    ASSERT(session_id);
+    RETHROW(get_terminal_hash(&terminal_hash));
+    ASSERT(getcwd(cwd, sizeof(cwd)));
+
+    RETHROW(send_session_message(session_id, MSG_ATTACH, terminal_hash, cwd, &delivered));
+    if (!delivered) {
+        fprintf(stderr, "No dashboard is running with session %s.\n", session_id);
+        ABORT();
+    }
+
+    RETHROW(update_terminal_file(terminal_hash, session_id, true));
+
+cleanup:
+    return err;
+}
+
 err_t detach_terminal_to_session(char *session_id) {
     err_t err = NO_ERROR;
-    char session_file[PATH_MAX] = {0};
-    int fd = FD_INVALID;
+    const char *terminal_hash = NULL;
+    bool delivered = false;
 
     ASSERT(session_id);
+    RETHROW(get_terminal_hash(&terminal_hash));
 
-    RETHROW(get_session_file_path(session_id, session_file, sizeof(session_file)));
+    // the dashboard might already be gone, in that case there is only the terminal file left to clean
+    RETHROW(send_session_message(session_id, MSG_DETACH, terminal_hash, "", &delivered));
+    RETHROW(update_terminal_file(terminal_hash, session_id, false));
 
-    ASSERT(!unlink(session_file));
+cleanup:
+    return err;
+}
 
-    cleanup:
+err_t notify_terminal_cwd() {
+    err_t err = NO_ERROR;
+    char cwd[PATH_MAX] = {0};
+    char content[TERMINAL_FILE_MAX_LEN] = {0};
+    const char *terminal_hash = NULL;
+    char *session_id = NULL;
+    char *saveptr = NULL;
+    bool delivered = false;
+
+    RETHROW(get_terminal_hash(&terminal_hash));
+    ASSERT(getcwd(cwd, sizeof(cwd)));
+
+    RETHROW(read_terminal_file(terminal_hash, content, sizeof(content)));
+
+    for (session_id = strtok_r(content, "\n", &saveptr); session_id; session_id = strtok_r(NULL, "\n", &saveptr)) {
+        RETHROW(send_session_message(session_id, MSG_CWD, terminal_hash, cwd, &delivered));
+        if (!delivered) {
+            // the dashboard exited, forget about it so the shell hook stops spawning us when nothing is attached
+            RETHROW(update_terminal_file(terminal_hash, session_id, false));
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/* in_use is set when a live dashboard owns the socket, a dead one's socket is removed. */
+static err_t claim_session_socket(const struct sockaddr_un *addr, bool *in_use) {
+    err_t err = NO_ERROR;
+    int fd = FD_INVALID;
+
+    *in_use = false;
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    ASSERT(fd != FD_INVALID);
+
+    if (!connect(fd, (const struct sockaddr *)addr, sizeof(*addr))) {
+        *in_use = true;
+        goto cleanup;
+    }
+    ASSERT(errno == ENOENT || errno == ECONNREFUSED);
+    // a previous dashboard with the same session id might have been killed before it could clean up
+    if (errno == ECONNREFUSED) {
+        ASSERT(!unlink(addr->sun_path) || errno == ENOENT);
+    }
+
+cleanup:
     RETHROW_PRINT(safe_close_fd(&fd));
     return err;
 }
 
+static err_t open_session_socket(struct attach_session *session) {
+    err_t err = NO_ERROR;
+    struct sockaddr_un addr = {0};
+    char sockets_dir[PATH_MAX] = {0};
+    bool in_use = true;
+
+    RETHROW(get_sockets_dir(sockets_dir, sizeof(sockets_dir)));
+    RETHROW(make_dirs(sockets_dir));
+
+    session->socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ASSERT(session->socket_fd != FD_INVALID);
+
+    for (uint32_t tries = 0; in_use; tries++) {
+        ASSERT(tries < SESSION_ID_TRIES);
+        RETHROW(gen_session_id(session->session_id, sizeof(session->session_id)));
+        RETHROW(get_session_socket_addr(session->session_id, &addr));
+        RETHROW(claim_session_socket(&addr, &in_use));
+        // another dashboard may take the same id between the check and the bind
+        if (!in_use && bind(session->socket_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            ASSERT(errno == EADDRINUSE);
+            in_use = true;
+        }
+    }
+    strcpy(session->socket_path, addr.sun_path);
+
+    RETHROW(timing_add_fd(session->timer, session->socket_fd));
+
+cleanup:
+    return err;
+}
+
 err_t init_attach_session(struct attach_session** session, struct timer* timer) {
     err_t err = NO_ERROR;
 
@@ -161,20 +400,19 @@ err_t init_attach_session(struct attach_session** session, struct timer* timer)
     ASSERT(!*session);
     ASSERT(timer);
 
-    *session = malloc(sizeof(**session));
+    *session = calloc(1, sizeof(**session));
     ASSERT(*session);
 
     (*session)->timer = timer;
-    (*session)->terminal_file_watch = INVALID_WATCH_ID;
-    (*session)->session_file_watch = INVALID_WATCH_ID;
-    memset((*session)->prev_session_file_path, '\0', sizeof((*session)->prev_session_file_path));
-    memset((*session)->prev_terminal_file_path, '\0', sizeof((*session)->prev_terminal_file_path));
+    (*session)->socket_fd = FD_INVALID;
 
-    RETHROW(gen_session_id((*session)->session_id, sizeof((*session)->session_id)));
+    RETHROW(open_session_socket(*session));
 
 cleanup:
     if (err && *session) {
+        RETHROW_PRINT(safe_close_fd(&(*session)->socket_fd));
         free(*session);
+        *session = NULL;
     }
     return err;
 }
@@ -184,12 +422,10 @@ err_t free_attach_session(struct attach_session* session) {
 
     ASSERT(session);
 
-    if (session->timer && session->session_file_watch) {
-        RETHROW_PRINT(timing_remove_watch(session->timer, session->session_file_watch));
-    }
-
-    if (session->timer && session->terminal_file_watch) {
-        RETHROW_PRINT(timing_remove_watch(session->timer, session->terminal_file_watch));
+    if (session->socket_fd != FD_INVALID) {
+        RETHROW_PRINT(timing_remove_fd(session->timer, session->socket_fd));
+        RETHROW_PRINT(safe_close_fd(&session->socket_fd));
+        ASSERT_PRINT(!unlink(session->socket_path));
     }
 
     free(session);
@@ -198,67 +434,51 @@ cleanup:
     return err;
 }
 
+static void handle_session_message(struct attach_session* session, char *msg) {
+    char *saveptr = NULL;
+    char *command = strtok_r(msg, " ", &saveptr);
+    char *terminal_hash = strtok_r(NULL, " ", &saveptr);
+    // the path is the rest of the message, it may contain spaces
+    char *path = saveptr;
+
+    if (!command || !terminal_hash || strlen(terminal_hash) != TERMINAL_HASH_LEN)
+        return;
+
+    if (!strcmp(command, MSG_ATTACH) && path && strlen(path)) {
+        session->is_attached = true;
+        strcpy(session->terminal_hash, terminal_hash);
+        strncpy(session->workdir, path, sizeof(session->workdir) - 1);
+    } else if (!strcmp(command, MSG_DETACH)) {
+        session->is_attached = false;
+    } else if (!strcmp(command, MSG_CWD) && path && strlen(path) && session->is_attached &&
+               !strcmp(session->terminal_hash, terminal_hash)) {
+        strncpy(session->workdir, path, sizeof(session->workdir) - 1);
+    }
+}
+
 err_t get_attached_workdir(struct attach_session* session, char *out, uint32_t out_len, bool *is_attached) {
     err_t err = NO_ERROR;
-    char session_file_path[PATH_MAX] = {0};
-    char terminal_file_path[PATH_MAX] = {0};
-    char terminal_hash[TERMINAL_HASH_LEN + 1] = {0};
-    int fd = FD_INVALID;
-    int fd2 = FD_INVALID;
-    bool does_file_exist = false;
+    char msg[MSG_MAX_LEN + 1] = {0};
+    ssize_t res = 0;
 
     ASSERT(session);
     ASSERT(out);
     ASSERT(is_attached);
 
-    *is_attached = false;
-
-    RETHROW(get_session_file_path(session->session_id, session_file_path, sizeof(session_file_path)));
-
-    RETHROW(file_exists(session_file_path, &does_file_exist));
-    if (does_file_exist && strcmp(session_file_path, session->prev_session_file_path)) {
-        strcpy(session->prev_session_file_path, session_file_path);
-        RETHROW(timing_add_or_modify_watch(session->timer, &session->session_file_watch, session_file_path));
-    }
-
-    fd = open(session_file_path, O_RDONLY);
-    if (fd == FD_INVALID) {
-        *is_attached = false;
-        goto cleanup;
+    if (timing_is_fd_ready(session->timer, session->socket_fd)) {
+        while ((res = recv(session->socket_fd, msg, sizeof(msg) - 1, 0)) >= 0) {
+            msg[res] = '\0';
+            handle_session_message(session, msg);
+        }
+        ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
     }
 
-    ssize_t res = read(fd, terminal_hash, sizeof(terminal_hash) - 1);
-    if (res <= 0) {
-        *is_attached = false;
-        goto cleanup;
-    }
-
-    RETHROW(get_terminal_file_path(terminal_hash, terminal_file_path, sizeof(terminal_file_path)));
-
-    RETHROW(file_exists(terminal_file_path, &does_file_exist));
-    if (does_file_exist && strcmp(terminal_file_path, session->prev_terminal_file_path)) {
-        strcpy(session->prev_terminal_file_path, terminal_file_path);
-        RETHROW(timing_add_or_modify_watch(session->timer, &session->terminal_file_watch, terminal_file_path));
+    *is_attached = session->is_attached;
+    if (session->is_attached) {
+        strncpy(out, session->workdir, out_len);
     }
 
-    fd2 = open(terminal_file_path, O_RDONLY);
-    if (fd2 == FD_INVALID) {
-        *is_attached = false;
-        goto cleanup;
-    }
-
-    res = read(fd2, out, out_len);
-    if (res <= 0) {
-        *is_attached = false;
-        goto cleanup;
-    }
-    out[res - 1] = '\0'; // override newline with null terminator
-
-    *is_attached = true;
-
 cleanup:
-    RETHROW_PRINT(safe_close_fd(&fd));
-    RETHROW_PRINT(safe_close_fd(&fd2));
     return err;
 }
 
@@ -14,10 +14,16 @@ err_t attach_terminal_to_session(char *session_id);
 
 err_t detach_terminal_to_session(char *session_id);
 
+/* push the cwd of the current terminal to every session it is attached to, called by the shell hook. */
+err_t notify_terminal_cwd();
+
 err_t init_attach_session(struct attach_session**, struct timer*);
 err_t free_attach_session(struct attach_session*);
 
 err_t get_attached_workdir(struct attach_session* session, char *out, uint32_t out_len, bool *is_attached);
 err_t get_attach_session_id(struct attach_session* session, char *out, uint32_t out_len);
 
+/* where the sockets of the sessions (and the daemons) live, $XDG_RUNTIME_DIR/git-live if set. */
+err_t get_sockets_dir(char *buff, uint32_t buff_maxlen);
+
 #endif //GIT_LIVE_ATTACH_H
@@ -0,0 +1,50 @@
+#include "config.h"
+#include <git2.h>
+#include <stdint.h>
+#include <string.h>
+#include "../lib/err.h"
+#include "utils.h"
+
+static void get_config_uint32(git_config *cfg, const char *name, uint32_t min, uint32_t max, uint32_t *out) {
+    int32_t value = 0;
+
+    if (git_config_get_int32(&value, cfg, name))
+        return;
+    if (value < (int32_t)min || (uint32_t)value > max)
+        return;
+    *out = value;
+}
+
+static void get_config_string(git_config *cfg, const char *name, char *out, size_t out_len) {
+    const char *value = NULL;
+
+    if (git_config_get_string(&value, cfg, name))
+        return;
+    strncpy(out, value, out_len - 1);
+    out[out_len - 1] = '\0';
+}
+
+err_t load_live_config(git_repository *repo, struct live_config *out) {
+    err_t err = NO_ERROR;
+    git_config *cfg = NULL;
+
+    ASSERT(repo);
+    ASSERT(out);
+
+    *out = (struct live_config){
+        .abbrev_len = DEFAULT_ABBREV_LEN,
+        .ahead_behind_budget_ms = DEFAULT_AHEAD_BEHIND_BUDGET_MS,
+        .diffstat_max_file_size = DEFAULT_DIFFSTAT_MAX_FILE_SIZE,
+    };
+
+    ASSERT(!git_repository_config_snapshot(&cfg, repo));
+
+    get_config_uint32(cfg, "live.abbrev", MIN_ABBREV_LEN, GIT_OID_HEXSZ, &out->abbrev_len);
+    get_config_string(cfg, "live.baseBranch", out->base_branch, sizeof(out->base_branch));
+    get_config_uint32(cfg, "live.aheadBehindBudget", 1, MAX_AHEAD_BEHIND_BUDGET_MS, &out->ahead_behind_budget_ms);
+    get_config_uint32(cfg, "live.diffstatMaxSize", 0, UINT32_MAX, &out->diffstat_max_file_size);
+
+cleanup:
+    git_config_free(cfg);
+    return err;
+}
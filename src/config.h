@@ -0,0 +1,34 @@
+#ifndef GIT_LIVE_CONFIG_H
+#define GIT_LIVE_CONFIG_H
+
+#include <git2.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * Dashboard settings, read from the repository's git config under the "live." section so they can be set per repo or
+ * globally with `git config`.
+ */
+
+#define DEFAULT_ABBREV_LEN (4)
+#define MIN_ABBREV_LEN (4)
+
+#define DEFAULT_AHEAD_BEHIND_BUDGET_MS (500)
+#define MAX_AHEAD_BEHIND_BUDGET_MS (60 * 1000)
+
+#define DEFAULT_DIFFSTAT_MAX_FILE_SIZE (1024 * 1024)
+
+#define BRANCH_NAME_MAX_LEN (256)
+
+struct live_config {
+    uint32_t abbrev_len;
+    // the branch every branch is also compared against, empty if not configured
+    char base_branch[BRANCH_NAME_MAX_LEN];
+    uint32_t ahead_behind_budget_ms;
+    // files larger than this (in bytes) are not diffed for the status panel line counts
+    uint32_t diffstat_max_file_size;
+};
+
+err_t load_live_config(git_repository *repo, struct live_config *out);
+
+#endif // GIT_LIVE_CONFIG_H
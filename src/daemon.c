@@ -0,0 +1,634 @@
+#include "daemon.h"
+#include <fcntl.h>
+#include <git2.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "attach.h"
+#include "diffstat.h"
+#include "engine.h"
+#include "repo_cache.h"
+#include "snapshot.h"
+#include "timing.h"
+#include "untracked.h"
+#include "utils.h"
+
+#define DAEMON_SOCKET_PREFIX ("daemon-")
+#define DAEMON_MAX_CLIENTS (64)
+#define DAEMON_LISTEN_BACKLOG (16)
+
+// the daemon doesn't know the screens of its clients, they hide whatever doesn't fit
+#define DAEMON_MAX_STATUS_ROWS (256)
+#define DAEMON_MAX_REFS (64)
+#define DAEMON_MAX_COMMITS (32)
+#define DAEMON_MAX_SUBMODULES (32)
+
+// anything bigger is a corrupted stream
+#define DAEMON_MAX_FRAME_LEN (64 * 1024 * 1024)
+#define RECV_BUFF_LEN (64 * 1024)
+
+#define QUERY_TIMEOUT_MS (5000)
+
+/* every message is a frame_header followed by a snapshot written by write_snapshot. */
+struct frame_header {
+    uint64_t len;
+};
+
+/* a connected client, as seen by the daemon. */
+struct peer {
+    int fd;
+    // the rest of a frame the socket buffer had no room for, sent before anything else
+    char *partial;
+    size_t partial_len;
+    size_t partial_sent;
+    // the latest frame was not sent yet, only the newest one is, the ones in between are skipped
+    bool outdated;
+    // the order of the connections, the oldest client makes room for a new one when the table is full
+    uint64_t accepted;
+};
+
+struct daemon {
+    struct timer *timer;
+    int listen_fd;
+    char socket_path[PATH_MAX];
+    struct peer clients[DAEMON_MAX_CLIENTS];
+    size_t clients_count;
+    uint64_t accepted_count;
+    // the latest frame, header included, sent to every client as it connects
+    char *frame;
+    size_t frame_len;
+};
+
+struct daemon_client {
+    int fd;
+    struct timer *timer;
+    // received bytes that don't make a whole frame yet
+    char *buff;
+    size_t len;
+    size_t cap;
+};
+
+static volatile bool keep_running = true;
+
+static void stop_handler() {
+    keep_running = false;
+}
+
+static err_t set_nonblocking(int fd) {
+    err_t err = NO_ERROR;
+    int flags = 0;
+
+    flags = fcntl(fd, F_GETFL);
+    ASSERT(flags != -1);
+    ASSERT(fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+
+cleanup:
+    return err;
+}
+
+static err_t get_daemon_socket_addr(const char *git_dir, struct sockaddr_un *addr) {
+    err_t err = NO_ERROR;
+    char sockets_dir[PATH_MAX] = {0};
+    char name[32] = {0};
+    char socket_path[PATH_MAX] = {0};
+
+    RETHROW(get_sockets_dir(sockets_dir, sizeof(sockets_dir)));
+    RETHROW(make_dirs(sockets_dir));
+    snprintf(name, sizeof(name), "%s%016lx", DAEMON_SOCKET_PREFIX, hash_string(git_dir));
+    RETHROW(join_paths(sockets_dir, name, socket_path, sizeof(socket_path)));
+    ASSERT(strlen(socket_path) < sizeof(addr->sun_path));
+
+    memset(addr, '\0', sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, socket_path);
+
+cleanup:
+    return err;
+}
+
+/* connected is false if nothing listens on the address, a socket file left by a killed daemon included. */
+static err_t connect_socket(const struct sockaddr_un *addr, int *fd, bool *connected) {
+    err_t err = NO_ERROR;
+
+    *connected = false;
+    *fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ASSERT(*fd != FD_INVALID);
+
+    if (connect(*fd, (const struct sockaddr *)addr, sizeof(*addr))) {
+        ASSERT(errno == ENOENT || errno == ECONNREFUSED);
+        RETHROW(safe_close_fd(fd));
+        goto cleanup;
+    }
+    *connected = true;
+
+cleanup:
+    if (err) {
+        RETHROW_PRINT(safe_close_fd(fd));
+    }
+    return err;
+}
+
+static err_t open_listen_socket(struct daemon *daemon, const char *git_dir) {
+    err_t err = NO_ERROR;
+    struct sockaddr_un addr = {0};
+    int fd = FD_INVALID;
+    bool running = false;
+
+    RETHROW(get_daemon_socket_addr(git_dir, &addr));
+
+    RETHROW(connect_socket(&addr, &fd, &running));
+    RETHROW(safe_close_fd(&fd));
+    if (running) {
+        fprintf(stderr, "A daemon is already running for %s.\n", git_dir);
+        ABORT();
+    }
+    ASSERT(!unlink(addr.sun_path) || errno == ENOENT);
+
+    daemon->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    ASSERT(daemon->listen_fd != FD_INVALID);
+    ASSERT(!bind(daemon->listen_fd, (struct sockaddr *)&addr, sizeof(addr)));
+    strcpy(daemon->socket_path, addr.sun_path);
+    ASSERT(!listen(daemon->listen_fd, DAEMON_LISTEN_BACKLOG));
+    RETHROW(timing_add_fd(daemon->timer, daemon->listen_fd));
+
+cleanup:
+    return err;
+}
+
+static err_t drop_client(struct daemon *daemon, size_t i) {
+    err_t err = NO_ERROR;
+
+    free(daemon->clients[i].partial);
+    RETHROW(safe_close_fd(&daemon->clients[i].fd));
+    daemon->clients[i] = daemon->clients[--daemon->clients_count];
+
+cleanup:
+    return err;
+}
+
+/* sent is how much the socket buffer took, gone is set when the client disconnected. */
+static err_t send_bytes(int fd, const char *buff, size_t len, size_t *sent, bool *gone) {
+    err_t err = NO_ERROR;
+    ssize_t res = 0;
+
+    *sent = 0;
+    *gone = false;
+    res = send(fd, buff, len, MSG_NOSIGNAL);
+    if (res >= 0) {
+        *sent = res;
+    } else if (errno == EPIPE || errno == ECONNRESET) {
+        *gone = true;
+    } else {
+        ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+cleanup:
+    return err;
+}
+
+/*
+ * Send the rest of the client's partial frame, then the latest frame if the client doesn't have it yet. Whatever the
+ * socket buffer has no room for is kept and sent on a later call.
+ */
+static err_t flush_client(struct daemon *daemon, size_t i, bool *dropped) {
+    err_t err = NO_ERROR;
+    struct peer *client = &daemon->clients[i];
+    size_t sent = 0;
+    bool gone = false;
+
+    *dropped = false;
+
+    if (client->partial) {
+        RETHROW(send_bytes(client->fd, client->partial + client->partial_sent,
+                           client->partial_len - client->partial_sent, &sent, &gone));
+        client->partial_sent += sent;
+        if (gone || client->partial_sent < client->partial_len)
+            goto cleanup;
+        free(client->partial);
+        client->partial = NULL;
+    }
+    if (!client->outdated)
+        goto cleanup;
+
+    client->outdated = false;
+    RETHROW(send_bytes(client->fd, daemon->frame, daemon->frame_len, &sent, &gone));
+    if (gone || sent == daemon->frame_len)
+        goto cleanup;
+
+    // the frames can't be interleaved, so the rest is copied for when the client catches up
+    client->partial = malloc(daemon->frame_len - sent);
+    ASSERT(client->partial);
+    memcpy(client->partial, daemon->frame + sent, daemon->frame_len - sent);
+    client->partial_len = daemon->frame_len - sent;
+    client->partial_sent = 0;
+
+cleanup:
+    if (gone) {
+        RETHROW_PRINT(drop_client(daemon, i));
+        *dropped = true;
+    }
+    return err;
+}
+
+/* also called on every wakeup, a client that fell behind catches up as its socket buffer drains. */
+static err_t flush_clients(struct daemon *daemon) {
+    err_t err = NO_ERROR;
+    bool dropped = false;
+
+    // a dropped client is replaced by the last one, which was already flushed
+    for (size_t i = daemon->clients_count; i > 0; i--) {
+        RETHROW(flush_client(daemon, i - 1, &dropped));
+    }
+
+cleanup:
+    return err;
+}
+
+/*
+ * Clients never write, so a readable socket means the client closed it. Their fds don't fit in the timer's poll set,
+ * so they are peeked at on every wakeup instead, otherwise a client that read its frame and exited (like a query) keeps
+ * its slot until a send to it fails, which in a quiet repository is never.
+ */
+static err_t drop_closed_clients(struct daemon *daemon) {
+    err_t err = NO_ERROR;
+    char byte = 0;
+    ssize_t res = 0;
+
+    for (size_t i = daemon->clients_count; i > 0; i--) {
+        res = recv(daemon->clients[i - 1].fd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+        if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            continue;
+        ASSERT(res >= 0 || errno == ECONNRESET);
+        RETHROW(drop_client(daemon, i - 1));
+    }
+
+cleanup:
+    return err;
+}
+
+static size_t get_oldest_client(const struct daemon *daemon) {
+    size_t oldest = 0;
+
+    for (size_t i = 1; i < daemon->clients_count; i++) {
+        if (daemon->clients[i].accepted < daemon->clients[oldest].accepted) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static err_t accept_clients(struct daemon *daemon) {
+    err_t err = NO_ERROR;
+    int fd = FD_INVALID;
+    bool dropped = false;
+
+    if (!timing_is_fd_ready(daemon->timer, daemon->listen_fd))
+        goto cleanup;
+
+    while ((fd = accept(daemon->listen_fd, NULL, NULL)) != FD_INVALID) {
+        // the oldest client is the likeliest to be gone without us noticing
+        if (daemon->clients_count == DAEMON_MAX_CLIENTS) {
+            RETHROW(drop_client(daemon, get_oldest_client(daemon)));
+        }
+        ASSERT(fcntl(fd, F_SETFD, FD_CLOEXEC) != -1);
+        RETHROW(set_nonblocking(fd));
+        daemon->clients[daemon->clients_count++] =
+            (struct peer){.fd = fd, .outdated = daemon->frame != NULL, .accepted = daemon->accepted_count++};
+        RETHROW(flush_client(daemon, daemon->clients_count - 1, &dropped));
+    }
+    ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+
+cleanup:
+    return err;
+}
+
+/* serialize the snapshot and send it to every client, unless it is the same as the last one. */
+static err_t publish_frame(struct daemon *daemon, const struct snapshot *snapshot) {
+    err_t err = NO_ERROR;
+    struct frame_header header = {0};
+    char *frame = NULL;
+    size_t frame_len = 0;
+    FILE *stream = NULL;
+
+    stream = open_memstream(&frame, &frame_len);
+    ASSERT(stream);
+    ASSERT(fwrite(&header, sizeof(header), 1, stream) == 1);
+    RETHROW(write_snapshot(snapshot, stream));
+    ASSERT(!fclose(stream));
+    stream = NULL;
+
+    ((struct frame_header *)frame)->len = frame_len - sizeof(header);
+    if (daemon->frame && daemon->frame_len == frame_len && !memcmp(daemon->frame, frame, frame_len))
+        goto cleanup;
+
+    free(daemon->frame);
+    daemon->frame = frame;
+    daemon->frame_len = frame_len;
+    frame = NULL;
+
+    for (size_t i = 0; i < daemon->clients_count; i++) {
+        daemon->clients[i].outdated = true;
+    }
+    RETHROW(flush_clients(daemon));
+
+cleanup:
+    if (stream) {
+        fclose(stream);
+    }
+    free(frame);
+    return err;
+}
+
+err_t run_daemon() {
+    err_t err = NO_ERROR;
+    char cwd[PATH_MAX] = {0};
+    struct daemon daemon = {.listen_fd = FD_INVALID};
+    struct snapshot *snapshot = NULL;
+    struct repo_cache *repo_cache = NULL;
+    struct repo_handle *handle = NULL;
+    watch_id_t workdir_watch_id = INVALID_WATCH_ID;
+
+    signal(SIGINT, stop_handler);
+    signal(SIGTERM, stop_handler);
+
+    ASSERT(getcwd(cwd, sizeof(cwd)));
+    ASSERT(git_libgit2_init() > 0);
+
+    RETHROW(init_timer(&daemon.timer, (struct timer_config){
+                                          .min_timeout = 200,
+                                          .idle_cpu_percent_target = 10,
+                                          .max_cpu_percent_target = 50,
+                                      }));
+    RETHROW(init_snapshot(&snapshot));
+    RETHROW(init_repo_cache(&repo_cache, daemon.timer));
+    RETHROW(repo_cache_open(repo_cache, cwd, &handle));
+    ASSERT(git_repository_workdir(handle->repo));
+
+    RETHROW(open_listen_socket(&daemon, git_repository_path(handle->repo)));
+    RETHROW(timing_add_or_modify_watch(daemon.timer, &workdir_watch_id, git_repository_workdir(handle->repo)));
+    fprintf(stderr, "Serving %s\n", git_repository_workdir(handle->repo));
+
+    while (keep_running) {
+        RETHROW(compute_snapshot(handle, git_repository_workdir(handle->repo),
+                                 (struct engine_limits){
+                                     .max_status_rows = DAEMON_MAX_STATUS_ROWS,
+                                     .max_refs = DAEMON_MAX_REFS,
+                                     .max_commits = DAEMON_MAX_COMMITS,
+                                     .max_submodules = DAEMON_MAX_SUBMODULES,
+                                 },
+                                 snapshot));
+        RETHROW(publish_frame(&daemon, snapshot));
+
+        RETHROW(timing_wait(daemon.timer));
+        RETHROW(drop_closed_clients(&daemon));
+        RETHROW(flush_clients(&daemon));
+        RETHROW(accept_clients(&daemon));
+    }
+
+cleanup:
+    while (daemon.clients_count) {
+        RETHROW_PRINT(drop_client(&daemon, 0));
+    }
+    if (daemon.listen_fd != FD_INVALID) {
+        RETHROW_PRINT(timing_remove_fd(daemon.timer, daemon.listen_fd));
+        RETHROW_PRINT(safe_close_fd(&daemon.listen_fd));
+        ASSERT_PRINT(!unlink(daemon.socket_path));
+    }
+    free(daemon.frame);
+    if (repo_cache) {
+        RETHROW_PRINT(free_repo_cache(repo_cache));
+    }
+    if (snapshot) {
+        RETHROW_PRINT(free_snapshot(snapshot));
+    }
+    if (daemon.timer) {
+        RETHROW_PRINT(free_timer(daemon.timer));
+    }
+    return err;
+}
+
+err_t connect_daemon(struct daemon_client **client, const char *git_dir, struct timer *timer, bool *connected) {
+    err_t err = NO_ERROR;
+    struct sockaddr_un addr = {0};
+    struct daemon_client *result = NULL;
+
+    ASSERT(client);
+    ASSERT(git_dir);
+    ASSERT(connected);
+
+    *client = NULL;
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+    result->fd = FD_INVALID;
+
+    RETHROW(get_daemon_socket_addr(git_dir, &addr));
+    RETHROW(connect_socket(&addr, &result->fd, connected));
+    if (!*connected)
+        goto cleanup;
+
+    // receiving reads whatever arrived so far and never blocks the frame
+    RETHROW(set_nonblocking(result->fd));
+    if (timer) {
+        RETHROW(timing_add_fd(timer, result->fd));
+        result->timer = timer;
+    }
+
+    *client = result;
+    result = NULL;
+
+cleanup:
+    if (result) {
+        RETHROW_PRINT(free_daemon_client(result));
+    }
+    return err;
+}
+
+err_t free_daemon_client(struct daemon_client *client) {
+    err_t err = NO_ERROR;
+
+    ASSERT(client);
+
+    if (client->timer) {
+        RETHROW_PRINT(timing_remove_fd(client->timer, client->fd));
+    }
+    RETHROW_PRINT(safe_close_fd(&client->fd));
+    free(client->buff);
+    free(client);
+
+cleanup:
+    return err;
+}
+
+static err_t receive_bytes(struct daemon_client *client, bool *disconnected) {
+    err_t err = NO_ERROR;
+    ssize_t res = 0;
+    char *new_buff = NULL;
+
+    while (true) {
+        if (client->cap - client->len < RECV_BUFF_LEN) {
+            new_buff = realloc(client->buff, client->cap + RECV_BUFF_LEN);
+            ASSERT(new_buff);
+            client->buff = new_buff;
+            client->cap += RECV_BUFF_LEN;
+        }
+
+        res = recv(client->fd, client->buff + client->len, client->cap - client->len, 0);
+        if (res > 0) {
+            client->len += res;
+            continue;
+        }
+        if (res == 0 || errno == ECONNRESET) {
+            *disconnected = true;
+        } else {
+            ASSERT(errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        break;
+    }
+
+cleanup:
+    return err;
+}
+
+err_t daemon_client_receive(struct daemon_client *client, struct snapshot *out, bool *updated, bool *disconnected) {
+    err_t err = NO_ERROR;
+    struct frame_header header = {0};
+    size_t offset = 0;
+    size_t newest = 0;
+    FILE *stream = NULL;
+    bool loaded = false;
+
+    ASSERT(client);
+    ASSERT(out);
+    ASSERT(updated);
+    ASSERT(disconnected);
+
+    *updated = false;
+    *disconnected = false;
+
+    RETHROW(receive_bytes(client, disconnected));
+
+    // only the newest whole frame matters, the older ones are skipped
+    while (client->len - offset >= sizeof(header)) {
+        memcpy(&header, client->buff + offset, sizeof(header));
+        if (header.len > DAEMON_MAX_FRAME_LEN) {
+            *disconnected = true;
+            goto cleanup;
+        }
+        if (client->len - offset - sizeof(header) < header.len)
+            break;
+        newest = offset;
+        offset += sizeof(header) + header.len;
+        *updated = true;
+    }
+
+    if (*updated) {
+        memcpy(&header, client->buff + newest, sizeof(header));
+        stream = fmemopen(client->buff + newest + sizeof(header), header.len, "rb");
+        ASSERT(stream);
+        RETHROW(read_snapshot(out, stream, &loaded));
+        if (!loaded) {
+            *disconnected = true;
+        }
+    }
+
+    memmove(client->buff, client->buff + offset, client->len - offset);
+    client->len -= offset;
+
+cleanup:
+    if (stream) {
+        fclose(stream);
+    }
+    return err;
+}
+
+static void print_snapshot(const struct snapshot *snapshot) {
+    char diffstat[MAX(DIFFSTAT_TEXT_LEN, UNTRACKED_FILES_TEXT_LEN)] = {0};
+    static const char *titles[STATUS_SECTIONS_COUNT] = {"staged:", "changed:", "untracked:"};
+
+    printf("(%s)", snapshot_str(snapshot, snapshot->head_name));
+    if (snapshot->head_tracking != EMPTY_STR) {
+        printf(" %s", snapshot_str(snapshot, snapshot->head_tracking));
+    }
+    if (snapshot->operation != EMPTY_STR) {
+        printf(" %s", snapshot_str(snapshot, snapshot->operation));
+    }
+    if (snapshot->operation_running) {
+        printf(" (git is running)");
+    }
+    printf("\n");
+
+    for (size_t section = 0, i = 0, shown = 0; section < STATUS_SECTIONS_COUNT; section++, shown = 0) {
+        printf("%s\n", titles[section]);
+        for (; i < snapshot->status_rows.count && snapshot->status_rows.items[i].section == section; i++, shown++) {
+            const struct status_row *row = &snapshot->status_rows.items[i];
+            const char *path = snapshot_str(snapshot, row->path);
+            if (section == status_section_untracked && path[strlen(path) - 1] == '/') {
+                format_untracked_files(row->files, !row->counting, row->count_failed, diffstat, sizeof(diffstat));
+            } else {
+                format_diffstat(&row->diffstat, diffstat, sizeof(diffstat));
+            }
+            if (row->old_path != row->path) {
+                printf("   %s: %s->%s%s\n", snapshot_str(snapshot, row->status), snapshot_str(snapshot, row->old_path),
+                       snapshot_str(snapshot, row->path), diffstat);
+            } else {
+                printf("   %s: %s%s\n", snapshot_str(snapshot, row->status), path, diffstat);
+            }
+        }
+        if (snapshot->status_counts[section] > shown) {
+            printf("   +%zu more\n", snapshot->status_counts[section] - shown);
+        }
+    }
+}
+
+err_t query_daemon() {
+    err_t err = NO_ERROR;
+    char cwd[PATH_MAX] = {0};
+    git_buf git_dir = {0};
+    struct daemon_client *client = NULL;
+    struct snapshot *snapshot = NULL;
+    struct pollfd pollfd = {0};
+    bool connected = false;
+    bool updated = false;
+    bool disconnected = false;
+
+    ASSERT(getcwd(cwd, sizeof(cwd)));
+    ASSERT(git_libgit2_init() > 0);
+    // the same key the daemon uses, without opening the repository
+    ASSERT(!git_repository_discover(&git_dir, cwd, 0, "/"));
+
+    RETHROW(connect_daemon(&client, git_dir.ptr, NULL, &connected));
+    if (!connected) {
+        fprintf(stderr, "No daemon is running for this repository, start one with `git live daemon`.\n");
+        ABORT();
+    }
+    RETHROW(init_snapshot(&snapshot));
+
+    // the daemon sends its latest snapshot as soon as it accepts the connection
+    pollfd = (struct pollfd){.fd = client->fd, .events = POLLIN};
+    while (!updated) {
+        ASSERT(poll(&pollfd, 1, QUERY_TIMEOUT_MS) == 1);
+        RETHROW(daemon_client_receive(client, snapshot, &updated, &disconnected));
+        ASSERT(!disconnected);
+    }
+    print_snapshot(snapshot);
+
+cleanup:
+    if (client) {
+        RETHROW_PRINT(free_daemon_client(client));
+    }
+    if (snapshot) {
+        RETHROW_PRINT(free_snapshot(snapshot));
+    }
+    git_buf_dispose(&git_dir);
+    return err;
+}
@@ -0,0 +1,35 @@
+#ifndef GIT_LIVE_DAEMON_H
+#define GIT_LIVE_DAEMON_H
+
+#include <stdbool.h>
+#include "../lib/err.h"
+#include "snapshot.h"
+#include "timing.h"
+
+/*
+ * A daemon owns the watches and caches of one repository and computes its snapshots once for every client. It listens
+ * on a stream socket named after the repository's git dir, clients get the latest snapshot when they connect and
+ * then every snapshot that differs from the previous one. Status paths are relative to the work tree.
+ * A client that doesn't keep up is never waited for: the rest of a frame its socket can't take is kept and sent on the
+ * next wakeups, and the frames published meanwhile are skipped but for the newest.
+ */
+
+struct daemon_client;
+
+/* serve the repository of the current directory until interrupted. */
+err_t run_daemon();
+
+/* print the status of the current repository as seen by its daemon. */
+err_t query_daemon();
+
+/* connected is false when no daemon serves the repository at git_dir, the client is then NULL. */
+err_t connect_daemon(struct daemon_client **client, const char *git_dir, struct timer *timer, bool *connected);
+err_t free_daemon_client(struct daemon_client *client);
+
+/*
+ * Copy the newest snapshot the daemon sent since the last call to out, if any. disconnected is set when the daemon
+ * went away, the client should then be freed.
+ */
+err_t daemon_client_receive(struct daemon_client *client, struct snapshot *out, bool *updated, bool *disconnected);
+
+#endif // GIT_LIVE_DAEMON_H
@@ -8,19 +8,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/queue.h>
+#include <time.h>
 #include <unistd.h>
 #include "../lib/err.h"
 #include "../lib/layout/layout.h"
 #include "attach.h"
+#include "daemon.h"
+#include "diffstat.h"
+#include "engine.h"
 #include "ncurses_layout.h"
+#include "ndjson.h"
+#include "repo_cache.h"
+#include "repo_worker.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "trace.h"
 #include "timing.h"
+#include "untracked.h"
 #include "utils.h"
 
-#define REFLOG_CO_PREFIX ("checkout:")
-
 #define CHECKOUT_MAX_LEN (100)
 
+#define COMMIT_TIME_BUFF_LEN (64)
+
 #define COLOR_UNTRACKED (33)
 #define COLOR_NOT_STAGED (34)
 #define COLOR_STAGED (35)
@@ -34,116 +44,29 @@
 #define ASSERT_NCURSES(expr) ASSERT(expr != ERR)
 #define ASSERT_NCURSES_PRINT(expr) ASSERT_PRINT(expr != ERR)
 
-#define GIT_RETRY_COUNT (10)
-
 #define ERR_BUFF_LEN (4096)
 
-struct ref {
-    char *name;
-    size_t index;
-    LIST_ENTRY(ref) entry;
-};
-
-LIST_HEAD(refs, ref);
-
-static volatile bool keep_running = TRUE;
-
-bool is_checkout_reflog(const git_reflog_entry *entry) {
-    const char *message = git_reflog_entry_message(entry);
-    return !strncmp(message, REFLOG_CO_PREFIX, strlen(REFLOG_CO_PREFIX));
-}
-
-const char *get_checkout_reflog_target(const git_reflog_entry *entry) {
-    const char *message = git_reflog_entry_message(entry);
-    return strrchr(message, ' ') + 1;
-}
-
-struct ref *create_ref(const char *target, size_t index) {
-    struct ref *ref = malloc(sizeof(struct ref));
-    ref->index = index;
-    ref->name = malloc(strlen(target) + 1);
-    strcpy(ref->name, target);
-    return ref;
-}
-
-err_t free_ref(struct ref *ref) {
-    err_t err = NO_ERROR;
-
-    ASSERT(ref);
-
-    free(ref->name);
-    free(ref);
-
-cleanup:
-    return err;
-}
-
-bool refs_append_unique(struct refs *list, struct ref *ref) {
-    struct ref *curr = LIST_FIRST(list);
-    struct ref *last = curr;
+#define STATS_OVERLAY_LEN (256)
+#define STATS_DIR (".cache/git-live/stats")
+#define SNAPSHOTS_DIR (".cache/git-live/snapshots")
 
-    LIST_FOREACH(curr, list, entry) {
-        if (strcmp(curr->name, ref->name) == 0)
-            return false;
-        last = curr;
-    }
+// how often the last frame is persisted for the next startup, it is also saved on exit
+#define SNAPSHOT_SAVE_INTERVAL_US (5 * 1000 * 1000)
 
-    if (last == NULL) {
-        LIST_INSERT_HEAD(list, ref, entry);
-    } else {
-        LIST_INSERT_AFTER(last, ref, entry);
-    }
-    return true;
-}
+// without a daemon, how often to check whether one was started (or restarted) since
+#define DAEMON_RECONNECT_US (5 * 1000 * 1000)
 
-err_t get_latest_refs(struct refs *out, git_repository *repo, size_t max) {
-    err_t err = NO_ERROR;
-    git_reflog *reflog;
-    size_t collected = 0;
+// the screen size used when running headless, big enough that nothing is cut off in the benchmarks
+#define HEADLESS_ROWS (50)
+#define HEADLESS_COLS (200)
 
-    ASSERT(out);
-    ASSERT(repo);
-
-    git_reflog_read(&reflog, repo, "HEAD");
-    size_t count = git_reflog_entrycount(reflog);
-
-    for (size_t index = 0; index < count; index++) {
-        const git_reflog_entry *entry = git_reflog_entry_byindex(reflog, index);
-
-        if (!is_checkout_reflog(entry))
-            continue;
+#define MULTI_MAX_REPOS (16)
+// the workers don't know how much of the screen their repository gets, the layout cuts whatever doesn't fit
+#define MULTI_MAX_STATUS_ROWS (64)
+#define REPO_LIST_PATH (".config/git-live/repos")
 
-        const char *target = get_checkout_reflog_target(entry);
-        struct ref *ref = create_ref(target, index);
-
-        if (!refs_append_unique(out, ref)) {
-            RETHROW(free_ref(ref));
-            continue;
-        }
-
-        collected++;
-        if (collected == max)
-            break;
-    }
-
-cleanup:
-    git_reflog_free(reflog);
-    return err;
-}
-
-err_t clear_refs(struct refs *refs) {
-    err_t err = NO_ERROR;
-
-    ASSERT(refs);
-
-    struct ref *first;
-    while ((first = LIST_FIRST(refs)) != NULL) {
-        LIST_REMOVE(first, entry);
-        RETHROW(free_ref(first));
-    }
-cleanup:
-    return err;
-}
+static volatile bool keep_running = TRUE;
+static volatile bool dump_stats_requested = FALSE;
 
 void get_co_command(char *out, size_t maxlen, size_t index) {
     if (index == 1) {
@@ -153,60 +76,56 @@ void get_co_command(char *out, size_t maxlen, size_t index) {
     }
 }
 
-err_t print_refs(struct node *node, struct refs *refs) {
+err_t render_refs(struct node *node, const struct snapshot *snapshot) {
     err_t err = NO_ERROR;
-    struct ref *curr;
     char buff[CHECKOUT_MAX_LEN];
     struct node *names = NULL;
+    struct node *tracking = NULL;
     struct node *co_commands = NULL;
 
+    ASSERT(node);
+    ASSERT(snapshot);
+
     clear_children(node);
 
     append_child(node, &names);
     names->nodes_direction = nodes_direction_rows;
     names->fit_content = true;
-    //    names->basis = 15;
+
+    append_child(node, &tracking);
+    tracking->nodes_direction = nodes_direction_rows;
+    tracking->fit_content = true;
+    tracking->padding_left = 2;
 
     append_child(node, &co_commands);
     co_commands->nodes_direction = nodes_direction_rows;
     co_commands->padding_left = 4;
     co_commands->expand = 1;
 
-    ASSERT(node);
-    ASSERT(refs);
+    for (size_t i = 0; i < snapshot->ref_rows.count; i++) {
+        const struct ref_row *row = &snapshot->ref_rows.items[i];
 
-    LIST_FOREACH(curr, refs, entry) {
-        if (curr->index == 0)
-            continue;
-        append_text(names, curr->name);
-        if (curr->index) {
-            get_co_command(buff, CHECKOUT_MAX_LEN, curr->index);
-            append_styled_text(co_commands, buff, 0, WA_DIM);
-        }
+        append_text(names, snapshot_str(snapshot, row->name));
+        append_styled_text(tracking, snapshot_str(snapshot, row->tracking), 0, WA_DIM);
+
+        get_co_command(buff, CHECKOUT_MAX_LEN, row->index);
+        append_styled_text(co_commands, buff, 0, WA_DIM);
     }
+
 cleanup:
     return err;
 }
 
-err_t print_latest_commits(struct node *node, git_repository *repo, int max) {
+err_t render_latest_commits(struct node *node, const struct snapshot *snapshot, int64_t now) {
     err_t err = NO_ERROR;
-    git_revwalk *walker;
-    git_commit *commit;
-    int line = 1;
-    char hash[6];
-    char time[16];
-    char msg[512];
-    git_oid next;
+    char time_buff[COMMIT_TIME_BUFF_LEN];
     struct node *hash_col = NULL;
     struct node *msg_col = NULL;
     struct node *user_col = NULL;
     struct node *time_col = NULL;
 
     ASSERT(node);
-    ASSERT(repo);
-
-    git_revwalk_new(&walker, repo);
-    git_revwalk_push_ref(walker, "HEAD");
+    ASSERT(snapshot);
 
     clear_children(node);
 
@@ -230,187 +149,162 @@ err_t print_latest_commits(struct node *node, git_repository *repo, int max) {
     time_col->padding_left = 1;
     time_col->padding_right = 1;
 
-    while (git_revwalk_next(&next, walker) != GIT_ITEROVER) {
-        if (git_commit_lookup(&commit, repo, &next))
-            continue;
-
-        sprintf(hash, "%02x%02x", next.id[0], next.id[1]);
-
-        append_styled_text(hash_col, hash, COLOR_COMMIT_HASH, WA_DIM);
+    for (size_t i = 0; i < snapshot->commit_rows.count; i++) {
+        const struct commit_row *row = &snapshot->commit_rows.items[i];
 
-        strncpy(msg, git_commit_message(commit), sizeof(msg) - 1);
-        strtok(msg, "\n");
-        append_styled_text(msg_col, msg, COLOR_COMMIT_TITLE, 0);
+        append_styled_text(hash_col, snapshot_str(snapshot, row->hash), COLOR_COMMIT_HASH, WA_DIM);
+        append_styled_text(msg_col, snapshot_str(snapshot, row->summary), COLOR_COMMIT_TITLE, 0);
+        append_styled_text(user_col, snapshot_str(snapshot, row->author), COLOR_COMMIT_USER, WA_DIM);
 
-        append_styled_text(user_col, git_commit_committer(commit)->name, COLOR_COMMIT_USER, WA_DIM);
-
-        RETHROW(get_human_readable_time(git_commit_time(commit), time, 15));
-        append_styled_text(time_col, time, COLOR_COMMIT_DATE, 0);
-
-        git_commit_free(commit);
-        if (++line == max)
-            break;
+        RETHROW(get_human_readable_time(now, row->time, time_buff, sizeof(time_buff)));
+        append_styled_text(time_col, time_buff, COLOR_COMMIT_DATE, 0);
     }
 
-    git_revwalk_free(walker);
-
 cleanup:
     return err;
 }
 
-err_t get_head_name(git_repository *repo, char *buff, size_t len) {
-    err_t err = NO_ERROR;
-    git_reference *head = NULL;
-
-    err = git_repository_head(&head, repo);
-    ASSERT(err != GIT_EUNBORNBRANCH && err != GIT_ENOTFOUND);
-
-    strncpy(buff, git_reference_shorthand(head), len);
-    git_reference_free(head);
+static void format_status_row(const struct snapshot *snapshot, const struct status_row *row, char *buff, size_t len) {
+    size_t used = 0;
 
-cleanup:
-    return err;
+    if (row->old_path != row->path) {
+        snprintf(buff, len, "   %s: %s->%s", snapshot_str(snapshot, row->status), snapshot_str(snapshot, row->old_path),
+                 snapshot_str(snapshot, row->path));
+    } else {
+        snprintf(buff, len, "   %s: %s", snapshot_str(snapshot, row->status), snapshot_str(snapshot, row->path));
+    }
+    used = strlen(buff);
+    if (row->section == status_section_untracked && buff[used - 1] == '/') {
+        format_untracked_files(row->files, !row->counting, row->count_failed, buff + used, len - used);
+    } else {
+        format_diffstat(&row->diffstat, buff + used, len - used);
+    }
 }
 
-static err_t format_path(const char *path, const char *git_dir, const char *attached_dir, char *out_buff,
-                         unsigned long out_len) {
+err_t render_status(struct node *node, const struct snapshot *snapshot) {
     err_t err = NO_ERROR;
-    bool is_relative = FALSE;
-    char abs_path[PATH_MAX] = {0};
+    char buff[2 * PATH_MAX + DIFFSTAT_TEXT_LEN] = {0};
+    static const char *titles[STATUS_SECTIONS_COUNT] = {" staged:", " changed:", " untracked:"};
+    static const int colors[STATUS_SECTIONS_COUNT] = {COLOR_STAGED, COLOR_NOT_STAGED, COLOR_UNTRACKED};
+    size_t shown = 0;
 
-    ASSERT(path);
-    ASSERT(git_dir);
-    ASSERT(attached_dir);
-    ASSERT(out_buff);
-    ASSERT(out_len > 1);
-
-    RETHROW(is_relative_to(git_dir, attached_dir, &is_relative));
-    if (is_relative) {
-        strncpy(out_buff, path, out_len);
-        goto cleanup;
-    }
+    ASSERT(node);
+    ASSERT(snapshot);
 
-    RETHROW(join_paths(git_dir, path, abs_path, sizeof(abs_path)));
-    RETHROW(relative_to(abs_path, attached_dir, out_buff, out_len));
+    clear_children(node);
+
+    // the engine adds the rows section by section, so they are already grouped
+    for (size_t section = 0, i = 0; section < STATUS_SECTIONS_COUNT; section++) {
+        append_text(node, titles[section]);
+        for (shown = 0; i < snapshot->status_rows.count && snapshot->status_rows.items[i].section == section; i++) {
+            format_status_row(snapshot, &snapshot->status_rows.items[i], buff, sizeof(buff));
+            append_styled_text(node, buff, colors[section], 0);
+            shown++;
+        }
+        // the engine only builds the rows that fit
+        if (snapshot->status_counts[section] > shown) {
+            snprintf(buff, sizeof(buff), "   +%zu more", snapshot->status_counts[section] - shown);
+            append_styled_text(node, buff, colors[section], WA_DIM);
+        }
+    }
+    if (snapshot->status_scope != EMPTY_STR) {
+        snprintf(buff, sizeof(buff), " %zu changed files outside %s", snapshot->outside_changes,
+                 snapshot_str(snapshot, snapshot->status_scope));
+        append_styled_text(node, buff, 0, WA_DIM);
+    }
 
 cleanup:
     return err;
 }
 
-void print_status_entry(const char *git_dir, const char *attached_dir, const git_status_entry *entry, char *buff,
-                        size_t len) {
-    const char *status = "";
-    if (entry->status & (GIT_STATUS_INDEX_NEW | GIT_STATUS_WT_NEW)) {
-        status = "new";
-    } else if (entry->status & (GIT_STATUS_INDEX_RENAMED | GIT_STATUS_WT_RENAMED)) {
-        status = "renamed";
-    } else if (entry->status & (GIT_STATUS_INDEX_MODIFIED | GIT_STATUS_WT_MODIFIED)) {
-        status = "modified";
-    } else if (entry->status & (GIT_STATUS_INDEX_DELETED | GIT_STATUS_WT_DELETED)) {
-        status = "deleted";
-    }
-    if (entry->head_to_index) {
-        if (strcmp(entry->head_to_index->new_file.path, entry->head_to_index->old_file.path) != 0) {
-            char old_filename[PATH_MAX] = {0};
-            char new_filename[PATH_MAX] = {0};
-            format_path(entry->head_to_index->old_file.path, git_dir, attached_dir, old_filename,
-                        sizeof(old_filename) - 1);
-            format_path(entry->head_to_index->new_file.path, git_dir, attached_dir, new_filename,
-                        sizeof(new_filename) - 1);
-            snprintf(buff, len, "   %s: %s->%s", status, old_filename, new_filename);
-        } else {
-            char filename[PATH_MAX] = {0};
-            format_path(entry->head_to_index->new_file.path, git_dir, attached_dir, filename, sizeof(filename) - 1);
-            snprintf(buff, len, "   %s: %s", status, filename);
-        }
-    }
-    if (entry->index_to_workdir) {
-        if (strcmp(entry->index_to_workdir->new_file.path, entry->index_to_workdir->old_file.path) != 0) {
-            char old_filename[PATH_MAX] = {0};
-            char new_filename[PATH_MAX] = {0};
-            format_path(entry->index_to_workdir->old_file.path, git_dir, attached_dir, old_filename,
-                        sizeof(old_filename) - 1);
-            format_path(entry->index_to_workdir->new_file.path, git_dir, attached_dir, new_filename,
-                        sizeof(new_filename) - 1);
-            snprintf(buff, len, "   %s: %s->%s", status, old_filename, new_filename);
-        } else {
-            char filename[PATH_MAX] = {0};
-            format_path(entry->index_to_workdir->new_file.path, git_dir, attached_dir, filename, sizeof(filename) - 1);
-            snprintf(buff, len, "   %s: %s", status, filename);
-        }
+static void format_submodule_state(const struct submodule_row *row, char *buff, size_t len) {
+    switch (row->state) {
+    case submodule_state_pending:
+        snprintf(buff, len, "+? -?");
+        break;
+    case submodule_state_missing:
+        snprintf(buff, len, "missing");
+        break;
+    case submodule_state_ready:
+        snprintf(buff, len, "+%zu -%zu%s", row->ahead, row->behind, row->dirty ? "  dirty" : "");
+        break;
     }
 }
 
-err_t safe_git_status_list_new(git_status_list **status_list, git_repository *repo, git_status_options *opts) {
+err_t render_submodules(struct node *header, struct node *node, const struct snapshot *snapshot) {
     err_t err = NO_ERROR;
-    uint32_t retries = 0;
-    int inner_err = 0;
+    char buff[CHECKOUT_MAX_LEN];
+    struct node *paths = NULL;
+    struct node *heads = NULL;
+    struct node *states = NULL;
+    bool any = snapshot->submodule_rows.count > 0;
 
-    ASSERT(status_list);
-    ASSERT(repo);
-    ASSERT(opts);
+    ASSERT(header);
+    ASSERT(node);
+    ASSERT(snapshot);
 
-    while (retries++ < GIT_RETRY_COUNT) {
-        inner_err = git_status_list_new(status_list, repo, opts);
-        if (!inner_err)
-            goto cleanup;
-    }
-    ABORT();
+    RETHROW(clear_children(header));
+    RETHROW(clear_children(node));
 
-cleanup:
-    return err;
-}
+    // most repositories have no submodules, don't waste a line on them
+    header->basis = any ? 1 : 0;
+    node->expand = any ? 1 : 0;
+    if (!any)
+        goto cleanup;
 
-err_t print_status(const char *pwd, const char *new_pwd, struct node *node, git_repository *repo) {
-    err_t err = NO_ERROR;
-    char buff[PATH_MAX] = {0};
-    git_status_list *status_list;
-    git_status_options opts = {.version = GIT_STATUS_OPTIONS_VERSION,
-                               .flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED,
-                               .show = GIT_STATUS_SHOW_INDEX_ONLY};
+    RETHROW(append_text(header, "Submodules"));
 
-    ASSERT(node);
-    ASSERT(repo);
+    RETHROW(append_child(node, &paths));
+    paths->nodes_direction = nodes_direction_rows;
+    paths->fit_content = true;
 
-    RETHROW(safe_git_status_list_new(&status_list, repo, &opts));
+    RETHROW(append_child(node, &heads));
+    heads->nodes_direction = nodes_direction_rows;
+    heads->fit_content = true;
+    heads->padding_left = 2;
 
-    clear_children(node);
+    RETHROW(append_child(node, &states));
+    states->nodes_direction = nodes_direction_rows;
+    states->padding_left = 2;
+    states->expand = 1;
 
-    append_text(node, " staged:");
-    for (size_t i = 0; i < git_status_list_entrycount(status_list); i++) {
-        const git_status_entry *entry = git_status_byindex(status_list, i);
-        print_status_entry(pwd, new_pwd, entry, buff, sizeof(buff));
-        append_styled_text(node, buff, COLOR_STAGED, 0);
-    }
-    git_status_list_free(status_list);
-    opts =
-        (git_status_options){.version = GIT_STATUS_OPTIONS_VERSION, .flags = 0, .show = GIT_STATUS_SHOW_WORKDIR_ONLY};
+    for (size_t i = 0; i < snapshot->submodule_rows.count; i++) {
+        const struct submodule_row *row = &snapshot->submodule_rows.items[i];
+
+        RETHROW(append_text(paths, snapshot_str(snapshot, row->path)));
 
-    RETHROW(safe_git_status_list_new(&status_list, repo, &opts));
+        buff[0] = '\0';
+        if (row->head != EMPTY_STR) {
+            snprintf(buff, sizeof(buff), row->detached ? "%s" : "(%s)", snapshot_str(snapshot, row->head));
+        }
+        RETHROW(append_styled_text(heads, buff, row->detached ? COLOR_COMMIT_HASH : 0, WA_DIM));
 
-    append_text(node, " changed:");
-    for (size_t i = 0; i < git_status_list_entrycount(status_list); i++) {
-        const git_status_entry *entry = git_status_byindex(status_list, i);
-        print_status_entry(pwd, new_pwd, entry, buff, sizeof(buff));
-        append_styled_text(node, buff, COLOR_NOT_STAGED, 0);
+        format_submodule_state(row, buff, sizeof(buff));
+        RETHROW(append_styled_text(states, buff, row->dirty ? COLOR_NOT_STAGED : 0, row->dirty ? 0 : WA_DIM));
     }
-    git_status_list_free(status_list);
 
-    opts = (git_status_options){.version = GIT_STATUS_OPTIONS_VERSION,
-                                .flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED,
-                                .show = GIT_STATUS_SHOW_WORKDIR_ONLY};
+cleanup:
+    return err;
+}
 
-    RETHROW(safe_git_status_list_new(&status_list, repo, &opts));
-    append_text(node, " untracked:");
-    for (size_t i = 0; i < git_status_list_entrycount(status_list); i++) {
-        const git_status_entry *entry = git_status_byindex(status_list, i);
-        if (entry->index_to_workdir && entry->index_to_workdir->status != GIT_DELTA_UNTRACKED) {
-            continue;
-        }
-        print_status_entry(pwd, new_pwd, entry, buff, sizeof(buff));
-        append_styled_text(node, buff, COLOR_UNTRACKED, 0);
+static err_t render_branch(struct node *node, const struct snapshot *snapshot) {
+    err_t err = NO_ERROR;
+
+    RETHROW(append_text(node, "("));
+    RETHROW(append_text(node, snapshot_str(snapshot, snapshot->head_name)));
+    RETHROW(append_text(node, ")"));
+    if (snapshot->head_tracking != EMPTY_STR) {
+        RETHROW(append_text(node, " "));
+        RETHROW(append_styled_text(node, snapshot_str(snapshot, snapshot->head_tracking), 0, WA_DIM));
+    }
+    if (snapshot->operation != EMPTY_STR) {
+        RETHROW(append_text(node, " "));
+        RETHROW(append_styled_text(node, snapshot_str(snapshot, snapshot->operation), COLOR_NOT_STAGED, 0));
+    }
+    // the status below is the one from before git started, it is recomputed once git is done
+    if (snapshot->operation_running) {
+        RETHROW(append_styled_text(node, " (git is running)", 0, WA_DIM));
     }
-    git_status_list_free(status_list);
 
 cleanup:
     return err;
@@ -444,107 +338,382 @@ void interrupt_handler() {
     keep_running = 0;
 }
 
-err_t run_dashboard() {
+void dump_stats_handler() {
+    dump_stats_requested = 1;
+}
+
+/*
+ * The daemon's paths are relative to the work tree while ours are relative to the cwd, so only a dashboard started at
+ * the root of the work tree shows the same rows either way.
+ */
+static err_t is_workdir_root(git_repository *repo, const char *dir, bool *out) {
+    err_t err = NO_ERROR;
+    char relative[PATH_MAX] = {0};
+
+    *out = false;
+    if (!git_repository_workdir(repo))
+        goto cleanup;
+    RETHROW(relative_to(dir, git_repository_workdir(repo), relative, sizeof(relative)));
+    *out = !strcmp(relative, ".");
+
+cleanup:
+    return err;
+}
+
+/* ~/.cache/git-live/stats/<pid>, so dumps of a few dashboards running side by side don't overwrite each other. */
+static err_t get_default_stats_path(char *buff, size_t len) {
+    err_t err = NO_ERROR;
+    char dir[PATH_MAX] = {0};
+    char name[32] = {0};
+    const char *home = NULL;
+
+    RETHROW(get_home_dir(&home));
+    RETHROW(join_paths(home, STATS_DIR, dir, sizeof(dir)));
+    snprintf(name, sizeof(name), "%d", getpid());
+    RETHROW(join_paths(dir, name, buff, len));
+
+cleanup:
+    return err;
+}
+
+/* ~/.cache/git-live/snapshots/<hash of the workdir>, the last frame of every repository shown is kept there. */
+static err_t save_last_snapshot(const struct snapshot *snapshot, git_repository *repo) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+
+    RETHROW(get_keyed_cache_path(SNAPSHOTS_DIR, git_repository_workdir(repo), path, sizeof(path)));
+    RETHROW(save_snapshot_file(snapshot, path));
+
+cleanup:
+    return err;
+}
+
+static err_t trace_wakeup(const struct timing_wakeup *wakeup) {
+    err_t err = NO_ERROR;
+    char detail[NAME_MAX + 64] = {0};
+
+    if (wakeup->reasons == timing_wake_timeout) {
+        trace_instant("wakeup", "timer", "timeout");
+        goto cleanup;
+    }
+
+    // there can be more than one reason when several things happened during the poll
+    snprintf(detail, sizeof(detail), "%s%s%s%s", wakeup->reasons & timing_wake_inotify ? "inotify:" : "",
+             wakeup->reasons & timing_wake_inotify ? wakeup->name : "",
+             wakeup->reasons & timing_wake_notify ? " worker" : "", wakeup->reasons & timing_wake_fd ? " fd" : "");
+    trace_instant("wakeup", "timer", detail[0] == ' ' ? detail + 1 : detail);
+
+cleanup:
+    return err;
+}
+
+static err_t headless_draw_text(void *arg, const char *text, uint32_t len, uint32_t col, uint32_t row, int color,
+                                int attrs) {
+    (void)arg, (void)text, (void)len, (void)col, (void)row, (void)color, (void)attrs;
+    return NO_ERROR;
+}
+
+static err_t headless_draw_color(void *arg, uint32_t col, uint32_t row, uint32_t width, uint32_t height, int color) {
+    (void)arg, (void)col, (void)row, (void)width, (void)height, (void)color;
+    return NO_ERROR;
+}
+
+static struct rect get_screen_rect(WINDOW *win) {
+    if (!win) {
+        return (struct rect){0, 0, HEADLESS_COLS, HEADLESS_ROWS};
+    }
+    return (struct rect){0, 0, getmaxx(win), getmaxy(win)};
+}
+
+static err_t init_screen(WINDOW **win) {
+    err_t err = NO_ERROR;
+
+    ASSERT(*win = initscr());
+    ASSERT_NCURSES(curs_set(0));
+    ASSERT_NCURSES(start_color());
+    ASSERT_NCURSES(use_default_colors());
+
+    ASSERT_NCURSES(init_pair(COLOR_STAGED, COLOR_GREEN, -1));
+    ASSERT_NCURSES(init_pair(COLOR_NOT_STAGED, COLOR_RED, -1));
+    ASSERT_NCURSES(init_pair(COLOR_UNTRACKED, COLOR_RED, -1));
+    ASSERT_NCURSES(init_pair(COLOR_TITLE, COLOR_BLACK, COLOR_WHITE));
+    ASSERT_NCURSES(init_pair(COLOR_COMMIT_HASH, COLOR_BLUE, -1));
+    ASSERT_NCURSES(init_pair(COLOR_COMMIT_TITLE, -1, -1));
+    ASSERT_NCURSES(init_pair(COLOR_COMMIT_DATE, -1, -1));
+    ASSERT_NCURSES(init_pair(COLOR_COMMIT_USER, -1, -1));
+
+cleanup:
+    return err;
+}
+
+struct dashboard_nodes {
+    struct node *top_header;
+    struct node *top;
+    struct node *submodules_header;
+    struct node *submodules;
+    struct node *middle_header;
+    struct node *middle;
+    struct node *bottom_header;
+    struct node *bottom;
+};
+
+/* stale is set while a snapshot persisted by a previous run is shown, until the first one is computed. */
+static err_t render_dashboard(const struct dashboard_nodes *nodes, const struct snapshot *snapshot,
+                              const char *session_id, bool is_attached, bool stale) {
+    err_t err = NO_ERROR;
+    struct node *top_header_left = NULL;
+    struct node *title = NULL;
+    struct node *top_header_right = NULL;
+    struct node *branch = NULL;
+    struct node *padding = NULL;
+
+    RETHROW(render_status(nodes->top, snapshot));
+    RETHROW(render_submodules(nodes->submodules_header, nodes->submodules, snapshot));
+    RETHROW(render_refs(nodes->middle, snapshot));
+    RETHROW(render_latest_commits(nodes->bottom, snapshot, time(NULL)));
+
+    RETHROW(clear_children(nodes->top_header));
+    RETHROW(clear_children(nodes->middle_header));
+    RETHROW(clear_children(nodes->bottom_header));
+
+    RETHROW(append_child(nodes->top_header, &top_header_left));
+    top_header_left->expand = 1;
+    top_header_left->nodes_direction = nodes_direction_columns;
+
+    RETHROW(append_child(nodes->top_header, &title));
+    title->fit_content = true;
+    title->padding_left = 1;
+    title->padding_right = 1;
+    RETHROW(append_text(title, "Git Live"));
+    RETHROW(append_text(title, " (session "));
+    RETHROW(append_text(title, session_id));
+    if (is_attached) {
+        RETHROW(append_text(title, " <attached>"));
+    }
+    if (stale) {
+        RETHROW(append_text(title, " <stale>"));
+    }
+    RETHROW(append_text(title, ")"));
+
+    RETHROW(append_child(nodes->top_header, &top_header_right));
+    top_header_right->expand = 1;
+    top_header_right->nodes_direction = nodes_direction_columns;
+
+    RETHROW(append_text(top_header_left, "Status"));
+
+    RETHROW(append_child(top_header_left, &branch));
+    branch->expand = 1;
+    branch->padding_left = 1;
+    branch->nodes_direction = nodes_direction_columns;
+    RETHROW(render_branch(branch, snapshot));
+
+    RETHROW(append_child(top_header_right, &padding));
+    padding->expand = 1;
+
+    RETHROW(append_text(top_header_right, snapshot_str(snapshot, snapshot->workdir)));
+
+    RETHROW(append_text(nodes->middle_header, "Latest Branches"));
+    RETHROW(append_text(nodes->bottom_header, "Commits"));
+
+cleanup:
+    return err;
+}
+
+/* one line per frame, for whatever is driving the headless dashboard to synchronize with. */
+/* stale is set for the snapshot of the last run, shown until the first frame is computed. */
+static void print_headless_frame(const struct snapshot *snapshot, uint64_t frame, uint64_t frame_started,
+                                 uint64_t frame_ended, bool stale) {
+    size_t changes = 0;
+
+    for (size_t i = 0; i < STATUS_SECTIONS_COUNT; i++) {
+        changes += snapshot->status_counts[i];
+    }
+    printf("frame %lu %lu %lu %zu %d\n", frame, frame_ended - frame_started,
+           snapshot->event_arrived ? frame_ended - snapshot->event_arrived : 0, changes, stale);
+    fflush(stdout);
+}
+
+err_t run_dashboard(const struct dashboard_options *options) {
     err_t err = NO_ERROR;
     char err_buff[ERR_BUFF_LEN] = {0};
+    char stats_path[PATH_MAX] = {0};
+    char stats_overlay[STATS_OVERLAY_LEN] = {0};
     char cwd[PATH_MAX] = {0};
     char new_pwd[PATH_MAX] = {0};
     char repo_root[PATH_MAX] = {0};
-    char head_name[100] = {0};
     char session_id[SESSION_ID_LEN + 1] = {0};
-    struct refs refs = LIST_HEAD_INITIALIZER();
+    char snapshot_path[PATH_MAX] = {0};
+    struct snapshot *snapshot = NULL;
     struct layout *layout = NULL;
-    struct node *top_header = NULL;
-    struct node *top = NULL;
-    struct node *middle_header = NULL;
-    struct node *middle = NULL;
-    struct node *bottom_header = NULL;
-    struct node *bottom = NULL;
+    struct dashboard_nodes nodes = {0};
+    struct node *overlay = NULL;
     WINDOW *win = NULL;
     git_repository *repo = NULL;
     bool is_attached = false;
     struct timer *timer = NULL;
     struct attach_session* attach_session = NULL;
     int workdir_watch_id = INVALID_WATCH_ID;
+    struct repo_cache *repo_cache = NULL;
+    struct repo_handle *handle = NULL;
+    uint64_t frame_started = 0;
+    uint64_t started = 0;
+    struct timing_wakeup wakeup = {0};
+    struct rect screen = {0};
+    uint64_t frame_ended = 0;
+    uint64_t frames = 0;
+    uint64_t snapshot_saved = 0;
+    bool loaded = false;
+    struct daemon_client *daemon = NULL;
+    bool daemon_connected = false;
+    bool daemon_updated = false;
+    bool daemon_disconnected = false;
+    // set once the repository is open, see is_workdir_root
+    bool use_daemon = false;
+    uint64_t daemon_tried = 0;
+    struct ndjson_writer *ndjson = NULL;
+    bool record_written = false;
 
     signal(SIGINT, interrupt_handler);
+    signal(SIGUSR1, dump_stats_handler);
     init_stderr_buffering(err_buff, sizeof(err_buff));
 
+    ASSERT(options);
+    if (options->stats_path) {
+        strncpy(stats_path, options->stats_path, sizeof(stats_path) - 1);
+    } else {
+        RETHROW(get_default_stats_path(stats_path, sizeof(stats_path)));
+    }
+    if (options->trace_path) {
+        RETHROW(init_trace(options->trace_path));
+    }
+
     ASSERT(getcwd(cwd, PATH_MAX));
     ASSERT(getcwd(new_pwd, PATH_MAX));
     ASSERT(git_libgit2_init() > 0);
-    ASSERT(!git_repository_open_ext(&repo, cwd, 0, "/"));
-
-    RETHROW(get_root_repo_path(git_repository_path(repo), strlen(git_repository_path(repo)), repo_root, PATH_MAX));
 
-    ASSERT(win = initscr());
-    ASSERT_NCURSES(curs_set(0));
-    ASSERT_NCURSES(start_color());
-    ASSERT_NCURSES(use_default_colors());
+    RETHROW(init_timer(&timer, (struct timer_config){
+                                    .min_timeout = 200,
+                                    .idle_cpu_percent_target = 10,
+                                    .max_cpu_percent_target = 50,
+                                }));
+    RETHROW(init_snapshot(&snapshot));
+    RETHROW(init_repo_cache(&repo_cache, timer));
+    RETHROW(repo_cache_open(repo_cache, cwd, &handle));
+    repo = handle->repo;
+
+    // the daemon computes the status of the whole work tree, a scoped one is only computed here
+    if (!options->no_daemon && !options->scoped) {
+        RETHROW(is_workdir_root(repo, cwd, &use_daemon));
+    }
 
-    ASSERT_NCURSES(init_pair(COLOR_STAGED, COLOR_GREEN, -1));
-    ASSERT_NCURSES(init_pair(COLOR_NOT_STAGED, COLOR_RED, -1));
-    ASSERT_NCURSES(init_pair(COLOR_UNTRACKED, COLOR_RED, -1));
-    ASSERT_NCURSES(init_pair(COLOR_TITLE, COLOR_BLACK, COLOR_WHITE));
-    ASSERT_NCURSES(init_pair(COLOR_COMMIT_HASH, COLOR_BLUE, -1));
-    ASSERT_NCURSES(init_pair(COLOR_COMMIT_TITLE, -1, -1));
-    ASSERT_NCURSES(init_pair(COLOR_COMMIT_DATE, -1, -1));
-    ASSERT_NCURSES(init_pair(COLOR_COMMIT_USER, -1, -1));
+    RETHROW(get_root_repo_path(git_repository_path(repo), strlen(git_repository_path(repo)), repo_root, PATH_MAX));
 
-    RETHROW(init_ncurses_layout(&layout, win));
+    if (options->format == output_format_ndjson) {
+        RETHROW(init_ndjson_writer(&ndjson, stdout));
+    }
+    if (options->headless || options->format != output_format_screen) {
+        RETHROW(init_layout(&layout, headless_draw_text, headless_draw_color, NULL));
+    } else {
+        RETHROW(init_screen(&win));
+        RETHROW(init_ncurses_layout(&layout, win));
+    }
     layout->root.expand = 1;
     layout->root.fit_content = true;
     layout->root.nodes_direction = nodes_direction_rows;
 
-    RETHROW(append_child(&layout->root, &top_header));
-    top_header->basis = 1;
-    top_header->padding_left = 1;
-    top_header->nodes_direction = nodes_direction_columns;
-    top_header->color = COLOR_TITLE;
-
-    RETHROW(append_child(&layout->root, &top));
-    top->expand = 1;
-    top->nodes_direction = nodes_direction_rows;
-    top->wrap = node_wrap_wrap;
-    top->fit_content = true;
-
-    RETHROW(append_child(&layout->root, &middle_header));
-    middle_header->basis = 1;
-    middle_header->padding_left = 1;
-    middle_header->color = COLOR_TITLE;
-
-    RETHROW(append_child(&layout->root, &middle));
-    middle->expand = 1;
-    middle->nodes_direction = nodes_direction_columns;
-    middle->padding_left = 1;
-
-    RETHROW(append_child(&layout->root, &bottom_header));
-    bottom_header->basis = 1;
-    bottom_header->padding_left = 1;
-    bottom_header->color = COLOR_TITLE;
-
-    RETHROW(append_child(&layout->root, &bottom));
-    bottom->expand = 1;
-    bottom->nodes_direction = nodes_direction_columns;
-    bottom->padding_left = 1;
+    RETHROW(append_child(&layout->root, &nodes.top_header));
+    nodes.top_header->basis = 1;
+    nodes.top_header->padding_left = 1;
+    nodes.top_header->nodes_direction = nodes_direction_columns;
+    nodes.top_header->color = COLOR_TITLE;
+
+    RETHROW(append_child(&layout->root, &nodes.top));
+    nodes.top->expand = 1;
+    nodes.top->nodes_direction = nodes_direction_rows;
+    nodes.top->wrap = node_wrap_wrap;
+    nodes.top->fit_content = true;
+
+    RETHROW(append_child(&layout->root, &nodes.submodules_header));
+    nodes.submodules_header->padding_left = 1;
+    nodes.submodules_header->color = COLOR_TITLE;
+
+    RETHROW(append_child(&layout->root, &nodes.submodules));
+    nodes.submodules->nodes_direction = nodes_direction_columns;
+    nodes.submodules->padding_left = 1;
+
+    RETHROW(append_child(&layout->root, &nodes.middle_header));
+    nodes.middle_header->basis = 1;
+    nodes.middle_header->padding_left = 1;
+    nodes.middle_header->color = COLOR_TITLE;
+
+    RETHROW(append_child(&layout->root, &nodes.middle));
+    nodes.middle->expand = 1;
+    nodes.middle->nodes_direction = nodes_direction_columns;
+    nodes.middle->padding_left = 1;
+
+    RETHROW(append_child(&layout->root, &nodes.bottom_header));
+    nodes.bottom_header->basis = 1;
+    nodes.bottom_header->padding_left = 1;
+    nodes.bottom_header->color = COLOR_TITLE;
+
+    RETHROW(append_child(&layout->root, &nodes.bottom));
+    nodes.bottom->expand = 1;
+    nodes.bottom->nodes_direction = nodes_direction_columns;
+    nodes.bottom->padding_left = 1;
+
+    RETHROW(append_child(&layout->root, &overlay));
+    // the timings and the memory
+    overlay->basis = options->stats_overlay ? 2 : 0;
+    overlay->padding_left = 1;
 
-    RETHROW(init_timer(&timer, (struct timer_config){
-                                    .min_timeout = 200,
-                                    .idle_cpu_percent_target = 10,
-                                    .max_cpu_percent_target = 50,
-                                }));
     RETHROW(init_attach_session(&attach_session, timer));
 
-    RETHROW(timing_add_or_modify_watch(timer, &workdir_watch_id, git_repository_workdir(repo)));
+    // a scoped status only needs to hear about its own directory
+    RETHROW(timing_add_or_modify_watch(timer, &workdir_watch_id, options->scoped ? cwd : git_repository_workdir(repo)));
 
-    while (keep_running) {
-        struct node *top_header_left = NULL;
-        struct node *title = NULL;
-        struct node *top_header_right = NULL;
-        struct node *branch = NULL;
-        struct node *padding = NULL;
+    if (use_daemon) {
+        RETHROW(connect_daemon(&daemon, git_repository_path(repo), timer, &daemon_connected));
+        daemon_tried = stats_now_us();
+    }
 
+    // the first frame waits for the timer and a full status, until then show what the last run saw. records are only
+    // written for fresh snapshots
+    frame_started = stats_now_us();
+    RETHROW(get_keyed_cache_path(SNAPSHOTS_DIR, git_repository_workdir(repo), snapshot_path, sizeof(snapshot_path)));
+    if (!ndjson) {
+        RETHROW(load_snapshot_file(snapshot, snapshot_path, &loaded));
+    }
+    if (loaded) {
+        RETHROW(get_attach_session_id(attach_session, session_id, sizeof(session_id)));
+        RETHROW(render_dashboard(&nodes, snapshot, session_id, is_attached, true));
+        if (win) {
+            werase(win);
+        }
+        RETHROW(draw_layout(layout, get_screen_rect(win)));
+        if (win) {
+            wrefresh(win);
+        }
+        if (options->headless) {
+            print_headless_frame(snapshot, ++frames, frame_started, stats_now_us(), true);
+        }
+    }
+
+    while (keep_running) {
+        started = stats_now_us();
         RETHROW(timing_wait(timer));
+        stats_record(stats_phase_wait, started);
+        frame_started = stats_now_us();
+        RETHROW(timing_get_wakeup(timer, &wakeup));
+        if (trace_enabled()) {
+            RETHROW(trace_wakeup(&wakeup));
+        }
+
+        if (dump_stats_requested) {
+            dump_stats_requested = 0;
+            RETHROW_PRINT(stats_dump(stats_path));
+        }
+
+        screen = get_screen_rect(win);
 
         RETHROW(get_attached_workdir(attach_session, new_pwd, sizeof(new_pwd) - 1, &is_attached));
 
@@ -554,78 +723,337 @@ err_t run_dashboard() {
             bool is_relative = FALSE;
             RETHROW(is_relative_to(new_pwd, repo_root, &is_relative));
             if (is_relative) {
-                git_repository_free(repo);
-                ASSERT(!git_repository_open_ext(&repo, new_pwd, 0, "/"));
+                RETHROW(repo_cache_open(repo_cache, new_pwd, &handle));
+                if (handle->repo != repo || options->scoped) {
+                    repo = handle->repo;
+                    RETHROW(timing_add_or_modify_watch(timer, &workdir_watch_id,
+                                                       options->scoped ? new_pwd : git_repository_workdir(repo)));
+                }
+            }
+        }
+
+        // the daemon's paths are relative to the work tree, an attached terminal needs them relative to its cwd
+        if (daemon && is_attached) {
+            RETHROW(free_daemon_client(daemon));
+            daemon = NULL;
+        }
+        if (!daemon && use_daemon && !is_attached && frame_started - daemon_tried >= DAEMON_RECONNECT_US) {
+            RETHROW(connect_daemon(&daemon, git_repository_path(repo), timer, &daemon_connected));
+            daemon_tried = frame_started;
+        }
+        if (daemon) {
+            RETHROW(daemon_client_receive(daemon, snapshot, &daemon_updated, &daemon_disconnected));
+            if (daemon_disconnected) {
+                RETHROW(free_daemon_client(daemon));
+                daemon = NULL;
+                daemon_tried = frame_started;
+                fprintf(stderr, "Lost the daemon, computing the status here until it is back.\n");
+            }
+        }
+
+        if (!daemon) {
+            RETHROW(compute_snapshot(handle, new_pwd,
+                                     (struct engine_limits){
+                                         // a section can't show more rows than the screen has
+                                         .max_status_rows = screen.height,
+                                         // we get more refs than fit and some will be hidden
+                                         .max_refs = screen.height - 2,
+                                         .max_commits = MAX(screen.height / 3, 1) - 1,
+                                         .max_submodules = screen.height / 4,
+                                         .scope_status = options->scoped,
+                                     },
+                                     snapshot));
+        }
+        // the daemon saw the event, not us
+        snapshot->event_arrived = daemon ? 0 : wakeup.inotify_arrived;
+
+        // nothing is drawn when the frames are written as records
+        if (!ndjson) {
+            started = stats_now_us();
+            RETHROW(get_attach_session_id(attach_session, session_id, sizeof(session_id)));
+            RETHROW(render_dashboard(&nodes, snapshot, session_id, is_attached, false));
+
+            if (options->stats_overlay) {
+                RETHROW(clear_children(overlay));
+                RETHROW(stats_format_overlay(stats_overlay, sizeof(stats_overlay)));
+                RETHROW(append_styled_text(overlay, stats_overlay, 0, WA_DIM));
             }
+            stats_record(stats_phase_render, started);
+
+            started = stats_now_us();
+            if (win) {
+                werase(win);
+            }
+            RETHROW(draw_layout(layout, screen));
+            stats_record(stats_phase_layout, started);
+
+            started = stats_now_us();
+            if (win) {
+                wrefresh(win);
+            }
+            stats_record(stats_phase_refresh, started);
         }
 
-        RETHROW(print_status(git_repository_workdir(repo), new_pwd, top, repo));
+        frame_ended = stats_now_us();
+        stats_record(stats_phase_frame, frame_started);
+        if (snapshot->event_arrived) {
+            stats_record(stats_phase_event_to_screen, snapshot->event_arrived);
+        }
+        stats_sample_memory();
+        frames++;
+        if (ndjson) {
+            RETHROW(ndjson_write_frame(ndjson, snapshot,
+                                       &(struct ndjson_frame){
+                                           .frame = frames,
+                                           .frame_us = frame_ended - frame_started,
+                                           .event_us = snapshot->event_arrived ? frame_ended - snapshot->event_arrived
+                                                                               : 0,
+                                       },
+                                       &record_written));
+        } else if (options->headless) {
+            print_headless_frame(snapshot, frames, frame_started, frame_ended, false);
+        }
 
-        RETHROW(get_latest_refs(&refs, repo, getmaxy(win) - 2)); // we get more and some will be hidden
-        RETHROW(print_refs(middle, &refs));
-        RETHROW(clear_refs(&refs));
+        // saving is off the critical path, the frame is already on the screen
+        if (frame_ended - snapshot_saved >= SNAPSHOT_SAVE_INTERVAL_US) {
+            RETHROW_PRINT(save_last_snapshot(snapshot, handle->repo));
+            snapshot_saved = frame_ended;
+        }
+    }
 
-        RETHROW(print_latest_commits(bottom, repo, getmaxy(win) / 3));
+    if (snapshot_saved) {
+        RETHROW_PRINT(save_last_snapshot(snapshot, handle->repo));
+    }
+    if (options->stats_path) {
+        RETHROW_PRINT(stats_dump(stats_path));
+    }
 
-        RETHROW(clear_children(top_header));
-        RETHROW(clear_children(middle_header));
-        RETHROW(clear_children(bottom_header));
+cleanup:
+    if (ndjson) {
+        RETHROW_PRINT(free_ndjson_writer(ndjson));
+    }
+    if (daemon) {
+        RETHROW_PRINT(free_daemon_client(daemon));
+    }
+    if (repo_cache) {
+        RETHROW_PRINT(free_repo_cache(repo_cache));
+    }
+    RETHROW_PRINT(free_attach_session(attach_session));
+    RETHROW_PRINT(free_timer(timer));
+    RETHROW_PRINT(deinit_trace());
+    if (snapshot) {
+        RETHROW_PRINT(free_snapshot(snapshot));
+    }
+    RETHROW_PRINT(free_layout(layout));
+    if (win) {
+        ASSERT_NCURSES_PRINT(delwin(win));
+        ASSERT_NCURSES_PRINT(endwin());
+    }
+    flush_stderr_buff();
+    deinit_stderr_buff();
+    return err;
+}
 
-        RETHROW(get_head_name(repo, head_name, sizeof(head_name)));
+static err_t render_repo_section(struct node *header, struct node *body, const char *path,
+                                 const struct snapshot *snapshot) {
+    err_t err = NO_ERROR;
+    struct node *branch = NULL;
+    struct node *padding = NULL;
 
-        RETHROW(append_child(top_header, &top_header_left));
-        top_header_left->expand = 1;
-        top_header_left->nodes_direction = nodes_direction_columns;
+    RETHROW(clear_children(header));
+    RETHROW(clear_children(body));
 
-        RETHROW(get_attach_session_id(attach_session, session_id, sizeof(session_id)));
+    RETHROW(append_child(header, &branch));
+    branch->expand = 1;
+    branch->nodes_direction = nodes_direction_columns;
 
-        RETHROW(append_child(top_header, &title));
-        title->fit_content = true;
-        title->padding_left = 1;
-        title->padding_right = 1;
-        RETHROW(append_text(title, "Git Live"));
-        RETHROW(append_text(title, " (session "));
-        RETHROW(append_text(title, session_id));
-        if (is_attached) {
-            RETHROW(append_text(title, " <attached>"));
-        }
-        RETHROW(append_text(title, ")"));
+    RETHROW(append_child(header, &padding));
+    padding->expand = 1;
+
+    if (!snapshot) {
+        RETHROW(append_text(branch, "(loading)"));
+        RETHROW(append_text(header, path));
+        goto cleanup;
+    }
+
+    RETHROW(render_branch(branch, snapshot));
+    RETHROW(append_text(header, snapshot_str(snapshot, snapshot->workdir)));
+    RETHROW(render_status(body, snapshot));
+
+cleanup:
+    return err;
+}
+
+/*
+ * Read the repositories to monitor from ~/.config/git-live/repos, one path per line, empty lines and lines starting
+ * with '#' are skipped. The returned paths point into buff.
+ */
+static err_t read_repo_list(char *buff, size_t len, const char **paths, size_t max_paths, size_t *count) {
+    err_t err = NO_ERROR;
+    char list_path[PATH_MAX] = {0};
+    const char *home = NULL;
+    FILE *file = NULL;
+    size_t used = 0;
+    char *line = NULL;
+    char *saveptr = NULL;
+
+    ASSERT(buff);
+    ASSERT(paths);
+    ASSERT(count);
+
+    *count = 0;
+
+    RETHROW(get_home_dir(&home));
+    RETHROW(join_paths(home, REPO_LIST_PATH, list_path, sizeof(list_path)));
+    file = fopen(list_path, "r");
+    if (!file) {
+        fprintf(stderr, "No repositories given and %s could not be read.\n", list_path);
+        ABORT();
+    }
+
+    used = fread(buff, 1, len - 1, file);
+    ASSERT(!ferror(file));
+    buff[used] = '\0';
+
+    for (line = strtok_r(buff, "\n", &saveptr); line && *count < max_paths; line = strtok_r(NULL, "\n", &saveptr)) {
+        if (!strlen(line) || line[0] == '#')
+            continue;
+        paths[(*count)++] = line;
+    }
+    ASSERT(*count > 0);
 
-        RETHROW(append_child(top_header, &top_header_right));
-        top_header_right->expand = 1;
-        top_header_right->nodes_direction = nodes_direction_columns;
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    return err;
+}
 
-        RETHROW(append_text(top_header_left, "Status"));
+err_t run_multi_dashboard(const char **paths, size_t count) {
+    err_t err = NO_ERROR;
+    char err_buff[ERR_BUFF_LEN] = {0};
+    char repo_list_buff[MULTI_MAX_REPOS * PATH_MAX] = {0};
+    const char *repo_list[MULTI_MAX_REPOS] = {0};
+    struct layout *layout = NULL;
+    struct node **headers = NULL;
+    struct node **bodies = NULL;
+    struct repo_worker **workers = NULL;
+    uint64_t *events_arrived = NULL;
+    const struct snapshot *snapshot = NULL;
+    bool updated = false;
+    bool any_updated = true;
+    WINDOW *win = NULL;
+    struct timer *timer = NULL;
+    struct timer_config worker_timer_config = {
+        .min_timeout = 200,
+        .idle_cpu_percent_target = 10,
+        .max_cpu_percent_target = 50,
+    };
+
+    if (!count) {
+        RETHROW(read_repo_list(repo_list_buff, sizeof(repo_list_buff), repo_list, MULTI_MAX_REPOS, &count));
+        paths = repo_list;
+    }
+    ASSERT(paths);
+    ASSERT(count <= MULTI_MAX_REPOS);
 
-        RETHROW(append_child(top_header_left, &branch));
-        branch->expand = 1;
-        branch->padding_left = 1;
-        branch->nodes_direction = nodes_direction_columns;
-        RETHROW(append_text(branch, "("));
-        RETHROW(append_text(branch, head_name));
-        RETHROW(append_text(branch, ")"));
+    signal(SIGINT, interrupt_handler);
+    init_stderr_buffering(err_buff, sizeof(err_buff));
+
+    ASSERT(git_libgit2_init() > 0);
 
-        RETHROW(append_child(top_header_right, &padding));
-        padding->expand = 1;
+    // every repo gets its own timer, they split the budget of a single dashboard between them
+    worker_timer_config.budget_shares = count;
+
+    // the main thread only waits for workers to publish, its cpu usage is counted by the workers' budget
+    RETHROW(init_timer(&timer, (struct timer_config){
+                                   .min_timeout = 1000,
+                                   .idle_cpu_percent_target = 1,
+                                   .max_cpu_percent_target = 1,
+                               }));
+
+    headers = calloc(count, sizeof(*headers));
+    bodies = calloc(count, sizeof(*bodies));
+    workers = calloc(count, sizeof(*workers));
+    events_arrived = calloc(count, sizeof(*events_arrived));
+    ASSERT(headers && bodies && workers && events_arrived);
+
+    for (size_t i = 0; i < count; i++) {
+        RETHROW(init_repo_worker(&workers[i], paths[i],
+                                 (struct engine_limits){.max_status_rows = MULTI_MAX_STATUS_ROWS},
+                                 worker_timer_config, timer));
+    }
 
-        RETHROW(append_text(top_header_right, git_repository_workdir(repo)));
+    RETHROW(init_screen(&win));
 
-        RETHROW(append_text(middle_header, "Latest Branches"));
-        RETHROW(append_text(bottom_header, "Commits"));
+    RETHROW(init_ncurses_layout(&layout, win));
+    layout->root.expand = 1;
+    layout->root.fit_content = true;
+    layout->root.nodes_direction = nodes_direction_rows;
 
-        werase(win);
-        RETHROW(draw_layout(layout, (struct rect){0, 0, getmaxx(win), getmaxy(win)}));
-        wrefresh(win);
+    for (size_t i = 0; i < count; i++) {
+        RETHROW(append_child(&layout->root, &headers[i]));
+        headers[i]->basis = 1;
+        headers[i]->padding_left = 1;
+        headers[i]->padding_right = 1;
+        headers[i]->nodes_direction = nodes_direction_columns;
+        headers[i]->color = COLOR_TITLE;
+
+        RETHROW(append_child(&layout->root, &bodies[i]));
+        bodies[i]->expand = 1;
+        bodies[i]->nodes_direction = nodes_direction_rows;
+        bodies[i]->wrap = node_wrap_wrap;
+        bodies[i]->fit_content = true;
+    }
+
+    while (keep_running) {
+        for (size_t i = 0; i < count; i++) {
+            RETHROW(repo_worker_take_snapshot(workers[i], &snapshot, &updated));
+            if (updated || !snapshot) {
+                RETHROW(render_repo_section(headers[i], bodies[i], paths[i], snapshot));
+            }
+            events_arrived[i] = updated ? snapshot->event_arrived : 0;
+            any_updated |= updated;
+        }
+
+        // nothing changed since the last frame, this was the periodic wakeup
+        if (any_updated) {
+            werase(win);
+            RETHROW(draw_layout(layout, (struct rect){0, 0, getmaxx(win), getmaxy(win)}));
+            wrefresh(win);
+        }
+        any_updated = false;
+
+        for (size_t i = 0; i < count; i++) {
+            if (events_arrived[i]) {
+                stats_record(stats_phase_event_to_screen, events_arrived[i]);
+            }
+        }
+
+        RETHROW(timing_wait(timer));
     }
 
 cleanup:
-    RETHROW_PRINT(free_attach_session(attach_session));
-    RETHROW_PRINT(free_timer(timer));
-    git_repository_free(repo);
-    RETHROW_PRINT(clear_refs(&refs));
-    RETHROW_PRINT(free_layout(layout));
-    ASSERT_NCURSES_PRINT(delwin(win));
-    ASSERT_NCURSES_PRINT(endwin());
+    // stop the workers before tearing down the timer they notify
+    for (size_t i = 0; workers && i < count; i++) {
+        if (workers[i]) {
+            RETHROW_PRINT(free_repo_worker(workers[i]));
+        }
+    }
+    free(workers);
+    free(events_arrived);
+    free(headers);
+    free(bodies);
+    if (timer) {
+        RETHROW_PRINT(free_timer(timer));
+    }
+    if (layout) {
+        RETHROW_PRINT(free_layout(layout));
+    }
+    if (win) {
+        ASSERT_NCURSES_PRINT(delwin(win));
+        ASSERT_NCURSES_PRINT(endwin());
+    }
     flush_stderr_buff();
     deinit_stderr_buff();
     return err;
@@ -1,8 +1,35 @@
 #ifndef GIT_LIVE_DASHBOARD_H
 #define GIT_LIVE_DASHBOARD_H
 
+#include <stdbool.h>
 #include "../lib/err.h"
 
-err_t run_dashboard();
+enum output_format {
+    output_format_screen = 0,
+    // a JSON record per frame that changed something on stdout, see ndjson.h
+    output_format_ndjson,
+};
+
+struct dashboard_options {
+    // show the frame timing stats in the last line
+    bool stats_overlay;
+    // where SIGUSR1 dumps the stats, they are also dumped there on exit. defaults to ~/.cache/git-live/stats/<pid>
+    const char *stats_path;
+    // write a chrome trace event file of the session, NULL to disable
+    const char *trace_path;
+    // run without a terminal and print a line with the timings of every frame instead, for benchmarks
+    bool headless;
+    // compute the snapshots locally even if a daemon serves the repository
+    bool no_daemon;
+    // anything but the screen runs without a terminal
+    enum output_format format;
+    // limit the status (and the watch) to the subtree of the cwd, or of the attached terminal's cwd
+    bool scoped;
+};
+
+err_t run_dashboard(const struct dashboard_options *options);
+
+/* show the status of several repositories stacked on one screen, each one refreshed by its own worker thread. */
+err_t run_multi_dashboard(const char **paths, size_t count);
 
 #endif //GIT_LIVE_DASHBOARD_H
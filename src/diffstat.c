@@ -0,0 +1,408 @@
+#include "diffstat.h"
+#include <fcntl.h>
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "utils.h"
+
+#define DIFFSTAT_CACHE_BUCKETS (1024)
+
+// git looks for a null byte in the first 8000 bytes to decide if a file is binary
+#define BINARY_CHECK_LEN (8000)
+
+enum entry_kind {
+    entry_kind_blobs = 0,
+    entry_kind_workdir,
+};
+
+struct file_stat {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t ino;
+};
+
+struct diffstat_entry {
+    struct diffstat_entry *next;
+    enum entry_kind kind;
+    git_oid old_id;
+    git_oid new_id;
+    char *path;
+    struct file_stat file_stat;
+    uint64_t generation;
+    struct diffstat diffstat;
+};
+
+struct diffstat_cache {
+    struct diffstat_entry *buckets[DIFFSTAT_CACHE_BUCKETS];
+    uint64_t generation;
+    uint64_t max_file_size;
+};
+
+static size_t get_bucket(enum entry_kind kind, const git_oid *old_id, const git_oid *new_id, const char *path) {
+    uint64_t hash = HASH_INIT;
+    hash = hash_bytes(hash, &kind, sizeof(kind));
+    hash = hash_bytes(hash, old_id->id, sizeof(old_id->id));
+    if (new_id) {
+        hash = hash_bytes(hash, new_id->id, sizeof(new_id->id));
+    }
+    if (path) {
+        hash = hash_bytes(hash, path, strlen(path));
+    }
+    return hash % DIFFSTAT_CACHE_BUCKETS;
+}
+
+static struct diffstat_entry *find_entry(struct diffstat_cache *cache, size_t bucket, enum entry_kind kind,
+                                         const git_oid *old_id, const git_oid *new_id, const char *path,
+                                         const struct file_stat *file_stat) {
+    struct diffstat_entry *curr = cache->buckets[bucket];
+    for (; curr; curr = curr->next) {
+        if (curr->kind != kind || !git_oid_equal(&curr->old_id, old_id))
+            continue;
+        if (kind == entry_kind_blobs && git_oid_equal(&curr->new_id, new_id))
+            return curr;
+        if (kind == entry_kind_workdir && !strcmp(curr->path, path) &&
+            !memcmp(&curr->file_stat, file_stat, sizeof(*file_stat)))
+            return curr;
+    }
+    return NULL;
+}
+
+static err_t insert_entry(struct diffstat_cache *cache, size_t bucket, enum entry_kind kind, const git_oid *old_id,
+                          const git_oid *new_id, const char *path, const struct file_stat *file_stat,
+                          const struct diffstat *diffstat) {
+    err_t err = NO_ERROR;
+    struct diffstat_entry *entry = NULL;
+
+    entry = calloc(1, sizeof(*entry));
+    ASSERT(entry);
+
+    entry->kind = kind;
+    git_oid_cpy(&entry->old_id, old_id);
+    if (new_id) {
+        git_oid_cpy(&entry->new_id, new_id);
+    }
+    if (path) {
+        entry->path = strdup(path);
+        ASSERT(entry->path);
+    }
+    if (file_stat) {
+        entry->file_stat = *file_stat;
+    }
+    entry->generation = cache->generation;
+    entry->diffstat = *diffstat;
+
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    entry = NULL;
+
+cleanup:
+    free(entry);
+    return err;
+}
+
+static void free_entry(struct diffstat_entry *entry) {
+    free(entry->path);
+    free(entry);
+}
+
+/* found is false when id is not a blob in this repository, like the commit a submodule entry points to. */
+static err_t get_blob_size(git_repository *repo, const git_oid *id, size_t *size, bool *found) {
+    err_t err = NO_ERROR;
+    git_odb *odb = NULL;
+    git_object_t type;
+
+    *size = 0;
+    *found = true;
+    if (git_oid_is_zero(id))
+        goto cleanup;
+
+    // only reads the object header, so huge blobs are not inflated just to learn they are too big
+    ASSERT(!git_repository_odb(&odb, repo));
+    *found = !git_odb_read_header(size, &type, odb, id) && type == GIT_OBJECT_BLOB;
+
+cleanup:
+    git_odb_free(odb);
+    return err;
+}
+
+static err_t lookup_blob(git_repository *repo, const git_oid *id, git_blob **out) {
+    err_t err = NO_ERROR;
+
+    *out = NULL;
+    if (git_oid_is_zero(id))
+        goto cleanup;
+
+    ASSERT(!git_blob_lookup(out, repo, id));
+
+cleanup:
+    return err;
+}
+
+static err_t get_patch_stats(git_patch *patch, struct diffstat *out) {
+    err_t err = NO_ERROR;
+    size_t context = 0;
+
+    ASSERT(!git_patch_line_stats(&context, &out->additions, &out->deletions, patch));
+
+cleanup:
+    return err;
+}
+
+static err_t compute_blobs_diffstat(git_repository *repo, uint64_t max_file_size, const git_oid *old_id,
+                                    const git_oid *new_id, struct diffstat *out) {
+    err_t err = NO_ERROR;
+    git_blob *old_blob = NULL;
+    git_blob *new_blob = NULL;
+    git_patch *patch = NULL;
+    size_t old_size = 0;
+    size_t new_size = 0;
+    bool old_found = false;
+    bool new_found = false;
+
+    *out = (struct diffstat){0};
+
+    RETHROW(get_blob_size(repo, old_id, &old_size, &old_found));
+    RETHROW(get_blob_size(repo, new_id, &new_size, &new_found));
+    if (!old_found || !new_found || old_size > max_file_size || new_size > max_file_size) {
+        out->skipped = true;
+        goto cleanup;
+    }
+
+    RETHROW(lookup_blob(repo, old_id, &old_blob));
+    RETHROW(lookup_blob(repo, new_id, &new_blob));
+    if ((old_blob && git_blob_is_binary(old_blob)) || (new_blob && git_blob_is_binary(new_blob))) {
+        out->binary = true;
+        goto cleanup;
+    }
+
+    ASSERT(!git_patch_from_blobs(&patch, old_blob, NULL, new_blob, NULL, NULL));
+    RETHROW(get_patch_stats(patch, out));
+
+cleanup:
+    git_patch_free(patch);
+    git_blob_free(old_blob);
+    git_blob_free(new_blob);
+    return err;
+}
+
+static err_t read_file(const char *path, size_t size, char **out) {
+    err_t err = NO_ERROR;
+    int fd = FD_INVALID;
+    size_t total = 0;
+    ssize_t res = 0;
+
+    *out = malloc(size + 1);
+    ASSERT(*out);
+
+    fd = open(path, O_RDONLY);
+    ASSERT(fd != FD_INVALID);
+
+    while (total < size && (res = read(fd, *out + total, size - total)) > 0) {
+        total += res;
+    }
+    ASSERT(res >= 0);
+    // the file may have been truncated while we read it, the next frame will see new stat data and re-diff it
+    (*out)[total] = '\0';
+
+cleanup:
+    RETHROW_PRINT(safe_close_fd(&fd));
+    if (err) {
+        free(*out);
+        *out = NULL;
+    }
+    return err;
+}
+
+static err_t compute_workdir_diffstat(git_repository *repo, uint64_t max_file_size, const git_oid *old_id,
+                                      const char *abs_path, const struct stat *st, bool exists,
+                                      struct diffstat *out) {
+    err_t err = NO_ERROR;
+    git_blob *old_blob = NULL;
+    git_patch *patch = NULL;
+    char *buff = NULL;
+    size_t old_size = 0;
+    size_t size = exists ? st->st_size : 0;
+    bool old_found = false;
+
+    *out = (struct diffstat){0};
+
+    RETHROW(get_blob_size(repo, old_id, &old_size, &old_found));
+    if (!old_found || old_size > max_file_size || size > max_file_size) {
+        out->skipped = true;
+        goto cleanup;
+    }
+
+    if (exists) {
+        RETHROW(read_file(abs_path, size, &buff));
+        if (memchr(buff, '\0', MIN(size, BINARY_CHECK_LEN))) {
+            out->binary = true;
+            goto cleanup;
+        }
+    }
+
+    RETHROW(lookup_blob(repo, old_id, &old_blob));
+    if (old_blob && git_blob_is_binary(old_blob)) {
+        out->binary = true;
+        goto cleanup;
+    }
+
+    ASSERT(!git_patch_from_blob_and_buffer(&patch, old_blob, NULL, buff, buff ? size : 0, NULL, NULL));
+    RETHROW(get_patch_stats(patch, out));
+
+cleanup:
+    git_patch_free(patch);
+    git_blob_free(old_blob);
+    free(buff);
+    return err;
+}
+
+err_t init_diffstat_cache(struct diffstat_cache **cache, uint64_t max_file_size) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+
+    *cache = calloc(1, sizeof(**cache));
+    ASSERT(*cache);
+
+    (*cache)->max_file_size = max_file_size;
+
+cleanup:
+    return err;
+}
+
+err_t free_diffstat_cache(struct diffstat_cache *cache) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+
+    for (size_t i = 0; i < DIFFSTAT_CACHE_BUCKETS; i++) {
+        struct diffstat_entry *curr = cache->buckets[i];
+        while (curr) {
+            struct diffstat_entry *next = curr->next;
+            free_entry(curr);
+            curr = next;
+        }
+    }
+    free(cache);
+
+cleanup:
+    return err;
+}
+
+err_t diffstat_blobs(struct diffstat_cache *cache, git_repository *repo, const git_oid *old_id,
+                     const git_oid *new_id, struct diffstat *out) {
+    err_t err = NO_ERROR;
+    struct diffstat_entry *entry = NULL;
+    size_t bucket = 0;
+
+    ASSERT(cache);
+    ASSERT(repo);
+    ASSERT(old_id);
+    ASSERT(new_id);
+    ASSERT(out);
+
+    bucket = get_bucket(entry_kind_blobs, old_id, new_id, NULL);
+    entry = find_entry(cache, bucket, entry_kind_blobs, old_id, new_id, NULL, NULL);
+    if (entry) {
+        entry->generation = cache->generation;
+        *out = entry->diffstat;
+        goto cleanup;
+    }
+
+    RETHROW(compute_blobs_diffstat(repo, cache->max_file_size, old_id, new_id, out));
+    RETHROW(insert_entry(cache, bucket, entry_kind_blobs, old_id, new_id, NULL, NULL, out));
+
+cleanup:
+    return err;
+}
+
+err_t diffstat_workdir(struct diffstat_cache *cache, git_repository *repo, const git_oid *old_id, const char *workdir,
+                       const char *path, struct diffstat *out) {
+    err_t err = NO_ERROR;
+    char abs_path[PATH_MAX] = {0};
+    struct stat st = {0};
+    struct file_stat file_stat = {0};
+    struct diffstat_entry *entry = NULL;
+    bool exists = false;
+    size_t bucket = 0;
+
+    ASSERT(cache);
+    ASSERT(repo);
+    ASSERT(old_id);
+    ASSERT(workdir);
+    ASSERT(path);
+    ASSERT(out);
+
+    RETHROW(join_paths(workdir, path, abs_path, sizeof(abs_path)));
+
+    // a deleted file keeps the zeroed stat data, that is enough to tell it apart from any existing version
+    exists = !lstat(abs_path, &st);
+    if (exists) {
+        file_stat = (struct file_stat){
+            .mtime_sec = st.st_mtim.tv_sec,
+            .mtime_nsec = st.st_mtim.tv_nsec,
+            .size = st.st_size,
+            .ino = st.st_ino,
+        };
+        // untracked directories and symlinks have no meaningful line count
+        if (!S_ISREG(st.st_mode)) {
+            *out = (struct diffstat){.skipped = true};
+            goto cleanup;
+        }
+    }
+
+    bucket = get_bucket(entry_kind_workdir, old_id, NULL, path);
+    entry = find_entry(cache, bucket, entry_kind_workdir, old_id, NULL, path, &file_stat);
+    if (entry) {
+        entry->generation = cache->generation;
+        *out = entry->diffstat;
+        goto cleanup;
+    }
+
+    RETHROW(compute_workdir_diffstat(repo, cache->max_file_size, old_id, abs_path, &st, exists, out));
+    RETHROW(insert_entry(cache, bucket, entry_kind_workdir, old_id, NULL, path, &file_stat, out));
+
+cleanup:
+    return err;
+}
+
+err_t diffstat_end_frame(struct diffstat_cache *cache) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+
+    for (size_t i = 0; i < DIFFSTAT_CACHE_BUCKETS; i++) {
+        struct diffstat_entry **curr = &cache->buckets[i];
+        while (*curr) {
+            struct diffstat_entry *entry = *curr;
+            if (entry->generation != cache->generation) {
+                *curr = entry->next;
+                free_entry(entry);
+            } else {
+                curr = &entry->next;
+            }
+        }
+    }
+    cache->generation++;
+
+cleanup:
+    return err;
+}
+
+void format_diffstat(const struct diffstat *diffstat, char *buff, size_t len) {
+    if (diffstat->skipped) {
+        buff[0] = '\0';
+    } else if (diffstat->binary) {
+        snprintf(buff, len, " (binary)");
+    } else {
+        snprintf(buff, len, " (+%zu -%zu)", diffstat->additions, diffstat->deletions);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef GIT_LIVE_DIFFSTAT_H
+#define GIT_LIVE_DIFFSTAT_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * This module counts the added/removed lines of changed files.
+ * Diffs between two blobs are memoized by the (old blob, new blob) pair, diffs against the work tree are memoized by
+ * the file's stat data (path, mtime, size, inode) so only files that actually changed since the last frame are
+ * re-diffed. Entries that were not used during a frame are dropped at its end so the cache only holds the current
+ * change set.
+ */
+
+#define DIFFSTAT_TEXT_LEN (48)
+
+struct diffstat {
+    size_t additions;
+    size_t deletions;
+    bool binary;
+    // the file is larger than the size threshold, or not a file (a submodule), and was not diffed
+    bool skipped;
+};
+
+struct diffstat_cache;
+
+err_t init_diffstat_cache(struct diffstat_cache **cache, uint64_t max_file_size);
+err_t free_diffstat_cache(struct diffstat_cache *cache);
+
+/* diff two blobs, a zero oid stands for a missing side (an added or deleted file). */
+err_t diffstat_blobs(struct diffstat_cache *cache, git_repository *repo, const git_oid *old_id,
+                     const git_oid *new_id, struct diffstat *out);
+
+/* diff a blob against the file at path (relative to workdir), a zero oid stands for an untracked file. */
+err_t diffstat_workdir(struct diffstat_cache *cache, git_repository *repo, const git_oid *old_id, const char *workdir,
+                       const char *path, struct diffstat *out);
+
+/* drop every entry that was not used since the previous call. */
+err_t diffstat_end_frame(struct diffstat_cache *cache);
+
+void format_diffstat(const struct diffstat *diffstat, char *buff, size_t len);
+
+#endif // GIT_LIVE_DIFFSTAT_H
@@ -0,0 +1,848 @@
+#include "engine.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+#include <time.h>
+#include "../lib/err.h"
+#include "ahead_behind.h"
+#include "config.h"
+#include "diffstat.h"
+#include "operation.h"
+#include "prompt.h"
+#include "repo_cache.h"
+#include "snapshot.h"
+#include "staged_scan.h"
+#include "stats.h"
+#include "status_cache.h"
+#include "submodules.h"
+#include "trace.h"
+#include "untracked.h"
+#include "utils.h"
+#include "worktree_scan.h"
+
+#define REFLOG_CO_PREFIX ("checkout:")
+
+#define TRACKING_MAX_LEN (100)
+
+#define COMMIT_ROW_BUFF_LEN (GIT_OID_HEXSZ + 1)
+
+#define GIT_RETRY_COUNT (10)
+// the wait before the first retry, doubled for every one after it
+#define GIT_RETRY_BACKOFF_MS (1)
+
+// how often the changes outside a scoped status are recounted, counting them stats every tracked file
+#define OUTSIDE_RECOUNT_US (60 * 1000 * 1000)
+
+struct ref {
+    char *name;
+    size_t index;
+    LIST_ENTRY(ref) entry;
+};
+
+LIST_HEAD(refs, ref);
+
+struct base_branch {
+    const char *name;
+    git_oid oid;
+    bool found;
+};
+
+bool is_checkout_reflog(const git_reflog_entry *entry) {
+    const char *message = git_reflog_entry_message(entry);
+    return !strncmp(message, REFLOG_CO_PREFIX, strlen(REFLOG_CO_PREFIX));
+}
+
+const char *get_checkout_reflog_target(const git_reflog_entry *entry) {
+    const char *message = git_reflog_entry_message(entry);
+    return strrchr(message, ' ') + 1;
+}
+
+struct ref *create_ref(const char *target, size_t index) {
+    struct ref *ref = malloc(sizeof(struct ref));
+    ref->index = index;
+    ref->name = malloc(strlen(target) + 1);
+    strcpy(ref->name, target);
+    stats_count_alloc(stats_allocator_refs, sizeof(struct ref) + strlen(target) + 1);
+    return ref;
+}
+
+err_t free_ref(struct ref *ref) {
+    err_t err = NO_ERROR;
+
+    ASSERT(ref);
+
+    stats_count_free(stats_allocator_refs, sizeof(struct ref) + strlen(ref->name) + 1);
+    free(ref->name);
+    free(ref);
+
+cleanup:
+    return err;
+}
+
+bool refs_append_unique(struct refs *list, struct ref *ref) {
+    struct ref *curr = LIST_FIRST(list);
+    struct ref *last = curr;
+
+    LIST_FOREACH(curr, list, entry) {
+        if (strcmp(curr->name, ref->name) == 0)
+            return false;
+        last = curr;
+    }
+
+    if (last == NULL) {
+        LIST_INSERT_HEAD(list, ref, entry);
+    } else {
+        LIST_INSERT_AFTER(last, ref, entry);
+    }
+    return true;
+}
+
+err_t get_latest_refs(struct refs *out, git_repository *repo, size_t max) {
+    err_t err = NO_ERROR;
+    git_reflog *reflog;
+    size_t collected = 0;
+
+    ASSERT(out);
+    ASSERT(repo);
+
+    git_reflog_read(&reflog, repo, "HEAD");
+    size_t count = git_reflog_entrycount(reflog);
+
+    for (size_t index = 0; index < count && collected < max; index++) {
+        const git_reflog_entry *entry = git_reflog_entry_byindex(reflog, index);
+
+        if (!is_checkout_reflog(entry))
+            continue;
+
+        const char *target = get_checkout_reflog_target(entry);
+        struct ref *ref = create_ref(target, index);
+
+        if (!refs_append_unique(out, ref)) {
+            RETHROW(free_ref(ref));
+            continue;
+        }
+
+        collected++;
+    }
+
+cleanup:
+    git_reflog_free(reflog);
+    return err;
+}
+
+err_t clear_refs(struct refs *refs) {
+    err_t err = NO_ERROR;
+
+    ASSERT(refs);
+
+    struct ref *first;
+    while ((first = LIST_FIRST(refs)) != NULL) {
+        LIST_REMOVE(first, entry);
+        RETHROW(free_ref(first));
+    }
+cleanup:
+    return err;
+}
+
+static err_t get_base_branch(git_repository *repo, const char *name, struct base_branch *out) {
+    err_t err = NO_ERROR;
+    git_reference *ref = NULL;
+
+    ASSERT(repo);
+    ASSERT(name);
+    ASSERT(out);
+
+    out->name = name;
+    out->found = false;
+
+    if (!strlen(name) || git_reference_dwim(&ref, repo, name) || !git_reference_target(ref))
+        goto cleanup;
+
+    git_oid_cpy(&out->oid, git_reference_target(ref));
+    out->found = true;
+
+cleanup:
+    git_reference_free(ref);
+    return err;
+}
+
+/*
+ * Format the ahead/behind counts of a local branch against its upstream and the base branch, counts that are still
+ * being computed are shown as "?". The counts against the upstream are also set in prompt, if given.
+ */
+static err_t get_tracking_text(struct ahead_behind_engine *engine, git_reference *branch,
+                               const struct base_branch *base, char *buff, size_t len, struct prompt_status *prompt) {
+    err_t err = NO_ERROR;
+    git_reference *upstream = NULL;
+    char counts[AHEAD_BEHIND_TEXT_LEN] = {0};
+    struct ahead_behind ahead_behind;
+    bool ready = false;
+    int written = 0;
+
+    ASSERT(engine);
+    ASSERT(branch);
+    ASSERT(base);
+    ASSERT(buff);
+    ASSERT(len > 0);
+
+    buff[0] = '\0';
+    if (!git_reference_target(branch))
+        goto cleanup;
+
+    if (!git_branch_upstream(&upstream, branch) && git_reference_target(upstream)) {
+        RETHROW(ahead_behind_lookup(engine, git_reference_target(branch), git_reference_target(upstream),
+                                    &ahead_behind, &ready));
+        format_ahead_behind(&ahead_behind, ready, counts, sizeof(counts));
+        written = snprintf(buff, len, "%s %s", git_reference_shorthand(upstream), counts);
+        if (prompt) {
+            prompt->has_upstream = true;
+            prompt->counting = !ready;
+            if (ready) {
+                prompt->ahead = ahead_behind.ahead;
+                prompt->behind = ahead_behind.behind;
+                prompt->truncated = ahead_behind.truncated;
+            }
+        }
+    }
+
+    // no need to show the base branch again if it is the branch itself or its upstream
+    if (base->found && (size_t)written < len && strcmp(git_reference_shorthand(branch), base->name) &&
+        (!upstream || strcmp(git_reference_shorthand(upstream), base->name))) {
+        RETHROW(ahead_behind_lookup(engine, git_reference_target(branch), &base->oid, &ahead_behind, &ready));
+        format_ahead_behind(&ahead_behind, ready, counts, sizeof(counts));
+        snprintf(buff + written, len - written, "%s%s %s", written ? "  " : "", base->name, counts);
+    }
+
+cleanup:
+    git_reference_free(upstream);
+    return err;
+}
+
+static err_t collect_refs(struct snapshot *snapshot, struct refs *refs, git_repository *repo,
+                          struct ahead_behind_engine *engine, const struct base_branch *base) {
+    err_t err = NO_ERROR;
+    struct ref *curr;
+    struct ref_row *row = NULL;
+    char buff[TRACKING_MAX_LEN];
+    git_reference *branch = NULL;
+
+    ASSERT(snapshot);
+    ASSERT(refs);
+    ASSERT(repo);
+    ASSERT(engine);
+    ASSERT(base);
+
+    LIST_FOREACH(curr, refs, entry) {
+        // the latest checkout is the current HEAD, it is already shown in the header
+        if (curr->index == 0)
+            continue;
+
+        RETHROW(snapshot_add_ref_row(snapshot, &row));
+        row->index = curr->index;
+        RETHROW(snapshot_add_string(snapshot, curr->name, &row->name));
+
+        // reflog targets can also be detached commits, those have nothing to be compared against
+        if (!git_branch_lookup(&branch, repo, curr->name, GIT_BRANCH_LOCAL)) {
+            RETHROW(get_tracking_text(engine, branch, base, buff, sizeof(buff), NULL));
+            RETHROW(snapshot_add_string(snapshot, buff, &row->tracking));
+            git_reference_free(branch);
+            branch = NULL;
+        }
+    }
+
+cleanup:
+    git_reference_free(branch);
+    return err;
+}
+
+static err_t collect_latest_commits(struct snapshot *snapshot, git_repository *repo, size_t max,
+                                    uint32_t abbrev_len) {
+    err_t err = NO_ERROR;
+    git_revwalk *walker = NULL;
+    git_commit *commit;
+    struct commit_row *row = NULL;
+    char row_buff[COMMIT_ROW_BUFF_LEN];
+    const char *summary;
+    git_oid next;
+
+    ASSERT(snapshot);
+    ASSERT(repo);
+    ASSERT(abbrev_len < sizeof(row_buff));
+
+    if (!max)
+        goto cleanup;
+
+    ASSERT(!git_revwalk_new(&walker, repo));
+    git_revwalk_push_ref(walker, "HEAD");
+
+    while (snapshot->commit_rows.count < max && git_revwalk_next(&next, walker) != GIT_ITEROVER) {
+        if (git_commit_lookup(&commit, repo, &next))
+            continue;
+
+        RETHROW(snapshot_add_commit_row(snapshot, &row));
+
+        // git_oid_tostr null terminates, so it needs room for one more char than the abbreviation
+        git_oid_tostr(row_buff, abbrev_len + 1, &next);
+        RETHROW(snapshot_add_string(snapshot, row_buff, &row->hash));
+
+        // the summary is parsed once and cached on the commit object, no need to copy the whole message
+        summary = git_commit_summary(commit);
+        RETHROW(snapshot_add_string(snapshot, summary ? summary : "", &row->summary));
+
+        RETHROW(snapshot_add_string(snapshot, git_commit_committer(commit)->name, &row->author));
+        row->time = git_commit_time(commit);
+
+        git_commit_free(commit);
+    }
+
+cleanup:
+    git_revwalk_free(walker);
+    return err;
+}
+
+static err_t collect_head(struct snapshot *snapshot, git_repository *repo, struct ahead_behind_engine *engine,
+                          const struct base_branch *base, uint32_t abbrev_len, struct prompt_status *prompt) {
+    err_t err = NO_ERROR;
+    git_reference *head = NULL;
+    char tracking[TRACKING_MAX_LEN] = {0};
+
+    err = git_repository_head(&head, repo);
+    ASSERT(err != GIT_EUNBORNBRANCH && err != GIT_ENOTFOUND);
+
+    RETHROW(snapshot_add_string(snapshot, git_reference_shorthand(head), &snapshot->head_name));
+    if (!git_repository_head_detached(repo)) {
+        RETHROW(get_tracking_text(engine, head, base, tracking, sizeof(tracking), prompt));
+        RETHROW(snapshot_add_string(snapshot, tracking, &snapshot->head_tracking));
+        strncpy(prompt->branch, git_reference_shorthand(head), sizeof(prompt->branch) - 1);
+    } else {
+        prompt->detached = true;
+        git_oid_tostr(prompt->branch, MIN(abbrev_len + 1, sizeof(prompt->branch)), git_reference_target(head));
+    }
+
+cleanup:
+    git_reference_free(head);
+    return err;
+}
+
+static err_t format_path(const char *path, const char *git_dir, const char *attached_dir, char *out_buff,
+                         unsigned long out_len) {
+    err_t err = NO_ERROR;
+    bool is_relative = false;
+    char abs_path[PATH_MAX] = {0};
+
+    ASSERT(path);
+    ASSERT(git_dir);
+    ASSERT(attached_dir);
+    ASSERT(out_buff);
+    ASSERT(out_len > 1);
+
+    RETHROW(is_relative_to(git_dir, attached_dir, &is_relative));
+    if (is_relative) {
+        strncpy(out_buff, path, out_len);
+        goto cleanup;
+    }
+
+    RETHROW(join_paths(git_dir, path, abs_path, sizeof(abs_path)));
+    RETHROW(relative_to(abs_path, attached_dir, out_buff, out_len));
+
+cleanup:
+    return err;
+}
+
+static const char *get_status_name(const git_status_entry *entry) {
+    if (entry->status & GIT_STATUS_CONFLICTED) {
+        return "conflicted";
+    } else if (entry->status & (GIT_STATUS_INDEX_NEW | GIT_STATUS_WT_NEW)) {
+        return "new";
+    } else if (entry->status & (GIT_STATUS_INDEX_RENAMED | GIT_STATUS_WT_RENAMED)) {
+        return "renamed";
+    } else if (entry->status & (GIT_STATUS_INDEX_MODIFIED | GIT_STATUS_WT_MODIFIED)) {
+        return "modified";
+    } else if (entry->status & (GIT_STATUS_INDEX_DELETED | GIT_STATUS_WT_DELETED)) {
+        return "deleted";
+    } else if (entry->status & (GIT_STATUS_INDEX_TYPECHANGE | GIT_STATUS_WT_TYPECHANGE)) {
+        return "typechange";
+    }
+    return "";
+}
+
+/* the paths are kept relative to the work tree, they are formatted for the attached directory when copied out. */
+static err_t fill_status_row(struct snapshot *rows, const git_status_entry *entry, const git_diff_delta *delta,
+                             struct status_row *row) {
+    err_t err = NO_ERROR;
+
+    RETHROW(snapshot_add_string(rows, get_status_name(entry), &row->status));
+    RETHROW(snapshot_add_string(rows, delta->new_file.path, &row->path));
+
+    row->old_path = row->path;
+    if (strcmp(delta->new_file.path, delta->old_file.path) != 0) {
+        RETHROW(snapshot_add_string(rows, delta->old_file.path, &row->old_path));
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t copy_status_rows(struct snapshot *snapshot, const struct snapshot *rows, const char *workdir,
+                              const char *attached_dir, struct untracked_cache *untracked) {
+    err_t err = NO_ERROR;
+    char filename[PATH_MAX] = {0};
+    struct status_row *row = NULL;
+    const char *path = NULL;
+    bool ready = false;
+
+    for (size_t i = 0; i < rows->status_rows.count; i++) {
+        const struct status_row *cached = &rows->status_rows.items[i];
+
+        RETHROW(snapshot_add_status_row(snapshot, &row));
+        row->section = cached->section;
+        row->diffstat = cached->diffstat;
+        RETHROW(snapshot_add_string(snapshot, snapshot_str(rows, cached->status), &row->status));
+
+        RETHROW(format_path(snapshot_str(rows, cached->path), workdir, attached_dir, filename, sizeof(filename) - 1));
+        RETHROW(snapshot_add_string(snapshot, filename, &row->path));
+
+        row->old_path = row->path;
+        if (cached->old_path != cached->path) {
+            RETHROW(format_path(snapshot_str(rows, cached->old_path), workdir, attached_dir, filename,
+                                sizeof(filename) - 1));
+            RETHROW(snapshot_add_string(snapshot, filename, &row->old_path));
+        }
+
+        // the counts are not part of the cached rows, they become ready on their own
+        path = snapshot_str(rows, cached->path);
+        if (cached->section == status_section_untracked && path[strlen(path) - 1] == '/') {
+            RETHROW(untracked_cache_count(untracked, path, &row->files, &ready, &row->count_failed));
+            row->counting = !ready;
+        }
+    }
+    memcpy(snapshot->status_counts, rows->status_counts, sizeof(snapshot->status_counts));
+
+cleanup:
+    return err;
+}
+
+err_t safe_git_status_list_new(git_status_list **status_list, git_repository *repo, git_status_options *opts) {
+    err_t err = NO_ERROR;
+    uint32_t retries = 0;
+    uint64_t backoff_ms = GIT_RETRY_BACKOFF_MS;
+    int inner_err = 0;
+
+    ASSERT(status_list);
+    ASSERT(repo);
+    ASSERT(opts);
+
+    while (retries++ < GIT_RETRY_COUNT) {
+        inner_err = git_status_list_new(status_list, repo, opts);
+        if (!inner_err)
+            goto cleanup;
+        // usually someone else holding index.lock
+        trace_instant("status retry", "git", git_error_last() ? git_error_last()->message : NULL);
+        // retrying right away only races the lock holder again
+        nanosleep(&(struct timespec){.tv_sec = backoff_ms / MSEC_IN_SEC,
+                                     .tv_nsec = backoff_ms % MSEC_IN_SEC * NSEC_IN_MSEC},
+                  NULL);
+        backoff_ms *= 2;
+    }
+    ABORT();
+
+cleanup:
+    return err;
+}
+
+static err_t collect_status_section(struct snapshot *rows, const char *workdir, git_repository *repo,
+                                    struct diffstat_cache *diffstat_cache, enum status_section section,
+                                    git_status_options *opts, size_t max_rows) {
+    err_t err = NO_ERROR;
+    git_status_list *status_list = NULL;
+    struct status_row *row = NULL;
+    uint64_t started = 0;
+    static const enum stats_phase status_phases[STATUS_SECTIONS_COUNT] = {
+        stats_phase_status_staged, stats_phase_status_changed, stats_phase_status_untracked};
+
+    started = stats_now_us();
+    RETHROW(safe_git_status_list_new(&status_list, repo, opts));
+    stats_record(status_phases[section], started);
+
+    for (size_t i = 0; i < git_status_list_entrycount(status_list); i++) {
+        const git_status_entry *entry = git_status_byindex(status_list, i);
+        const git_diff_delta *delta = entry->index_to_workdir ? entry->index_to_workdir : entry->head_to_index;
+
+        if (!delta)
+            continue;
+
+        // the counts are exact, but only the rows that can be shown are built (and diffed), so a flood of changes
+        // costs a counter rather than a row, a diffstat and a layout node each
+        if (++rows->status_counts[section] > max_rows)
+            continue;
+
+        RETHROW(snapshot_add_status_row(rows, &row));
+        row->section = section;
+        RETHROW(fill_status_row(rows, entry, delta, row));
+
+        if (delta->old_file.mode == GIT_FILEMODE_COMMIT || delta->new_file.mode == GIT_FILEMODE_COMMIT) {
+            row->diffstat.skipped = true;
+        } else if (section == status_section_staged) {
+            RETHROW(diffstat_blobs(diffstat_cache, repo, &delta->old_file.id, &delta->new_file.id, &row->diffstat));
+        } else {
+            RETHROW(diffstat_workdir(diffstat_cache, repo, &delta->old_file.id, workdir, delta->new_file.path,
+                                     &row->diffstat));
+        }
+    }
+
+cleanup:
+    git_status_list_free(status_list);
+    return err;
+}
+
+/* the staged files come from our own diff of HEAD and the index, git status only for what that diff leaves to it. */
+static err_t collect_staged_section(struct snapshot *rows, const char *workdir, git_repository *repo,
+                                    struct diffstat_cache *diffstat_cache, struct staged_scanner *staged,
+                                    git_status_options *opts, const char *scope, size_t max_rows) {
+    err_t err = NO_ERROR;
+    const struct staged_change *changes = NULL;
+    size_t count = 0;
+    struct status_row *row = NULL;
+    bool supported = false;
+    uint64_t started = 0;
+
+    started = stats_now_us();
+    RETHROW(staged_scan(staged, scope, &changes, &count, &supported));
+    if (!supported) {
+        RETHROW(collect_status_section(rows, workdir, repo, diffstat_cache, status_section_staged, opts, max_rows));
+        goto cleanup;
+    }
+    stats_record(stats_phase_status_staged, started);
+
+    rows->status_counts[status_section_staged] = count;
+    for (size_t i = 0; i < MIN(count, max_rows); i++) {
+        RETHROW(snapshot_add_status_row(rows, &row));
+        row->section = status_section_staged;
+        RETHROW(snapshot_add_string(rows, changes[i].status, &row->status));
+        RETHROW(snapshot_add_string(rows, changes[i].path, &row->path));
+        row->old_path = row->path;
+        // a submodule's ids are commits in its own repository, there are no lines to count
+        if (changes[i].old_mode == GIT_FILEMODE_COMMIT || changes[i].new_mode == GIT_FILEMODE_COMMIT) {
+            row->diffstat.skipped = true;
+        } else {
+            RETHROW(diffstat_blobs(diffstat_cache, repo, &changes[i].old_id, &changes[i].new_id, &row->diffstat));
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/* the changed files come from our own stat scan of the index, git status only when the index can't be read. */
+static err_t collect_changed_section(struct snapshot *rows, const char *workdir, git_repository *repo,
+                                     struct diffstat_cache *diffstat_cache, struct worktree_scanner *worktree,
+                                     git_status_options *opts, const char *scope, size_t max_rows) {
+    err_t err = NO_ERROR;
+    const struct worktree_change *changes = NULL;
+    size_t count = 0;
+    struct status_row *row = NULL;
+    bool supported = false;
+    uint64_t started = 0;
+
+    started = stats_now_us();
+    RETHROW(worktree_scan(worktree, scope, opts->flags & GIT_STATUS_OPT_EXCLUDE_SUBMODULES, &changes, &count,
+                          &supported));
+    if (!supported) {
+        RETHROW(collect_status_section(rows, workdir, repo, diffstat_cache, status_section_changed, opts, max_rows));
+        goto cleanup;
+    }
+    stats_record(stats_phase_status_changed, started);
+
+    rows->status_counts[status_section_changed] = count;
+    for (size_t i = 0; i < MIN(count, max_rows); i++) {
+        RETHROW(snapshot_add_status_row(rows, &row));
+        row->section = status_section_changed;
+        RETHROW(snapshot_add_string(rows, changes[i].status, &row->status));
+        RETHROW(snapshot_add_string(rows, changes[i].path, &row->path));
+        row->old_path = row->path;
+        if (changes[i].mode == GIT_FILEMODE_COMMIT) {
+            row->diffstat.skipped = true;
+        } else {
+            RETHROW(diffstat_workdir(diffstat_cache, repo, &changes[i].id, workdir, changes[i].path, &row->diffstat));
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/* the untracked paths come from our own walk rather than git status, it keeps the ignore decisions between frames. */
+static err_t collect_untracked_section(struct snapshot *rows, const char *workdir, git_repository *repo,
+                                       struct diffstat_cache *diffstat_cache, struct untracked_cache *untracked,
+                                       const char *scope, size_t max_rows) {
+    err_t err = NO_ERROR;
+    const char *const *paths = NULL;
+    size_t count = 0;
+    struct status_row *row = NULL;
+    git_oid untracked_id = {0};
+    uint64_t started = 0;
+
+    started = stats_now_us();
+    RETHROW(untracked_cache_scan(untracked, scope, &paths, &count));
+    stats_record(stats_phase_status_untracked, started);
+
+    rows->status_counts[status_section_untracked] = count;
+    for (size_t i = 0; i < MIN(count, max_rows); i++) {
+        RETHROW(snapshot_add_status_row(rows, &row));
+        row->section = status_section_untracked;
+        RETHROW(snapshot_add_string(rows, "new", &row->status));
+        RETHROW(snapshot_add_string(rows, paths[i], &row->path));
+        row->old_path = row->path;
+        // directories are skipped by the diffstat, they get a count of their files instead
+        RETHROW(diffstat_workdir(diffstat_cache, repo, &untracked_id, workdir, paths[i], &row->diffstat));
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t collect_status(struct snapshot *snapshot, const char *workdir, const char *attached_dir,
+                            const char *scope, size_t max_rows, bool exclude_submodules, git_repository *repo,
+                            struct diffstat_cache *diffstat_cache, struct status_cache *status_cache,
+                            struct staged_scanner *staged, struct worktree_scanner *worktree,
+                            struct untracked_cache *untracked, bool quiesce) {
+    err_t err = NO_ERROR;
+    char *scope_pattern = (char *)scope;
+    // libgit2 only walks the directories that can match, so a scope costs a scan of its subtree alone
+    git_strarray pathspec = {.strings = &scope_pattern, .count = strlen(scope) ? 1 : 0};
+    git_status_options opts = {.version = GIT_STATUS_OPTIONS_VERSION,
+                               .flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED,
+                               .show = GIT_STATUS_SHOW_INDEX_ONLY,
+                               .pathspec = pathspec};
+    struct snapshot *rows = NULL;
+    bool hit = false;
+    uint64_t started = 0;
+
+    ASSERT(snapshot);
+    ASSERT(scope);
+    ASSERT(repo);
+    ASSERT(diffstat_cache);
+    ASSERT(status_cache);
+    ASSERT(staged);
+    ASSERT(worktree);
+    ASSERT(untracked);
+
+    // while git rewrites the work tree the last rows are kept as they are, even fingerprinting it would be wasted
+    quiesce = quiesce && status_cache_has_rows(status_cache, scope, max_rows);
+    if (!quiesce) {
+        started = stats_now_us();
+        RETHROW(status_cache_lookup(status_cache, worktree, scope, max_rows, &hit));
+        stats_record(stats_phase_status_cache, started);
+    }
+    trace_instant("status cache", "git", quiesce ? "quiesced" : hit ? "hit" : "miss");
+
+    rows = status_cache_rows(status_cache);
+    if (!hit && !quiesce) {
+        RETHROW(clear_snapshot(rows));
+        RETHROW(collect_staged_section(rows, workdir, repo, diffstat_cache, staged, &opts, scope, max_rows));
+
+        // a submodule's work tree is a whole status of its own, left to the submodule pool when it shows them
+        opts = (git_status_options){.version = GIT_STATUS_OPTIONS_VERSION,
+                                    .flags = exclude_submodules ? GIT_STATUS_OPT_EXCLUDE_SUBMODULES : 0,
+                                    .show = GIT_STATUS_SHOW_WORKDIR_ONLY,
+                                    .pathspec = pathspec};
+        RETHROW(collect_changed_section(rows, workdir, repo, diffstat_cache, worktree, &opts, scope, max_rows));
+        RETHROW(collect_untracked_section(rows, workdir, repo, diffstat_cache, untracked, scope, max_rows));
+
+        // a hit doesn't use the diffstat cache, so it only ends the frames that did
+        RETHROW(diffstat_end_frame(diffstat_cache));
+        RETHROW(status_cache_store(status_cache));
+    }
+
+    RETHROW(copy_status_rows(snapshot, rows, workdir, attached_dir, untracked));
+    RETHROW(snapshot_add_string(snapshot, scope, &snapshot->status_scope));
+
+cleanup:
+    return err;
+}
+
+/* the attached dir relative to the work tree with a trailing slash, empty if it is the work tree or not in it. */
+static err_t get_status_scope(const char *workdir, const char *attached_dir, char *buff, size_t len) {
+    err_t err = NO_ERROR;
+    bool is_inside = false;
+
+    ASSERT(len > 2);
+    memset(buff, '\0', len);
+
+    RETHROW(is_relative_to(attached_dir, workdir, &is_inside));
+    if (!is_inside)
+        goto cleanup;
+
+    // room for the slash and the terminator
+    RETHROW(relative_to(attached_dir, workdir, buff, len - 2));
+    if (!strcmp(buff, ".")) {
+        buff[0] = '\0';
+    } else if (buff[strlen(buff) - 1] != '/') {
+        strcat(buff, "/");
+    }
+
+cleanup:
+    return err;
+}
+
+/* the libgit2 count of count_outside_changes, for an index the scanners can't read. */
+static err_t count_outside_changes_libgit2(git_repository *repo, const char *scope, bool exclude_submodules,
+                                           size_t *out) {
+    err_t err = NO_ERROR;
+    git_status_list *status_list = NULL;
+    // untracked files would mean walking every directory of the work tree
+    git_status_options opts = {.version = GIT_STATUS_OPTIONS_VERSION,
+                               .flags = exclude_submodules ? GIT_STATUS_OPT_EXCLUDE_SUBMODULES : 0,
+                               .show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR};
+
+    *out = 0;
+    RETHROW(safe_git_status_list_new(&status_list, repo, &opts));
+    for (size_t i = 0; i < git_status_list_entrycount(status_list); i++) {
+        const git_status_entry *entry = git_status_byindex(status_list, i);
+        const git_diff_delta *delta = entry->head_to_index ? entry->head_to_index : entry->index_to_workdir;
+
+        if (delta && strncmp(delta->new_file.path, scope, strlen(scope))) {
+            (*out)++;
+        }
+    }
+
+cleanup:
+    git_status_list_free(status_list);
+    return err;
+}
+
+/*
+ * Files with tracked changes outside the scope, a file that is both staged and changed counts once. The unscoped scans
+ * reuse what the scanners remember, so this is the parallel stat pass over the index and a cache tree walk.
+ */
+static err_t count_outside_changes(struct repo_handle *handle, const char *scope, bool exclude_submodules,
+                                   size_t *out) {
+    err_t err = NO_ERROR;
+    const struct staged_change *staged = NULL;
+    const struct worktree_change *changed = NULL;
+    size_t staged_count = 0;
+    size_t changed_count = 0;
+    size_t s = 0;
+    size_t c = 0;
+    size_t scope_len = strlen(scope);
+    bool supported = false;
+
+    *out = 0;
+    RETHROW(staged_scan(handle->staged, "", &staged, &staged_count, &supported));
+    if (supported) {
+        RETHROW(worktree_scan(handle->worktree, "", exclude_submodules, &changed, &changed_count, &supported));
+    }
+    if (!supported) {
+        RETHROW(count_outside_changes_libgit2(handle->repo, scope, exclude_submodules, out));
+        goto cleanup;
+    }
+
+    // both are in path order, so they are merged like two sorted lists
+    while (s < staged_count || c < changed_count) {
+        int cmp = s == staged_count ? 1 : c == changed_count ? -1 : strcmp(staged[s].path, changed[c].path);
+        const char *path = cmp <= 0 ? staged[s].path : changed[c].path;
+
+        if (strncmp(path, scope, scope_len)) {
+            (*out)++;
+        }
+        s += cmp <= 0;
+        c += cmp >= 0;
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t update_outside_changes(struct repo_handle *handle, const char *scope, bool exclude_submodules) {
+    err_t err = NO_ERROR;
+    uint64_t started = stats_now_us();
+
+    if (!strcmp(handle->outside_scope, scope) && started - handle->outside_counted_at < OUTSIDE_RECOUNT_US)
+        goto cleanup;
+
+    RETHROW(count_outside_changes(handle, scope, exclude_submodules, &handle->outside_changes));
+    strncpy(handle->outside_scope, scope, sizeof(handle->outside_scope) - 1);
+    handle->outside_counted_at = started;
+    stats_record(stats_phase_status_outside, started);
+
+cleanup:
+    return err;
+}
+
+err_t compute_snapshot(struct repo_handle *handle, const char *attached_dir, struct engine_limits limits,
+                       struct snapshot *out) {
+    err_t err = NO_ERROR;
+    struct refs refs = LIST_HEAD_INITIALIZER();
+    struct base_branch base = {0};
+    struct prompt_status prompt = {0};
+    char scope[PATH_MAX] = {0};
+    git_repository *repo = NULL;
+    const char *operation = NULL;
+    uint64_t started = 0;
+    // the submodule pool runs when there are submodule rows, the status doesn't compute them again
+    bool exclude_submodules = limits.max_submodules > 0;
+
+    ASSERT(handle);
+    ASSERT(attached_dir);
+    ASSERT(out);
+
+    repo = handle->repo;
+
+    RETHROW(clear_snapshot(out));
+    RETHROW(snapshot_add_string(out, git_repository_workdir(repo), &out->workdir));
+
+    RETHROW(operation_watch_check(handle->operation, &out->operation_running));
+    operation = get_operation_name(git_repository_state(repo));
+    if (operation) {
+        RETHROW(snapshot_add_string(out, operation, &out->operation));
+    }
+
+    if (limits.scope_status) {
+        RETHROW(get_status_scope(git_repository_workdir(repo), attached_dir, scope, sizeof(scope)));
+    }
+    RETHROW(collect_status(out, git_repository_workdir(repo), attached_dir, scope, limits.max_status_rows,
+                           exclude_submodules, repo, handle->diffstat_cache, handle->status_cache, handle->staged,
+                           handle->worktree, handle->untracked, out->operation_running));
+    if (strlen(scope)) {
+        if (!out->operation_running) {
+            RETHROW(update_outside_changes(handle, scope, exclude_submodules));
+        }
+        out->outside_changes = handle->outside_changes;
+    }
+
+    RETHROW(submodule_pool_collect(handle->submodules, out, limits.max_submodules));
+
+    RETHROW(get_base_branch(repo, handle->config.base_branch, &base));
+
+    if (limits.max_refs) {
+        started = stats_now_us();
+        RETHROW(get_latest_refs(&refs, repo, limits.max_refs));
+        RETHROW(collect_refs(out, &refs, repo, handle->ahead_behind, &base));
+        stats_record(stats_phase_refs, started);
+    }
+
+    if (limits.max_commits) {
+        started = stats_now_us();
+        RETHROW(collect_latest_commits(out, repo, limits.max_commits, handle->config.abbrev_len));
+        stats_record(stats_phase_commits, started);
+    }
+
+    RETHROW(collect_head(out, repo, handle->ahead_behind, &base, handle->config.abbrev_len, &prompt));
+
+    // the counts of a scoped status would only be those of the scope
+    if (handle->prompt && !strlen(scope)) {
+        prompt.staged = out->status_counts[status_section_staged];
+        prompt.changed = out->status_counts[status_section_changed];
+        prompt.untracked = out->status_counts[status_section_untracked];
+        prompt.operation = git_repository_state(repo);
+        RETHROW(prompt_publish(handle->prompt, &prompt));
+    }
+
+cleanup:
+    RETHROW_PRINT(clear_refs(&refs));
+    return err;
+}
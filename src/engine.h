@@ -0,0 +1,32 @@
+#ifndef GIT_LIVE_ENGINE_H
+#define GIT_LIVE_ENGINE_H
+
+#include <git2.h>
+#include <stddef.h>
+#include "../lib/err.h"
+#include "repo_cache.h"
+#include "snapshot.h"
+
+/*
+ * The engine queries a repository for everything the dashboard shows and fills a snapshot with it, it does not touch
+ * the screen so it can run on any thread that owns the repository handle.
+ */
+
+struct engine_limits {
+    // per status section, the rest of the changes are only counted
+    size_t max_status_rows;
+    size_t max_refs;
+    size_t max_commits;
+    size_t max_submodules;
+    // only compute the status of the subtree of the attached dir, with a count of the changes outside it
+    bool scope_status;
+};
+
+/* git_status_list_new, retried with a backoff while someone else holds the index lock. */
+err_t safe_git_status_list_new(git_status_list **status_list, git_repository *repo, git_status_options *opts);
+
+/* paths in the status rows are relative to attached_dir. */
+err_t compute_snapshot(struct repo_handle *handle, const char *attached_dir, struct engine_limits limits,
+                       struct snapshot *out);
+
+#endif // GIT_LIVE_ENGINE_H
@@ -0,0 +1,489 @@
+#include "index_file.h"
+#include <fcntl.h>
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "utils.h"
+
+#define INDEX_SIGNATURE ("DIRC")
+#define INDEX_HEADER_LEN (12)
+#define INDEX_CHECKSUM_LEN (20)
+
+// the stat data, the object id and the flags, the path follows
+#define ENTRY_FIXED_LEN (62)
+
+#define ENTRY_FLAG_EXTENDED (0x4000)
+#define ENTRY_FLAG_STAGE_MASK (0x3000)
+#define ENTRY_FLAG_STAGE_SHIFT (12)
+#define ENTRY_EXTENDED_SKIP_WORKTREE (0x4000)
+#define ENTRY_EXTENDED_INTENT_TO_ADD (0x2000)
+
+#define EXTENSION_HEADER_LEN (8)
+#define SPLIT_INDEX_SIGNATURE ("link")
+#define CACHE_TREE_SIGNATURE ("TREE")
+
+struct index_file {
+    char path[PATH_MAX];
+    // of the file last seen, it is replaced on every write
+    struct stat st;
+    // when the mapped content was written, a rewrite with the same content keeps the old mapping (and this)
+    struct timespec written;
+    unsigned char checksum[INDEX_CHECKSUM_LEN];
+    bool exists;
+    bool supported;
+    void *map;
+    size_t map_len;
+    struct index_entry *entries;
+    size_t count;
+    size_t cap;
+    struct index_tree *trees;
+    size_t trees_count;
+    size_t trees_cap;
+    // the unpacked paths of a version 4 index and the paths of the cache tree
+    char *paths;
+    size_t paths_len;
+    size_t paths_cap;
+};
+
+static uint32_t read_be32(const unsigned char *data) {
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static uint16_t read_be16(const unsigned char *data) {
+    return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+/* the offset encoding git uses for the stripped prefix lengths of version 4. */
+static bool read_varint(const unsigned char **data, const unsigned char *end, size_t *out) {
+    const unsigned char *curr = *data;
+    unsigned char byte = 0;
+    size_t value = 0;
+
+    if (curr >= end)
+        return false;
+    byte = *curr++;
+    value = byte & 0x7f;
+    while (byte & 0x80) {
+        if (curr >= end)
+            return false;
+        byte = *curr++;
+        value = ((value + 1) << 7) | (byte & 0x7f);
+    }
+    *data = curr;
+    *out = value;
+    return true;
+}
+
+/* add the first prefix_len bytes of the pooled path at prefix followed by suffix to the pool. */
+static err_t add_path(struct index_file *index, size_t prefix, size_t prefix_len, const char *suffix,
+                      size_t suffix_len) {
+    err_t err = NO_ERROR;
+    size_t needed = index->paths_len + prefix_len + suffix_len + 1;
+    char *grown = NULL;
+
+    if (needed > index->paths_cap) {
+        grown = realloc(index->paths, MAX(needed, index->paths_cap * 2));
+        ASSERT(grown);
+        index->paths = grown;
+        index->paths_cap = MAX(needed, index->paths_cap * 2);
+    }
+    memmove(index->paths + index->paths_len, index->paths + prefix, prefix_len);
+    memcpy(index->paths + index->paths_len + prefix_len, suffix, suffix_len);
+    index->paths[needed - 1] = '\0';
+    index->paths_len = needed;
+
+cleanup:
+    return err;
+}
+
+static void read_entry_stat(const unsigned char *data, struct index_entry *entry) {
+    entry->ctime_sec = read_be32(data);
+    entry->ctime_nsec = read_be32(data + 4);
+    entry->mtime_sec = read_be32(data + 8);
+    entry->mtime_nsec = read_be32(data + 12);
+    entry->dev = read_be32(data + 16);
+    entry->ino = read_be32(data + 20);
+    entry->mode = read_be32(data + 24);
+    entry->uid = read_be32(data + 28);
+    entry->gid = read_be32(data + 32);
+    entry->size = read_be32(data + 36);
+    memcpy(entry->id.id, data + 40, GIT_OID_RAWSZ);
+}
+
+/* a decimal number ended by terminator, the counts of the cache tree are written out in ascii. */
+static bool read_decimal(const unsigned char **data, const unsigned char *end, unsigned char terminator, long *out) {
+    const unsigned char *curr = *data;
+    bool negative = false;
+    long value = 0;
+
+    if (curr < end && *curr == '-') {
+        negative = true;
+        curr++;
+    }
+    if (curr >= end || *curr == terminator)
+        return false;
+    while (curr < end && *curr != terminator) {
+        if (*curr < '0' || *curr > '9' || value > INT32_MAX)
+            return false;
+        value = value * 10 + (*curr++ - '0');
+    }
+    if (curr >= end)
+        return false;
+    *data = curr + 1;
+    *out = negative ? -value : value;
+    return true;
+}
+
+/* a node of the cache tree, its subtrees follow it. ok is false if the extension is malformed. */
+static err_t parse_cache_tree(struct index_file *index, const unsigned char **data, const unsigned char *end,
+                              size_t parent, size_t parent_len, bool *ok) {
+    err_t err = NO_ERROR;
+    const unsigned char *curr = *data;
+    char name[NAME_MAX + 2] = {0};
+    size_t name_len = 0;
+    size_t path = 0;
+    size_t path_len = 0;
+    long entries_count = 0;
+    long subtrees = 0;
+    struct index_tree *grown = NULL;
+
+    *ok = false;
+    name_len = strnlen((const char *)curr, end - curr);
+    if (name_len == (size_t)(end - curr) || name_len > NAME_MAX || parent_len + name_len + 1 >= PATH_MAX)
+        goto cleanup;
+    memcpy(name, curr, name_len);
+    curr += name_len + 1;
+    // the root has an empty name, the other paths get the trailing slash of a directory like a scope
+    if (name_len) {
+        name[name_len++] = '/';
+    }
+    if (!read_decimal(&curr, end, ' ', &entries_count) || !read_decimal(&curr, end, '\n', &subtrees))
+        goto cleanup;
+    // an invalidated node (a count of -1) has no id
+    if (entries_count >= 0 && end - curr < GIT_OID_RAWSZ)
+        goto cleanup;
+
+    if (index->trees_count == index->trees_cap) {
+        grown = realloc(index->trees, MAX(16, index->trees_cap * 2) * sizeof(*grown));
+        ASSERT(grown);
+        index->trees = grown;
+        index->trees_cap = MAX(16, index->trees_cap * 2);
+    }
+    RETHROW(add_path(index, parent, parent_len, name, name_len));
+    path_len = parent_len + name_len;
+    path = index->paths_len - path_len - 1;
+    index->trees[index->trees_count] = (struct index_tree){.path = (const char *)(uintptr_t)path};
+    if (entries_count >= 0) {
+        index->trees[index->trees_count].valid = true;
+        memcpy(index->trees[index->trees_count].id.id, curr, GIT_OID_RAWSZ);
+        curr += GIT_OID_RAWSZ;
+    }
+    index->trees_count++;
+
+    for (long i = 0; i < subtrees; i++) {
+        RETHROW(parse_cache_tree(index, &curr, end, path, path_len, ok));
+        if (!*ok)
+            goto cleanup;
+    }
+    *data = curr;
+    *ok = true;
+
+cleanup:
+    return err;
+}
+
+static int compare_trees(const void *a, const void *b) {
+    return strcmp(((const struct index_tree *)a)->path, ((const struct index_tree *)b)->path);
+}
+
+/* supported stays false for anything that is not a whole index of a known version. */
+static err_t parse_index(struct index_file *index) {
+    err_t err = NO_ERROR;
+    const unsigned char *data = index->map;
+    const unsigned char *end = data + index->map_len - INDEX_CHECKSUM_LEN;
+    const unsigned char *curr = NULL;
+    size_t prev = 0;
+    size_t prev_len = 0;
+    size_t strip = 0;
+    size_t len = 0;
+    uint32_t version = 0;
+    uint32_t count = 0;
+    uint16_t flags = 0;
+    uint16_t extended = 0;
+    struct index_entry *grown = NULL;
+    const unsigned char *tree_data = NULL;
+    bool tree_ok = false;
+
+    index->count = 0;
+    index->trees_count = 0;
+    index->paths_len = 0;
+    if (index->map_len < INDEX_HEADER_LEN + INDEX_CHECKSUM_LEN || memcmp(data, INDEX_SIGNATURE, 4))
+        goto cleanup;
+    version = read_be32(data + 4);
+    count = read_be32(data + 8);
+    if (version < 2 || version > 4)
+        goto cleanup;
+
+    if (count > index->cap) {
+        grown = realloc(index->entries, count * sizeof(*grown));
+        ASSERT(grown);
+        index->entries = grown;
+        index->cap = count;
+    }
+
+    curr = data + INDEX_HEADER_LEN;
+    for (uint32_t i = 0; i < count; i++) {
+        struct index_entry *entry = &index->entries[i];
+        const unsigned char *start = curr;
+
+        if (end - curr < ENTRY_FIXED_LEN)
+            goto cleanup;
+        read_entry_stat(curr, entry);
+        flags = read_be16(curr + 60);
+        curr += ENTRY_FIXED_LEN;
+
+        extended = 0;
+        if (flags & ENTRY_FLAG_EXTENDED) {
+            if (version < 3 || end - curr < 2)
+                goto cleanup;
+            extended = read_be16(curr);
+            curr += 2;
+        }
+        entry->stage = (flags & ENTRY_FLAG_STAGE_MASK) >> ENTRY_FLAG_STAGE_SHIFT;
+        entry->skip_worktree = extended & ENTRY_EXTENDED_SKIP_WORKTREE;
+        entry->intent_to_add = extended & ENTRY_EXTENDED_INTENT_TO_ADD;
+
+        if (version == 4) {
+            // the path is the end of the previous one's, with its last strip bytes replaced
+            if (!read_varint(&curr, end, &strip) || strip > prev_len)
+                goto cleanup;
+            len = strnlen((const char *)curr, end - curr);
+            if (len == (size_t)(end - curr))
+                goto cleanup;
+            RETHROW(add_path(index, prev, prev_len - strip, (const char *)curr, len));
+            prev_len = prev_len - strip + len;
+            prev = index->paths_len - prev_len - 1;
+            // the pool may still move, the offsets are turned into pointers once it is complete
+            entry->path = (const char *)(uintptr_t)prev;
+            curr += len + 1;
+        } else {
+            len = strnlen((const char *)curr, end - curr);
+            if (len == (size_t)(end - curr))
+                goto cleanup;
+            entry->path = (const char *)curr;
+            // entries are padded with 1 to 8 null bytes to a multiple of 8
+            curr = start + ((curr - start + len + 8) & ~(size_t)7);
+            if (curr > end)
+                goto cleanup;
+        }
+    }
+
+    while (end - curr >= EXTENSION_HEADER_LEN) {
+        // the rest of the entries of a split index live in another file
+        if (!memcmp(curr, SPLIT_INDEX_SIGNATURE, 4))
+            goto cleanup;
+        len = read_be32(curr + 4);
+        if ((size_t)(end - curr - EXTENSION_HEADER_LEN) < len)
+            goto cleanup;
+        if (!memcmp(curr, CACHE_TREE_SIGNATURE, 4)) {
+            tree_data = curr + EXTENSION_HEADER_LEN;
+            RETHROW(parse_cache_tree(index, &tree_data, tree_data + len, 0, 0, &tree_ok));
+            // a cache tree that can't be read only costs the shortcuts it would have given
+            if (!tree_ok) {
+                index->trees_count = 0;
+            }
+        }
+        curr += EXTENSION_HEADER_LEN + len;
+    }
+
+    // the pool doesn't move anymore
+    if (version == 4) {
+        for (uint32_t i = 0; i < count; i++) {
+            index->entries[i].path = index->paths + (uintptr_t)index->entries[i].path;
+        }
+    }
+    for (size_t i = 0; i < index->trees_count; i++) {
+        index->trees[i].path = index->paths + (uintptr_t)index->trees[i].path;
+    }
+    // git keeps the subtrees ordered by the length of their names
+    qsort(index->trees, index->trees_count, sizeof(*index->trees), compare_trees);
+
+    index->count = count;
+    index->supported = true;
+
+cleanup:
+    return err;
+}
+
+static void unmap_index(struct index_file *index) {
+    if (index->map) {
+        munmap(index->map, index->map_len);
+    }
+    index->map = NULL;
+    index->map_len = 0;
+    index->count = 0;
+    index->trees_count = 0;
+}
+
+/* changed is left false when the file has the content that is mapped already. */
+static err_t map_index(struct index_file *index, bool *changed) {
+    err_t err = NO_ERROR;
+    static const unsigned char unset_checksum[INDEX_CHECKSUM_LEN] = {0};
+    int fd = FD_INVALID;
+    void *map = NULL;
+    size_t map_len = 0;
+    const unsigned char *checksum = NULL;
+
+    *changed = true;
+    fd = open(index->path, O_RDONLY | O_CLOEXEC);
+    // replaced again between the stat and the open, the next refresh maps the new one
+    if (fd == FD_INVALID || fstat(fd, &index->st) || index->st.st_size < INDEX_HEADER_LEN + INDEX_CHECKSUM_LEN) {
+        unmap_index(index);
+        index->supported = false;
+        goto cleanup;
+    }
+    map_len = index->st.st_size;
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        ABORT();
+    }
+
+    // the index ends with a hash of the rest of it, so a rewrite with the same hash (git rewrites it after every
+    // refresh, even when nothing changed) has the same entries. index.skipHash leaves it zeroed.
+    checksum = (const unsigned char *)map + map_len - INDEX_CHECKSUM_LEN;
+    if (index->map && !memcmp(checksum, index->checksum, INDEX_CHECKSUM_LEN) &&
+        memcmp(checksum, unset_checksum, INDEX_CHECKSUM_LEN)) {
+        *changed = false;
+        goto cleanup;
+    }
+
+    unmap_index(index);
+    index->map = map;
+    index->map_len = map_len;
+    map = NULL;
+    memcpy(index->checksum, checksum, INDEX_CHECKSUM_LEN);
+    index->written = index->st.st_mtim;
+    index->supported = false;
+    RETHROW(parse_index(index));
+
+cleanup:
+    if (map) {
+        munmap(map, map_len);
+    }
+    RETHROW_PRINT(safe_close_fd(&fd));
+    return err;
+}
+
+err_t init_index_file(struct index_file **index, const char *git_dir) {
+    err_t err = NO_ERROR;
+
+    ASSERT(index);
+    ASSERT(git_dir);
+
+    *index = calloc(1, sizeof(**index));
+    ASSERT(*index);
+    RETHROW(join_paths(git_dir, "index", (*index)->path, sizeof((*index)->path)));
+
+cleanup:
+    if (err && index && *index) {
+        free(*index);
+        *index = NULL;
+    }
+    return err;
+}
+
+err_t free_index_file(struct index_file *index) {
+    err_t err = NO_ERROR;
+
+    ASSERT(index);
+
+    unmap_index(index);
+    free(index->entries);
+    free(index->trees);
+    free(index->paths);
+    free(index);
+
+cleanup:
+    return err;
+}
+
+err_t index_file_refresh(struct index_file *index, bool *supported, bool *changed) {
+    err_t err = NO_ERROR;
+    struct stat st = {0};
+    bool exists = false;
+
+    ASSERT(index);
+    ASSERT(supported);
+    ASSERT(changed);
+
+    *changed = false;
+    exists = !stat(index->path, &st);
+    if (exists == index->exists && (!exists || (st.st_ino == index->st.st_ino && st.st_size == index->st.st_size &&
+                                                !memcmp(&st.st_mtim, &index->st.st_mtim, sizeof(st.st_mtim)) &&
+                                                !memcmp(&st.st_ctim, &index->st.st_ctim, sizeof(st.st_ctim)))))
+        goto cleanup;
+
+    index->exists = exists;
+    index->st = st;
+    if (exists) {
+        RETHROW(map_index(index, changed));
+    } else {
+        // a repository without commits might not have an index yet, it has no entries then
+        unmap_index(index);
+        index->supported = true;
+        *changed = true;
+    }
+
+cleanup:
+    if (index) {
+        *supported = index->supported;
+    }
+    return err;
+}
+
+const struct index_entry *index_file_entries(const struct index_file *index, size_t *count) {
+    *count = index->count;
+    return index->entries;
+}
+
+bool index_file_is_racy(const struct index_file *index, const struct index_entry *entry) {
+    return index->exists &&
+           (index->written.tv_sec < entry->mtime_sec ||
+            (index->written.tv_sec == entry->mtime_sec && index->written.tv_nsec <= entry->mtime_nsec));
+}
+
+size_t index_file_find_prefix(const struct index_file *index, const char *prefix) {
+    size_t low = 0;
+    size_t high = index->count;
+    size_t len = strlen(prefix);
+
+    // the entries are sorted by path, so the ones starting with prefix are a single run
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strcmp(index->entries[mid].path, prefix) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low < index->count && strncmp(index->entries[low].path, prefix, len)) {
+        return index->count;
+    }
+    return low;
+}
+
+const struct index_tree *index_file_find_tree(const struct index_file *index, const char *dir) {
+    struct index_tree key = {.path = dir};
+
+    if (!index->supported)
+        return NULL;
+    return bsearch(&key, index->trees, index->trees_count, sizeof(*index->trees), compare_trees);
+}
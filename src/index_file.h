@@ -0,0 +1,67 @@
+#ifndef GIT_LIVE_INDEX_FILE_H
+#define GIT_LIVE_INDEX_FILE_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * A read only view of .git/index for the scanners that only compare it with the work tree. The file is memory mapped
+ * and parsed into a flat array of entries, and only parsed again once git replaced it (git writes the index to a lock
+ * file and renames it over, so the stat data of the file changes with every write).
+ * Versions 2 to 4 are understood. Split indexes keep most entries in another file, supported is false for those (and
+ * for anything else that can't be read) and the caller falls back to libgit2.
+ * The cache tree extension is kept too: the tree ids git already computed for the directories whose entries didn't
+ * change since, which tell whether a whole directory of the index matches a tree without looking at its entries.
+ */
+
+#define INDEX_MODE_GITLINK (0160000)
+#define INDEX_MODE_SYMLINK (0120000)
+
+struct index_entry {
+    // points into the mapping, or into a pool of the unpacked paths for version 4 (those are prefix compressed)
+    const char *path;
+    uint32_t ctime_sec;
+    uint32_t ctime_nsec;
+    uint32_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t dev;
+    uint32_t ino;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    // truncated to 32 bits, like git stores it
+    uint32_t size;
+    git_oid id;
+    uint16_t stage;
+    bool skip_worktree;
+    bool intent_to_add;
+};
+
+struct index_tree {
+    // relative to the work tree with a trailing slash, empty for the root
+    const char *path;
+    // false once an entry under it changed, the id is stale then
+    bool valid;
+    git_oid id;
+};
+
+struct index_file;
+
+err_t init_index_file(struct index_file **index, const char *git_dir);
+err_t free_index_file(struct index_file *index);
+
+/* parse the index again if it was replaced by one with other content since the last call, changed is set then. */
+err_t index_file_refresh(struct index_file *index, bool *supported, bool *changed);
+
+const struct index_entry *index_file_entries(const struct index_file *index, size_t *count);
+/* entries whose files changed at or after the index was written can't be trusted by their stat data alone. */
+bool index_file_is_racy(const struct index_file *index, const struct index_entry *entry);
+/* the position of the first entry starting with prefix, count if there is none. */
+size_t index_file_find_prefix(const struct index_file *index, const char *prefix);
+/* the cache tree node of dir (like a scope, a trailing slash or empty), NULL if git didn't write one. */
+const struct index_tree *index_file_find_tree(const struct index_file *index, const char *dir);
+
+#endif // GIT_LIVE_INDEX_FILE_H
@@ -2,16 +2,44 @@
 #include <string.h>
 #include "../lib/err.h"
 #include "attach.h"
+#include "daemon.h"
 #include "dashboard.h"
+#include "prompt.h"
 
 void print_usage() {
-    fprintf(stderr, "Usage: git live <command>\n");
+    fprintf(stderr, "Usage: git live [<options>]\n");
+    fprintf(stderr, "       git live <command>\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --stats               Show frame timing percentiles in the last line.\n");
+    fprintf(stderr, "  --stats-file <path>   Write the frame timing stats to path on exit and on SIGUSR1 (default "
+                    "~/.cache/git-live/stats/<pid>, only on SIGUSR1).\n");
+    fprintf(stderr, "  --trace <path>        Write a Chrome trace event file of the session (open it in "
+                    "ui.perfetto.dev).\n");
+    fprintf(stderr, "  --headless            Run without a terminal, printing \"frame <n> <frame_us> <event_us> "
+                    "<changes> <stale>\" for every frame (for benchmarks), stale is 1 for the last run's saved "
+                    "status shown before the first frame.\n");
+    fprintf(stderr, "  --no-daemon           Compute the status locally even if a daemon serves the repository.\n");
+    fprintf(stderr, "  --scope               Only compute the status of the cwd's subtree (or the attached "
+                    "terminal's), with a count of the changed files outside it. Never served by a daemon.\n");
+    fprintf(stderr, "  --format=<format>     \"screen\" (default), or \"ndjson\" to write a JSON line to stdout "
+                    "whenever something changed, with only the sections that did.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Commands:\n");
     fprintf(stderr, "  <none>       Run a new git-live dashboard.\n");
     fprintf(stderr, "  attach       Attach a running dashboard to the current terminal so that the paths are relative "
                     "to its cwd.\n");
     fprintf(stderr, "  detach       Detach a running dashboard from the terminal it is attached to.\n");
+    fprintf(stderr, "  notify       Send the current directory to the dashboards attached to this terminal (used by the "
+                    "shell hook).\n");
+    fprintf(stderr, "  multi        Monitor several repositories at once, given as arguments or listed one per line in "
+                    "~/.config/git-live/repos.\n");
+    fprintf(stderr, "  daemon       Compute the status of the current repository once for every dashboard started "
+                    "in it afterwards.\n");
+    fprintf(stderr, "  query        Print the status of the current repository as seen by its daemon.\n");
+    fprintf(stderr, "  prompt       Print a one line status for a shell prompt, like \"main [+1 -2] +3 *4 %%5 "
+                    "MERGING\" (staged, changed, untracked), as published by a dashboard or daemon of the current "
+                    "repository. Prints nothing and fails if there is none.\n");
 }
 
 void print_attach_usage() {
@@ -22,9 +50,40 @@ void print_detach_usage() {
     fprintf(stderr, "Usage: git live detach <session_id>\n");
 }
 
+int parse_dashboard_options(int argc, char *argv[], struct dashboard_options *out) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--stats")) {
+            out->stats_overlay = true;
+        } else if (!strcmp(argv[i], "--stats-file") && i + 1 < argc) {
+            out->stats_path = argv[++i];
+        } else if (!strcmp(argv[i], "--headless")) {
+            out->headless = true;
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            out->trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--no-daemon")) {
+            out->no_daemon = true;
+        } else if (!strcmp(argv[i], "--scope")) {
+            out->scoped = true;
+        } else if (!strcmp(argv[i], "--format=screen")) {
+            out->format = output_format_screen;
+        } else if (!strcmp(argv[i], "--format=ndjson")) {
+            out->format = output_format_ndjson;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            print_usage();
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
-    if (argc == 1) {
-        return run_dashboard();
+    struct dashboard_options options = {0};
+
+    if (argc == 1 || (!strncmp(argv[1], "--", 2) && strcmp(argv[1], "--help"))) {
+        if (parse_dashboard_options(argc, argv, &options))
+            return 1;
+        return run_dashboard(&options);
     } else if (!strcmp(argv[1], "attach")) {
         if (argc == 3 && strcmp(argv[2], "--help")) {
             return attach_terminal_to_session(argv[2]);
@@ -43,6 +102,29 @@ int main(int argc, char *argv[]) {
         } else {
             print_detach_usage();
         }
+    } else if (!strcmp(argv[1], "notify")) {
+        if (argc == 2) {
+            return notify_terminal_cwd();
+        }
+        fprintf(stderr, "Too many arguments.\n");
+    } else if (!strcmp(argv[1], "multi")) {
+        return run_multi_dashboard((const char **)argv + 2, argc - 2);
+    } else if (!strcmp(argv[1], "daemon")) {
+        if (argc == 2) {
+            return run_daemon();
+        }
+        fprintf(stderr, "Too many arguments.\n");
+    } else if (!strcmp(argv[1], "query")) {
+        if (argc == 2) {
+            return query_daemon();
+        }
+        fprintf(stderr, "Too many arguments.\n");
+    } else if (!strcmp(argv[1], "prompt")) {
+        if (argc == 2) {
+            bool printed = false;
+            return print_prompt(&printed) || !printed;
+        }
+        fprintf(stderr, "Too many arguments.\n");
     } else if (!strcmp(argv[1], "--help")) {
         print_usage();
     } else {
@@ -0,0 +1,341 @@
+#include "ndjson.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/err.h"
+#include "snapshot.h"
+
+enum ndjson_section {
+    ndjson_section_head = 0,
+    ndjson_section_status,
+    ndjson_section_refs,
+    ndjson_section_commits,
+    ndjson_section_submodules,
+    NDJSON_SECTIONS_COUNT,
+};
+
+struct json {
+    FILE *file;
+    // a value was already written at this level, the next one needs a comma
+    bool need_comma;
+};
+
+struct ndjson_writer {
+    FILE *file;
+    // the sections of the previous record back to back, NULL before the first one
+    char *prev;
+    size_t prev_offsets[NDJSON_SECTIONS_COUNT + 1];
+};
+
+static const char *section_names[NDJSON_SECTIONS_COUNT] = {"head", "status", "refs", "commits", "submodules"};
+static const char *status_section_names[STATUS_SECTIONS_COUNT] = {"staged", "changed", "untracked"};
+static const char *submodule_state_names[] = {"pending", "missing", "ready"};
+
+/* the length of the utf-8 sequence at c, 0 if it is not a valid one (overlong, a surrogate or above U+10FFFF). */
+static size_t get_utf8_len(const unsigned char *c) {
+    size_t len = 0;
+    uint32_t min = 0;
+    uint32_t code = 0;
+
+    if (c[0] < 0x80)
+        return 1;
+    if ((c[0] & 0xe0) == 0xc0) {
+        len = 2;
+        min = 0x80;
+        code = c[0] & 0x1f;
+    } else if ((c[0] & 0xf0) == 0xe0) {
+        len = 3;
+        min = 0x800;
+        code = c[0] & 0x0f;
+    } else if ((c[0] & 0xf8) == 0xf0) {
+        len = 4;
+        min = 0x10000;
+        code = c[0] & 0x07;
+    } else {
+        return 0;
+    }
+    // the terminator is not a continuation byte, so this never reads past it
+    for (size_t i = 1; i < len; i++) {
+        if ((c[i] & 0xc0) != 0x80)
+            return 0;
+        code = (code << 6) | (c[i] & 0x3f);
+    }
+    if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff))
+        return 0;
+    return len;
+}
+
+static void write_json_string(FILE *file, const char *str) {
+    size_t len = 0;
+
+    fputc('"', file);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c += len ? len : 1) {
+        len = get_utf8_len(c);
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+            fputc(*c, file);
+        } else if (*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else if (!len) {
+            // paths are not necessarily utf-8, but json must be, so every invalid byte becomes a replacement character
+            fputs("\\ufffd", file);
+        } else {
+            fwrite(c, 1, len, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void json_separate(struct json *json) {
+    if (json->need_comma) {
+        fputc(',', json->file);
+    }
+    json->need_comma = true;
+}
+
+static void json_key(struct json *json, const char *key) {
+    json_separate(json);
+    write_json_string(json->file, key);
+    fputc(':', json->file);
+    json->need_comma = false;
+}
+
+static void json_begin(struct json *json, char bracket) {
+    json_separate(json);
+    fputc(bracket, json->file);
+    json->need_comma = false;
+}
+
+static void json_end(struct json *json, char bracket) {
+    fputc(bracket, json->file);
+    json->need_comma = true;
+}
+
+static void json_string_field(struct json *json, const char *key, const char *value) {
+    json_key(json, key);
+    json_separate(json);
+    write_json_string(json->file, value);
+}
+
+static void json_uint_field(struct json *json, const char *key, uint64_t value) {
+    json_key(json, key);
+    json_separate(json);
+    fprintf(json->file, "%lu", value);
+}
+
+static void json_int_field(struct json *json, const char *key, int64_t value) {
+    json_key(json, key);
+    json_separate(json);
+    fprintf(json->file, "%ld", value);
+}
+
+static void json_bool_field(struct json *json, const char *key, bool value) {
+    json_key(json, key);
+    json_separate(json);
+    fputs(value ? "true" : "false", json->file);
+}
+
+static void write_head(struct json *json, const struct snapshot *snapshot) {
+    json_begin(json, '{');
+    json_string_field(json, "name", snapshot_str(snapshot, snapshot->head_name));
+    json_string_field(json, "tracking", snapshot_str(snapshot, snapshot->head_tracking));
+    json_string_field(json, "workdir", snapshot_str(snapshot, snapshot->workdir));
+    // git's prompt name for it ("MERGING"), empty when there is none
+    json_string_field(json, "operation", snapshot_str(snapshot, snapshot->operation));
+    // the status is the one from before the running git command, a record with the new one follows once it is done
+    json_bool_field(json, "operation_running", snapshot->operation_running);
+    json_end(json, '}');
+}
+
+static void write_status(struct json *json, const struct snapshot *snapshot) {
+    json_begin(json, '{');
+
+    json_key(json, "counts");
+    json_begin(json, '{');
+    for (size_t i = 0; i < STATUS_SECTIONS_COUNT; i++) {
+        json_uint_field(json, status_section_names[i], snapshot->status_counts[i]);
+    }
+    json_end(json, '}');
+    // empty when the status is not scoped, outside_changes is 0 then
+    json_string_field(json, "scope", snapshot_str(snapshot, snapshot->status_scope));
+    json_uint_field(json, "outside_changes", snapshot->outside_changes);
+
+    json_key(json, "rows");
+    json_begin(json, '[');
+    for (size_t i = 0; i < snapshot->status_rows.count; i++) {
+        const struct status_row *row = &snapshot->status_rows.items[i];
+
+        json_begin(json, '{');
+        json_string_field(json, "section", status_section_names[row->section]);
+        json_string_field(json, "status", snapshot_str(snapshot, row->status));
+        json_string_field(json, "path", snapshot_str(snapshot, row->path));
+        // only renames have one
+        if (row->old_path != row->path) {
+            json_string_field(json, "old_path", snapshot_str(snapshot, row->old_path));
+        }
+        json_uint_field(json, "additions", row->diffstat.additions);
+        json_uint_field(json, "deletions", row->diffstat.deletions);
+        json_bool_field(json, "binary", row->diffstat.binary);
+        json_bool_field(json, "skipped", row->diffstat.skipped);
+        // collapsed untracked directories
+        if (row->files || row->counting) {
+            json_uint_field(json, "files", row->files);
+            json_bool_field(json, "counting", row->counting);
+        }
+        json_end(json, '}');
+    }
+    json_end(json, ']');
+
+    json_end(json, '}');
+}
+
+static void write_refs(struct json *json, const struct snapshot *snapshot) {
+    json_begin(json, '[');
+    for (size_t i = 0; i < snapshot->ref_rows.count; i++) {
+        const struct ref_row *row = &snapshot->ref_rows.items[i];
+
+        json_begin(json, '{');
+        json_uint_field(json, "index", row->index);
+        json_string_field(json, "name", snapshot_str(snapshot, row->name));
+        json_string_field(json, "tracking", snapshot_str(snapshot, row->tracking));
+        json_end(json, '}');
+    }
+    json_end(json, ']');
+}
+
+static void write_commits(struct json *json, const struct snapshot *snapshot) {
+    json_begin(json, '[');
+    for (size_t i = 0; i < snapshot->commit_rows.count; i++) {
+        const struct commit_row *row = &snapshot->commit_rows.items[i];
+
+        json_begin(json, '{');
+        json_string_field(json, "hash", snapshot_str(snapshot, row->hash));
+        json_string_field(json, "summary", snapshot_str(snapshot, row->summary));
+        json_string_field(json, "author", snapshot_str(snapshot, row->author));
+        json_int_field(json, "time", row->time);
+        json_end(json, '}');
+    }
+    json_end(json, ']');
+}
+
+static void write_submodules(struct json *json, const struct snapshot *snapshot) {
+    json_begin(json, '[');
+    for (size_t i = 0; i < snapshot->submodule_rows.count; i++) {
+        const struct submodule_row *row = &snapshot->submodule_rows.items[i];
+
+        json_begin(json, '{');
+        json_string_field(json, "path", snapshot_str(snapshot, row->path));
+        json_string_field(json, "head", snapshot_str(snapshot, row->head));
+        json_string_field(json, "state", submodule_state_names[row->state]);
+        json_bool_field(json, "dirty", row->dirty);
+        json_bool_field(json, "detached", row->detached);
+        json_uint_field(json, "ahead", row->ahead);
+        json_uint_field(json, "behind", row->behind);
+        json_end(json, '}');
+    }
+    json_end(json, ']');
+}
+
+static void (*const section_writers[NDJSON_SECTIONS_COUNT])(struct json *, const struct snapshot *) = {
+    write_head, write_status, write_refs, write_commits, write_submodules};
+
+err_t init_ndjson_writer(struct ndjson_writer **writer, FILE *file) {
+    err_t err = NO_ERROR;
+
+    ASSERT(writer);
+    ASSERT(file);
+
+    *writer = calloc(1, sizeof(**writer));
+    ASSERT(*writer);
+    (*writer)->file = file;
+
+cleanup:
+    return err;
+}
+
+err_t free_ndjson_writer(struct ndjson_writer *writer) {
+    err_t err = NO_ERROR;
+
+    ASSERT(writer);
+
+    free(writer->prev);
+    free(writer);
+
+cleanup:
+    return err;
+}
+
+static bool is_section_changed(const struct ndjson_writer *writer, const char *buff, const size_t *offsets,
+                               enum ndjson_section section) {
+    size_t len = offsets[section + 1] - offsets[section];
+
+    return !writer->prev || len != writer->prev_offsets[section + 1] - writer->prev_offsets[section] ||
+           memcmp(buff + offsets[section], writer->prev + writer->prev_offsets[section], len);
+}
+
+err_t ndjson_write_frame(struct ndjson_writer *writer, const struct snapshot *snapshot,
+                         const struct ndjson_frame *frame, bool *written) {
+    err_t err = NO_ERROR;
+    FILE *stream = NULL;
+    char *buff = NULL;
+    size_t len = 0;
+    size_t offsets[NDJSON_SECTIONS_COUNT + 1] = {0};
+    struct json json = {0};
+    int closed = 0;
+
+    ASSERT(writer);
+    ASSERT(snapshot);
+    ASSERT(frame);
+    ASSERT(written);
+
+    *written = false;
+
+    // the sections are serialized first, they are compared by their text with the ones of the previous record
+    stream = open_memstream(&buff, &len);
+    ASSERT(stream);
+    json.file = stream;
+    for (size_t i = 0; i < NDJSON_SECTIONS_COUNT; i++) {
+        offsets[i] = ftell(stream);
+        json.need_comma = false;
+        section_writers[i](&json, snapshot);
+    }
+    offsets[NDJSON_SECTIONS_COUNT] = ftell(stream);
+    closed = fclose(stream);
+    stream = NULL;
+    ASSERT(!closed);
+
+    json = (struct json){.file = writer->file};
+    for (size_t i = 0; i < NDJSON_SECTIONS_COUNT; i++) {
+        if (!is_section_changed(writer, buff, offsets, i))
+            continue;
+
+        if (!*written) {
+            json_begin(&json, '{');
+            json_uint_field(&json, "frame", frame->frame);
+            json_uint_field(&json, "frame_us", frame->frame_us);
+            json_uint_field(&json, "event_us", frame->event_us);
+            *written = true;
+        }
+        json_key(&json, section_names[i]);
+        fwrite(buff + offsets[i], 1, offsets[i + 1] - offsets[i], writer->file);
+        json.need_comma = true;
+    }
+    if (*written) {
+        fputs("}\n", writer->file);
+        ASSERT(!fflush(writer->file));
+    }
+
+    free(writer->prev);
+    writer->prev = buff;
+    buff = NULL;
+    memcpy(writer->prev_offsets, offsets, sizeof(offsets));
+
+cleanup:
+    if (stream) {
+        fclose(stream);
+    }
+    free(buff);
+    return err;
+}
@@ -0,0 +1,35 @@
+#ifndef GIT_LIVE_NDJSON_H
+#define GIT_LIVE_NDJSON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../lib/err.h"
+#include "snapshot.h"
+
+/*
+ * The ndjson output writes one compact JSON object per line for every frame that changed something, for editors and
+ * scripts to follow the repository without polling git themselves:
+ *   {"frame":3,"frame_us":812,"event_us":1030,"status":{...},"refs":[...]}
+ * Only the sections that differ from the previous record are included (the first record has all of them), a missing
+ * section kept its previous value. The sections are "head", "status", "refs", "commits" and "submodules".
+ * Records are written straight to the stream as the snapshot is walked, without building a document first.
+ */
+
+struct ndjson_frame {
+    uint64_t frame;
+    uint64_t frame_us;
+    // from the inotify event the frame was computed for to the end of the frame, 0 if there was none
+    uint64_t event_us;
+};
+
+struct ndjson_writer;
+
+err_t init_ndjson_writer(struct ndjson_writer **writer, FILE *file);
+err_t free_ndjson_writer(struct ndjson_writer *writer);
+
+/* written is false when nothing changed since the previous record, nothing is written then. */
+err_t ndjson_write_frame(struct ndjson_writer *writer, const struct snapshot *snapshot,
+                         const struct ndjson_frame *frame, bool *written);
+
+#endif // GIT_LIVE_NDJSON_H
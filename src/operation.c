@@ -0,0 +1,96 @@
+#include "operation.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "../lib/err.h"
+#include "stats.h"
+#include "utils.h"
+
+// long enough for a rebase to take the lock for its next commit
+#define OPERATION_SETTLE_US (200 * 1000)
+
+// a lock this old was most likely left behind by a git that crashed, git refuses to run until it's removed anyway
+#define OPERATION_STALE_SEC (60)
+
+struct operation_watch {
+    char lock_path[PATH_MAX];
+    // when the lock was last seen (stats_now_us clock), 0 if never
+    uint64_t locked_at;
+};
+
+err_t init_operation_watch(struct operation_watch **watch, const char *git_dir) {
+    err_t err = NO_ERROR;
+
+    ASSERT(watch);
+    ASSERT(git_dir);
+
+    *watch = calloc(1, sizeof(**watch));
+    ASSERT(*watch);
+    RETHROW(join_paths(git_dir, "index.lock", (*watch)->lock_path, sizeof((*watch)->lock_path)));
+
+cleanup:
+    if (err && watch && *watch) {
+        free(*watch);
+        *watch = NULL;
+    }
+    return err;
+}
+
+err_t free_operation_watch(struct operation_watch *watch) {
+    err_t err = NO_ERROR;
+
+    ASSERT(watch);
+
+    free(watch);
+
+cleanup:
+    return err;
+}
+
+err_t operation_watch_check(struct operation_watch *watch, bool *running) {
+    err_t err = NO_ERROR;
+    struct stat st = {0};
+    uint64_t now = stats_now_us();
+
+    ASSERT(watch);
+    ASSERT(running);
+
+    if (!stat(watch->lock_path, &st) && time(NULL) - st.st_mtim.tv_sec < OPERATION_STALE_SEC) {
+        watch->locked_at = now;
+    }
+    *running = watch->locked_at && now - watch->locked_at < OPERATION_SETTLE_US;
+
+cleanup:
+    return err;
+}
+
+const char *get_operation_name(int32_t state) {
+    // the names git's own prompt uses
+    switch (state) {
+    case GIT_REPOSITORY_STATE_MERGE:
+        return "MERGING";
+    case GIT_REPOSITORY_STATE_REVERT:
+    case GIT_REPOSITORY_STATE_REVERT_SEQUENCE:
+        return "REVERTING";
+    case GIT_REPOSITORY_STATE_CHERRYPICK:
+    case GIT_REPOSITORY_STATE_CHERRYPICK_SEQUENCE:
+        return "CHERRY-PICKING";
+    case GIT_REPOSITORY_STATE_BISECT:
+        return "BISECTING";
+    case GIT_REPOSITORY_STATE_REBASE:
+        return "REBASE";
+    case GIT_REPOSITORY_STATE_REBASE_INTERACTIVE:
+        return "REBASE-i";
+    case GIT_REPOSITORY_STATE_REBASE_MERGE:
+        return "REBASE-m";
+    case GIT_REPOSITORY_STATE_APPLY_MAILBOX:
+        return "AM";
+    case GIT_REPOSITORY_STATE_APPLY_MAILBOX_OR_REBASE:
+        return "AM/REBASE";
+    default:
+        return NULL;
+    }
+}
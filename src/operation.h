@@ -0,0 +1,27 @@
+#ifndef GIT_LIVE_OPERATION_H
+#define GIT_LIVE_OPERATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * Git commands that rewrite the work tree (checkout, merge, rebase, ...) hold index.lock while they run, and a rebase
+ * or a cherry-pick of several commits takes it again for every one of them. A status computed meanwhile sees a half
+ * updated work tree and is stale again right away, so while the lock is held, and until it has been gone for
+ * OPERATION_SETTLE_US, the engine keeps the status it has and shows that git is running. The first frame after that
+ * computes the status once, for everything that changed meanwhile.
+ */
+
+struct operation_watch;
+
+err_t init_operation_watch(struct operation_watch **watch, const char *git_dir);
+err_t free_operation_watch(struct operation_watch *watch);
+
+/* running is set while a git command is rewriting the work tree, or has only just released the lock. */
+err_t operation_watch_check(struct operation_watch *watch, bool *running);
+
+/* the name git's own prompt uses for a git_repository_state_t, NULL when there is no operation. */
+const char *get_operation_name(int32_t state);
+
+#endif // GIT_LIVE_OPERATION_H
@@ -0,0 +1,297 @@
+#include "prompt.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "ahead_behind.h"
+#include "attach.h"
+#include "operation.h"
+#include "utils.h"
+
+#define PROMPT_FILE_PREFIX ("prompt-")
+
+#define PROMPT_RECORD_MAGIC (0x74706d70766c6967) // "gilvpmpt"
+#define PROMPT_RECORD_VERSION (1)
+
+// a writer that died in the middle of an update leaves the sequence odd, the reader gives up instead of spinning
+#define PROMPT_READ_RETRIES (1000)
+
+#define PROMPT_TEXT_LEN (PROMPT_BRANCH_LEN + 128)
+
+struct prompt_record {
+    uint64_t magic;
+    uint32_t version;
+    // odd while a writer is in the middle of an update
+    _Atomic uint32_t seq;
+    // the process that published the record, 0 once it stopped. it and the status are only read under the sequence
+    int32_t pid;
+    struct prompt_status status;
+};
+
+struct prompt_publisher {
+    int fd;
+    struct prompt_record *record;
+    int32_t pid;
+    struct prompt_status last;
+    bool published;
+};
+
+static err_t get_prompt_path(const char *workdir, bool create_dir, char *buff, size_t len) {
+    err_t err = NO_ERROR;
+    char dir[PATH_MAX] = {0};
+    char name[32] = {0};
+
+    RETHROW(get_sockets_dir(dir, sizeof(dir)));
+    if (create_dir) {
+        RETHROW(make_dirs(dir));
+    }
+    snprintf(name, sizeof(name), "%s%016lx", PROMPT_FILE_PREFIX, hash_string(workdir));
+    RETHROW(join_paths(dir, name, buff, len));
+
+cleanup:
+    return err;
+}
+
+/* writers hold the file lock, so the sequence only has to protect the record from readers. */
+static void write_record(struct prompt_record *record, int32_t pid, const struct prompt_status *status) {
+    uint32_t seq = atomic_load_explicit(&record->seq, memory_order_relaxed);
+
+    // left odd by a writer that died while writing
+    seq += seq & 1;
+    atomic_store_explicit(&record->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    record->pid = pid;
+    if (status) {
+        record->status = *status;
+    }
+    atomic_store_explicit(&record->seq, seq + 2, memory_order_release);
+}
+
+err_t init_prompt_publisher(struct prompt_publisher **publisher, const char *workdir) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+    struct stat st = {0};
+    bool locked = false;
+
+    ASSERT(publisher);
+    ASSERT(workdir);
+
+    *publisher = calloc(1, sizeof(**publisher));
+    ASSERT(*publisher);
+    (*publisher)->fd = FD_INVALID;
+    (*publisher)->pid = getpid();
+
+    RETHROW(get_prompt_path(workdir, true, path, sizeof(path)));
+    (*publisher)->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    ASSERT((*publisher)->fd != FD_INVALID);
+
+    ASSERT(!flock((*publisher)->fd, LOCK_EX));
+    locked = true;
+    ASSERT(!fstat((*publisher)->fd, &st));
+    if ((size_t)st.st_size < sizeof(struct prompt_record)) {
+        ASSERT(!ftruncate((*publisher)->fd, sizeof(struct prompt_record)));
+    }
+    (*publisher)->record =
+        mmap(NULL, sizeof(struct prompt_record), PROT_READ | PROT_WRITE, MAP_SHARED, (*publisher)->fd, 0);
+    ASSERT((*publisher)->record != MAP_FAILED);
+
+    // a new file, or one of another version
+    if ((*publisher)->record->magic != PROMPT_RECORD_MAGIC || (*publisher)->record->version != PROMPT_RECORD_VERSION) {
+        write_record((*publisher)->record, 0, &(struct prompt_status){0});
+        (*publisher)->record->version = PROMPT_RECORD_VERSION;
+        (*publisher)->record->magic = PROMPT_RECORD_MAGIC;
+    }
+
+cleanup:
+    if (locked) {
+        flock((*publisher)->fd, LOCK_UN);
+    }
+    if (err && publisher && *publisher) {
+        if ((*publisher)->record == MAP_FAILED) {
+            (*publisher)->record = NULL;
+        }
+        RETHROW_PRINT(free_prompt_publisher(*publisher));
+        *publisher = NULL;
+    }
+    return err;
+}
+
+err_t free_prompt_publisher(struct prompt_publisher *publisher) {
+    err_t err = NO_ERROR;
+
+    ASSERT(publisher);
+
+    // the file stays, other processes may publish to it too
+    if (publisher->record) {
+        ASSERT_PRINT(!flock(publisher->fd, LOCK_EX));
+        if (publisher->record->pid == publisher->pid) {
+            write_record(publisher->record, 0, NULL);
+        }
+        flock(publisher->fd, LOCK_UN);
+        ASSERT_PRINT(!munmap(publisher->record, sizeof(*publisher->record)));
+    }
+    RETHROW_PRINT(safe_close_fd(&publisher->fd));
+    free(publisher);
+
+cleanup:
+    return err;
+}
+
+err_t prompt_publish(struct prompt_publisher *publisher, const struct prompt_status *status) {
+    err_t err = NO_ERROR;
+
+    ASSERT(publisher);
+    ASSERT(status);
+
+    // most frames change nothing, those don't touch the record. another publisher of the same repository (or one that
+    // exited) may have written it last, it is then taken over even if our status didn't change
+    if (publisher->published && publisher->record->pid == publisher->pid &&
+        !memcmp(&publisher->last, status, sizeof(*status)))
+        goto cleanup;
+
+    ASSERT(!flock(publisher->fd, LOCK_EX));
+    write_record(publisher->record, publisher->pid, status);
+    flock(publisher->fd, LOCK_UN);
+
+    publisher->last = *status;
+    publisher->published = true;
+
+cleanup:
+    return err;
+}
+
+/* the closest parent of the cwd with a .git, in the form libgit2 reports work trees in (with a trailing slash). */
+static err_t find_workdir(char *buff, size_t len, bool *found) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+    char *slash = NULL;
+
+    *found = false;
+    // room for the trailing slash
+    ASSERT(getcwd(buff, len - 1));
+
+    while (true) {
+        // the root is the only directory that already ends with a slash
+        slash = buff + strlen(buff) - 1;
+        ASSERT(snprintf(path, sizeof(path), "%s%s.git", buff, *slash == '/' ? "" : "/") < (int)sizeof(path));
+        if (!access(path, F_OK)) {
+            if (*slash != '/') {
+                strcat(buff, "/");
+            }
+            *found = true;
+            goto cleanup;
+        }
+        if (*slash == '/')
+            break;
+        // cut the last component, but keep the slash of the root
+        slash = strrchr(buff, '/');
+        slash[slash == buff] = '\0';
+    }
+
+cleanup:
+    return err;
+}
+
+static bool read_record(const struct prompt_record *record, int32_t *pid, struct prompt_status *out) {
+    uint32_t seq = 0;
+
+    if (record->magic != PROMPT_RECORD_MAGIC || record->version != PROMPT_RECORD_VERSION)
+        return false;
+
+    for (int i = 0; i < PROMPT_READ_RETRIES; i++) {
+        seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        *pid = record->pid;
+        *out = record->status;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&record->seq, memory_order_relaxed) == seq)
+            return true;
+    }
+    return false;
+}
+
+/* "main [+1 -2] +3 *4 %5 MERGING", with git's prompt symbols for staged, changed and untracked, zeros are left out. */
+static void format_prompt(const struct prompt_status *status, char *buff, size_t len) {
+    struct ahead_behind ahead_behind = {
+        .ahead = status->ahead,
+        .behind = status->behind,
+        .truncated = status->truncated,
+    };
+    char counts[AHEAD_BEHIND_TEXT_LEN] = {0};
+    const char *operation = get_operation_name(status->operation);
+    int written = 0;
+
+    // PROMPT_TEXT_LEN fits all the parts, every part is still cut to what's left in case it doesn't
+    written += snprintf(buff, len, "%.*s", PROMPT_BRANCH_LEN, status->branch);
+    if (status->has_upstream && (status->counting || status->ahead || status->behind)) {
+        format_ahead_behind(&ahead_behind, !status->counting, counts, sizeof(counts));
+        written += snprintf(buff + written, len - MIN((size_t)written, len), " [%s]", counts);
+    }
+    if (status->staged) {
+        written += snprintf(buff + written, len - MIN((size_t)written, len), " +%u", status->staged);
+    }
+    if (status->changed) {
+        written += snprintf(buff + written, len - MIN((size_t)written, len), " *%u", status->changed);
+    }
+    if (status->untracked) {
+        written += snprintf(buff + written, len - MIN((size_t)written, len), " %%%u", status->untracked);
+    }
+    if (operation) {
+        snprintf(buff + written, len - MIN((size_t)written, len), " %s", operation);
+    }
+}
+
+err_t print_prompt(bool *printed) {
+    err_t err = NO_ERROR;
+    char workdir[PATH_MAX] = {0};
+    char path[PATH_MAX] = {0};
+    char text[PROMPT_TEXT_LEN] = {0};
+    struct prompt_status status = {0};
+    const struct prompt_record *record = MAP_FAILED;
+    struct stat st = {0};
+    int fd = FD_INVALID;
+    int32_t pid = 0;
+    bool found = false;
+
+    ASSERT(printed);
+    *printed = false;
+
+    RETHROW(find_workdir(workdir, sizeof(workdir), &found));
+    if (!found)
+        goto cleanup;
+
+    RETHROW(get_prompt_path(workdir, false, path, sizeof(path)));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == FD_INVALID || fstat(fd, &st) || (size_t)st.st_size < sizeof(*record))
+        goto cleanup;
+    record = mmap(NULL, sizeof(*record), PROT_READ, MAP_SHARED, fd, 0);
+    ASSERT(record != MAP_FAILED);
+
+    if (!read_record(record, &pid, &status))
+        goto cleanup;
+    // nobody publishes it anymore, it may be out of date
+    if (!pid || (kill(pid, 0) && errno != EPERM))
+        goto cleanup;
+
+    format_prompt(&status, text, sizeof(text));
+    printf("%s\n", text);
+    *printed = true;
+
+cleanup:
+    if (record != MAP_FAILED) {
+        munmap((void *)record, sizeof(*record));
+    }
+    RETHROW_PRINT(safe_close_fd(&fd));
+    return err;
+}
@@ -0,0 +1,47 @@
+#ifndef GIT_LIVE_PROMPT_H
+#define GIT_LIVE_PROMPT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * Whoever computes the snapshots of a repository (a dashboard or a daemon) also publishes a small fixed size record of
+ * it to a shared file, $XDG_RUNTIME_DIR/git-live/prompt-<hash of the work tree>. A shell prompt reads it with
+ * `git live prompt` in microseconds, without opening the repository.
+ * The record is guarded by a seqlock: writers make the sequence odd while they write it and readers retry until they
+ * copied it between two reads of the same even sequence, so a reader never waits for a writer and never blocks it.
+ */
+
+#define PROMPT_BRANCH_LEN (64)
+
+struct prompt_status {
+    // the branch, or the abbreviated commit when detached
+    char branch[PROMPT_BRANCH_LEN];
+    bool detached;
+    bool has_upstream;
+    // the counts against the upstream are still being computed
+    bool counting;
+    bool truncated;
+    uint32_t ahead;
+    uint32_t behind;
+    uint32_t staged;
+    uint32_t changed;
+    uint32_t untracked;
+    // a git_repository_state_t
+    int32_t operation;
+};
+
+struct prompt_publisher;
+
+err_t init_prompt_publisher(struct prompt_publisher **publisher, const char *workdir);
+/* the record is marked as unowned, so prompts stop showing it. */
+err_t free_prompt_publisher(struct prompt_publisher *publisher);
+
+/* only writes the record when it changed, or when another process wrote it last. */
+err_t prompt_publish(struct prompt_publisher *publisher, const struct prompt_status *status);
+
+/* print the published status of the repository containing the cwd, printed is false when nothing publishes it. */
+err_t print_prompt(bool *printed);
+
+#endif // GIT_LIVE_PROMPT_H
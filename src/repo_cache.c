@@ -0,0 +1,158 @@
+#include "repo_cache.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/err.h"
+#include "ahead_behind.h"
+#include "config.h"
+#include "diffstat.h"
+#include "operation.h"
+#include "prompt.h"
+#include "staged_scan.h"
+#include "status_cache.h"
+#include "submodules.h"
+#include "timing.h"
+#include "untracked.h"
+#include "worktree_scan.h"
+
+struct repo_cache {
+    struct repo_handle handles[REPO_CACHE_SIZE];
+    struct timer *timer;
+    uint64_t clock;
+};
+
+static err_t close_handle(struct repo_handle *handle) {
+    err_t err = NO_ERROR;
+
+    ASSERT(handle);
+
+    if (handle->prompt) {
+        RETHROW_PRINT(free_prompt_publisher(handle->prompt));
+    }
+    if (handle->untracked) {
+        RETHROW_PRINT(free_untracked_cache(handle->untracked));
+    }
+    if (handle->worktree) {
+        RETHROW_PRINT(free_worktree_scanner(handle->worktree));
+    }
+    if (handle->staged) {
+        RETHROW_PRINT(free_staged_scanner(handle->staged));
+    }
+    if (handle->operation) {
+        RETHROW_PRINT(free_operation_watch(handle->operation));
+    }
+    if (handle->submodules) {
+        RETHROW_PRINT(free_submodule_pool(handle->submodules));
+    }
+    if (handle->status_cache) {
+        RETHROW_PRINT(free_status_cache(handle->status_cache));
+    }
+    if (handle->diffstat_cache) {
+        RETHROW_PRINT(free_diffstat_cache(handle->diffstat_cache));
+    }
+    if (handle->ahead_behind) {
+        RETHROW_PRINT(free_ahead_behind_engine(handle->ahead_behind));
+    }
+    git_repository_free(handle->repo);
+    memset(handle, '\0', sizeof(*handle));
+
+cleanup:
+    return err;
+}
+
+static err_t open_handle(struct repo_handle *handle, const char *git_dir, struct timer *timer) {
+    err_t err = NO_ERROR;
+
+    ASSERT(handle);
+    ASSERT(git_dir);
+    ASSERT(strlen(git_dir) < sizeof(handle->git_dir));
+
+    strcpy(handle->git_dir, git_dir);
+    ASSERT(!git_repository_open(&handle->repo, git_dir));
+    RETHROW(load_live_config(handle->repo, &handle->config));
+    RETHROW(init_ahead_behind_engine(&handle->ahead_behind, git_dir, handle->config.ahead_behind_budget_ms, timer));
+    RETHROW(init_diffstat_cache(&handle->diffstat_cache, handle->config.diffstat_max_file_size));
+    RETHROW(init_status_cache(&handle->status_cache, handle->repo));
+    RETHROW(init_submodule_pool(&handle->submodules, git_dir, handle->config.abbrev_len, timer));
+    RETHROW(init_operation_watch(&handle->operation, git_dir));
+    if (git_repository_workdir(handle->repo)) {
+        RETHROW(init_staged_scanner(&handle->staged, handle->repo));
+        RETHROW(init_worktree_scanner(&handle->worktree, handle->repo, timer));
+        RETHROW(init_untracked_cache(&handle->untracked, handle->repo, timer));
+        RETHROW(init_prompt_publisher(&handle->prompt, git_repository_workdir(handle->repo)));
+    }
+
+cleanup:
+    if (err) {
+        RETHROW_PRINT(close_handle(handle));
+    }
+    return err;
+}
+
+err_t init_repo_cache(struct repo_cache **cache, struct timer *timer) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+    ASSERT(timer);
+
+    *cache = calloc(1, sizeof(**cache));
+    ASSERT(*cache);
+
+    (*cache)->timer = timer;
+
+cleanup:
+    return err;
+}
+
+err_t free_repo_cache(struct repo_cache *cache) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+
+    for (size_t i = 0; i < REPO_CACHE_SIZE; i++) {
+        if (cache->handles[i].repo) {
+            RETHROW_PRINT(close_handle(&cache->handles[i]));
+        }
+    }
+    free(cache);
+
+cleanup:
+    return err;
+}
+
+err_t repo_cache_open(struct repo_cache *cache, const char *path, struct repo_handle **out) {
+    err_t err = NO_ERROR;
+    git_buf git_dir = {0};
+    struct repo_handle *victim = NULL;
+
+    ASSERT(cache);
+    ASSERT(path);
+    ASSERT(out);
+
+    // discovery only stats its way up the tree, much cheaper than opening the repository
+    ASSERT(!git_repository_discover(&git_dir, path, 0, "/"));
+
+    for (size_t i = 0; i < REPO_CACHE_SIZE; i++) {
+        struct repo_handle *handle = &cache->handles[i];
+        if (handle->repo && !strcmp(handle->git_dir, git_dir.ptr)) {
+            handle->last_used = ++cache->clock;
+            *out = handle;
+            goto cleanup;
+        }
+        if (!victim || !handle->repo || (victim->repo && handle->last_used < victim->last_used)) {
+            victim = handle;
+        }
+    }
+
+    if (victim->repo) {
+        RETHROW(close_handle(victim));
+    }
+    RETHROW(open_handle(victim, git_dir.ptr, cache->timer));
+    victim->last_used = ++cache->clock;
+    *out = victim;
+
+cleanup:
+    git_buf_dispose(&git_dir);
+    return err;
+}
@@ -0,0 +1,61 @@
+#ifndef GIT_LIVE_REPO_CACHE_H
+#define GIT_LIVE_REPO_CACHE_H
+
+#include <git2.h>
+#include <linux/limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+#include "ahead_behind.h"
+#include "config.h"
+#include "diffstat.h"
+#include "operation.h"
+#include "prompt.h"
+#include "staged_scan.h"
+#include "status_cache.h"
+#include "submodules.h"
+#include "timing.h"
+#include "untracked.h"
+#include "worktree_scan.h"
+
+/*
+ * A small LRU of open repositories, so switching the attached terminal between a few repos (or worktrees, or
+ * submodules) keeps libgit2's odb/index/config caches and our own per-repo caches warm.
+ * Handles are keyed by their git dir, which is distinct for every worktree and submodule.
+ */
+
+#define REPO_CACHE_SIZE (4)
+
+struct repo_handle {
+    char git_dir[PATH_MAX];
+    git_repository *repo;
+    struct live_config config;
+    struct ahead_behind_engine *ahead_behind;
+    struct diffstat_cache *diffstat_cache;
+    struct status_cache *status_cache;
+    struct submodule_pool *submodules;
+    struct operation_watch *operation;
+    // all NULL for bare repositories
+    struct staged_scanner *staged;
+    struct worktree_scanner *worktree;
+    struct untracked_cache *untracked;
+    struct prompt_publisher *prompt;
+    // the changes outside a scoped status, recounted only now and then since that stats every tracked file
+    char outside_scope[PATH_MAX];
+    size_t outside_changes;
+    uint64_t outside_counted_at;
+    uint64_t last_used;
+};
+
+struct repo_cache;
+
+err_t init_repo_cache(struct repo_cache **cache, struct timer *timer);
+err_t free_repo_cache(struct repo_cache *cache);
+
+/*
+ * Get the handle of the repository containing path, opening it (and evicting the least recently used handle) if it
+ * is not cached. The handle stays valid until the next call.
+ */
+err_t repo_cache_open(struct repo_cache *cache, const char *path, struct repo_handle **out);
+
+#endif // GIT_LIVE_REPO_CACHE_H
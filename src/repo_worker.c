@@ -0,0 +1,184 @@
+#include "repo_worker.h"
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/err.h"
+#include "engine.h"
+#include "repo_cache.h"
+#include "snapshot.h"
+#include "timing.h"
+
+struct repo_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool thread_started;
+    bool stop;
+    // set once the worker thread gave up, the error itself was already printed by the worker
+    bool failed;
+    char path[PATH_MAX];
+    struct engine_limits limits;
+    struct timer *timer;
+    struct timer *main_timer;
+    struct snapshot *back;
+    struct snapshot *published;
+    struct snapshot *front;
+    bool has_published;
+    bool has_front;
+};
+
+static err_t publish_snapshot(struct repo_worker *worker) {
+    err_t err = NO_ERROR;
+    struct snapshot *tmp = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+    tmp = worker->published;
+    worker->published = worker->back;
+    worker->back = tmp;
+    worker->has_published = true;
+    pthread_mutex_unlock(&worker->lock);
+
+    RETHROW(timing_notify(worker->main_timer));
+
+cleanup:
+    return err;
+}
+
+static bool should_stop(struct repo_worker *worker) {
+    bool stop = false;
+
+    pthread_mutex_lock(&worker->lock);
+    stop = worker->stop;
+    pthread_mutex_unlock(&worker->lock);
+    return stop;
+}
+
+static void *repo_worker_thread(void *arg) {
+    err_t err = NO_ERROR;
+    struct repo_worker *worker = arg;
+    struct repo_cache *repo_cache = NULL;
+    struct repo_handle *handle = NULL;
+    watch_id_t workdir_watch_id = INVALID_WATCH_ID;
+    struct timing_wakeup wakeup = {0};
+
+    RETHROW(init_repo_cache(&repo_cache, worker->timer));
+    RETHROW(repo_cache_open(repo_cache, worker->path, &handle));
+    ASSERT(git_repository_workdir(handle->repo));
+    RETHROW(timing_add_or_modify_watch(worker->timer, &workdir_watch_id, git_repository_workdir(handle->repo)));
+
+    while (!should_stop(worker)) {
+        RETHROW(compute_snapshot(handle, git_repository_workdir(handle->repo), worker->limits, worker->back));
+        // carried along so the dashboard can measure the latency up to when the change is on screen
+        worker->back->event_arrived = wakeup.inotify_arrived;
+        RETHROW(publish_snapshot(worker));
+        RETHROW(timing_wait(worker->timer));
+        RETHROW(timing_get_wakeup(worker->timer, &wakeup));
+    }
+
+cleanup:
+    if (repo_cache) {
+        RETHROW_PRINT(free_repo_cache(repo_cache));
+    }
+    if (err) {
+        pthread_mutex_lock(&worker->lock);
+        worker->failed = true;
+        pthread_mutex_unlock(&worker->lock);
+        RETHROW_PRINT(timing_notify(worker->main_timer));
+    }
+    return NULL;
+}
+
+err_t init_repo_worker(struct repo_worker **worker, const char *path, struct engine_limits limits,
+                       struct timer_config timer_config, struct timer *main_timer) {
+    err_t err = NO_ERROR;
+    struct repo_worker *result = NULL;
+
+    ASSERT(worker);
+    ASSERT(path);
+    ASSERT(main_timer);
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    strncpy(result->path, path, sizeof(result->path) - 1);
+    result->limits = limits;
+    result->main_timer = main_timer;
+    RETHROW(init_timer(&result->timer, timer_config));
+    RETHROW(init_snapshot(&result->back));
+    RETHROW(init_snapshot(&result->published));
+    RETHROW(init_snapshot(&result->front));
+
+    ASSERT(!pthread_mutex_init(&result->lock, NULL));
+    ASSERT(!pthread_create(&result->thread, NULL, repo_worker_thread, result));
+    result->thread_started = true;
+
+    *worker = result;
+
+cleanup:
+    if (err && result) {
+        RETHROW_PRINT(free_repo_worker(result));
+    }
+    return err;
+}
+
+err_t free_repo_worker(struct repo_worker *worker) {
+    err_t err = NO_ERROR;
+
+    ASSERT(worker);
+
+    if (worker->thread_started) {
+        pthread_mutex_lock(&worker->lock);
+        worker->stop = true;
+        pthread_mutex_unlock(&worker->lock);
+        RETHROW_PRINT(timing_notify(worker->timer));
+        pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&worker->lock);
+    }
+    if (worker->back) {
+        RETHROW_PRINT(free_snapshot(worker->back));
+    }
+    if (worker->published) {
+        RETHROW_PRINT(free_snapshot(worker->published));
+    }
+    if (worker->front) {
+        RETHROW_PRINT(free_snapshot(worker->front));
+    }
+    if (worker->timer) {
+        RETHROW_PRINT(free_timer(worker->timer));
+    }
+    free(worker);
+
+cleanup:
+    return err;
+}
+
+err_t repo_worker_take_snapshot(struct repo_worker *worker, const struct snapshot **out, bool *updated) {
+    err_t err = NO_ERROR;
+    struct snapshot *tmp = NULL;
+    bool failed = false;
+
+    ASSERT(worker);
+    ASSERT(out);
+    ASSERT(updated);
+
+    *updated = false;
+
+    pthread_mutex_lock(&worker->lock);
+    failed = worker->failed;
+    if (worker->has_published) {
+        tmp = worker->front;
+        worker->front = worker->published;
+        worker->published = tmp;
+        worker->has_published = false;
+        worker->has_front = true;
+        *updated = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    ASSERT(!failed);
+    *out = worker->has_front ? worker->front : NULL;
+
+cleanup:
+    return err;
+}
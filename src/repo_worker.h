@@ -0,0 +1,30 @@
+#ifndef GIT_LIVE_REPO_WORKER_H
+#define GIT_LIVE_REPO_WORKER_H
+
+#include <stdbool.h>
+#include "../lib/err.h"
+#include "engine.h"
+#include "snapshot.h"
+#include "timing.h"
+
+/*
+ * A repo worker owns a repository on its own thread, watches its workdir with its own timer and keeps recomputing its
+ * snapshot. Snapshots are triple buffered: the worker computes into a back buffer and swaps it with the published
+ * one, the dashboard swaps the published one with its front buffer when it redraws, so neither side waits on the
+ * other for more than a pointer swap.
+ */
+
+struct repo_worker;
+
+/* main_timer is notified whenever a new snapshot is published. */
+err_t init_repo_worker(struct repo_worker **worker, const char *path, struct engine_limits limits,
+                       struct timer_config timer_config, struct timer *main_timer);
+err_t free_repo_worker(struct repo_worker *worker);
+
+/*
+ * Get the latest snapshot, out is NULL until the first one is published and stays valid until the next call.
+ * Fails if the worker stopped because of an error.
+ */
+err_t repo_worker_take_snapshot(struct repo_worker *worker, const struct snapshot **out, bool *updated);
+
+#endif // GIT_LIVE_REPO_WORKER_H
@@ -0,0 +1,398 @@
+#include "snapshot.h"
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/err.h"
+
+#define INITIAL_ARRAY_CAP (16)
+
+#define SNAPSHOT_FILE_MAGIC (0x70616e73766c6967) // "gilvsnap"
+#define SNAPSHOT_FILE_VERSION (5)
+
+struct snapshot_file_header {
+    uint64_t magic;
+    uint32_t version;
+    // the file is a raw dump, so it is only valid with the same row layout
+    uint32_t row_sizes[4];
+    str_t workdir;
+    str_t head_name;
+    str_t head_tracking;
+    uint64_t status_counts[STATUS_SECTIONS_COUNT];
+    str_t status_scope;
+    uint64_t outside_changes;
+    str_t operation;
+    uint32_t operation_running;
+    uint64_t status_rows;
+    uint64_t ref_rows;
+    uint64_t commit_rows;
+    uint64_t submodule_rows;
+    uint64_t strings;
+};
+
+static const uint32_t row_sizes[4] = {sizeof(struct status_row), sizeof(struct ref_row), sizeof(struct commit_row),
+                                      sizeof(struct submodule_row)};
+
+static err_t grow_array(void **items, size_t *cap, size_t count, size_t item_size, size_t needed) {
+    err_t err = NO_ERROR;
+    size_t new_cap = *cap ? *cap : INITIAL_ARRAY_CAP;
+    void *new_items = NULL;
+
+    if (count + needed <= *cap)
+        goto cleanup;
+
+    while (new_cap < count + needed) {
+        new_cap *= 2;
+    }
+
+    new_items = realloc(*items, new_cap * item_size);
+    ASSERT(new_items);
+
+    *items = new_items;
+    *cap = new_cap;
+
+cleanup:
+    return err;
+}
+
+#define ARRAY_ADD(array, out)                                                                                          \
+    do {                                                                                                               \
+        RETHROW(grow_array((void **)&(array).items, &(array).cap, (array).count, sizeof(*(array).items), 1));          \
+        *(out) = &(array).items[(array).count++];                                                                      \
+        memset(*(out), '\0', sizeof(**(out)));                                                                         \
+    } while (0)
+
+err_t init_snapshot(struct snapshot **snapshot) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+
+    *snapshot = calloc(1, sizeof(**snapshot));
+    ASSERT(*snapshot);
+
+    RETHROW(clear_snapshot(*snapshot));
+
+cleanup:
+    if (err && snapshot && *snapshot) {
+        free(*snapshot);
+        *snapshot = NULL;
+    }
+    return err;
+}
+
+err_t free_snapshot(struct snapshot *snapshot) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+
+    free(snapshot->status_rows.items);
+    free(snapshot->ref_rows.items);
+    free(snapshot->commit_rows.items);
+    free(snapshot->submodule_rows.items);
+    free(snapshot->strings.items);
+    free(snapshot);
+
+cleanup:
+    return err;
+}
+
+err_t clear_snapshot(struct snapshot *snapshot) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+
+    snapshot->event_arrived = 0;
+    snapshot->workdir = EMPTY_STR;
+    snapshot->head_name = EMPTY_STR;
+    snapshot->head_tracking = EMPTY_STR;
+    memset(snapshot->status_counts, '\0', sizeof(snapshot->status_counts));
+    snapshot->status_scope = EMPTY_STR;
+    snapshot->outside_changes = 0;
+    snapshot->operation = EMPTY_STR;
+    snapshot->operation_running = false;
+    snapshot->status_rows.count = 0;
+    snapshot->ref_rows.count = 0;
+    snapshot->commit_rows.count = 0;
+    snapshot->submodule_rows.count = 0;
+
+    // keep the empty string at offset 0
+    snapshot->strings.count = 0;
+    RETHROW(grow_array((void **)&snapshot->strings.items, &snapshot->strings.cap, 0, 1, 1));
+    snapshot->strings.items[snapshot->strings.count++] = '\0';
+
+cleanup:
+    return err;
+}
+
+err_t snapshot_add_string(struct snapshot *snapshot, const char *str, str_t *out) {
+    err_t err = NO_ERROR;
+    size_t len = 0;
+
+    ASSERT(snapshot);
+    ASSERT(str);
+    ASSERT(out);
+
+    len = strlen(str);
+    if (!len) {
+        *out = EMPTY_STR;
+        goto cleanup;
+    }
+
+    ASSERT(snapshot->strings.count + len + 1 < UINT32_MAX);
+    RETHROW(grow_array((void **)&snapshot->strings.items, &snapshot->strings.cap, snapshot->strings.count, 1,
+                       len + 1));
+
+    *out = snapshot->strings.count;
+    memcpy(snapshot->strings.items + snapshot->strings.count, str, len + 1);
+    snapshot->strings.count += len + 1;
+
+cleanup:
+    return err;
+}
+
+const char *snapshot_str(const struct snapshot *snapshot, str_t str) {
+    return snapshot->strings.items + str;
+}
+
+err_t snapshot_add_status_row(struct snapshot *snapshot, struct status_row **out) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+    ASSERT(out);
+
+    ARRAY_ADD(snapshot->status_rows, out);
+
+cleanup:
+    return err;
+}
+
+err_t snapshot_add_ref_row(struct snapshot *snapshot, struct ref_row **out) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+    ASSERT(out);
+
+    ARRAY_ADD(snapshot->ref_rows, out);
+
+cleanup:
+    return err;
+}
+
+err_t snapshot_add_commit_row(struct snapshot *snapshot, struct commit_row **out) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+    ASSERT(out);
+
+    ARRAY_ADD(snapshot->commit_rows, out);
+
+cleanup:
+    return err;
+}
+
+err_t snapshot_add_submodule_row(struct snapshot *snapshot, struct submodule_row **out) {
+    err_t err = NO_ERROR;
+
+    ASSERT(snapshot);
+    ASSERT(out);
+
+    ARRAY_ADD(snapshot->submodule_rows, out);
+
+cleanup:
+    return err;
+}
+
+#define WRITE_ARRAY(file, array)                                                                                       \
+    ASSERT(fwrite((array).items, sizeof(*(array).items), (array).count, file) == (array).count)
+
+#define READ_ARRAY(file, array, amount)                                                                                \
+    do {                                                                                                               \
+        RETHROW(grow_array((void **)&(array).items, &(array).cap, 0, sizeof(*(array).items), (amount)));               \
+        ASSERT(fread((array).items, sizeof(*(array).items), (amount), file) == (amount));                              \
+        (array).count = (amount);                                                                                      \
+    } while (0)
+
+err_t write_snapshot(const struct snapshot *snapshot, FILE *file) {
+    err_t err = NO_ERROR;
+    struct snapshot_file_header header = {0};
+
+    ASSERT(snapshot);
+    ASSERT(file);
+
+    header.magic = SNAPSHOT_FILE_MAGIC;
+    header.version = SNAPSHOT_FILE_VERSION;
+    memcpy(header.row_sizes, row_sizes, sizeof(row_sizes));
+    header.workdir = snapshot->workdir;
+    header.head_name = snapshot->head_name;
+    header.head_tracking = snapshot->head_tracking;
+    for (size_t i = 0; i < STATUS_SECTIONS_COUNT; i++) {
+        header.status_counts[i] = snapshot->status_counts[i];
+    }
+    header.status_scope = snapshot->status_scope;
+    header.outside_changes = snapshot->outside_changes;
+    header.operation = snapshot->operation;
+    header.operation_running = snapshot->operation_running;
+    header.status_rows = snapshot->status_rows.count;
+    header.ref_rows = snapshot->ref_rows.count;
+    header.commit_rows = snapshot->commit_rows.count;
+    header.submodule_rows = snapshot->submodule_rows.count;
+    header.strings = snapshot->strings.count;
+
+    ASSERT(fwrite(&header, sizeof(header), 1, file) == 1);
+    WRITE_ARRAY(file, snapshot->status_rows);
+    WRITE_ARRAY(file, snapshot->ref_rows);
+    WRITE_ARRAY(file, snapshot->commit_rows);
+    WRITE_ARRAY(file, snapshot->submodule_rows);
+    WRITE_ARRAY(file, snapshot->strings);
+
+cleanup:
+    return err;
+}
+
+err_t save_snapshot_file(const struct snapshot *snapshot, const char *path) {
+    err_t err = NO_ERROR;
+    char tmp_path[PATH_MAX] = {0};
+    FILE *file = NULL;
+
+    ASSERT(snapshot);
+    ASSERT(path);
+
+    ASSERT(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) < (int)sizeof(tmp_path));
+
+    file = fopen(tmp_path, "wb");
+    ASSERT(file);
+    RETHROW(write_snapshot(snapshot, file));
+    ASSERT(!fclose(file));
+    file = NULL;
+    ASSERT(!rename(tmp_path, path));
+
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    if (err) {
+        remove(tmp_path);
+    }
+    return err;
+}
+
+/* a stale file must not make the renderer read outside the string pool. */
+static bool is_snapshot_valid(const struct snapshot *snapshot) {
+    size_t strings = snapshot->strings.count;
+
+#define STR_VALID(str) ((str) < strings)
+    if (!strings || snapshot->strings.items[strings - 1] != '\0')
+        return false;
+    if (!STR_VALID(snapshot->workdir) || !STR_VALID(snapshot->head_name) || !STR_VALID(snapshot->head_tracking) ||
+        !STR_VALID(snapshot->status_scope) || !STR_VALID(snapshot->operation))
+        return false;
+    for (size_t i = 0; i < snapshot->status_rows.count; i++) {
+        const struct status_row *row = &snapshot->status_rows.items[i];
+        if (row->section >= STATUS_SECTIONS_COUNT || !STR_VALID(row->status) || !STR_VALID(row->path) ||
+            !STR_VALID(row->old_path))
+            return false;
+    }
+    for (size_t i = 0; i < snapshot->ref_rows.count; i++) {
+        const struct ref_row *row = &snapshot->ref_rows.items[i];
+        if (!STR_VALID(row->name) || !STR_VALID(row->tracking))
+            return false;
+    }
+    for (size_t i = 0; i < snapshot->commit_rows.count; i++) {
+        const struct commit_row *row = &snapshot->commit_rows.items[i];
+        if (!STR_VALID(row->hash) || !STR_VALID(row->summary) || !STR_VALID(row->author))
+            return false;
+    }
+    for (size_t i = 0; i < snapshot->submodule_rows.count; i++) {
+        const struct submodule_row *row = &snapshot->submodule_rows.items[i];
+        if (!STR_VALID(row->path) || !STR_VALID(row->head) || row->state > submodule_state_ready)
+            return false;
+    }
+#undef STR_VALID
+    return true;
+}
+
+/* the snapshot must be all that is left of the file, checked before allocating for the counts it claims. */
+static bool is_size_valid(FILE *file, const struct snapshot_file_header *header) {
+    long start = 0;
+    long end = 0;
+    uint64_t expected = 0;
+    const uint64_t counts[] = {header->status_rows, header->ref_rows, header->commit_rows, header->submodule_rows,
+                               header->strings};
+    const uint64_t sizes[] = {row_sizes[0], row_sizes[1], row_sizes[2], row_sizes[3], sizeof(char)};
+
+    if ((start = ftell(file)) < 0 || fseek(file, 0, SEEK_END) || (end = ftell(file)) < 0 ||
+        fseek(file, start, SEEK_SET))
+        return false;
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        if (counts[i] > (uint64_t)(end - start))
+            return false;
+        expected += counts[i] * sizes[i];
+    }
+    return expected == (uint64_t)(end - start);
+}
+
+err_t read_snapshot(struct snapshot *snapshot, FILE *file, bool *loaded) {
+    err_t err = NO_ERROR;
+    struct snapshot_file_header header = {0};
+
+    ASSERT(snapshot);
+    ASSERT(file);
+    ASSERT(loaded);
+
+    *loaded = false;
+    RETHROW(clear_snapshot(snapshot));
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != SNAPSHOT_FILE_MAGIC ||
+        header.version != SNAPSHOT_FILE_VERSION || memcmp(header.row_sizes, row_sizes, sizeof(row_sizes)))
+        goto cleanup;
+    if (!is_size_valid(file, &header))
+        goto cleanup;
+
+    snapshot->workdir = header.workdir;
+    snapshot->head_name = header.head_name;
+    snapshot->head_tracking = header.head_tracking;
+    for (size_t i = 0; i < STATUS_SECTIONS_COUNT; i++) {
+        snapshot->status_counts[i] = header.status_counts[i];
+    }
+    snapshot->status_scope = header.status_scope;
+    snapshot->outside_changes = header.outside_changes;
+    snapshot->operation = header.operation;
+    snapshot->operation_running = header.operation_running;
+    READ_ARRAY(file, snapshot->status_rows, header.status_rows);
+    READ_ARRAY(file, snapshot->ref_rows, header.ref_rows);
+    READ_ARRAY(file, snapshot->commit_rows, header.commit_rows);
+    READ_ARRAY(file, snapshot->submodule_rows, header.submodule_rows);
+    READ_ARRAY(file, snapshot->strings, header.strings);
+
+    *loaded = is_snapshot_valid(snapshot);
+
+cleanup:
+    // a truncated or corrupted file is the same as no file
+    if (!err && !*loaded) {
+        err = clear_snapshot(snapshot);
+    }
+    return err;
+}
+
+err_t load_snapshot_file(struct snapshot *snapshot, const char *path, bool *loaded) {
+    err_t err = NO_ERROR;
+    FILE *file = NULL;
+
+    ASSERT(snapshot);
+    ASSERT(path);
+    ASSERT(loaded);
+
+    *loaded = false;
+    file = fopen(path, "rb");
+    if (!file) {
+        RETHROW(clear_snapshot(snapshot));
+        goto cleanup;
+    }
+    RETHROW(read_snapshot(snapshot, file, loaded));
+
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    return err;
+}
@@ -0,0 +1,131 @@
+#ifndef GIT_LIVE_SNAPSHOT_H
+#define GIT_LIVE_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "../lib/err.h"
+#include "diffstat.h"
+
+/*
+ * A snapshot is everything the dashboard shows about a repository at one point in time, it is computed by the engine
+ * and rendered separately, so it can be computed on another thread.
+ * All strings live in a single pool and are referenced by offset, which keeps a snapshot in a handful of allocations
+ * that are reused when it is cleared and recomputed.
+ */
+
+// offset of a string in the snapshot string pool, the empty string is always at offset 0
+typedef uint32_t str_t;
+
+#define EMPTY_STR ((str_t)0)
+
+#define SNAPSHOT_ARRAY(type)                                                                                           \
+    struct {                                                                                                           \
+        type *items;                                                                                                   \
+        size_t count;                                                                                                  \
+        size_t cap;                                                                                                    \
+    }
+
+enum status_section {
+    status_section_staged = 0,
+    status_section_changed,
+    status_section_untracked,
+    STATUS_SECTIONS_COUNT,
+};
+
+struct status_row {
+    enum status_section section;
+    str_t status;
+    str_t path;
+    // only differs from path for renames
+    str_t old_path;
+    struct diffstat diffstat;
+    // untracked directories are a single row, the files in them are counted in the background
+    size_t files;
+    bool counting;
+    // the files could not be counted, no count is shown
+    bool count_failed;
+};
+
+struct ref_row {
+    str_t name;
+    str_t tracking;
+    // the position of the checkout in the reflog
+    size_t index;
+};
+
+struct commit_row {
+    str_t hash;
+    str_t summary;
+    str_t author;
+    int64_t time;
+};
+
+enum submodule_state {
+    submodule_state_pending = 0,
+    // not initialized, or its recorded commit is not in its odb
+    submodule_state_missing,
+    submodule_state_ready,
+};
+
+struct submodule_row {
+    str_t path;
+    // branch name, or abbreviated commit when detached
+    str_t head;
+    enum submodule_state state;
+    bool dirty;
+    bool detached;
+    // relative to the commit recorded in the superproject's index
+    size_t ahead;
+    size_t behind;
+};
+
+struct snapshot {
+    // when the inotify event this snapshot was computed for arrived (stats_now_us clock), 0 if it was not an event
+    uint64_t event_arrived;
+    str_t workdir;
+    str_t head_name;
+    str_t head_tracking;
+    size_t status_counts[STATUS_SECTIONS_COUNT];
+    // the directory the status rows are limited to, relative to the work tree, empty when they cover all of it
+    str_t status_scope;
+    // tracked changes outside status_scope, as of the last time they were counted
+    size_t outside_changes;
+    // the operation the repository is in the middle of, named like git's prompt does ("MERGING"), empty if none
+    str_t operation;
+    // a git command is rewriting the work tree right now, the status is the one from before it started
+    bool operation_running;
+    SNAPSHOT_ARRAY(struct status_row) status_rows;
+    SNAPSHOT_ARRAY(struct ref_row) ref_rows;
+    SNAPSHOT_ARRAY(struct commit_row) commit_rows;
+    SNAPSHOT_ARRAY(struct submodule_row) submodule_rows;
+    SNAPSHOT_ARRAY(char) strings;
+};
+
+err_t init_snapshot(struct snapshot **snapshot);
+err_t free_snapshot(struct snapshot *snapshot);
+/* forget the contents but keep the allocations for the next computation. */
+err_t clear_snapshot(struct snapshot *snapshot);
+
+err_t snapshot_add_string(struct snapshot *snapshot, const char *str, str_t *out);
+const char *snapshot_str(const struct snapshot *snapshot, str_t str);
+
+err_t snapshot_add_status_row(struct snapshot *snapshot, struct status_row **out);
+err_t snapshot_add_ref_row(struct snapshot *snapshot, struct ref_row **out);
+err_t snapshot_add_commit_row(struct snapshot *snapshot, struct commit_row **out);
+err_t snapshot_add_submodule_row(struct snapshot *snapshot, struct submodule_row **out);
+
+/*
+ * The snapshot file is a raw dump of the arrays behind a header, it is only meant to be read back by the same build
+ * (the header records the row sizes, files of another layout are ignored) so the last frame can be shown at startup.
+ */
+err_t write_snapshot(const struct snapshot *snapshot, FILE *file);
+/* reads up to the end of the file, loaded is false when it does not hold a usable snapshot. */
+err_t read_snapshot(struct snapshot *snapshot, FILE *file, bool *loaded);
+/* written to a temporary file and renamed over path, so readers never see a partial file. */
+err_t save_snapshot_file(const struct snapshot *snapshot, const char *path);
+/* loaded is false when there is no usable file, the snapshot is then left cleared. */
+err_t load_snapshot_file(struct snapshot *snapshot, const char *path, bool *loaded);
+
+#endif // GIT_LIVE_SNAPSHOT_H
@@ -0,0 +1,384 @@
+#include "staged_scan.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "../lib/err.h"
+#include "index_file.h"
+#include "utils.h"
+
+#define MODE_DIRECTORY (0040000)
+
+struct staged_scanner {
+    git_repository *repo;
+    struct index_file *index;
+    // the index has entries that only libgit2 diffs right
+    bool needs_libgit2;
+    // what the changes were computed from
+    bool computed;
+    git_oid head_tree;
+    char scope[PATH_MAX];
+    // the directory being walked, with a trailing slash
+    char prefix[PATH_MAX];
+    struct staged_change *changes;
+    size_t changes_count;
+    size_t changes_cap;
+    // the paths of the changes, the offsets are turned into pointers once the walk is done
+    char *paths;
+    size_t paths_len;
+    size_t paths_cap;
+};
+
+static bool needs_libgit2(const struct index_entry *entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].stage || entries[i].intent_to_add || (entries[i].mode & S_IFMT) == MODE_DIRECTORY)
+            return true;
+    }
+    return false;
+}
+
+/* zero for an unborn HEAD, everything in the index is new then. */
+static err_t get_head_tree(git_repository *repo, git_oid *out) {
+    err_t err = NO_ERROR;
+    git_oid commit_id = {0};
+    git_commit *commit = NULL;
+
+    memset(out, 0, sizeof(*out));
+    if (git_reference_name_to_id(&commit_id, repo, "HEAD"))
+        goto cleanup;
+    ASSERT(!git_commit_lookup(&commit, repo, &commit_id));
+    git_oid_cpy(out, git_commit_tree_id(commit));
+
+cleanup:
+    git_commit_free(commit);
+    return err;
+}
+
+/* the path is the first prefix_len bytes of the walked directory followed by name. */
+static err_t add_change(struct staged_scanner *scanner, size_t prefix_len, const char *name, const char *status,
+                        const git_oid *old_id, uint32_t old_mode, const git_oid *new_id, uint32_t new_mode) {
+    err_t err = NO_ERROR;
+    size_t name_len = strlen(name);
+    size_t needed = scanner->paths_len + prefix_len + name_len + 1;
+    struct staged_change *grown = NULL;
+    char *grown_paths = NULL;
+
+    if (scanner->changes_count == scanner->changes_cap) {
+        grown = realloc(scanner->changes, MAX(16, scanner->changes_cap * 2) * sizeof(*grown));
+        ASSERT(grown);
+        scanner->changes = grown;
+        scanner->changes_cap = MAX(16, scanner->changes_cap * 2);
+    }
+    if (needed > scanner->paths_cap) {
+        grown_paths = realloc(scanner->paths, MAX(needed, scanner->paths_cap * 2));
+        ASSERT(grown_paths);
+        scanner->paths = grown_paths;
+        scanner->paths_cap = MAX(needed, scanner->paths_cap * 2);
+    }
+
+    scanner->changes[scanner->changes_count] = (struct staged_change){
+        .path = (const char *)(uintptr_t)scanner->paths_len,
+        .status = status,
+        .old_mode = old_mode,
+        .new_mode = new_mode,
+    };
+    if (old_id) {
+        git_oid_cpy(&scanner->changes[scanner->changes_count].old_id, old_id);
+    }
+    if (new_id) {
+        git_oid_cpy(&scanner->changes[scanner->changes_count].new_id, new_id);
+    }
+    scanner->changes_count++;
+
+    memcpy(scanner->paths + scanner->paths_len, scanner->prefix, prefix_len);
+    memcpy(scanner->paths + scanner->paths_len + prefix_len, name, name_len + 1);
+    scanner->paths_len = needed;
+
+cleanup:
+    return err;
+}
+
+/* like git orders tree entries, a directory sorts as if its name ended with a slash. */
+static int compare_names(const char *a, size_t a_len, bool a_dir, const char *b, size_t b_len, bool b_dir) {
+    size_t len = MIN(a_len, b_len);
+    int cmp = memcmp(a, b, len);
+    unsigned char a_next = 0;
+    unsigned char b_next = 0;
+
+    if (cmp)
+        return cmp;
+    a_next = len < a_len ? a[len] : a_dir ? '/' : '\0';
+    b_next = len < b_len ? b[len] : b_dir ? '/' : '\0';
+    return a_next - b_next;
+}
+
+/* the end of the entries in [start, end) whose paths start with the first len bytes of the path at start. */
+static size_t find_dir_end(const struct index_entry *entries, size_t start, size_t end, size_t len) {
+    const char *dir = entries[start].path;
+    size_t low = start + 1;
+    size_t high = end;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (strncmp(entries[mid].path, dir, len) <= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static err_t diff_file(struct staged_scanner *scanner, const git_tree_entry *tree_entry,
+                       const struct index_entry *entry) {
+    err_t err = NO_ERROR;
+    uint32_t mode = git_tree_entry_filemode(tree_entry);
+
+    if (git_oid_equal(git_tree_entry_id(tree_entry), &entry->id) && mode == entry->mode)
+        goto cleanup;
+    // a file that became a symlink or a submodule, or the other way around
+    RETHROW(add_change(scanner, 0, entry->path, (mode & S_IFMT) == (entry->mode & S_IFMT) ? "modified" : "typechange",
+                       git_tree_entry_id(tree_entry), mode, &entry->id, entry->mode));
+
+cleanup:
+    return err;
+}
+
+static err_t diff_subdir(struct staged_scanner *scanner, const git_tree_entry *tree_entry, size_t prefix_len,
+                         const char *name, size_t name_len, const struct index_entry *entries, size_t start,
+                         size_t end);
+
+/*
+ * The changes between the tree tree_id (NULL if HEAD has no such directory) and the index entries [start, end), which
+ * are the ones under the directory in the first prefix_len bytes of scanner->prefix.
+ */
+static err_t diff_dir(struct staged_scanner *scanner, const git_oid *tree_id, size_t prefix_len,
+                      const struct index_entry *entries, size_t start, size_t end) {
+    err_t err = NO_ERROR;
+    git_tree *tree = NULL;
+    const struct index_tree *cached = NULL;
+    size_t tree_count = 0;
+    size_t t = 0;
+    size_t i = start;
+
+    scanner->prefix[prefix_len] = '\0';
+    cached = tree_id && start < end ? index_file_find_tree(scanner->index, scanner->prefix) : NULL;
+    // git computed the same tree from these entries, nothing under it is staged
+    if (cached && cached->valid && git_oid_equal(&cached->id, tree_id))
+        goto cleanup;
+    if (tree_id) {
+        ASSERT(!git_tree_lookup(&tree, scanner->repo, tree_id));
+        tree_count = git_tree_entrycount(tree);
+    }
+
+    // both are in the same order, so they are merged like two sorted lists
+    while (t < tree_count || i < end) {
+        const git_tree_entry *tree_entry = t < tree_count ? git_tree_entry_byindex(tree, t) : NULL;
+        const char *tree_name = tree_entry ? git_tree_entry_name(tree_entry) : NULL;
+        bool tree_dir = tree_entry && git_tree_entry_type(tree_entry) == GIT_OBJECT_TREE;
+        const char *name = i < end ? entries[i].path + prefix_len : NULL;
+        const char *slash = name ? strchr(name, '/') : NULL;
+        size_t name_len = slash ? (size_t)(slash - name) : name ? strlen(name) : 0;
+        size_t next = i + 1;
+        int cmp = 0;
+
+        if (!tree_entry) {
+            cmp = 1;
+        } else if (!name) {
+            cmp = -1;
+        } else {
+            cmp = compare_names(tree_name, strlen(tree_name), tree_dir, name, name_len, slash);
+        }
+        if (slash && cmp >= 0) {
+            next = find_dir_end(entries, i, end, prefix_len + name_len + 1);
+        }
+
+        if (cmp < 0 && tree_dir) {
+            // only in HEAD, everything under it was deleted
+            RETHROW(diff_subdir(scanner, tree_entry, prefix_len, tree_name, strlen(tree_name), entries, i, i));
+        } else if (cmp < 0) {
+            RETHROW(add_change(scanner, prefix_len, tree_name, "deleted", git_tree_entry_id(tree_entry),
+                               git_tree_entry_filemode(tree_entry), NULL, 0));
+        } else if (slash) {
+            // a directory only compares equal to a directory
+            RETHROW(diff_subdir(scanner, cmp ? NULL : tree_entry, prefix_len, name, name_len, entries, i, next));
+        } else if (cmp > 0) {
+            RETHROW(add_change(scanner, 0, entries[i].path, "new", NULL, 0, &entries[i].id, entries[i].mode));
+        } else {
+            RETHROW(diff_file(scanner, tree_entry, &entries[i]));
+        }
+
+        if (cmp <= 0) {
+            t++;
+        }
+        if (cmp >= 0) {
+            i = next;
+        }
+    }
+
+cleanup:
+    git_tree_free(tree);
+    return err;
+}
+
+static err_t diff_subdir(struct staged_scanner *scanner, const git_tree_entry *tree_entry, size_t prefix_len,
+                         const char *name, size_t name_len, const struct index_entry *entries, size_t start,
+                         size_t end) {
+    err_t err = NO_ERROR;
+    size_t len = prefix_len + name_len + 1;
+
+    ASSERT(len < sizeof(scanner->prefix));
+    memcpy(scanner->prefix + prefix_len, name, name_len);
+    scanner->prefix[len - 1] = '/';
+    RETHROW(diff_dir(scanner, tree_entry ? git_tree_entry_id(tree_entry) : NULL, len, entries, start, end));
+
+cleanup:
+    return err;
+}
+
+/* the tree of the scope directory in HEAD, zero if it is not a directory there. */
+static err_t get_scope_tree(git_repository *repo, const git_oid *head_tree, const char *scope, git_oid *out) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+    size_t len = strlen(scope);
+    git_tree *root = NULL;
+    git_tree_entry *entry = NULL;
+
+    memset(out, 0, sizeof(*out));
+    if (git_oid_is_zero(head_tree))
+        goto cleanup;
+    if (!len) {
+        git_oid_cpy(out, head_tree);
+        goto cleanup;
+    }
+
+    ASSERT(len < sizeof(path));
+    memcpy(path, scope, len - 1);
+    ASSERT(!git_tree_lookup(&root, repo, head_tree));
+    if (!git_tree_entry_bypath(&entry, root, path) && git_tree_entry_type(entry) == GIT_OBJECT_TREE) {
+        git_oid_cpy(out, git_tree_entry_id(entry));
+    }
+
+cleanup:
+    git_tree_entry_free(entry);
+    git_tree_free(root);
+    return err;
+}
+
+static err_t compute_changes(struct staged_scanner *scanner, const git_oid *head_tree, const char *scope) {
+    err_t err = NO_ERROR;
+    const struct index_entry *entries = NULL;
+    size_t entries_count = 0;
+    size_t scope_len = strlen(scope);
+    size_t start = 0;
+    size_t end = 0;
+    git_oid tree_id = {0};
+
+    ASSERT(scope_len < sizeof(scanner->scope));
+
+    scanner->computed = false;
+    scanner->changes_count = 0;
+    scanner->paths_len = 0;
+
+    entries = index_file_entries(scanner->index, &entries_count);
+    end = entries_count;
+    if (scope_len) {
+        start = index_file_find_prefix(scanner->index, scope);
+        end = start < entries_count ? find_dir_end(entries, start, entries_count, scope_len) : start;
+    }
+
+    RETHROW(get_scope_tree(scanner->repo, head_tree, scope, &tree_id));
+    memcpy(scanner->prefix, scope, scope_len);
+    RETHROW(diff_dir(scanner, git_oid_is_zero(&tree_id) ? NULL : &tree_id, scope_len, entries, start, end));
+
+    for (size_t i = 0; i < scanner->changes_count; i++) {
+        scanner->changes[i].path = scanner->paths + (uintptr_t)scanner->changes[i].path;
+    }
+    git_oid_cpy(&scanner->head_tree, head_tree);
+    strcpy(scanner->scope, scope);
+    scanner->computed = true;
+
+cleanup:
+    return err;
+}
+
+err_t staged_scan(struct staged_scanner *scanner, const char *scope, const struct staged_change **changes,
+                  size_t *count, bool *supported) {
+    err_t err = NO_ERROR;
+    const struct index_entry *entries = NULL;
+    size_t entries_count = 0;
+    git_oid head_tree = {0};
+    bool changed = false;
+
+    ASSERT(scanner);
+    ASSERT(scope);
+    ASSERT(changes);
+    ASSERT(count);
+    ASSERT(supported);
+
+    *changes = NULL;
+    *count = 0;
+
+    RETHROW(index_file_refresh(scanner->index, supported, &changed));
+    if (changed) {
+        entries = index_file_entries(scanner->index, &entries_count);
+        scanner->computed = false;
+        scanner->needs_libgit2 = needs_libgit2(entries, entries_count);
+    }
+    if (!*supported || scanner->needs_libgit2) {
+        *supported = false;
+        goto cleanup;
+    }
+
+    RETHROW(get_head_tree(scanner->repo, &head_tree));
+    if (!scanner->computed || !git_oid_equal(&head_tree, &scanner->head_tree) || strcmp(scope, scanner->scope)) {
+        RETHROW(compute_changes(scanner, &head_tree, scope));
+    }
+    *changes = scanner->changes;
+    *count = scanner->changes_count;
+
+cleanup:
+    return err;
+}
+
+err_t init_staged_scanner(struct staged_scanner **scanner, git_repository *repo) {
+    err_t err = NO_ERROR;
+    struct staged_scanner *result = NULL;
+
+    ASSERT(scanner);
+    ASSERT(repo);
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    result->repo = repo;
+    RETHROW(init_index_file(&result->index, git_repository_path(repo)));
+
+    *scanner = result;
+    result = NULL;
+
+cleanup:
+    if (result) {
+        RETHROW_PRINT(free_staged_scanner(result));
+    }
+    return err;
+}
+
+err_t free_staged_scanner(struct staged_scanner *scanner) {
+    err_t err = NO_ERROR;
+
+    ASSERT(scanner);
+
+    if (scanner->index) {
+        RETHROW_PRINT(free_index_file(scanner->index));
+    }
+    free(scanner->changes);
+    free(scanner->paths);
+    free(scanner);
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,45 @@
+#ifndef GIT_LIVE_STAGED_SCAN_H
+#define GIT_LIVE_STAGED_SCAN_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * The staged section is the difference between the tree of HEAD and the memory mapped index. The index is walked
+ * together with the trees, and a directory whose cache tree id (see index_file.h) is the id of the tree in HEAD has
+ * nothing staged, so it is skipped without looking at its entries or reading its tree. The changes are kept until
+ * the index content, the tree of HEAD or the scope change, so the section costs a stat of the index and a lookup of
+ * HEAD while nothing is staged or unstaged.
+ * Conflicts, intent to add entries and sparse directories are left to libgit2.
+ */
+
+struct staged_change {
+    const char *path;
+    // "new", "modified", "deleted" or "typechange"
+    const char *status;
+    // zero for a new file
+    git_oid old_id;
+    // zero for a deleted file
+    git_oid new_id;
+    // zero for the missing side, like the ids
+    uint32_t old_mode;
+    uint32_t new_mode;
+};
+
+struct staged_scanner;
+
+err_t init_staged_scanner(struct staged_scanner **scanner, git_repository *repo);
+err_t free_staged_scanner(struct staged_scanner *scanner);
+
+/*
+ * The staged files in scope (relative to the work tree with a trailing slash, empty for all of it) in path order.
+ * They stay valid until the next scan. supported is false when the index has something only libgit2 handles, the
+ * caller then falls back to git status.
+ */
+err_t staged_scan(struct staged_scanner *scanner, const char *scope, const struct staged_change **changes,
+                  size_t *count, bool *supported);
+
+#endif // GIT_LIVE_STAGED_SCAN_H
@@ -0,0 +1,353 @@
+#include "stats.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include "../lib/err.h"
+#include "../lib/layout/layout.h"
+#include "trace.h"
+#include "utils.h"
+
+// samples below this are counted exactly, above it every power of two is split in STATS_SUB_BUCKETS buckets
+#define STATS_LINEAR_LIMIT (16)
+#define STATS_SUB_BUCKETS_LOG (3)
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BUCKETS_LOG)
+#define STATS_BUCKETS (STATS_LINEAR_LIMIT + (32 - 4) * STATS_SUB_BUCKETS)
+
+#define OVERLAY_PHASES (3)
+
+#define BYTES_IN_KB (1024)
+
+// the allocators first, so they can be indexed by enum stats_allocator
+#define MEMORY_SOURCE_LAYOUT (STATS_ALLOCATORS_COUNT)
+#define MEMORY_SOURCES_COUNT (STATS_ALLOCATORS_COUNT + 1)
+
+struct phase_stats {
+    uint32_t samples[STATS_WINDOW];
+    uint16_t buckets[STATS_BUCKETS];
+    size_t next;
+    size_t count;
+    uint64_t total_count;
+};
+
+struct allocator_counters {
+    uint64_t allocations;
+    uint64_t live_count;
+    uint64_t live_bytes;
+};
+
+struct memory_stats {
+    struct allocator_counters sampled;
+    uint32_t per_frame[STATS_WINDOW];
+    size_t next;
+    size_t count;
+};
+
+static const char *memory_source_names[MEMORY_SOURCES_COUNT] = {
+    [stats_allocator_refs] = "refs",
+    [MEMORY_SOURCE_LAYOUT] = "layout_nodes",
+};
+
+static const char *phase_names[STATS_PHASES_COUNT] = {
+    [stats_phase_wait] = "wait",
+    [stats_phase_status_cache] = "status_cache",
+    [stats_phase_status_staged] = "status_staged",
+    [stats_phase_status_changed] = "status_changed",
+    [stats_phase_status_untracked] = "status_untracked",
+    [stats_phase_status_outside] = "status_outside",
+    [stats_phase_refs] = "refs",
+    [stats_phase_commits] = "commits",
+    [stats_phase_render] = "render",
+    [stats_phase_layout] = "layout",
+    [stats_phase_refresh] = "refresh",
+    [stats_phase_frame] = "frame",
+    [stats_phase_event_to_screen] = "event_to_screen",
+};
+
+static const char *phase_categories[STATS_PHASES_COUNT] = {
+    [stats_phase_wait] = "timer",
+    [stats_phase_status_cache] = "git",
+    [stats_phase_status_staged] = "git",
+    [stats_phase_status_changed] = "git",
+    [stats_phase_status_untracked] = "git",
+    [stats_phase_status_outside] = "git",
+    [stats_phase_refs] = "git",
+    [stats_phase_commits] = "git",
+    [stats_phase_render] = "layout",
+    [stats_phase_layout] = "layout",
+    [stats_phase_refresh] = "draw",
+    [stats_phase_frame] = "frame",
+    [stats_phase_event_to_screen] = "latency",
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct phase_stats stats[STATS_PHASES_COUNT];
+static struct memory_stats memory[MEMORY_SOURCES_COUNT];
+static int64_t git_cached_bytes = 0;
+static int64_t git_cache_limit = 0;
+
+// counted by whatever thread allocates, so only touched atomically
+static struct allocator_counters allocators[STATS_ALLOCATORS_COUNT];
+
+static size_t get_bucket(uint32_t value) {
+    uint32_t exponent = 0;
+
+    if (value < STATS_LINEAR_LIMIT)
+        return value;
+
+    exponent = 31 - __builtin_clz(value);
+    return STATS_LINEAR_LIMIT + (exponent - 4) * STATS_SUB_BUCKETS +
+           ((value >> (exponent - STATS_SUB_BUCKETS_LOG)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/* the largest value that falls in the bucket, so percentiles are never reported lower than they are. */
+static uint32_t get_bucket_limit(size_t bucket) {
+    uint32_t exponent = 0;
+    uint32_t sub_bucket = 0;
+
+    if (bucket < STATS_LINEAR_LIMIT)
+        return bucket;
+
+    exponent = (bucket - STATS_LINEAR_LIMIT) / STATS_SUB_BUCKETS + 4;
+    sub_bucket = (bucket - STATS_LINEAR_LIMIT) % STATS_SUB_BUCKETS;
+    return (uint32_t)((((uint64_t)STATS_SUB_BUCKETS + sub_bucket + 1) << (exponent - STATS_SUB_BUCKETS_LOG)) - 1);
+}
+
+/* must be called with the lock held. */
+static uint32_t get_max(const struct phase_stats *phase) {
+    uint32_t max = 0;
+
+    for (size_t i = 0; i < phase->count; i++) {
+        max = MAX(max, phase->samples[i]);
+    }
+    return max;
+}
+
+/* must be called with the lock held. */
+static uint32_t get_percentile(const struct phase_stats *phase, uint32_t percent) {
+    size_t seen = 0;
+    size_t rank = (phase->count * percent + 99) / 100;
+
+    for (size_t bucket = 0; bucket < STATS_BUCKETS; bucket++) {
+        seen += phase->buckets[bucket];
+        if (seen >= rank && seen)
+            return MIN(get_bucket_limit(bucket), get_max(phase));
+    }
+    return 0;
+}
+
+uint64_t stats_now_us() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * USEC_IN_SEC + ts.tv_nsec / NSEC_IN_USEC;
+}
+
+void stats_record(enum stats_phase phase, uint64_t started) {
+    uint64_t now = stats_now_us();
+    uint64_t elapsed = now - started;
+    uint32_t sample = (uint32_t)MIN(elapsed, UINT32_MAX);
+    struct phase_stats *curr = &stats[phase];
+
+    pthread_mutex_lock(&stats_lock);
+    if (curr->count == STATS_WINDOW) {
+        curr->buckets[get_bucket(curr->samples[curr->next])]--;
+    } else {
+        curr->count++;
+    }
+    curr->samples[curr->next] = sample;
+    curr->buckets[get_bucket(sample)]++;
+    curr->next = (curr->next + 1) % STATS_WINDOW;
+    curr->total_count++;
+    pthread_mutex_unlock(&stats_lock);
+
+    trace_span(phase_names[phase], phase_categories[phase], started, now);
+}
+
+void stats_count_alloc(enum stats_allocator allocator, size_t bytes) {
+    __atomic_add_fetch(&allocators[allocator].allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocators[allocator].live_count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocators[allocator].live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void stats_count_free(enum stats_allocator allocator, size_t bytes) {
+    __atomic_sub_fetch(&allocators[allocator].live_count, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&allocators[allocator].live_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/* must be called with the lock held. */
+static void sample_memory_source(struct memory_stats *source, struct allocator_counters counters) {
+    // the layout counters can be reset under us, then everything since is new
+    uint64_t allocated = counters.allocations >= source->sampled.allocations
+                             ? counters.allocations - source->sampled.allocations
+                             : counters.allocations;
+
+    source->per_frame[source->next] = (uint32_t)MIN(allocated, UINT32_MAX);
+    source->next = (source->next + 1) % STATS_WINDOW;
+    source->count = MIN(source->count + 1, STATS_WINDOW);
+    source->sampled = counters;
+}
+
+/* must be called with the lock held. */
+static uint32_t get_last_frame_allocations(const struct memory_stats *source) {
+    return source->count ? source->per_frame[(source->next + STATS_WINDOW - 1) % STATS_WINDOW] : 0;
+}
+
+/* must be called with the lock held. */
+static uint32_t get_max_frame_allocations(const struct memory_stats *source) {
+    uint32_t max = 0;
+
+    for (size_t i = 0; i < source->count; i++) {
+        max = MAX(max, source->per_frame[i]);
+    }
+    return max;
+}
+
+void stats_sample_memory() {
+    struct layout_counters layout = {0};
+    struct allocator_counters counters = {0};
+    ssize_t cached = 0;
+    ssize_t limit = 0;
+
+    get_layout_counters(&layout);
+    git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &cached, &limit);
+
+    pthread_mutex_lock(&stats_lock);
+    for (size_t allocator = 0; allocator < STATS_ALLOCATORS_COUNT; allocator++) {
+        counters.allocations = __atomic_load_n(&allocators[allocator].allocations, __ATOMIC_RELAXED);
+        counters.live_count = __atomic_load_n(&allocators[allocator].live_count, __ATOMIC_RELAXED);
+        counters.live_bytes = __atomic_load_n(&allocators[allocator].live_bytes, __ATOMIC_RELAXED);
+        sample_memory_source(&memory[allocator], counters);
+    }
+    sample_memory_source(&memory[MEMORY_SOURCE_LAYOUT], (struct allocator_counters){
+                                                            .allocations = layout.allocations,
+                                                            .live_count = layout.live_nodes,
+                                                            .live_bytes = layout.live_bytes,
+                                                        });
+    git_cached_bytes = cached;
+    git_cache_limit = limit;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void format_us(uint32_t us, char *buff, size_t len) {
+    if (us < MSEC_IN_SEC) {
+        snprintf(buff, len, "%uus", us);
+    } else {
+        snprintf(buff, len, "%u.%ums", us / MSEC_IN_SEC, us % MSEC_IN_SEC / 100);
+    }
+}
+
+err_t stats_format_overlay(char *buff, size_t len) {
+    err_t err = NO_ERROR;
+    enum stats_phase slowest[OVERLAY_PHASES] = {0};
+    uint32_t slowest_p95[OVERLAY_PHASES] = {0};
+    char p50[16];
+    char p95[16];
+    char max[16];
+    size_t written = 0;
+
+    ASSERT(buff);
+    ASSERT(len > 0);
+
+    pthread_mutex_lock(&stats_lock);
+
+    format_us(get_percentile(&stats[stats_phase_frame], 50), p50, sizeof(p50));
+    format_us(get_percentile(&stats[stats_phase_frame], 95), p95, sizeof(p95));
+    format_us(get_max(&stats[stats_phase_frame]), max, sizeof(max));
+    written = snprintf(buff, len, "frame p50 %s p95 %s max %s", p50, p95, max);
+
+    if (stats[stats_phase_event_to_screen].count && written < len) {
+        format_us(get_percentile(&stats[stats_phase_event_to_screen], 50), p50, sizeof(p50));
+        format_us(get_percentile(&stats[stats_phase_event_to_screen], 95), p95, sizeof(p95));
+        written += snprintf(buff + written, len - written, "  event p50 %s p95 %s", p50, p95);
+    }
+
+    // the frame total alone does not say where to look, so also show the phases with the worst tail
+    for (size_t phase = 0; phase < stats_phase_frame; phase++) {
+        uint32_t curr = get_percentile(&stats[phase], 95);
+        if (phase == stats_phase_wait)
+            continue;
+        for (size_t i = 0; i < OVERLAY_PHASES; i++) {
+            if (curr <= slowest_p95[i])
+                continue;
+            memmove(&slowest[i + 1], &slowest[i], (OVERLAY_PHASES - i - 1) * sizeof(*slowest));
+            memmove(&slowest_p95[i + 1], &slowest_p95[i], (OVERLAY_PHASES - i - 1) * sizeof(*slowest_p95));
+            slowest[i] = phase;
+            slowest_p95[i] = curr;
+            break;
+        }
+    }
+    for (size_t i = 0; i < OVERLAY_PHASES && slowest_p95[i] && written < len; i++) {
+        format_us(slowest_p95[i], p95, sizeof(p95));
+        written += snprintf(buff + written, len - written, "  %s p95 %s", phase_names[slowest[i]], p95);
+    }
+
+    if (memory[MEMORY_SOURCE_LAYOUT].count && written < len) {
+        uint64_t allocations = 0;
+        uint64_t live_bytes = 0;
+        for (size_t source = 0; source < MEMORY_SOURCES_COUNT; source++) {
+            allocations += get_last_frame_allocations(&memory[source]);
+            live_bytes += memory[source].sampled.live_bytes;
+        }
+        written += snprintf(buff + written, len - written, "\nallocs/frame %lu  nodes %lu  %lukB  git cache %ldkB",
+                            allocations, memory[MEMORY_SOURCE_LAYOUT].sampled.live_count, live_bytes / BYTES_IN_KB,
+                            git_cached_bytes / BYTES_IN_KB);
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+
+cleanup:
+    return err;
+}
+
+err_t stats_dump(const char *path) {
+    err_t err = NO_ERROR;
+    FILE *file = NULL;
+    char dir[PATH_MAX] = {0};
+    char *slash = NULL;
+
+    ASSERT(path);
+    ASSERT(strlen(path) < sizeof(dir));
+
+    // the directory is only created once there is something to put in it
+    strcpy(dir, path);
+    slash = strrchr(dir, '/');
+    if (slash && slash != dir) {
+        *slash = '\0';
+        RETHROW(make_dirs(dir));
+    }
+
+    file = fopen(path, "w");
+    ASSERT(file);
+
+    pthread_mutex_lock(&stats_lock);
+    fprintf(file, "%-18s %10s %10s %10s %10s %10s\n", "phase", "total", "window", "p50_us", "p95_us", "max_us");
+    for (size_t phase = 0; phase < STATS_PHASES_COUNT; phase++) {
+        fprintf(file, "%-18s %10lu %10zu %10u %10u %10u\n", phase_names[phase], stats[phase].total_count,
+                stats[phase].count, get_percentile(&stats[phase], 50), get_percentile(&stats[phase], 95),
+                get_max(&stats[phase]));
+    }
+
+    fprintf(file, "\n%-18s %10s %10s %10s %10s %10s\n", "memory", "allocs", "last_frame", "max_frame", "live",
+            "live_bytes");
+    for (size_t source = 0; source < MEMORY_SOURCES_COUNT; source++) {
+        fprintf(file, "%-18s %10lu %10u %10u %10lu %10lu\n", memory_source_names[source],
+                memory[source].sampled.allocations, get_last_frame_allocations(&memory[source]),
+                get_max_frame_allocations(&memory[source]), memory[source].sampled.live_count,
+                memory[source].sampled.live_bytes);
+    }
+    fprintf(file, "%-18s %10s %10s %10s %10s %10ld\n", "git_cache", "-", "-", "-", "-", git_cached_bytes);
+    fprintf(file, "%-18s %10s %10s %10s %10s %10ld\n", "git_cache_limit", "-", "-", "-", "-", git_cache_limit);
+    pthread_mutex_unlock(&stats_lock);
+
+    ASSERT(!ferror(file));
+
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    return err;
+}
@@ -0,0 +1,58 @@
+#ifndef GIT_LIVE_STATS_H
+#define GIT_LIVE_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * Timing of the phases of a frame, kept as histograms over the last STATS_WINDOW samples of every phase so the
+ * percentiles follow what the dashboard is doing now rather than since it started.
+ * The stats are process wide (phases are recorded by the engine on whatever thread runs it) and cheap enough to be
+ * always on.
+ */
+
+#define STATS_WINDOW (256)
+
+enum stats_phase {
+    stats_phase_wait = 0,
+    // fingerprinting the work tree, the status phases are skipped when nothing changed
+    stats_phase_status_cache,
+    stats_phase_status_staged,
+    stats_phase_status_changed,
+    stats_phase_status_untracked,
+    // counting the changes outside a scoped status, once in a while
+    stats_phase_status_outside,
+    stats_phase_refs,
+    stats_phase_commits,
+    stats_phase_render,
+    stats_phase_layout,
+    stats_phase_refresh,
+    // everything but the wait
+    stats_phase_frame,
+    // from seeing an inotify event to the wrefresh that shows it
+    stats_phase_event_to_screen,
+    STATS_PHASES_COUNT,
+};
+
+/* allocations counted with stats_count_alloc, liblayout counts its own. */
+enum stats_allocator {
+    stats_allocator_refs = 0,
+    STATS_ALLOCATORS_COUNT,
+};
+
+uint64_t stats_now_us();
+/* record the time since started, as returned by stats_now_us. also traced as a span when tracing is on. */
+void stats_record(enum stats_phase phase, uint64_t started);
+
+void stats_count_alloc(enum stats_allocator allocator, size_t bytes);
+void stats_count_free(enum stats_allocator allocator, size_t bytes);
+/* once per frame, samples the allocation counters, the live layout nodes and libgit2's object cache. */
+void stats_sample_memory();
+
+/* a summary of the slowest phases and a line about the memory, for the overlay. */
+err_t stats_format_overlay(char *buff, size_t len);
+/* creates the parent directory of path if it is missing. */
+err_t stats_dump(const char *path);
+
+#endif // GIT_LIVE_STATS_H
@@ -0,0 +1,368 @@
+#include "status_cache.h"
+#include <fcntl.h>
+#include <git2.h>
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "snapshot.h"
+#include "utils.h"
+#include "worktree_scan.h"
+
+#define STATUS_CACHE_DIR (".cache/git-live/status")
+
+#define STATUS_CACHE_MAGIC (0x74617473766c6967) // "gilvstat"
+#define STATUS_CACHE_VERSION (6)
+
+#define STATUS_CACHE_REVALIDATE_MS (10000)
+// rows are saved to disk at most this often, and on exit
+#define STATUS_CACHE_SAVE_MS (5000)
+
+// a file changed within this long before it was fingerprinted might change again without its stat data changing (the
+// timestamps are coarse on some filesystems), so the rows are not trusted until it settles
+#define STATUS_CACHE_RACY_SEC (2)
+
+#define INDEX_CHECKSUM_LEN (20)
+
+struct status_key {
+    unsigned char index_checksum[INDEX_CHECKSUM_LEN];
+    git_oid head;
+    // the rows of another scope, or cut to another length, are of no use
+    uint64_t scope_hash;
+    uint64_t max_rows;
+    // the tracked files, the directories containing them and the exclude file
+    uint64_t tracked_hash;
+    // the untracked paths of the rows
+    uint64_t untracked_hash;
+};
+
+struct status_cache_header {
+    uint64_t magic;
+    uint32_t version;
+    struct status_key key;
+};
+
+struct status_cache {
+    git_repository *repo;
+    char path[PATH_MAX];
+    struct snapshot *rows;
+    // what the rows were computed from, only meaningful when valid
+    struct status_key key;
+    bool valid;
+    // the rows are of key, even if they are not valid anymore
+    bool stored;
+    uint64_t stored_at;
+    // the fingerprint taken by the last lookup
+    struct status_key current;
+    bool current_racy;
+    bool unsaved;
+    uint64_t saved_at;
+};
+
+struct fingerprint {
+    uint64_t hash;
+    // realtime, stat data newer than this is racy
+    int64_t racy_after;
+    bool racy;
+    char path[PATH_MAX];
+    size_t root_len;
+};
+
+static void init_fingerprint(struct fingerprint *fingerprint) {
+    struct timespec now = {0};
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    fingerprint->hash = HASH_INIT;
+    fingerprint->racy_after = now.tv_sec - STATUS_CACHE_RACY_SEC;
+    fingerprint->racy = false;
+}
+
+/* the directory the paths passed to add_stat are relative to. */
+static void set_fingerprint_root(struct fingerprint *fingerprint, const char *root) {
+    fingerprint->root_len = MIN(strlen(root), sizeof(fingerprint->path) - 1);
+    memcpy(fingerprint->path, root, fingerprint->root_len);
+}
+
+/* fold the stat data of root/path (or root itself when len is 0) into the fingerprint. */
+static void add_stat(struct fingerprint *fingerprint, const char *path, size_t len) {
+    struct stat st = {0};
+    int result = 0;
+
+    len = MIN(len, sizeof(fingerprint->path) - fingerprint->root_len - 1);
+    memcpy(fingerprint->path + fingerprint->root_len, path, len);
+    fingerprint->path[fingerprint->root_len + len] = '\0';
+
+    result = lstat(fingerprint->path, &st);
+    fingerprint->hash = hash_bytes(fingerprint->hash, &result, sizeof(result));
+    if (result)
+        return;
+
+    fingerprint->hash = hash_bytes(fingerprint->hash, &st.st_ino, sizeof(st.st_ino));
+    fingerprint->hash = hash_bytes(fingerprint->hash, &st.st_mode, sizeof(st.st_mode));
+    fingerprint->hash = hash_bytes(fingerprint->hash, &st.st_size, sizeof(st.st_size));
+    fingerprint->hash = hash_bytes(fingerprint->hash, &st.st_mtim, sizeof(st.st_mtim));
+    fingerprint->hash = hash_bytes(fingerprint->hash, &st.st_ctim, sizeof(st.st_ctim));
+    if (st.st_mtim.tv_sec >= fingerprint->racy_after || st.st_ctim.tv_sec >= fingerprint->racy_after) {
+        fingerprint->racy = true;
+    }
+}
+
+/* the trailer of the index file is a checksum of all of it, so it changes with any change to the index. */
+static err_t read_index_checksum(const char *git_dir, unsigned char *out) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+    struct stat st = {0};
+    int fd = FD_INVALID;
+
+    memset(out, '\0', INDEX_CHECKSUM_LEN);
+    RETHROW(join_paths(git_dir, "index", path, sizeof(path)));
+
+    // a repository without commits might not have an index yet
+    fd = open(path, O_RDONLY);
+    if (fd == FD_INVALID || fstat(fd, &st) || st.st_size < INDEX_CHECKSUM_LEN)
+        goto cleanup;
+    ASSERT(pread(fd, out, INDEX_CHECKSUM_LEN, st.st_size - INDEX_CHECKSUM_LEN) == INDEX_CHECKSUM_LEN);
+
+cleanup:
+    RETHROW_PRINT(safe_close_fd(&fd));
+    return err;
+}
+
+/* the fingerprint of the tracked files through libgit2, for an index the work tree scanner can't read. */
+static err_t hash_tracked(struct status_cache *cache, const char *scope, struct fingerprint *fingerprint) {
+    err_t err = NO_ERROR;
+    git_index *index = NULL;
+    const char *prev = "";
+    size_t start = 0;
+
+    ASSERT(!git_repository_index(&index, cache->repo));
+    ASSERT(!git_index_read(index, false));
+
+    // the entries are sorted by path, so the ones of the scope are a single run
+    if (strlen(scope) && git_index_find_prefix(&start, index, scope)) {
+        start = git_index_entrycount(index);
+    }
+    for (size_t i = start; i < git_index_entrycount(index); i++) {
+        const char *path = git_index_get_byindex(index, i)->path;
+        if (strncmp(path, scope, strlen(scope)))
+            break;
+
+        // new untracked files only change the directory they are created in, the entries are sorted so every
+        // directory is added once, right before its first entry
+        for (const char *slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+            size_t len = slash - path;
+            if (!strncmp(prev, path, len) && prev[len] == '/')
+                continue;
+            add_stat(fingerprint, path, len);
+        }
+        add_stat(fingerprint, path, strlen(path));
+        prev = path;
+    }
+
+cleanup:
+    git_index_free(index);
+    return err;
+}
+
+static void hash_untracked(struct status_cache *cache, struct fingerprint *fingerprint) {
+    for (size_t i = 0; i < cache->rows->status_rows.count; i++) {
+        const struct status_row *row = &cache->rows->status_rows.items[i];
+        const char *path = snapshot_str(cache->rows, row->path);
+        if (row->section == status_section_untracked) {
+            add_stat(fingerprint, path, strlen(path));
+        }
+    }
+}
+
+static err_t load_status_cache(struct status_cache *cache) {
+    err_t err = NO_ERROR;
+    struct status_cache_header header = {0};
+    FILE *file = NULL;
+    bool loaded = false;
+
+    file = fopen(cache->path, "rb");
+    if (!file)
+        goto cleanup;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != STATUS_CACHE_MAGIC ||
+        header.version != STATUS_CACHE_VERSION)
+        goto cleanup;
+    RETHROW(read_snapshot(cache->rows, file, &loaded));
+    if (!loaded)
+        goto cleanup;
+
+    cache->key = header.key;
+    cache->valid = true;
+    cache->stored = true;
+    // it is checked against the repository like any other rows, but was not recomputed for a while
+    cache->stored_at = get_monotonic_ms();
+
+cleanup:
+    if (file) {
+        fclose(file);
+    }
+    return err;
+}
+
+static err_t save_status_cache(struct status_cache *cache) {
+    err_t err = NO_ERROR;
+    char tmp_path[PATH_MAX] = {0};
+    struct status_cache_header header = {0};
+    FILE *file = NULL;
+
+    // rows that are not valid are useless to the next run too
+    if (!cache->valid) {
+        remove(cache->path);
+        goto cleanup;
+    }
+
+    header.magic = STATUS_CACHE_MAGIC;
+    header.version = STATUS_CACHE_VERSION;
+    header.key = cache->key;
+
+    ASSERT(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path) < (int)sizeof(tmp_path));
+    file = fopen(tmp_path, "wb");
+    ASSERT(file);
+    ASSERT(fwrite(&header, sizeof(header), 1, file) == 1);
+    RETHROW(write_snapshot(cache->rows, file));
+    ASSERT(!fclose(file));
+    file = NULL;
+    ASSERT(!rename(tmp_path, cache->path));
+
+cleanup:
+    if (file) {
+        fclose(file);
+        remove(tmp_path);
+    }
+    cache->unsaved = false;
+    cache->saved_at = get_monotonic_ms();
+    return err;
+}
+
+err_t init_status_cache(struct status_cache **cache, git_repository *repo) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+    ASSERT(repo);
+
+    *cache = calloc(1, sizeof(**cache));
+    ASSERT(*cache);
+
+    (*cache)->repo = repo;
+    RETHROW(init_snapshot(&(*cache)->rows));
+    RETHROW(get_keyed_cache_path(STATUS_CACHE_DIR, git_repository_path(repo), (*cache)->path, sizeof((*cache)->path)));
+    RETHROW(load_status_cache(*cache));
+
+cleanup:
+    if (err && cache && *cache) {
+        RETHROW_PRINT(free_status_cache(*cache));
+        *cache = NULL;
+    }
+    return err;
+}
+
+err_t free_status_cache(struct status_cache *cache) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+
+    if (cache->unsaved) {
+        RETHROW_PRINT(save_status_cache(cache));
+    }
+    if (cache->rows) {
+        RETHROW_PRINT(free_snapshot(cache->rows));
+    }
+    free(cache);
+
+cleanup:
+    return err;
+}
+
+err_t status_cache_lookup(struct status_cache *cache, struct worktree_scanner *worktree, const char *scope,
+                          size_t max_rows, bool *hit) {
+    err_t err = NO_ERROR;
+    struct fingerprint fingerprint = {0};
+    uint64_t tracked_hash = 0;
+    bool tracked_racy = false;
+    bool supported = false;
+
+    ASSERT(cache);
+    ASSERT(worktree);
+    ASSERT(scope);
+    ASSERT(hit);
+
+    *hit = false;
+
+    RETHROW(read_index_checksum(git_repository_path(cache->repo), cache->current.index_checksum));
+    // an unborn HEAD stays zero
+    memset(&cache->current.head, '\0', sizeof(cache->current.head));
+    git_reference_name_to_id(&cache->current.head, cache->repo, "HEAD");
+    cache->current.scope_hash = hash_string(scope);
+    cache->current.max_rows = max_rows;
+
+    init_fingerprint(&fingerprint);
+    set_fingerprint_root(&fingerprint, git_repository_workdir(cache->repo));
+    add_stat(&fingerprint, scope, strlen(scope));
+    RETHROW(worktree_scan_fingerprint(worktree, scope, &tracked_hash, &tracked_racy, &supported));
+    if (supported) {
+        fingerprint.hash = hash_bytes(fingerprint.hash, &tracked_hash, sizeof(tracked_hash));
+        fingerprint.racy = fingerprint.racy || tracked_racy;
+    } else {
+        RETHROW(hash_tracked(cache, scope, &fingerprint));
+    }
+    set_fingerprint_root(&fingerprint, git_repository_path(cache->repo));
+    add_stat(&fingerprint, "info/exclude", strlen("info/exclude"));
+    cache->current.tracked_hash = fingerprint.hash;
+    cache->current_racy = fingerprint.racy;
+
+    init_fingerprint(&fingerprint);
+    set_fingerprint_root(&fingerprint, git_repository_workdir(cache->repo));
+    hash_untracked(cache, &fingerprint);
+    cache->current.untracked_hash = fingerprint.hash;
+
+    *hit = cache->valid && !cache->current_racy && !fingerprint.racy &&
+           !memcmp(&cache->key, &cache->current, sizeof(cache->key)) &&
+           get_monotonic_ms() - cache->stored_at < STATUS_CACHE_REVALIDATE_MS;
+
+cleanup:
+    return err;
+}
+
+bool status_cache_has_rows(const struct status_cache *cache, const char *scope, size_t max_rows) {
+    return cache->stored && cache->key.scope_hash == hash_string(scope) && cache->key.max_rows == max_rows;
+}
+
+struct snapshot *status_cache_rows(struct status_cache *cache) {
+    return cache->rows;
+}
+
+err_t status_cache_store(struct status_cache *cache) {
+    err_t err = NO_ERROR;
+    struct fingerprint fingerprint = {0};
+
+    ASSERT(cache);
+
+    // the untracked paths may differ from the ones the lookup saw, those are taken now
+    init_fingerprint(&fingerprint);
+    set_fingerprint_root(&fingerprint, git_repository_workdir(cache->repo));
+    hash_untracked(cache, &fingerprint);
+
+    cache->key = cache->current;
+    cache->key.untracked_hash = fingerprint.hash;
+    cache->valid = !cache->current_racy && !fingerprint.racy;
+    cache->stored = true;
+    cache->stored_at = get_monotonic_ms();
+    cache->unsaved = true;
+
+    if (cache->stored_at - cache->saved_at >= STATUS_CACHE_SAVE_MS) {
+        RETHROW(save_status_cache(cache));
+    }
+
+cleanup:
+    return err;
+}
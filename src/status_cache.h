@@ -0,0 +1,43 @@
+#ifndef GIT_LIVE_STATUS_CACHE_H
+#define GIT_LIVE_STATUS_CACHE_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include "../lib/err.h"
+#include "snapshot.h"
+#include "worktree_scan.h"
+
+/*
+ * The status rows of a repository are kept together with a fingerprint of everything they were computed from: the
+ * checksum of the index, the commit of HEAD, and the stat data of every tracked file, the directories that contain
+ * them, the untracked paths and the exclude file. While the fingerprint matches, the rows are reused without running
+ * git status, so neither file contents are hashed nor ignore rules evaluated. The rows are also saved under
+ * ~/.cache/git-live/status so a restart can reuse them.
+ * Some changes don't show in the fingerprint (commits inside submodules the submodule pool doesn't cover, new files in
+ * directories without tracked files, like empty or ignored ones) so the rows are recomputed at least every
+ * STATUS_CACHE_REVALIDATE_MS anyway.
+ */
+
+struct status_cache;
+
+err_t init_status_cache(struct status_cache **cache, git_repository *repo);
+/* saves the rows for the next run. */
+err_t free_status_cache(struct status_cache *cache);
+
+/*
+ * Fingerprint the repository, hit is set when the stored rows are still valid. Otherwise the caller computes the
+ * rows into status_cache_rows() and then calls status_cache_store. The tracked files are fingerprinted by the lstat
+ * pass of worktree, which its next scan reuses.
+ * scope is the directory the rows are limited to (relative to the work tree, with a trailing slash), only the files
+ * in it are fingerprinted. Empty for the whole work tree. max_rows is the number of rows kept per section.
+ */
+err_t status_cache_lookup(struct status_cache *cache, struct worktree_scanner *worktree, const char *scope,
+                          size_t max_rows, bool *hit);
+/* rows were stored (or loaded) for scope and max_rows, valid or not. */
+bool status_cache_has_rows(const struct status_cache *cache, const char *scope, size_t max_rows);
+/* status rows and counts only, with paths relative to the work tree. */
+struct snapshot *status_cache_rows(struct status_cache *cache);
+/* the rows are valid for the fingerprint taken by the last lookup. */
+err_t status_cache_store(struct status_cache *cache);
+
+#endif // GIT_LIVE_STATUS_CACHE_H
@@ -0,0 +1,532 @@
+#include "submodules.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "engine.h"
+#include "snapshot.h"
+#include "timing.h"
+#include "utils.h"
+
+#define SUBMODULE_POOL_MAX_THREADS (4)
+
+// the watches only see the top level of each work tree and git dir (a commit moves a ref below it), so this often the
+// commit of HEAD and the stat data of the index are checked, and the status recomputed if either moved
+#define SUBMODULE_REVALIDATE_MS (10000)
+
+#define SUBMODULE_HEAD_LEN (64)
+
+#define SUBMODULE_WATCH_MASK (IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+#define INOTIFY_BUFF_LEN (4096)
+
+enum entry_state {
+    entry_state_stale = 0,
+    entry_state_computing,
+    entry_state_done,
+    // done, but HEAD and the index are to be checked against the stamp of the result
+    entry_state_unverified,
+};
+
+/* what a commit, checkout, reset or add in the submodule changes. */
+struct entry_stamp {
+    git_oid head;
+    int64_t index_mtime_sec;
+    int64_t index_mtime_nsec;
+    int64_t index_size;
+    uint64_t index_ino;
+};
+
+struct submodule_result {
+    enum submodule_state state;
+    bool dirty;
+    bool detached;
+    size_t ahead;
+    size_t behind;
+    char head[SUBMODULE_HEAD_LEN];
+};
+
+struct submodule_entry {
+    char name[PATH_MAX];
+    // relative to the superproject's work tree
+    char path[PATH_MAX];
+    git_oid recorded;
+    bool has_recorded;
+    // only touched by the worker computing the entry
+    git_repository *repo;
+    int workdir_watch;
+    int gitdir_watch;
+    enum entry_state state;
+    // bumped by every change, a result computed for an older generation is stale as soon as it is ready
+    uint64_t generation;
+    uint64_t verified_at;
+    struct entry_stamp stamp;
+    struct submodule_result result;
+};
+
+struct submodule_list {
+    struct submodule_entry *entries;
+    size_t count;
+    size_t cap;
+};
+
+struct submodule_pool {
+    pthread_t threads[SUBMODULE_POOL_MAX_THREADS];
+    size_t threads_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool stop;
+    // the submodule list is refreshed when no entry is being computed, so entries never move under a worker
+    bool list_stale;
+    bool listing;
+    size_t computing;
+    uint64_t listed_at;
+    uint32_t abbrev_len;
+    struct timer *timer;
+    int inotify_fd;
+    int repo_watch;
+    int workdir_watch;
+    // only used by the worker refreshing the list
+    git_repository *repo;
+    struct submodule_list list;
+    // the cpu time of the workers, not charged to the timer yet
+    uint64_t cpu_us;
+};
+
+static void close_entry(struct submodule_pool *pool, struct submodule_entry *entry) {
+    if (entry->workdir_watch != INVALID_WATCH_ID) {
+        inotify_rm_watch(pool->inotify_fd, entry->workdir_watch);
+    }
+    if (entry->gitdir_watch != INVALID_WATCH_ID) {
+        inotify_rm_watch(pool->inotify_fd, entry->gitdir_watch);
+    }
+    git_repository_free(entry->repo);
+    entry->repo = NULL;
+}
+
+static int add_listed_submodule(git_submodule *submodule, const char *name, void *payload) {
+    struct submodule_list *list = payload;
+    struct submodule_entry *entry = NULL;
+    struct submodule_entry *grown = NULL;
+
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        grown = realloc(list->entries, list->cap * sizeof(*list->entries));
+        if (!grown)
+            return -1;
+        list->entries = grown;
+    }
+
+    entry = &list->entries[list->count++];
+    memset(entry, '\0', sizeof(*entry));
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    strncpy(entry->path, git_submodule_path(submodule), sizeof(entry->path) - 1);
+    entry->workdir_watch = INVALID_WATCH_ID;
+    entry->gitdir_watch = INVALID_WATCH_ID;
+    if (git_submodule_index_id(submodule)) {
+        git_oid_cpy(&entry->recorded, git_submodule_index_id(submodule));
+        entry->has_recorded = true;
+    }
+    return 0;
+}
+
+/* must be called with the lock held and no entry being computed. */
+static void merge_submodule_list(struct submodule_pool *pool, struct submodule_list *listed) {
+    for (size_t i = 0; i < listed->count; i++) {
+        struct submodule_entry *entry = &listed->entries[i];
+        for (size_t j = 0; j < pool->list.count; j++) {
+            struct submodule_entry *old = &pool->list.entries[j];
+            if (strcmp(old->name, entry->name) || strcmp(old->path, entry->path))
+                continue;
+
+            // keep the open repository, the watches and the last result
+            entry->repo = old->repo;
+            entry->workdir_watch = old->workdir_watch;
+            entry->gitdir_watch = old->gitdir_watch;
+            entry->generation = old->generation;
+            entry->verified_at = old->verified_at;
+            entry->stamp = old->stamp;
+            entry->result = old->result;
+            entry->state = old->state;
+            if (entry->has_recorded != old->has_recorded || !git_oid_equal(&entry->recorded, &old->recorded)) {
+                entry->state = entry_state_stale;
+            }
+            old->repo = NULL;
+            old->workdir_watch = INVALID_WATCH_ID;
+            old->gitdir_watch = INVALID_WATCH_ID;
+            break;
+        }
+    }
+
+    for (size_t j = 0; j < pool->list.count; j++) {
+        close_entry(pool, &pool->list.entries[j]);
+    }
+    free(pool->list.entries);
+    pool->list = *listed;
+}
+
+static err_t compute_submodule(struct submodule_pool *pool, git_repository *repo, const git_oid *recorded,
+                               struct submodule_result *out) {
+    err_t err = NO_ERROR;
+    git_reference *head = NULL;
+    git_status_list *status_list = NULL;
+    git_status_options opts = {.version = GIT_STATUS_OPTIONS_VERSION,
+                               .flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_EXCLUDE_SUBMODULES,
+                               .show = GIT_STATUS_SHOW_INDEX_AND_WORKDIR};
+
+    ASSERT(pool->abbrev_len < SUBMODULE_HEAD_LEN);
+
+    out->state = submodule_state_missing;
+    if (git_repository_head(&head, repo) || !git_reference_target(head))
+        goto cleanup;
+
+    out->detached = git_repository_head_detached(repo);
+    if (out->detached) {
+        git_oid_tostr(out->head, pool->abbrev_len + 1, git_reference_target(head));
+    } else {
+        strncpy(out->head, git_reference_shorthand(head), sizeof(out->head) - 1);
+    }
+
+    // the recorded commit might not be fetched yet
+    if (recorded && git_graph_ahead_behind(&out->ahead, &out->behind, repo, git_reference_target(head), recorded))
+        goto cleanup;
+
+    RETHROW(safe_git_status_list_new(&status_list, repo, &opts));
+    out->dirty = git_status_list_entrycount(status_list) > 0;
+    out->state = submodule_state_ready;
+
+cleanup:
+    git_status_list_free(status_list);
+    git_reference_free(head);
+    return err;
+}
+
+/* an unborn HEAD or a missing index are left zeroed. */
+static err_t get_entry_stamp(git_repository *repo, struct entry_stamp *out) {
+    err_t err = NO_ERROR;
+    char index_path[PATH_MAX] = {0};
+    struct stat st = {0};
+
+    *out = (struct entry_stamp){0};
+    git_reference_name_to_id(&out->head, repo, "HEAD");
+
+    RETHROW(join_paths(git_repository_path(repo), "index", index_path, sizeof(index_path)));
+    if (!stat(index_path, &st)) {
+        out->index_mtime_sec = st.st_mtim.tv_sec;
+        out->index_mtime_nsec = st.st_mtim.tv_nsec;
+        out->index_size = st.st_size;
+        out->index_ino = st.st_ino;
+    }
+
+cleanup:
+    return err;
+}
+
+static bool is_same_stamp(const struct entry_stamp *a, const struct entry_stamp *b) {
+    return git_oid_equal(&a->head, &b->head) && a->index_mtime_sec == b->index_mtime_sec &&
+           a->index_mtime_nsec == b->index_mtime_nsec && a->index_size == b->index_size &&
+           a->index_ino == b->index_ino;
+}
+
+static struct submodule_entry *get_stale_entry(struct submodule_pool *pool) {
+    for (size_t i = 0; i < pool->list.count; i++) {
+        if (pool->list.entries[i].state == entry_state_stale || pool->list.entries[i].state == entry_state_unverified)
+            return &pool->list.entries[i];
+    }
+    return NULL;
+}
+
+static void refresh_submodule_list(struct submodule_pool *pool) {
+    err_t err = NO_ERROR;
+    struct submodule_list listed = {0};
+
+    pool->list_stale = false;
+    pool->listing = true;
+    pthread_mutex_unlock(&pool->lock);
+
+    ASSERT_PRINT(!git_submodule_foreach(pool->repo, add_listed_submodule, &listed));
+
+    pthread_mutex_lock(&pool->lock);
+    if (err) {
+        // keep the previous list, it will be refreshed again on the next change
+        free(listed.entries);
+    } else {
+        merge_submodule_list(pool, &listed);
+    }
+    pool->listing = false;
+    pool->listed_at = get_monotonic_ms();
+    pthread_cond_broadcast(&pool->cond);
+}
+
+static void refresh_entry(struct submodule_pool *pool, struct submodule_entry *entry) {
+    err_t err = NO_ERROR;
+    uint64_t generation = entry->generation;
+    git_oid recorded;
+    bool has_recorded = entry->has_recorded;
+    git_repository *repo = entry->repo;
+    int workdir_watch = INVALID_WATCH_ID;
+    int gitdir_watch = INVALID_WATCH_ID;
+    char workdir[PATH_MAX] = {0};
+    bool verifying = entry->state == entry_state_unverified;
+    struct entry_stamp stamp = {0};
+    struct entry_stamp verified = entry->stamp;
+    struct submodule_result result = entry->result;
+    struct submodule_result computed = {0};
+
+    git_oid_cpy(&recorded, &entry->recorded);
+    entry->state = entry_state_computing;
+    pool->computing++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!repo) {
+        RETHROW_PRINT(join_paths(git_repository_workdir(pool->repo), entry->path, workdir, sizeof(workdir)));
+        // uninitialized submodules are just empty directories
+        if (!err && !git_repository_open(&repo, workdir)) {
+            workdir_watch = inotify_add_watch(pool->inotify_fd, workdir, SUBMODULE_WATCH_MASK);
+            gitdir_watch = inotify_add_watch(pool->inotify_fd, git_repository_path(repo), SUBMODULE_WATCH_MASK);
+        }
+    }
+    if (repo) {
+        RETHROW_PRINT(get_entry_stamp(repo, &stamp));
+    }
+    // only recompute the status when the check finds something moved, or there is nothing to check against
+    if (!verifying || !repo || err || !is_same_stamp(&stamp, &verified)) {
+        err = NO_ERROR;
+        computed = (struct submodule_result){.state = submodule_state_missing};
+        if (repo) {
+            RETHROW_PRINT(compute_submodule(pool, repo, has_recorded ? &recorded : NULL, &computed));
+        }
+        // a failure (like git rewriting the submodule's index) keeps the last result, the zeroed stamp makes the next
+        // check compute it again
+        if (err) {
+            stamp = (struct entry_stamp){0};
+        } else {
+            result = computed;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (!entry->repo && repo) {
+        entry->repo = repo;
+        entry->workdir_watch = workdir_watch;
+        entry->gitdir_watch = gitdir_watch;
+    }
+    entry->result = result;
+    entry->stamp = stamp;
+    entry->verified_at = get_monotonic_ms();
+    entry->state = generation == entry->generation ? entry_state_done : entry_state_stale;
+    pool->computing--;
+    pthread_cond_broadcast(&pool->cond);
+}
+
+static void *submodule_worker(void *arg) {
+    err_t err = NO_ERROR;
+    struct submodule_pool *pool = arg;
+    struct submodule_entry *entry = NULL;
+    uint64_t started = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        started = get_thread_cpu_us();
+        if (pool->list_stale && !pool->listing && !pool->computing) {
+            refresh_submodule_list(pool);
+        } else if (!pool->list_stale && !pool->listing && (entry = get_stale_entry(pool))) {
+            refresh_entry(pool, entry);
+        } else {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+        pool->cpu_us += get_thread_cpu_us() - started;
+
+        pthread_mutex_unlock(&pool->lock);
+        RETHROW_PRINT(timing_notify(pool->timer));
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static err_t start_workers(struct submodule_pool *pool) {
+    err_t err = NO_ERROR;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads_count = MIN(MAX(cpus, 1), SUBMODULE_POOL_MAX_THREADS);
+
+    pool->repo_watch = inotify_add_watch(pool->inotify_fd, git_repository_path(pool->repo), SUBMODULE_WATCH_MASK);
+    pool->workdir_watch =
+        inotify_add_watch(pool->inotify_fd, git_repository_workdir(pool->repo), SUBMODULE_WATCH_MASK);
+    RETHROW(timing_add_fd(pool->timer, pool->inotify_fd));
+
+    for (size_t i = 0; i < threads_count; i++) {
+        ASSERT(!pthread_create(&pool->threads[i], NULL, submodule_worker, pool));
+        pool->threads_count++;
+    }
+
+cleanup:
+    return err;
+}
+
+err_t init_submodule_pool(struct submodule_pool **pool, const char *repo_path, uint32_t abbrev_len,
+                          struct timer *timer) {
+    err_t err = NO_ERROR;
+    struct submodule_pool *result = NULL;
+
+    ASSERT(pool);
+    ASSERT(repo_path);
+    ASSERT(timer);
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    result->abbrev_len = abbrev_len;
+    result->timer = timer;
+    result->list_stale = true;
+    result->repo_watch = INVALID_WATCH_ID;
+    result->workdir_watch = INVALID_WATCH_ID;
+    result->inotify_fd = inotify_init1(IN_NONBLOCK);
+    ASSERT(result->inotify_fd != FD_INVALID);
+    ASSERT(!pthread_mutex_init(&result->lock, NULL));
+    ASSERT(!pthread_cond_init(&result->cond, NULL));
+    ASSERT(!git_repository_open(&result->repo, repo_path));
+
+    *pool = result;
+
+cleanup:
+    if (err && result) {
+        RETHROW_PRINT(free_submodule_pool(result));
+    }
+    return err;
+}
+
+err_t free_submodule_pool(struct submodule_pool *pool) {
+    err_t err = NO_ERROR;
+
+    ASSERT(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 0; i < pool->threads_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    if (pool->threads_count) {
+        RETHROW_PRINT(timing_remove_fd(pool->timer, pool->inotify_fd));
+    }
+
+    for (size_t i = 0; i < pool->list.count; i++) {
+        close_entry(pool, &pool->list.entries[i]);
+    }
+    free(pool->list.entries);
+    git_repository_free(pool->repo);
+    RETHROW_PRINT(safe_close_fd(&pool->inotify_fd));
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+
+cleanup:
+    return err;
+}
+
+/* must be called with the lock held. */
+static void handle_event(struct submodule_pool *pool, const struct inotify_event *event) {
+    if (event->wd == pool->repo_watch) {
+        // the index records the commit of every submodule
+        if (event->len && (!strcmp(event->name, "index") || !strcmp(event->name, "config")))
+            pool->list_stale = true;
+        return;
+    }
+    if (event->wd == pool->workdir_watch) {
+        if (event->len && !strcmp(event->name, ".gitmodules"))
+            pool->list_stale = true;
+        return;
+    }
+
+    for (size_t i = 0; i < pool->list.count; i++) {
+        struct submodule_entry *entry = &pool->list.entries[i];
+        if (event->wd != entry->workdir_watch && event->wd != entry->gitdir_watch)
+            continue;
+        entry->generation++;
+        if (entry->state == entry_state_done || entry->state == entry_state_unverified) {
+            entry->state = entry_state_stale;
+        }
+        return;
+    }
+}
+
+static void read_events(struct submodule_pool *pool) {
+    char buff[INOTIFY_BUFF_LEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event = NULL;
+    ssize_t bytes_read = 0;
+
+    while ((bytes_read = read(pool->inotify_fd, buff, sizeof(buff))) > 0) {
+        for (char *ptr = buff; ptr < buff + bytes_read; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)ptr;
+            handle_event(pool, event);
+        }
+    }
+}
+
+err_t submodule_pool_collect(struct submodule_pool *pool, struct snapshot *snapshot, size_t max) {
+    err_t err = NO_ERROR;
+    bool locked = false;
+    uint64_t now = get_monotonic_ms();
+    struct submodule_row *row = NULL;
+
+    ASSERT(pool);
+    ASSERT(snapshot);
+
+    if (!max || !git_repository_workdir(pool->repo))
+        goto cleanup;
+
+    if (!pool->threads_count) {
+        RETHROW(start_workers(pool));
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    locked = true;
+
+    read_events(pool);
+
+    if (now - pool->listed_at > SUBMODULE_REVALIDATE_MS && !pool->listing) {
+        pool->list_stale = true;
+    }
+    for (size_t i = 0; i < pool->list.count; i++) {
+        struct submodule_entry *entry = &pool->list.entries[i];
+        if (entry->state == entry_state_done && now - entry->verified_at > SUBMODULE_REVALIDATE_MS) {
+            entry->state = entry_state_unverified;
+        }
+    }
+    pthread_cond_broadcast(&pool->cond);
+
+    // timing_charge is only for the thread waiting on the timer, which is the one collecting
+    RETHROW(timing_charge(pool->timer, pool->cpu_us));
+    pool->cpu_us = 0;
+
+    // rows keep showing the previous result while they are recomputed
+    for (size_t i = 0; i < pool->list.count && i < max; i++) {
+        const struct submodule_entry *entry = &pool->list.entries[i];
+
+        RETHROW(snapshot_add_submodule_row(snapshot, &row));
+        RETHROW(snapshot_add_string(snapshot, entry->path, &row->path));
+        RETHROW(snapshot_add_string(snapshot, entry->result.head, &row->head));
+        row->state = entry->result.state;
+        row->dirty = entry->result.dirty;
+        row->detached = entry->result.detached;
+        row->ahead = entry->result.ahead;
+        row->behind = entry->result.behind;
+    }
+
+cleanup:
+    if (locked) {
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return err;
+}
@@ -0,0 +1,30 @@
+#ifndef GIT_LIVE_SUBMODULES_H
+#define GIT_LIVE_SUBMODULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+#include "snapshot.h"
+#include "timing.h"
+
+/*
+ * Submodule status is computed on a small pool of worker threads, every submodule is opened once as its own
+ * git_repository and its result is cached until inotify reports a change in its work tree or git dir, or a periodic
+ * check finds its HEAD or index moved (the watches are not recursive, so a commit is not always seen). An edit deeper
+ * in its work tree shows once one of those changes. The dashboard only copies whatever results are ready, so a
+ * superproject with many submodules does not slow down its frames, and the cpu time of the workers is charged to the
+ * timer's budget as it does.
+ * While the pool runs, the superproject's own status leaves the submodules to it.
+ */
+
+struct submodule_pool;
+
+/* timer is notified whenever a result is ready, the pool's inotify fd is also added to it. */
+err_t init_submodule_pool(struct submodule_pool **pool, const char *repo_path, uint32_t abbrev_len,
+                          struct timer *timer);
+err_t free_submodule_pool(struct submodule_pool *pool);
+
+/* add the latest known state of up to max submodules to the snapshot, starts the workers on the first call. */
+err_t submodule_pool_collect(struct submodule_pool *pool, struct snapshot *snapshot, size_t max);
+
+#endif // GIT_LIVE_SUBMODULES_H
@@ -3,10 +3,14 @@
 #include <linux/limits.h>
 #include <malloc.h>
 #include <poll.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include "stats.h"
 #include "utils.h"
 
 #define INVALID_WATCH_ID (-1)
@@ -14,11 +18,22 @@
 #define SUBTRACT_OR_ZERO(a, b) ((a) > (b) ? (a) - (b) : 0)
 #define DIVIDE_OR_ZERO(a, b) ((b) != 0 ? (a) / (b) : 0)
 
+#define INOTIFY_POLLFD (0)
+#define NOTIFY_POLLFD (1)
+#define FIRST_USER_POLLFD (2)
+#define MAX_POLLFDS (FIRST_USER_POLLFD + TIMER_MAX_USER_FDS)
+
 struct timer {
     int inotify_fd;
+    int notify_fd;
+    struct pollfd pollfds[MAX_POLLFDS];
+    uint32_t pollfds_count;
     uint64_t cpu_time_used;
+    // charged by timing_charge, below a millisecond
+    uint64_t charged_us;
     uint64_t total_time_used;
     uint64_t last_wakeup_time;
+    struct timing_wakeup last_wakeup;
     struct timer_config config;
 };
 
@@ -36,15 +51,26 @@ cleanup:
     return err;
 }
 
-static err_t clear_inotify_messages(int inotify) {
+/* also remembers the name of the first event, so a wakeup can be attributed to a file. */
+static err_t clear_inotify_messages(int inotify, char *first_name, size_t first_name_len) {
     err_t err = NO_ERROR;
-    char buff[sizeof(struct inotify_event) + NAME_MAX + 1] = {0};
+    char buff[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event = (const struct inotify_event *)buff;
     ssize_t bytes_read = 0;
+    bool first = true;
 
     ASSERT(inotify != FD_INVALID);
 
+    first_name[0] = '\0';
     do {
         bytes_read = read(inotify, buff, sizeof(buff));
+        if (bytes_read > 0 && first) {
+            first = false;
+            if (event->len) {
+                strncpy(first_name, event->name, first_name_len - 1);
+                first_name[first_name_len - 1] = '\0';
+            }
+        }
     } while (bytes_read > 0);
 
 cleanup:
@@ -60,7 +86,8 @@ static err_t timing_calculate_timeout(struct timer *timer, int *out) {
 
     ASSERT(timer->config.idle_cpu_percent_target > 0);
 
-    timeout = DIVIDE_OR_ZERO(timer->cpu_time_used * 100, timer->config.idle_cpu_percent_target);
+    timeout = DIVIDE_OR_ZERO(timer->cpu_time_used * 100 * MAX(timer->config.budget_shares, 1),
+                             timer->config.idle_cpu_percent_target);
     timeout = SUBTRACT_OR_ZERO(timeout, timer->total_time_used);
     timeout = MAX(timeout, timer->config.min_timeout);
 
@@ -88,9 +115,18 @@ err_t init_timer(struct timer **timer, struct timer_config config) {
 
     (*timer)->config = config;
     (*timer)->cpu_time_used = 0;
+    (*timer)->charged_us = 0;
     (*timer)->total_time_used = 0;
     (*timer)->inotify_fd = inotify_init1(IN_NONBLOCK);
+    (*timer)->notify_fd = eventfd(0, EFD_NONBLOCK);
     (*timer)->last_wakeup_time = time;
+    (*timer)->last_wakeup = (struct timing_wakeup){0};
+
+    ASSERT((*timer)->notify_fd != FD_INVALID);
+
+    (*timer)->pollfds[INOTIFY_POLLFD] = (struct pollfd){.fd = (*timer)->inotify_fd, .events = POLLIN};
+    (*timer)->pollfds[NOTIFY_POLLFD] = (struct pollfd){.fd = (*timer)->notify_fd, .events = POLLIN};
+    (*timer)->pollfds_count = FIRST_USER_POLLFD;
 
 cleanup:
     return err;
@@ -101,6 +137,8 @@ err_t free_timer(struct timer *timer) {
 
     ASSERT(timer);
 
+    RETHROW_PRINT(safe_close_fd(&timer->notify_fd));
+    RETHROW_PRINT(safe_close_fd(&timer->inotify_fd));
     free(timer);
 
 cleanup:
@@ -142,28 +180,119 @@ cleanup:
     return err;
 }
 
+err_t timing_add_fd(struct timer *timer, int fd) {
+    err_t err = NO_ERROR;
+
+    ASSERT(timer);
+    ASSERT(fd != FD_INVALID);
+    ASSERT(timer->pollfds_count < MAX_POLLFDS);
+
+    timer->pollfds[timer->pollfds_count++] = (struct pollfd){.fd = fd, .events = POLLIN};
+
+cleanup:
+    return err;
+}
+
+err_t timing_remove_fd(struct timer *timer, int fd) {
+    err_t err = NO_ERROR;
+
+    ASSERT(timer);
+
+    for (uint32_t i = FIRST_USER_POLLFD; i < timer->pollfds_count; i++) {
+        if (timer->pollfds[i].fd == fd) {
+            timer->pollfds[i] = timer->pollfds[--timer->pollfds_count];
+            break;
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+bool timing_is_fd_ready(struct timer *timer, int fd) {
+    for (uint32_t i = FIRST_USER_POLLFD; i < timer->pollfds_count; i++) {
+        if (timer->pollfds[i].fd == fd) {
+            return timer->pollfds[i].revents & POLLIN;
+        }
+    }
+    return false;
+}
+
+err_t timing_notify(struct timer *timer) {
+    err_t err = NO_ERROR;
+    uint64_t value = 1;
+
+    ASSERT(timer);
+
+    // the counter only saturates after 2^64 - 1 notifications, so this can only fail if the fd is gone
+    ASSERT(write(timer->notify_fd, &value, sizeof(value)) == sizeof(value));
+
+cleanup:
+    return err;
+}
+
+err_t timing_charge(struct timer *timer, uint64_t cpu_us) {
+    err_t err = NO_ERROR;
+
+    ASSERT(timer);
+
+    timer->charged_us += cpu_us;
+    timer->cpu_time_used += timer->charged_us / USEC_IN_MSEC;
+    timer->charged_us %= USEC_IN_MSEC;
+
+cleanup:
+    return err;
+}
+
 err_t timing_wait(struct timer *timer) {
     err_t err = NO_ERROR;
-    struct pollfd pollfd = {0};
+    uint64_t notifications = 0;
     int timeout = 0;
     uint64_t tm_before_poll = 0;
     uint64_t tm_after_poll = 0;
+    uint64_t polled = 0;
+    uint64_t entered = 0;
+    struct pollfd inotify_pending = {0};
 
     ASSERT(timer);
 
+    // events that came in while the last frame was computed waited since at least its end, not since poll returns
+    entered = stats_now_us();
+    inotify_pending = (struct pollfd){.fd = timer->inotify_fd, .events = POLLIN};
+    poll(&inotify_pending, 1, 0);
+
     RETHROW(get_time_ms(&tm_before_poll));
     timer->cpu_time_used += tm_before_poll - timer->last_wakeup_time;
     timer->total_time_used += tm_before_poll - timer->last_wakeup_time;
 
-    pollfd.fd = timer->inotify_fd;
-    pollfd.events = POLLIN;
-    pollfd.revents = 0;
+    for (uint32_t i = 0; i < timer->pollfds_count; i++) {
+        timer->pollfds[i].revents = 0;
+    }
 
     RETHROW(timing_calculate_timeout(timer, &timeout));
 
     errno = 0;
-    poll(&pollfd, 1, timeout);
-    RETHROW(clear_inotify_messages(pollfd.fd));
+    poll(timer->pollfds, timer->pollfds_count, timeout);
+    polled = stats_now_us();
+    RETHROW(clear_inotify_messages(timer->inotify_fd, timer->last_wakeup.name, sizeof(timer->last_wakeup.name)));
+
+    timer->last_wakeup.reasons = timing_wake_timeout;
+    timer->last_wakeup.inotify_arrived = 0;
+    if (timer->pollfds[INOTIFY_POLLFD].revents & POLLIN) {
+        timer->last_wakeup.reasons |= timing_wake_inotify;
+        timer->last_wakeup.inotify_arrived = inotify_pending.revents & POLLIN ? entered : polled;
+    }
+    if (timer->pollfds[NOTIFY_POLLFD].revents & POLLIN) {
+        // reading an eventfd resets its counter, we only care that there was at least one notification
+        ASSERT(read(timer->notify_fd, &notifications, sizeof(notifications)) == sizeof(notifications) ||
+               errno == EAGAIN);
+        timer->last_wakeup.reasons |= timing_wake_notify;
+    }
+    for (uint32_t i = FIRST_USER_POLLFD; i < timer->pollfds_count; i++) {
+        if (timer->pollfds[i].revents & POLLIN) {
+            timer->last_wakeup.reasons |= timing_wake_fd;
+        }
+    }
 
     RETHROW(get_time_ms(&tm_after_poll));
     timer->total_time_used += tm_after_poll - tm_before_poll;
@@ -172,3 +301,15 @@ err_t timing_wait(struct timer *timer) {
 cleanup:
     return err;
 }
+
+err_t timing_get_wakeup(struct timer *timer, struct timing_wakeup *out) {
+    err_t err = NO_ERROR;
+
+    ASSERT(timer);
+    ASSERT(out);
+
+    *out = timer->last_wakeup;
+
+cleanup:
+    return err;
+}
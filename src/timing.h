@@ -1,6 +1,8 @@
 #ifndef GIT_LIVE_TIMING_H
 #define GIT_LIVE_TIMING_H
 
+#include <stdbool.h>
+#include <linux/limits.h>
 #include <stdint.h>
 #include "../lib/err.h"
 
@@ -12,6 +14,8 @@
 
 #define INVALID_WATCH_ID (-1)
 
+#define TIMER_MAX_USER_FDS (8)
+
 typedef uint8_t percent_t;
 typedef int watch_id_t;
 
@@ -19,6 +23,25 @@ struct timer_config {
     uint32_t min_timeout;
     percent_t idle_cpu_percent_target;
     percent_t max_cpu_percent_target;
+    // number of timers splitting the cpu targets between them, 0 is the same as 1
+    uint32_t budget_shares;
+};
+
+enum timing_wake_reason {
+    timing_wake_timeout = 0,
+    timing_wake_inotify = 1 << 0,
+    timing_wake_notify = 1 << 1,
+    timing_wake_fd = 1 << 2,
+};
+
+struct timing_wakeup {
+    // bitmask of timing_wake_reason
+    uint32_t reasons;
+    // the file name of the first inotify event, if any
+    char name[NAME_MAX + 1];
+    // when the inotify events were seen (when timing_wait was entered if they were already pending then), on the
+    // stats_now_us clock, 0 if there were none
+    uint64_t inotify_arrived;
 };
 
 struct timer;
@@ -30,4 +53,24 @@ err_t timing_add_or_modify_watch(struct timer*, watch_id_t* watch_id, const char
 err_t timing_remove_watch(struct timer*, watch_id_t watch_id);
 err_t timing_wait(struct timer*);
 
+/*
+ * Also wake up when fd is readable, the owner of the fd is responsible for reading from it after timing_wait returns
+ * and timing_is_fd_ready says it is ready.
+ */
+err_t timing_add_fd(struct timer*, int fd);
+err_t timing_remove_fd(struct timer*, int fd);
+bool timing_is_fd_ready(struct timer*, int fd);
+
+/* why the last timing_wait returned. */
+err_t timing_get_wakeup(struct timer*, struct timing_wakeup *out);
+
+/*
+ * Count cpu time spent on other threads for the timer's owner (like a pool working for it) towards its budget. Only
+ * from the thread that waits on the timer, its own time is counted already.
+ */
+err_t timing_charge(struct timer*, uint64_t cpu_us);
+
+/* wake up a thread blocked in timing_wait, safe to call from any thread. */
+err_t timing_notify(struct timer*);
+
 #endif //GIT_LIVE_TIMING_H
@@ -0,0 +1,192 @@
+#include "trace.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "stats.h"
+
+#define TRACE_BUFF_LEN (64 * 1024)
+// no single event is longer than this, so there is always room for one after a flush
+#define TRACE_EVENT_MAX_LEN (2048)
+#define TRACE_NAME_MAX_LEN (64)
+#define TRACE_DETAIL_MAX_LEN (256)
+
+#define UINT64_DIGITS_MAX (20)
+
+struct trace {
+    FILE *file;
+    char buff[TRACE_BUFF_LEN];
+    size_t used;
+    uint64_t started;
+    int pid;
+    bool first_event;
+};
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace *trace = NULL;
+static _Thread_local int thread_id = 0;
+
+static int get_thread_id() {
+    if (!thread_id) {
+        thread_id = (int)syscall(SYS_gettid);
+    }
+    return thread_id;
+}
+
+/* must be called with the lock held. */
+static void flush_trace() {
+    fwrite(trace->buff, 1, trace->used, trace->file);
+    trace->used = 0;
+}
+
+/* must be called with the lock held. */
+static void append_str(const char *str, size_t len) {
+    memcpy(trace->buff + trace->used, str, len);
+    trace->used += len;
+}
+
+#define APPEND_LITERAL(literal) append_str(literal, sizeof(literal) - 1)
+
+/* must be called with the lock held, printf is much slower than this for the most common field. */
+static void append_uint(uint64_t value) {
+    char digits[UINT64_DIGITS_MAX];
+    size_t count = 0;
+
+    do {
+        digits[UINT64_DIGITS_MAX - ++count] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    append_str(digits + UINT64_DIGITS_MAX - count, count);
+}
+
+/* must be called with the lock held. */
+static void append_json_str(const char *str, size_t max_len) {
+    trace->buff[trace->used++] = '"';
+    for (size_t i = 0; str[i] && i < max_len; i++) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            trace->buff[trace->used++] = '\\';
+            trace->buff[trace->used++] = c;
+        } else if (c < 0x20) {
+            trace->buff[trace->used++] = ' ';
+        } else {
+            trace->buff[trace->used++] = c;
+        }
+    }
+    trace->buff[trace->used++] = '"';
+}
+
+/* must be called with the lock held. */
+static void begin_event(const char *name, const char *category, char phase, uint64_t ts) {
+    if (trace->used + TRACE_EVENT_MAX_LEN > sizeof(trace->buff)) {
+        flush_trace();
+    }
+    if (!trace->first_event) {
+        APPEND_LITERAL(",\n");
+    }
+    trace->first_event = false;
+
+    APPEND_LITERAL("{\"name\":");
+    append_json_str(name, TRACE_NAME_MAX_LEN);
+    APPEND_LITERAL(",\"cat\":");
+    append_json_str(category, TRACE_NAME_MAX_LEN);
+    APPEND_LITERAL(",\"ph\":\"");
+    trace->buff[trace->used++] = phase;
+    APPEND_LITERAL("\",\"pid\":");
+    append_uint(trace->pid);
+    APPEND_LITERAL(",\"tid\":");
+    append_uint(get_thread_id());
+    APPEND_LITERAL(",\"ts\":");
+    append_uint(ts > trace->started ? ts - trace->started : 0);
+}
+
+err_t init_trace(const char *path) {
+    err_t err = NO_ERROR;
+    struct trace *result = NULL;
+
+    ASSERT(path);
+    ASSERT(!trace);
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    result->file = fopen(path, "w");
+    ASSERT(result->file);
+    result->started = stats_now_us();
+    result->pid = getpid();
+    result->first_event = true;
+    memcpy(result->buff, "[\n", 2);
+    result->used = 2;
+
+    pthread_mutex_lock(&trace_lock);
+    trace = result;
+    pthread_mutex_unlock(&trace_lock);
+
+cleanup:
+    if (err && result) {
+        free(result);
+    }
+    return err;
+}
+
+err_t deinit_trace() {
+    err_t err = NO_ERROR;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace) {
+        APPEND_LITERAL("\n]\n");
+        flush_trace();
+        ASSERT_PRINT(!ferror(trace->file));
+        fclose(trace->file);
+        free(trace);
+        trace = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    return err;
+}
+
+bool trace_enabled() {
+    return trace != NULL;
+}
+
+void trace_span(const char *name, const char *category, uint64_t started, uint64_t ended) {
+    if (!trace_enabled())
+        return;
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace) {
+        begin_event(name, category, 'X', started);
+        APPEND_LITERAL(",\"dur\":");
+        append_uint(ended > started ? ended - started : 0);
+        APPEND_LITERAL("}");
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+void trace_instant(const char *name, const char *category, const char *detail) {
+    uint64_t now = 0;
+
+    if (!trace_enabled())
+        return;
+
+    now = stats_now_us();
+    pthread_mutex_lock(&trace_lock);
+    if (trace) {
+        begin_event(name, category, 'i', now);
+        // thread scoped instants show up on the track of the thread that emitted them
+        APPEND_LITERAL(",\"s\":\"t\"");
+        if (detail) {
+            APPEND_LITERAL(",\"args\":{\"detail\":");
+            append_json_str(detail, TRACE_DETAIL_MAX_LEN);
+            APPEND_LITERAL("}");
+        }
+        APPEND_LITERAL("}");
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
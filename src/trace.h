@@ -0,0 +1,23 @@
+#ifndef GIT_LIVE_TRACE_H
+#define GIT_LIVE_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../lib/err.h"
+
+/*
+ * Writes trace events in the Chrome trace event format (chrome://tracing, ui.perfetto.dev) so a real session can be
+ * looked at on a timeline. Events are formatted into a buffer that is only written out when full, and tracing costs a
+ * single branch when it is off.
+ * Timestamps are in microseconds, as returned by stats_now_us.
+ */
+
+err_t init_trace(const char *path);
+err_t deinit_trace();
+
+bool trace_enabled();
+void trace_span(const char *name, const char *category, uint64_t started, uint64_t ended);
+/* detail is optional, it shows up as the "detail" argument of the event. */
+void trace_instant(const char *name, const char *category, const char *detail);
+
+#endif // GIT_LIVE_TRACE_H
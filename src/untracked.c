@@ -0,0 +1,764 @@
+#include "untracked.h"
+#include <dirent.h>
+#include <git2.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "timing.h"
+#include "utils.h"
+
+#define DIR_CACHE_BUCKETS (1024)
+
+#define UNTRACKED_REVALIDATE_MS (30000)
+// the entries of directories that were not walked for this long (deleted, or outside the recent scopes) are dropped
+#define UNTRACKED_DROP_MS (120000)
+
+#define COUNT_CACHE_SIZE (256)
+#define COUNT_CACHE_PROBE (4)
+// changes deeper in a collapsed directory don't change its stat data, so counts are redone once they get this old
+#define RECOUNT_MS (30000)
+
+#define MAX_WALK_DEPTH (256)
+
+struct dir_stat {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t ino;
+};
+
+struct dir_entry {
+    struct dir_entry *next;
+    // relative to the work tree with a trailing slash, empty for the work tree itself
+    char *path;
+    struct dir_stat stat;
+    // the stat data of the ignore files that apply to the directory
+    uint64_t rules_hash;
+    // the names of its tracked children
+    uint64_t tracked_hash;
+    // the stat data of the child directories that are neither tracked nor ignored, a file created in one of them
+    // doesn't change the directory itself but can make the child show up (or disappear)
+    uint64_t subdirs_hash;
+    // the untracked children back to back, each null terminated, directories end with a slash
+    char *untracked;
+    size_t untracked_len;
+    // the child directories of subdirs_hash, in the same form
+    char *subdirs;
+    size_t subdirs_len;
+    uint64_t read_at;
+    uint64_t used_at;
+};
+
+enum count_state {
+    count_state_empty = 0,
+    count_state_pending,
+    count_state_done,
+    // retried like a done count, when the directory changes or after RECOUNT_MS
+    count_state_failed,
+};
+
+struct count_entry {
+    char *path;
+    struct dir_stat stat;
+    enum count_state state;
+    // a previous count is still shown while the directory is recounted
+    bool counted;
+    // the last count failed, without a previous one the row is shown without a count
+    bool failed;
+    size_t files;
+    uint64_t counted_at;
+};
+
+struct untracked_cache {
+    git_repository *repo;
+    struct dir_entry *buckets[DIR_CACHE_BUCKETS];
+    // the paths found by the last scan
+    char **paths;
+    size_t count;
+    size_t cap;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool thread_started;
+    bool stop;
+    // the worker could not open the repository
+    bool worker_failed;
+    char repo_path[PATH_MAX];
+    struct timer *timer;
+    struct count_entry counts[COUNT_CACHE_SIZE];
+};
+
+struct walk {
+    git_repository *repo;
+    git_index *index;
+    // the absolute path of the current directory or file, after root_len it is relative to the work tree
+    char path[PATH_MAX];
+    size_t root_len;
+    uint64_t now;
+};
+
+struct dir_frame {
+    // of the directory's path in walk.path
+    size_t len;
+    uint64_t rules_hash;
+    uint64_t tracked_hash;
+};
+
+static uint64_t hash_stat(uint64_t hash, const char *path) {
+    struct stat st = {0};
+    int result = lstat(path, &st);
+
+    hash = hash_bytes(hash, &result, sizeof(result));
+    if (result)
+        return hash;
+    hash = hash_bytes(hash, &st.st_ino, sizeof(st.st_ino));
+    hash = hash_bytes(hash, &st.st_size, sizeof(st.st_size));
+    return hash_bytes(hash, &st.st_mtim, sizeof(st.st_mtim));
+}
+
+static bool get_dir_stat(const char *path, struct dir_stat *out) {
+    struct stat st = {0};
+
+    if (lstat(path, &st) || !S_ISDIR(st.st_mode))
+        return false;
+    *out = (struct dir_stat){.mtime_sec = st.st_mtim.tv_sec, .mtime_nsec = st.st_mtim.tv_nsec, .ino = st.st_ino};
+    return true;
+}
+
+static bool is_dot(const char *name) {
+    return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+/* replace whatever follows len in the walk path with len bytes of name. */
+static err_t walk_set(struct walk *walk, size_t at, const char *name, size_t len) {
+    err_t err = NO_ERROR;
+
+    ASSERT(at + len < sizeof(walk->path));
+    memcpy(walk->path + at, name, len);
+    walk->path[at + len] = '\0';
+
+cleanup:
+    return err;
+}
+
+static bool is_dir_entry(const struct walk *walk, const struct dirent *dirent) {
+    struct stat st = {0};
+
+    if (dirent->d_type != DT_UNKNOWN)
+        return dirent->d_type == DT_DIR;
+    return !lstat(walk->path, &st) && S_ISDIR(st.st_mode);
+}
+
+/* count the files that are not ignored under the directory in the walk path (with a trailing slash), up to limit. */
+static err_t count_files(struct walk *walk, size_t limit, size_t *files) {
+    err_t err = NO_ERROR;
+    DIR *dir = NULL;
+    struct dirent *dirent = NULL;
+    size_t len = strlen(walk->path);
+    bool is_dir = false;
+    int ignored = 0;
+
+    // git never looks inside a nested repository, it is a single untracked directory
+    RETHROW(walk_set(walk, len, ".git", strlen(".git")));
+    if (!access(walk->path, F_OK)) {
+        (*files)++;
+        goto cleanup;
+    }
+    walk->path[len] = '\0';
+
+    // deleted since it was listed
+    dir = opendir(walk->path);
+    if (!dir)
+        goto cleanup;
+
+    while (*files < limit && (dirent = readdir(dir))) {
+        if (is_dot(dirent->d_name))
+            continue;
+        RETHROW(walk_set(walk, len, dirent->d_name, strlen(dirent->d_name)));
+        is_dir = is_dir_entry(walk, dirent);
+        ASSERT(!git_ignore_path_is_ignored(&ignored, walk->repo, walk->path + walk->root_len));
+        if (ignored)
+            continue;
+        if (is_dir) {
+            RETHROW(walk_set(walk, strlen(walk->path), "/", 1));
+            RETHROW(count_files(walk, limit, files));
+        } else {
+            (*files)++;
+        }
+    }
+
+cleanup:
+    if (dir) {
+        closedir(dir);
+    }
+    walk->path[len] = '\0';
+    return err;
+}
+
+static uint64_t hash_subdirs(struct walk *walk, const char *names, size_t names_len) {
+    size_t len = strlen(walk->path);
+    uint64_t hash = HASH_INIT;
+
+    for (const char *name = names; name < names + names_len; name += strlen(name) + 1) {
+        if (!walk_set(walk, len, name, strlen(name))) {
+            hash = hash_stat(hash, walk->path);
+        }
+    }
+    walk->path[len] = '\0';
+    return hash;
+}
+
+/* list the children of the directory in the walk path that are neither tracked nor ignored into the entry. */
+static err_t read_dir(struct walk *walk, struct dir_entry *entry) {
+    err_t err = NO_ERROR;
+    FILE *untracked = NULL;
+    FILE *subdirs = NULL;
+    char *untracked_buff = NULL;
+    char *subdirs_buff = NULL;
+    size_t untracked_len = 0;
+    size_t subdirs_len = 0;
+    DIR *dir = NULL;
+    struct dirent *dirent = NULL;
+    const char *rel_path = walk->path + walk->root_len;
+    size_t len = strlen(walk->path);
+    size_t pos = 0;
+    size_t files = 0;
+    bool is_dir = false;
+    int ignored = 0;
+    int closed = 0;
+
+    untracked = open_memstream(&untracked_buff, &untracked_len);
+    ASSERT(untracked);
+    subdirs = open_memstream(&subdirs_buff, &subdirs_len);
+    ASSERT(subdirs);
+
+    dir = opendir(walk->path);
+    while (dir && (dirent = readdir(dir))) {
+        if (is_dot(dirent->d_name) || !strcmp(dirent->d_name, ".git"))
+            continue;
+        RETHROW(walk_set(walk, len, dirent->d_name, strlen(dirent->d_name)));
+        is_dir = is_dir_entry(walk, dirent);
+
+        // tracked files and submodules, the directories with tracked files in them are walked on their own
+        if (!git_index_find(&pos, walk->index, rel_path))
+            continue;
+        if (is_dir) {
+            RETHROW(walk_set(walk, strlen(walk->path), "/", 1));
+            if (!git_index_find_prefix(&pos, walk->index, rel_path))
+                continue;
+            walk->path[strlen(walk->path) - 1] = '\0';
+        }
+
+        ASSERT(!git_ignore_path_is_ignored(&ignored, walk->repo, rel_path));
+        if (ignored)
+            continue;
+
+        if (is_dir) {
+            fprintf(subdirs, "%s%c", dirent->d_name, '\0');
+            // like git, a directory with nothing but ignored files (or nothing at all) is not shown
+            RETHROW(walk_set(walk, strlen(walk->path), "/", 1));
+            files = 0;
+            RETHROW(count_files(walk, 1, &files));
+            if (files) {
+                fprintf(untracked, "%s/%c", dirent->d_name, '\0');
+            }
+        } else {
+            fprintf(untracked, "%s%c", dirent->d_name, '\0');
+        }
+    }
+    walk->path[len] = '\0';
+
+    closed = fclose(untracked);
+    untracked = NULL;
+    ASSERT(!closed);
+    closed = fclose(subdirs);
+    subdirs = NULL;
+    ASSERT(!closed);
+
+    free(entry->untracked);
+    entry->untracked = untracked_buff;
+    entry->untracked_len = untracked_len;
+    untracked_buff = NULL;
+    free(entry->subdirs);
+    entry->subdirs = subdirs_buff;
+    entry->subdirs_len = subdirs_len;
+    subdirs_buff = NULL;
+    entry->subdirs_hash = hash_subdirs(walk, entry->subdirs, entry->subdirs_len);
+    entry->read_at = walk->now;
+
+cleanup:
+    if (dir) {
+        closedir(dir);
+    }
+    if (untracked) {
+        fclose(untracked);
+    }
+    if (subdirs) {
+        fclose(subdirs);
+    }
+    free(untracked_buff);
+    free(subdirs_buff);
+    walk->path[len] = '\0';
+    return err;
+}
+
+static struct dir_entry **find_dir_entry(struct untracked_cache *cache, const char *path) {
+    struct dir_entry **curr = &cache->buckets[hash_string(path) % DIR_CACHE_BUCKETS];
+
+    while (*curr && strcmp((*curr)->path, path)) {
+        curr = &(*curr)->next;
+    }
+    return curr;
+}
+
+static void free_dir_entry(struct dir_entry *entry) {
+    free(entry->path);
+    free(entry->untracked);
+    free(entry->subdirs);
+    free(entry);
+}
+
+static err_t add_path(struct untracked_cache *cache, const char *dir, const char *name) {
+    err_t err = NO_ERROR;
+    char **paths = NULL;
+    char *path = NULL;
+
+    if (cache->count == cache->cap) {
+        paths = realloc(cache->paths, MAX(cache->cap * 2, 64) * sizeof(*paths));
+        ASSERT(paths);
+        cache->paths = paths;
+        cache->cap = MAX(cache->cap * 2, 64);
+    }
+    path = malloc(strlen(dir) + strlen(name) + 1);
+    ASSERT(path);
+    strcpy(path, dir);
+    strcat(path, name);
+    cache->paths[cache->count++] = path;
+
+cleanup:
+    return err;
+}
+
+/* the directory in the walk path is read again only if it, its tracked children or its ignore rules changed. */
+static err_t visit_dir(struct untracked_cache *cache, struct walk *walk, const struct dir_frame *frame) {
+    err_t err = NO_ERROR;
+    const char *rel_path = walk->path + walk->root_len;
+    struct dir_entry **slot = NULL;
+    struct dir_entry *entry = NULL;
+    struct dir_stat stat = {0};
+    bool stale = false;
+
+    // gone, or replaced by a file
+    if (!get_dir_stat(walk->path, &stat))
+        goto cleanup;
+
+    slot = find_dir_entry(cache, rel_path);
+    entry = *slot;
+    if (!entry) {
+        entry = calloc(1, sizeof(*entry));
+        ASSERT(entry);
+        entry->path = strdup(rel_path);
+        if (!entry->path) {
+            free(entry);
+            ABORT();
+        }
+        *slot = entry;
+        stale = true;
+    } else {
+        stale = memcmp(&entry->stat, &stat, sizeof(stat)) || entry->rules_hash != frame->rules_hash ||
+                entry->tracked_hash != frame->tracked_hash || walk->now - entry->read_at >= UNTRACKED_REVALIDATE_MS ||
+                entry->subdirs_hash != hash_subdirs(walk, entry->subdirs, entry->subdirs_len);
+    }
+
+    if (stale) {
+        entry->stat = stat;
+        entry->rules_hash = frame->rules_hash;
+        entry->tracked_hash = frame->tracked_hash;
+        RETHROW(read_dir(walk, entry));
+    }
+
+    entry->used_at = walk->now;
+    for (const char *name = entry->untracked; name < entry->untracked + entry->untracked_len;
+         name += strlen(name) + 1) {
+        RETHROW(add_path(cache, entry->path, name));
+    }
+
+cleanup:
+    return err;
+}
+
+/* the directory in the walk path, the ignore files of its parents are already in parent_rules. */
+static err_t enter_dir(struct walk *walk, struct dir_frame *frame, uint64_t parent_rules) {
+    err_t err = NO_ERROR;
+
+    frame->len = strlen(walk->path);
+    frame->tracked_hash = HASH_INIT;
+    RETHROW(walk_set(walk, frame->len, ".gitignore", strlen(".gitignore")));
+    frame->rules_hash = hash_stat(parent_rules, walk->path);
+    walk->path[frame->len] = '\0';
+
+cleanup:
+    return err;
+}
+
+/* enter the scope, with the ignore files of the directories above it. */
+static err_t enter_scope(struct untracked_cache *cache, struct walk *walk, const char *scope,
+                         struct dir_frame *frame) {
+    err_t err = NO_ERROR;
+    char exclude_path[PATH_MAX] = {0};
+    uint64_t rules = HASH_INIT;
+
+    RETHROW(join_paths(git_repository_path(cache->repo), "info/exclude", exclude_path, sizeof(exclude_path)));
+    rules = hash_stat(rules, exclude_path);
+
+    RETHROW(walk_set(walk, 0, git_repository_workdir(cache->repo), walk->root_len));
+    RETHROW(enter_dir(walk, frame, rules));
+    for (const char *slash = strchr(scope, '/'); slash; slash = strchr(slash + 1, '/')) {
+        RETHROW(walk_set(walk, walk->root_len, scope, slash - scope + 1));
+        RETHROW(enter_dir(walk, frame, frame->rules_hash));
+    }
+
+cleanup:
+    return err;
+}
+
+/*
+ * The index is sorted by path, so the directories holding tracked files come up depth first. Every directory is
+ * visited when the walk leaves it, once the names of all its tracked children are known.
+ */
+static err_t walk_tracked_dirs(struct untracked_cache *cache, struct walk *walk, const char *scope) {
+    err_t err = NO_ERROR;
+    struct dir_frame frames[MAX_WALK_DEPTH] = {0};
+    size_t depth = 1;
+    size_t start = 0;
+    const char *rest = NULL;
+
+    RETHROW(enter_scope(cache, walk, scope, &frames[0]));
+
+    if (strlen(scope) && git_index_find_prefix(&start, walk->index, scope)) {
+        start = git_index_entrycount(walk->index);
+    }
+    for (size_t i = start; i < git_index_entrycount(walk->index); i++) {
+        const char *path = git_index_get_byindex(walk->index, i)->path;
+        if (strncmp(path, scope, strlen(scope)))
+            break;
+
+        // leave the directories the entry is not in
+        while (depth > 1 && strncmp(path, walk->path + walk->root_len, frames[depth - 1].len - walk->root_len)) {
+            RETHROW(visit_dir(cache, walk, &frames[depth - 1]));
+            depth--;
+            walk->path[frames[depth - 1].len] = '\0';
+        }
+
+        // and enter the ones it is in
+        rest = path + frames[depth - 1].len - walk->root_len;
+        for (const char *slash = strchr(rest, '/'); slash; rest = slash + 1, slash = strchr(rest, '/')) {
+            ASSERT(depth < MAX_WALK_DEPTH);
+            frames[depth - 1].tracked_hash = hash_bytes(frames[depth - 1].tracked_hash, rest, slash - rest + 1);
+            RETHROW(walk_set(walk, frames[depth - 1].len, rest, slash - rest + 1));
+            RETHROW(enter_dir(walk, &frames[depth], frames[depth - 1].rules_hash));
+            depth++;
+        }
+        frames[depth - 1].tracked_hash = hash_bytes(frames[depth - 1].tracked_hash, rest, strlen(rest) + 1);
+    }
+
+    while (depth > 0) {
+        RETHROW(visit_dir(cache, walk, &frames[depth - 1]));
+        depth--;
+        if (depth) {
+            walk->path[frames[depth - 1].len] = '\0';
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+static void drop_unused_dirs(struct untracked_cache *cache, uint64_t now) {
+    for (size_t i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        struct dir_entry **curr = &cache->buckets[i];
+        while (*curr) {
+            struct dir_entry *entry = *curr;
+            if (now - entry->used_at < UNTRACKED_DROP_MS) {
+                curr = &entry->next;
+                continue;
+            }
+            *curr = entry->next;
+            free_dir_entry(entry);
+        }
+    }
+}
+
+static void clear_paths(struct untracked_cache *cache) {
+    for (size_t i = 0; i < cache->count; i++) {
+        free(cache->paths[i]);
+    }
+    cache->count = 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+err_t untracked_cache_scan(struct untracked_cache *cache, const char *scope, const char *const **paths,
+                           size_t *count) {
+    err_t err = NO_ERROR;
+    struct walk *walk = NULL;
+
+    ASSERT(cache);
+    ASSERT(scope);
+    ASSERT(paths);
+    ASSERT(count);
+
+    clear_paths(cache);
+
+    walk = calloc(1, sizeof(*walk));
+    ASSERT(walk);
+    walk->repo = cache->repo;
+    walk->root_len = strlen(git_repository_workdir(cache->repo));
+    walk->now = get_monotonic_ms();
+    ASSERT(!git_repository_index(&walk->index, cache->repo));
+    ASSERT(!git_index_read(walk->index, false));
+
+    RETHROW(walk_tracked_dirs(cache, walk, scope));
+    drop_unused_dirs(cache, walk->now);
+
+    // the directories are visited depth first, but every directory comes after the ones inside it
+    qsort(cache->paths, cache->count, sizeof(*cache->paths), compare_paths);
+    *paths = (const char *const *)cache->paths;
+    *count = cache->count;
+
+cleanup:
+    if (walk) {
+        git_index_free(walk->index);
+    }
+    free(walk);
+    return err;
+}
+
+static struct count_entry *find_count_entry(struct untracked_cache *cache, const char *path, bool *found) {
+    size_t index = hash_string(path) % COUNT_CACHE_SIZE;
+    struct count_entry *victim = &cache->counts[index];
+
+    *found = false;
+    for (size_t i = 0; i < COUNT_CACHE_PROBE; i++) {
+        struct count_entry *entry = &cache->counts[(index + i) % COUNT_CACHE_SIZE];
+        if (entry->state != count_state_empty && !strcmp(entry->path, path)) {
+            *found = true;
+            return entry;
+        }
+        if (entry->state == count_state_empty && victim->state != count_state_empty) {
+            victim = entry;
+        }
+    }
+    return victim;
+}
+
+static struct count_entry *get_pending_count(struct untracked_cache *cache) {
+    for (size_t i = 0; i < COUNT_CACHE_SIZE; i++) {
+        if (cache->counts[i].state == count_state_pending) {
+            return &cache->counts[i];
+        }
+    }
+    return NULL;
+}
+
+static void *count_worker(void *arg) {
+    err_t err = NO_ERROR;
+    struct untracked_cache *cache = arg;
+    struct walk *walk = NULL;
+    struct count_entry *entry = NULL;
+    size_t files = 0;
+    bool started = false;
+
+    walk = calloc(1, sizeof(*walk));
+    ASSERT(walk);
+    ASSERT(!git_repository_open(&walk->repo, cache->repo_path));
+    walk->root_len = strlen(git_repository_workdir(walk->repo));
+    RETHROW(walk_set(walk, 0, git_repository_workdir(walk->repo), walk->root_len));
+    started = true;
+
+    pthread_mutex_lock(&cache->lock);
+    while (!cache->stop) {
+        entry = get_pending_count(cache);
+        if (!entry) {
+            pthread_cond_wait(&cache->cond, &cache->lock);
+            continue;
+        }
+        err = walk_set(walk, walk->root_len, entry->path, strlen(entry->path));
+        pthread_mutex_unlock(&cache->lock);
+
+        files = 0;
+        if (!err) {
+            err = count_files(walk, UNTRACKED_COUNT_LIMIT, &files);
+        }
+
+        pthread_mutex_lock(&cache->lock);
+        // the entry might have been evicted and reused for another directory while we were counting
+        if (entry->state == count_state_pending && !strcmp(entry->path, walk->path + walk->root_len)) {
+            // a failed recount keeps showing the previous count
+            if (!err) {
+                entry->files = files;
+                entry->counted = true;
+            }
+            entry->failed = err;
+            entry->counted_at = get_monotonic_ms();
+            entry->state = err ? count_state_failed : count_state_done;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        RETHROW_PRINT(timing_notify(cache->timer));
+        pthread_mutex_lock(&cache->lock);
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+cleanup:
+    // nothing will ever be counted, the rows are shown without counts rather than as counting forever
+    if (!started) {
+        pthread_mutex_lock(&cache->lock);
+        cache->worker_failed = true;
+        pthread_mutex_unlock(&cache->lock);
+        RETHROW_PRINT(timing_notify(cache->timer));
+    }
+    if (walk) {
+        git_repository_free(walk->repo);
+    }
+    free(walk);
+    return NULL;
+}
+
+err_t untracked_cache_count(struct untracked_cache *cache, const char *dir, size_t *files, bool *ready,
+                            bool *failed) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+    struct count_entry *entry = NULL;
+    struct dir_stat stat = {0};
+    bool found = false;
+    char *copy = NULL;
+
+    ASSERT(cache);
+    ASSERT(dir);
+    ASSERT(files);
+    ASSERT(ready);
+    ASSERT(failed);
+
+    *files = 0;
+    *ready = false;
+    *failed = false;
+
+    RETHROW(join_paths(git_repository_workdir(cache->repo), dir, path, sizeof(path)));
+    get_dir_stat(path, &stat);
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->worker_failed) {
+        *ready = true;
+        *failed = true;
+        pthread_mutex_unlock(&cache->lock);
+        goto cleanup;
+    }
+    entry = find_count_entry(cache, dir, &found);
+    if (!found) {
+        copy = strdup(dir);
+        if (copy) {
+            free(entry->path);
+            *entry = (struct count_entry){.path = copy, .stat = stat, .state = count_state_pending};
+            pthread_cond_signal(&cache->cond);
+        }
+    } else {
+        *files = entry->files;
+        *ready = entry->counted || entry->failed;
+        *failed = !entry->counted && entry->failed;
+        if ((entry->state == count_state_done || entry->state == count_state_failed) &&
+            (memcmp(&entry->stat, &stat, sizeof(stat)) || get_monotonic_ms() - entry->counted_at >= RECOUNT_MS)) {
+            entry->stat = stat;
+            entry->state = count_state_pending;
+            pthread_cond_signal(&cache->cond);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+    ASSERT(found || copy);
+
+cleanup:
+    return err;
+}
+
+void format_untracked_files(size_t files, bool ready, bool failed, char *buff, size_t len) {
+    if (failed) {
+        buff[0] = '\0';
+    } else if (!ready) {
+        snprintf(buff, len, " (counting files)");
+    } else if (files >= UNTRACKED_COUNT_LIMIT) {
+        snprintf(buff, len, " (%zu+ files)", files);
+    } else {
+        snprintf(buff, len, " (%zu file%s)", files, files == 1 ? "" : "s");
+    }
+}
+
+err_t init_untracked_cache(struct untracked_cache **cache, git_repository *repo, struct timer *timer) {
+    err_t err = NO_ERROR;
+    struct untracked_cache *result = NULL;
+
+    ASSERT(cache);
+    ASSERT(repo);
+    ASSERT(timer);
+    ASSERT(git_repository_workdir(repo));
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    result->repo = repo;
+    result->timer = timer;
+    strncpy(result->repo_path, git_repository_path(repo), sizeof(result->repo_path) - 1);
+    ASSERT(!pthread_mutex_init(&result->lock, NULL));
+    ASSERT(!pthread_cond_init(&result->cond, NULL));
+    ASSERT(!pthread_create(&result->thread, NULL, count_worker, result));
+    result->thread_started = true;
+
+    *cache = result;
+
+cleanup:
+    if (err && result) {
+        free(result);
+    }
+    return err;
+}
+
+err_t free_untracked_cache(struct untracked_cache *cache) {
+    err_t err = NO_ERROR;
+
+    ASSERT(cache);
+
+    if (cache->thread_started) {
+        pthread_mutex_lock(&cache->lock);
+        cache->stop = true;
+        pthread_cond_signal(&cache->cond);
+        pthread_mutex_unlock(&cache->lock);
+        pthread_join(cache->thread, NULL);
+    }
+    pthread_cond_destroy(&cache->cond);
+    pthread_mutex_destroy(&cache->lock);
+
+    for (size_t i = 0; i < DIR_CACHE_BUCKETS; i++) {
+        while (cache->buckets[i]) {
+            struct dir_entry *entry = cache->buckets[i];
+            cache->buckets[i] = entry->next;
+            free_dir_entry(entry);
+        }
+    }
+    for (size_t i = 0; i < COUNT_CACHE_SIZE; i++) {
+        free(cache->counts[i].path);
+    }
+    clear_paths(cache);
+    free(cache->paths);
+    free(cache);
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,51 @@
+#ifndef GIT_LIVE_UNTRACKED_H
+#define GIT_LIVE_UNTRACKED_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../lib/err.h"
+#include "timing.h"
+
+/*
+ * The untracked paths of a work tree are found by our own walk rather than by git status, so the ignore decisions can
+ * be cached. Only the directories holding tracked files are walked, every other directory is either ignored (and never
+ * entered) or collapsed into a single untracked row, like git does. The children of every walked directory that are
+ * neither tracked nor ignored are cached with the stat data of the directory and of the ignore files that apply to
+ * it, so a directory is only read again (and its children matched against the ignore rules again) after it or one of
+ * those ignore files changed. A huge ignored build directory then costs one ignore decision, once.
+ * A file created deep inside a collapsed directory doesn't change any walked directory, so entries are read again at
+ * least every UNTRACKED_REVALIDATE_MS anyway.
+ * The files in the collapsed directories are counted by a background thread, the rows show the counts once ready.
+ */
+
+// counting stops there, the count is then shown as a lower bound
+#define UNTRACKED_COUNT_LIMIT (100000)
+
+#define UNTRACKED_FILES_TEXT_LEN (32)
+
+struct untracked_cache;
+
+/* timer is notified whenever a count is ready. */
+err_t init_untracked_cache(struct untracked_cache **cache, git_repository *repo, struct timer *timer);
+err_t free_untracked_cache(struct untracked_cache *cache);
+
+/*
+ * Find the untracked paths in scope (relative to the work tree with a trailing slash, empty for all of it). The paths
+ * are relative to the work tree, sorted, and collapsed directories end with a slash. They stay valid until the next
+ * scan.
+ */
+err_t untracked_cache_scan(struct untracked_cache *cache, const char *scope, const char *const **paths,
+                           size_t *count);
+
+/*
+ * The files in a collapsed directory that are not ignored, ready is false while they are first counted. failed is set
+ * when they could not be counted, the count is retried when the directory changes or after a while.
+ */
+err_t untracked_cache_count(struct untracked_cache *cache, const char *dir, size_t *files, bool *ready,
+                            bool *failed);
+
+/* nothing for a count that failed. */
+void format_untracked_files(size_t files, bool ready, bool failed, char *buff, size_t len);
+
+#endif // GIT_LIVE_UNTRACKED_H
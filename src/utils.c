@@ -1,18 +1,21 @@
 #include "utils.h"
 #include <curses.h>
+#include <linux/limits.h>
+#include <pwd.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
-err_t get_human_readable_time(int64_t t, char *buff, size_t len) {
+err_t get_human_readable_time(int64_t now, int64_t t, char *buff, size_t len) {
     err_t err = NO_ERROR;
 
     ASSERT(buff);
 
-    int64_t diff = time(NULL) - t;
+    int64_t diff = now - t;
     if (diff < 60) {
         snprintf(buff, len, "now");
     } else if (diff < 60 * 60) {
@@ -157,4 +160,91 @@ err_t file_exists(const char* path, bool* out) {
 
 cleanup:
     return err;
-}
\ No newline at end of file
+}
+
+err_t make_dirs(const char *path) {
+    err_t err = NO_ERROR;
+    char partial[PATH_MAX] = {0};
+    size_t len = 0;
+
+    ASSERT(path);
+
+    len = strlen(path);
+    ASSERT(len < sizeof(partial));
+
+    for (size_t i = 1; i <= len; i++) {
+        if (path[i] != '/' && path[i] != '\0')
+            continue;
+        memcpy(partial, path, i);
+        partial[i] = '\0';
+        ASSERT(!mkdir(partial, S_IRWXU) || errno == EEXIST);
+    }
+
+cleanup:
+    return err;
+}
+
+err_t get_home_dir(const char **out) {
+    err_t err = NO_ERROR;
+    const char *home = getenv("HOME");
+    struct passwd *pw = NULL;
+
+    ASSERT(out);
+
+    if (!home || !strlen(home)) {
+        pw = getpwuid(getuid());
+        ASSERT(pw && pw->pw_dir);
+        home = pw->pw_dir;
+    }
+    *out = home;
+
+cleanup:
+    return err;
+}
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+uint64_t hash_string(const char *str) {
+    // the keys are only used to name files so any stable hash will do
+    return hash_bytes(HASH_INIT, str, strlen(str));
+}
+
+uint64_t get_monotonic_ms() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * MSEC_IN_SEC + ts.tv_nsec / NSEC_IN_MSEC;
+}
+
+uint64_t get_thread_cpu_us() {
+    struct timespec ts = {0};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * USEC_IN_SEC + ts.tv_nsec / NSEC_IN_USEC;
+}
+
+err_t get_keyed_cache_path(const char *dir, const char *key, char *buff, size_t len) {
+    err_t err = NO_ERROR;
+    char full_dir[PATH_MAX] = {0};
+    char name[32] = {0};
+    const char *home = NULL;
+
+    ASSERT(dir);
+    ASSERT(key);
+    ASSERT(buff);
+
+    RETHROW(get_home_dir(&home));
+    RETHROW(join_paths(home, dir, full_dir, sizeof(full_dir)));
+    RETHROW(make_dirs(full_dir));
+    snprintf(name, sizeof(name), "%016lx", hash_string(key));
+    RETHROW(join_paths(full_dir, name, buff, len));
+
+cleanup:
+    return err;
+}
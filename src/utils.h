@@ -1,8 +1,9 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "../lib/err.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
@@ -10,14 +11,34 @@
 
 #define MSEC_IN_SEC (1000)
 #define NSEC_IN_MSEC (1000000)
+#define USEC_IN_SEC (1000000)
+#define USEC_IN_MSEC (1000)
+#define NSEC_IN_USEC (1000)
 
 #define FD_INVALID (-1)
 
-err_t get_human_readable_time(int64_t t, char *buff, size_t len);
+// the FNV-1a offset basis, the hash of nothing for hash_bytes
+#define HASH_INIT (0xcbf29ce484222325)
+
+err_t get_human_readable_time(int64_t now, int64_t t, char *buff, size_t len);
 err_t safe_close_fd(int *fd);
 err_t file_exists(const char* path, bool* out);
 err_t join_paths(const char *a, const char *b, char *out_buff, unsigned long out_len);
 err_t relative_to(const char* path, const char *dir, char *out_buff, unsigned long out_len);
 err_t is_relative_to(const char *path, const char *parent, bool* out);
+/* create the directory and its missing parents, like `mkdir -p`. */
+err_t make_dirs(const char *path);
+/* $HOME, or the user's home directory from the password database when it is not set, like git. */
+err_t get_home_dir(const char **out);
+/* FNV-1a of data continuing from hash, start from HASH_INIT. stable across runs but not a cryptographic hash. */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len);
+/* a stable hash for naming files after paths. */
+uint64_t hash_string(const char *str);
+/* CLOCK_MONOTONIC in milliseconds, for deadlines and ages. */
+uint64_t get_monotonic_ms();
+/* the cpu time of the calling thread, for charging the work of a pool to a timer. */
+uint64_t get_thread_cpu_us();
+/* ~/<dir>/<hash of key>, creating dir if needed. for per repository files, keyed by the repository's path. */
+err_t get_keyed_cache_path(const char *dir, const char *key, char *buff, size_t len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,620 @@
+#include "worktree_scan.h"
+#include <git2.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../lib/err.h"
+#include "index_file.h"
+#include "timing.h"
+#include "utils.h"
+
+#define SCAN_MAX_THREADS (8)
+
+// a run ends at the first directory boundary after this many entries, a huge directory is cut into runs of the max
+#define SCAN_RUN_ENTRIES (256)
+#define SCAN_RUN_MAX_ENTRIES (4 * SCAN_RUN_ENTRIES)
+
+// a file changed within this long before it was hashed might change again without its stat data changing, its
+// verdict is not remembered
+#define SCAN_RACY_SEC (2)
+
+#define MODE_EXECUTABLE (0100)
+
+enum verdict {
+    verdict_clean = 0,
+    verdict_hash,
+    verdict_modified,
+    verdict_deleted,
+    verdict_typechange,
+    verdict_submodule,
+    verdict_conflicted,
+};
+
+struct file_stat {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime_sec;
+    int64_t ctime_nsec;
+    uint64_t ino;
+    uint64_t size;
+    uint32_t mode;
+};
+
+/* what hashing an entry's file found, for as long as the file keeps the same stat data. */
+struct verified {
+    struct file_stat stat;
+    bool valid;
+    bool clean;
+};
+
+struct run {
+    size_t start;
+    size_t end;
+    // the stat data of the run, when fingerprinting
+    uint64_t hash;
+    bool racy;
+};
+
+struct worktree_scanner {
+    git_repository *repo;
+    struct timer *timer;
+    struct index_file *index;
+    bool filemode;
+    char workdir[PATH_MAX];
+    size_t workdir_len;
+    // one per index entry, the verified ones are forgotten when the index changes
+    uint8_t *verdicts;
+    struct verified *verified;
+    size_t entries_cap;
+    struct run *runs;
+    size_t runs_count;
+    size_t runs_cap;
+    atomic_size_t next_run;
+    // the lstat pass also hashes the stat data of the files and of their directories
+    bool fingerprint;
+    // realtime, stat data newer than this is racy
+    int64_t racy_after;
+    // the verdicts of [scanned_start, scanned_end) are of a pass over scanned_scope that no scan collected yet
+    bool scanned;
+    char scanned_scope[PATH_MAX];
+    size_t scanned_start;
+    size_t scanned_end;
+    struct worktree_change *changes;
+    size_t changes_count;
+    size_t changes_cap;
+
+    pthread_t threads[SCAN_MAX_THREADS];
+    size_t threads_count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t done_cond;
+    bool stop;
+    // bumped for every scan the threads take part in
+    uint64_t job;
+    size_t busy;
+    // the cpu time of the pool threads, not charged to the timer yet
+    uint64_t pool_cpu_us;
+};
+
+static void get_file_stat(const struct stat *st, struct file_stat *out) {
+    *out = (struct file_stat){
+        .mtime_sec = st->st_mtim.tv_sec,
+        .mtime_nsec = st->st_mtim.tv_nsec,
+        .ctime_sec = st->st_ctim.tv_sec,
+        .ctime_nsec = st->st_ctim.tv_nsec,
+        .ino = st->st_ino,
+        .size = st->st_size,
+        .mode = st->st_mode,
+    };
+}
+
+/* the index keeps 32 bits of everything, like git only those are compared. */
+static bool is_stat_equal(const struct index_entry *entry, const struct stat *st) {
+    return entry->mtime_sec == (uint32_t)st->st_mtim.tv_sec && entry->mtime_nsec == (uint32_t)st->st_mtim.tv_nsec &&
+           entry->ctime_sec == (uint32_t)st->st_ctim.tv_sec && entry->ctime_nsec == (uint32_t)st->st_ctim.tv_nsec &&
+           entry->ino == (uint32_t)st->st_ino && entry->size == (uint32_t)st->st_size;
+}
+
+/* st is left zeroed when the file was not looked at. */
+static enum verdict check_entry(const struct worktree_scanner *scanner, const struct index_entry *entry,
+                                const struct verified *verified, char *path, struct stat *st) {
+    struct file_stat file_stat = {0};
+    size_t len = strlen(entry->path);
+
+    if (entry->skip_worktree)
+        return verdict_clean;
+    if (entry->stage)
+        return verdict_conflicted;
+    if (entry->mode == INDEX_MODE_GITLINK)
+        return verdict_submodule;
+    if (scanner->workdir_len + len >= PATH_MAX)
+        return verdict_hash;
+
+    memcpy(path + scanner->workdir_len, entry->path, len + 1);
+    // a directory where the file was is a deleted file (and an untracked directory)
+    if (lstat(path, st) || S_ISDIR(st->st_mode))
+        return verdict_deleted;
+    if ((entry->mode == INDEX_MODE_SYMLINK) != S_ISLNK(st->st_mode) || (!S_ISLNK(st->st_mode) && !S_ISREG(st->st_mode)))
+        return verdict_typechange;
+    if (scanner->filemode && S_ISREG(st->st_mode) &&
+        (entry->mode & MODE_EXECUTABLE) != (st->st_mode & MODE_EXECUTABLE))
+        return verdict_modified;
+    if (is_stat_equal(entry, st) && !index_file_is_racy(scanner->index, entry))
+        return verdict_clean;
+
+    get_file_stat(st, &file_stat);
+    if (verified->valid && !memcmp(&verified->stat, &file_stat, sizeof(file_stat)))
+        return verified->clean ? verdict_clean : verdict_modified;
+    return verdict_hash;
+}
+
+/* fold what the fingerprint cares about field by field, a struct stat has padding. */
+static void hash_stat(struct run *run, int64_t racy_after, const struct stat *st) {
+    run->hash = hash_bytes(run->hash, &st->st_ino, sizeof(st->st_ino));
+    run->hash = hash_bytes(run->hash, &st->st_mode, sizeof(st->st_mode));
+    run->hash = hash_bytes(run->hash, &st->st_size, sizeof(st->st_size));
+    run->hash = hash_bytes(run->hash, &st->st_mtim, sizeof(st->st_mtim));
+    run->hash = hash_bytes(run->hash, &st->st_ctim, sizeof(st->st_ctim));
+    if (st->st_mtim.tv_sec >= racy_after || st->st_ctim.tv_sec >= racy_after) {
+        run->racy = true;
+    }
+}
+
+/* new untracked files only change the directory they are created in, so those are fingerprinted too. */
+static void hash_dirs(struct run *run, int64_t racy_after, const char *prev, const char *entry_path, char *path,
+                      size_t workdir_len) {
+    struct stat st = {0};
+
+    // the entries are sorted, so a directory is added right before its first entry in the run
+    for (const char *slash = strchr(entry_path, '/'); slash; slash = strchr(slash + 1, '/')) {
+        size_t len = slash - entry_path;
+        if (prev && !strncmp(prev, entry_path, len) && prev[len] == '/')
+            continue;
+        if (workdir_len + len >= PATH_MAX)
+            break;
+        memcpy(path + workdir_len, entry_path, len);
+        path[workdir_len + len] = '\0';
+        memset(&st, '\0', sizeof(st));
+        lstat(path, &st);
+        hash_stat(run, racy_after, &st);
+    }
+}
+
+/* take runs until there are none left, on the pool threads and on the caller alike. */
+static void scan_runs(struct worktree_scanner *scanner) {
+    char path[PATH_MAX] = {0};
+    size_t count = 0;
+    const struct index_entry *entries = index_file_entries(scanner->index, &count);
+    size_t index = 0;
+    struct stat st = {0};
+
+    memcpy(path, scanner->workdir, scanner->workdir_len);
+    while ((index = atomic_fetch_add(&scanner->next_run, 1)) < scanner->runs_count) {
+        struct run *run = &scanner->runs[index];
+        for (size_t i = run->start; i < run->end; i++) {
+            if (scanner->fingerprint) {
+                hash_dirs(run, scanner->racy_after, i > run->start ? entries[i - 1].path : NULL, entries[i].path,
+                          path, scanner->workdir_len);
+            }
+            memset(&st, '\0', sizeof(st));
+            scanner->verdicts[i] = check_entry(scanner, &entries[i], &scanner->verified[i], path, &st);
+            if (scanner->fingerprint) {
+                hash_stat(run, scanner->racy_after, &st);
+            }
+        }
+    }
+}
+
+static void *scan_worker(void *arg) {
+    struct worktree_scanner *scanner = arg;
+    uint64_t job = 0;
+    uint64_t started = 0;
+
+    pthread_mutex_lock(&scanner->lock);
+    while (!scanner->stop) {
+        if (scanner->job == job) {
+            pthread_cond_wait(&scanner->cond, &scanner->lock);
+            continue;
+        }
+        job = scanner->job;
+        pthread_mutex_unlock(&scanner->lock);
+
+        started = get_thread_cpu_us();
+        scan_runs(scanner);
+
+        pthread_mutex_lock(&scanner->lock);
+        scanner->pool_cpu_us += get_thread_cpu_us() - started;
+        if (--scanner->busy == 0) {
+            pthread_cond_signal(&scanner->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&scanner->lock);
+
+    return NULL;
+}
+
+static size_t get_dir_len(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? (size_t)(slash - path) : 0;
+}
+
+static bool is_same_dir(const char *a, const char *b) {
+    size_t len = get_dir_len(a);
+    return len == get_dir_len(b) && !memcmp(a, b, len);
+}
+
+static err_t split_runs(struct worktree_scanner *scanner, const struct index_entry *entries, size_t start,
+                        size_t end) {
+    err_t err = NO_ERROR;
+    struct run *grown = NULL;
+    size_t run_start = start;
+
+    scanner->runs_count = 0;
+    for (size_t i = start; i <= end; i++) {
+        if (i < end && (i - run_start < SCAN_RUN_ENTRIES ||
+                        (i - run_start < SCAN_RUN_MAX_ENTRIES && is_same_dir(entries[i - 1].path, entries[i].path))))
+            continue;
+        if (i == run_start)
+            continue;
+
+        if (scanner->runs_count == scanner->runs_cap) {
+            grown = realloc(scanner->runs, MAX(scanner->runs_cap * 2, 16) * sizeof(*grown));
+            ASSERT(grown);
+            scanner->runs = grown;
+            scanner->runs_cap = MAX(scanner->runs_cap * 2, 16);
+        }
+        scanner->runs[scanner->runs_count++] = (struct run){.start = run_start, .end = i, .hash = HASH_INIT};
+        run_start = i;
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t reset_entries(struct worktree_scanner *scanner, size_t count) {
+    err_t err = NO_ERROR;
+    uint8_t *verdicts = NULL;
+    struct verified *verified = NULL;
+
+    if (count > scanner->entries_cap) {
+        verdicts = realloc(scanner->verdicts, count * sizeof(*verdicts));
+        ASSERT(verdicts);
+        scanner->verdicts = verdicts;
+        verified = realloc(scanner->verified, count * sizeof(*verified));
+        ASSERT(verified);
+        scanner->verified = verified;
+        scanner->entries_cap = count;
+    }
+    if (count) {
+        memset(scanner->verified, '\0', count * sizeof(*scanner->verified));
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t add_change(struct worktree_scanner *scanner, const struct index_entry *entry, const char *status) {
+    err_t err = NO_ERROR;
+    struct worktree_change *grown = NULL;
+
+    if (scanner->changes_count == scanner->changes_cap) {
+        grown = realloc(scanner->changes, MAX(scanner->changes_cap * 2, 64) * sizeof(*grown));
+        ASSERT(grown);
+        scanner->changes = grown;
+        scanner->changes_cap = MAX(scanner->changes_cap * 2, 64);
+    }
+    scanner->changes[scanner->changes_count++] =
+        (struct worktree_change){.path = entry->path, .status = status, .id = entry->id, .mode = entry->mode};
+
+cleanup:
+    return err;
+}
+
+/* hash the file like git add would (through its filters, links by their target), remembering what was found. */
+static err_t hash_entry(struct worktree_scanner *scanner, const struct index_entry *entry, struct verified *verified,
+                        enum verdict *verdict) {
+    err_t err = NO_ERROR;
+    char path[PATH_MAX] = {0};
+    char target[PATH_MAX] = {0};
+    struct stat st = {0};
+    ssize_t len = 0;
+    git_oid id;
+    int result = 0;
+
+    RETHROW(join_paths(scanner->workdir, entry->path, path, sizeof(path)));
+    if (lstat(path, &st)) {
+        *verdict = verdict_deleted;
+        goto cleanup;
+    }
+
+    if (S_ISLNK(st.st_mode)) {
+        len = readlink(path, target, sizeof(target));
+        result = len < 0 || git_odb_hash(&id, target, len, GIT_OBJECT_BLOB);
+    } else {
+        result = git_repository_hashfile(&id, scanner->repo, entry->path, GIT_OBJECT_BLOB, NULL);
+    }
+    // gone, or unreadable, either way it differs from the index
+    if (result) {
+        *verdict = verdict_modified;
+        goto cleanup;
+    }
+    *verdict = git_oid_equal(&id, &entry->id) ? verdict_clean : verdict_modified;
+
+    if (st.st_mtim.tv_sec < time(NULL) - SCAN_RACY_SEC && st.st_ctim.tv_sec < time(NULL) - SCAN_RACY_SEC) {
+        get_file_stat(&st, &verified->stat);
+        verified->valid = true;
+        verified->clean = *verdict == verdict_clean;
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t check_submodule(struct worktree_scanner *scanner, const struct index_entry *entry,
+                             enum verdict *verdict) {
+    err_t err = NO_ERROR;
+    unsigned int flags = 0;
+
+    *verdict = verdict_clean;
+    // an uninitialized submodule is not a change, nor is one libgit2 can't read
+    if (git_status_file(&flags, scanner->repo, entry->path))
+        goto cleanup;
+    if (flags & GIT_STATUS_WT_DELETED) {
+        *verdict = verdict_deleted;
+    } else if (flags & (GIT_STATUS_WT_MODIFIED | GIT_STATUS_WT_TYPECHANGE)) {
+        *verdict = verdict_modified;
+    }
+
+cleanup:
+    return err;
+}
+
+static err_t collect_changes(struct worktree_scanner *scanner, const struct index_entry *entries, size_t start,
+                             size_t end, bool exclude_submodules) {
+    err_t err = NO_ERROR;
+    enum verdict verdict = verdict_clean;
+    static const char *const statuses[] = {
+        [verdict_modified] = "modified",
+        [verdict_deleted] = "deleted",
+        [verdict_typechange] = "typechange",
+        [verdict_conflicted] = "conflicted",
+    };
+
+    scanner->changes_count = 0;
+    for (size_t i = start; i < end; i++) {
+        verdict = scanner->verdicts[i];
+        if (verdict == verdict_hash) {
+            RETHROW(hash_entry(scanner, &entries[i], &scanner->verified[i], &verdict));
+        } else if (verdict == verdict_submodule && exclude_submodules) {
+            verdict = verdict_clean;
+        } else if (verdict == verdict_submodule) {
+            RETHROW(check_submodule(scanner, &entries[i], &verdict));
+        } else if (verdict == verdict_conflicted && i > start && !strcmp(entries[i - 1].path, entries[i].path)) {
+            // the stages of a conflict are one change
+            continue;
+        }
+
+        if (verdict != verdict_clean) {
+            RETHROW(add_change(scanner, &entries[i], statuses[verdict]));
+        }
+    }
+
+cleanup:
+    return err;
+}
+
+/* the lstat pass over the entries in scope, on the pool threads. The caller refreshed the index. */
+static err_t scan_entries(struct worktree_scanner *scanner, const char *scope, bool fingerprint) {
+    err_t err = NO_ERROR;
+    const struct index_entry *entries = NULL;
+    size_t entries_count = 0;
+    size_t start = 0;
+    size_t end = 0;
+    struct timespec now = {0};
+
+    ASSERT(strlen(scope) < sizeof(scanner->scanned_scope));
+
+    entries = index_file_entries(scanner->index, &entries_count);
+    start = strlen(scope) ? index_file_find_prefix(scanner->index, scope) : 0;
+    for (end = start; end < entries_count && !strncmp(entries[end].path, scope, strlen(scope)); end++) {
+    }
+    RETHROW(split_runs(scanner, entries, start, end));
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    scanner->racy_after = now.tv_sec - SCAN_RACY_SEC;
+    scanner->fingerprint = fingerprint;
+    atomic_store(&scanner->next_run, 0);
+    // a single run is not worth waking anyone
+    if (scanner->runs_count > 1 && scanner->threads_count) {
+        pthread_mutex_lock(&scanner->lock);
+        scanner->job++;
+        scanner->busy = scanner->threads_count;
+        pthread_cond_broadcast(&scanner->cond);
+        pthread_mutex_unlock(&scanner->lock);
+    }
+    scan_runs(scanner);
+    pthread_mutex_lock(&scanner->lock);
+    while (scanner->busy) {
+        pthread_cond_wait(&scanner->done_cond, &scanner->lock);
+    }
+    pthread_mutex_unlock(&scanner->lock);
+
+    // the caller's own time is already counted by the timer
+    RETHROW(timing_charge(scanner->timer, scanner->pool_cpu_us));
+    scanner->pool_cpu_us = 0;
+
+    strcpy(scanner->scanned_scope, scope);
+    scanner->scanned_start = start;
+    scanner->scanned_end = end;
+    scanner->scanned = true;
+
+cleanup:
+    return err;
+}
+
+/* like index_file_refresh, also forgetting what was learned about the entries of the previous index. */
+static err_t refresh_index(struct worktree_scanner *scanner, bool *supported) {
+    err_t err = NO_ERROR;
+    size_t entries_count = 0;
+    bool changed = false;
+
+    RETHROW(index_file_refresh(scanner->index, supported, &changed));
+    if (!*supported || !changed)
+        goto cleanup;
+    index_file_entries(scanner->index, &entries_count);
+    RETHROW(reset_entries(scanner, entries_count));
+    scanner->scanned = false;
+
+cleanup:
+    return err;
+}
+
+err_t worktree_scan_fingerprint(struct worktree_scanner *scanner, const char *scope, uint64_t *hash, bool *racy,
+                                bool *supported) {
+    err_t err = NO_ERROR;
+
+    ASSERT(scanner);
+    ASSERT(scope);
+    ASSERT(hash);
+    ASSERT(racy);
+    ASSERT(supported);
+
+    *hash = 0;
+    *racy = false;
+
+    RETHROW(refresh_index(scanner, supported));
+    if (!*supported)
+        goto cleanup;
+    RETHROW(scan_entries(scanner, scope, true));
+
+    // in the order of the runs, whichever thread took them
+    *hash = HASH_INIT;
+    for (size_t i = 0; i < scanner->runs_count; i++) {
+        *hash = hash_bytes(*hash, &scanner->runs[i].hash, sizeof(scanner->runs[i].hash));
+        *racy = *racy || scanner->runs[i].racy;
+    }
+
+cleanup:
+    return err;
+}
+
+err_t worktree_scan(struct worktree_scanner *scanner, const char *scope, bool exclude_submodules,
+                    const struct worktree_change **changes, size_t *count, bool *supported) {
+    err_t err = NO_ERROR;
+    const struct index_entry *entries = NULL;
+    size_t entries_count = 0;
+
+    ASSERT(scanner);
+    ASSERT(scope);
+    ASSERT(changes);
+    ASSERT(count);
+    ASSERT(supported);
+
+    *changes = NULL;
+    *count = 0;
+
+    RETHROW(refresh_index(scanner, supported));
+    if (!*supported)
+        goto cleanup;
+    // the fingerprint of the status cache was taken right before, its pass is as fresh as a new one
+    if (!scanner->scanned || strcmp(scanner->scanned_scope, scope)) {
+        RETHROW(scan_entries(scanner, scope, false));
+    }
+    scanner->scanned = false;
+
+    entries = index_file_entries(scanner->index, &entries_count);
+    RETHROW(collect_changes(scanner, entries, scanner->scanned_start, scanner->scanned_end, exclude_submodules));
+    *changes = scanner->changes;
+    *count = scanner->changes_count;
+
+cleanup:
+    return err;
+}
+
+static bool get_filemode(git_repository *repo) {
+    git_config *cfg = NULL;
+    int filemode = true;
+
+    if (!git_repository_config_snapshot(&cfg, repo)) {
+        git_config_get_bool(&filemode, cfg, "core.filemode");
+    }
+    git_config_free(cfg);
+    return filemode;
+}
+
+err_t init_worktree_scanner(struct worktree_scanner **scanner, git_repository *repo, struct timer *timer) {
+    err_t err = NO_ERROR;
+    struct worktree_scanner *result = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    // the caller scans too
+    size_t threads_count = MIN(MAX(cpus, 1), SCAN_MAX_THREADS) - 1;
+
+    ASSERT(scanner);
+    ASSERT(repo);
+    ASSERT(git_repository_workdir(repo));
+    ASSERT(timer);
+
+    result = calloc(1, sizeof(*result));
+    ASSERT(result);
+
+    result->repo = repo;
+    result->timer = timer;
+    result->filemode = get_filemode(repo);
+    result->workdir_len = strlen(git_repository_workdir(repo));
+    ASSERT(result->workdir_len < sizeof(result->workdir));
+    strcpy(result->workdir, git_repository_workdir(repo));
+    RETHROW(init_index_file(&result->index, git_repository_path(repo)));
+
+    ASSERT(!pthread_mutex_init(&result->lock, NULL));
+    ASSERT(!pthread_cond_init(&result->cond, NULL));
+    ASSERT(!pthread_cond_init(&result->done_cond, NULL));
+    for (size_t i = 0; i < threads_count; i++) {
+        ASSERT(!pthread_create(&result->threads[i], NULL, scan_worker, result));
+        result->threads_count++;
+    }
+
+    *scanner = result;
+    result = NULL;
+
+cleanup:
+    if (result) {
+        RETHROW_PRINT(free_worktree_scanner(result));
+    }
+    return err;
+}
+
+err_t free_worktree_scanner(struct worktree_scanner *scanner) {
+    err_t err = NO_ERROR;
+
+    ASSERT(scanner);
+
+    pthread_mutex_lock(&scanner->lock);
+    scanner->stop = true;
+    pthread_cond_broadcast(&scanner->cond);
+    pthread_mutex_unlock(&scanner->lock);
+    for (size_t i = 0; i < scanner->threads_count; i++) {
+        pthread_join(scanner->threads[i], NULL);
+    }
+    pthread_cond_destroy(&scanner->done_cond);
+    pthread_cond_destroy(&scanner->cond);
+    pthread_mutex_destroy(&scanner->lock);
+
+    if (scanner->index) {
+        RETHROW_PRINT(free_index_file(scanner->index));
+    }
+    free(scanner->verdicts);
+    free(scanner->verified);
+    free(scanner->runs);
+    free(scanner->changes);
+    free(scanner);
+
+cleanup:
+    return err;
+}
@@ -0,0 +1,54 @@
+#ifndef GIT_LIVE_WORKTREE_SCAN_H
+#define GIT_LIVE_WORKTREE_SCAN_H
+
+#include <git2.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../lib/err.h"
+#include "timing.h"
+
+/*
+ * The changed section only needs the tracked files whose work tree version differs from the index, so rather than a
+ * full git status the scanner compares the stat data in the memory mapped index with an lstat of every file. The
+ * entries are split into runs of whole directories that a pool of threads (and the caller) take one at a time, so the
+ * lstats of a directory stay on one core and the scan scales with them.
+ * Only files whose stat data changed, and racy ones (changed too close to the index write for their stat data to be
+ * trusted), are hashed, on the calling thread. A file found unchanged is remembered by its stat data until the index
+ * changes, so touching a file makes it hashed once rather than on every scan.
+ * Submodules are left to libgit2 (or skipped, for a caller that shows them on their own), whether they changed is not
+ * in their stat data.
+ * The cpu time of the pool threads is charged to the timer, the caller's own is counted by it already.
+ */
+
+struct worktree_change {
+    const char *path;
+    // "modified", "deleted", "typechange" or "conflicted"
+    const char *status;
+    // of the index version, for the diffstat
+    git_oid id;
+    uint32_t mode;
+};
+
+struct worktree_scanner;
+
+err_t init_worktree_scanner(struct worktree_scanner **scanner, git_repository *repo, struct timer *timer);
+err_t free_worktree_scanner(struct worktree_scanner *scanner);
+
+/*
+ * The changed files in scope (relative to the work tree with a trailing slash, empty for all of it) in index order.
+ * They stay valid until the next scan. supported is false when the index can't be read here (a split index), the
+ * caller then falls back to git status. exclude_submodules leaves out the submodules and their status.
+ */
+err_t worktree_scan(struct worktree_scanner *scanner, const char *scope, bool exclude_submodules,
+                    const struct worktree_change **changes, size_t *count, bool *supported);
+
+/*
+ * The lstat pass of a scan alone, for the status cache: hash is taken from the stat data of the files in scope and of
+ * the directories containing them, racy is set when some of it is too recent to be trusted. A worktree_scan of the
+ * same scope right after reuses the pass rather than doing it again.
+ */
+err_t worktree_scan_fingerprint(struct worktree_scanner *scanner, const char *scope, uint64_t *hash, bool *racy,
+                                bool *supported);
+
+#endif // GIT_LIVE_WORKTREE_SCAN_H
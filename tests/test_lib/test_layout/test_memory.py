@@ -0,0 +1,72 @@
+from .utils.library import Library
+from .utils.screen import VirtualScreen
+from .utils.trees import BUILDERS
+
+
+def test_live_nodes_follow_the_tree(library: Library):
+    scr = VirtualScreen(10, 5)
+    before = library.get_counters()
+    layout, root = library.init_layout(scr)
+
+    child = library.append_child(root)
+    library.append_text(child, b"blabla")
+    library.append_text(root, b"bla")
+
+    counters = library.get_counters()
+    assert counters.live_nodes - before.live_nodes == 3
+    assert counters.live_bytes > before.live_bytes
+
+    library.free_layout(layout)
+
+    counters = library.get_counters()
+    assert counters.live_nodes == before.live_nodes
+    assert counters.live_bytes == before.live_bytes
+
+
+def test_reset_keeps_live_counters(library: Library):
+    scr = VirtualScreen(10, 5)
+    layout, root = library.init_layout(scr)
+    library.append_text(root, b"blabla")
+    before = library.get_counters()
+
+    library.reset_counters()
+
+    counters = library.get_counters()
+    assert counters.allocations == 0
+    assert counters.live_nodes == before.live_nodes
+    assert counters.live_bytes == before.live_bytes
+
+    library.free_layout(layout)
+
+
+def test_rebuilding_does_not_leak(library: Library):
+    scr = VirtualScreen(80, 24)
+    layout, root = library.init_layout(scr)
+    before = library.get_counters()
+
+    # what the dashboard does every frame
+    for _ in range(10):
+        for build in BUILDERS:
+            library.clear_children(root)
+            build(library, root, 100)
+            library.draw_layout(layout, scr)
+    library.clear_children(root)
+
+    counters = library.get_counters()
+    assert counters.live_nodes == before.live_nodes
+    assert counters.live_bytes == before.live_bytes
+
+    library.free_layout(layout)
+
+
+def test_drawing_does_not_allocate(library: Library):
+    scr = VirtualScreen(80, 24)
+    for build in BUILDERS:
+        layout, root = library.init_layout(scr)
+        build(library, root, 100)
+
+        library.reset_counters()
+        library.draw_layout(layout, scr)
+
+        assert library.get_counters().allocations == 0
+        library.free_layout(layout)
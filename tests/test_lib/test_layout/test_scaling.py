@@ -0,0 +1,96 @@
+from dataclasses import dataclass
+from typing import Callable
+
+import pytest
+
+from .utils.library import Library, NodePointer
+from .utils.screen import VirtualScreen
+from .utils.trees import BUILDERS
+
+SIZES = [10, 100, 1000, 10000]
+
+# growing the tree by 10x may cost at most this much more than 10x the work,
+# anything quadratic costs ~100x and fails
+LINEAR_SLACK = 2
+
+# until the screen fills up the per node cost is still growing, so the
+# growth is only checked from this size up
+LINEAR_FROM = 100
+
+# a wrapped node searches for its min size one screen row (or column) at a
+# time, measuring its children for each, so before the screen is full a node
+# costs up to this many measure calls per row of the screen. checked on a
+# screen big enough for the growth to show.
+MEASURE_CALLS_PER_NODE_PER_ROW = 12
+BIG_SCREEN = (200, 60)
+BIG_SCREEN_SIZES = [10, 30, 100, 300, 1000, 3000]
+
+
+@dataclass
+class CountingScreen(VirtualScreen):
+    draw_text_calls: int = 0
+    draw_color_calls: int = 0
+
+    def draw_text(
+        self, text: bytes, length: int, col: int, row: int, color: int, attrs: int
+    ):
+        self.draw_text_calls += 1
+        return super().draw_text(text, length, col, row, color, attrs)
+
+    def draw_color(self, col: int, row: int, width: int, height: int, color: int):
+        self.draw_color_calls += 1
+        return super().draw_color(col, row, width, height, color)
+
+
+def draw(
+    library: Library,
+    build: Callable[[Library, NodePointer, int], None],
+    size: int,
+    screen_size: tuple[int, int] = (80, 24),
+) -> tuple[CountingScreen, int]:
+    scr = CountingScreen(*screen_size)
+    layout, root = library.init_layout(scr)
+    build(library, root, size)
+
+    library.reset_counters()
+    library.draw_layout(layout, scr)
+    measure_calls = library.get_counters().measure_calls
+
+    library.free_layout(layout)
+    return scr, measure_calls
+
+
+@pytest.mark.parametrize("build", BUILDERS)
+def test_measure_calls_grow_linearly(library: Library, build):
+    calls = {size: draw(library, build, size)[1] for size in SIZES}
+
+    sizes = [size for size in SIZES if size >= LINEAR_FROM]
+    for small, big in zip(sizes, sizes[1:]):
+        assert calls[big] <= calls[small] * (big // small) * LINEAR_SLACK, calls
+
+
+@pytest.mark.parametrize("build", BUILDERS)
+@pytest.mark.parametrize("size", BIG_SCREEN_SIZES)
+def test_measure_calls_per_node_bounded(library: Library, build, size: int):
+    scr, calls = draw(library, build, size, BIG_SCREEN)
+
+    assert calls <= size * MEASURE_CALLS_PER_NODE_PER_ROW * scr.height, calls
+
+
+@pytest.mark.parametrize("build", BUILDERS)
+@pytest.mark.parametrize("size", SIZES)
+def test_draw_calls_bounded_by_screen(library: Library, build, size: int):
+    scr, _ = draw(library, build, size)
+
+    # only what fits is drawn, at most a text and a background per cell
+    assert scr.draw_text_calls <= scr.width * scr.height
+    assert scr.draw_color_calls <= scr.width * scr.height
+
+
+@pytest.mark.parametrize("build", BUILDERS)
+def test_draw_calls_stop_growing(library: Library, build):
+    screens = [draw(library, build, size)[0] for size in SIZES[-2:]]
+
+    # once the screen is full more nodes can't draw more
+    assert screens[0].draw_text_calls == screens[1].draw_text_calls
+    assert screens[0].draw_color_calls == screens[1].draw_color_calls
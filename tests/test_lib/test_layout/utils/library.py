@@ -47,6 +47,17 @@ class Rect(ctypes.Structure):
     ]
 
 
+class LayoutCounters(ctypes.Structure):
+    _fields_ = [
+        ("measure_calls", ctypes.c_uint64),
+        ("overflow_measure_calls", ctypes.c_uint64),
+        ("print_calls", ctypes.c_uint64),
+        ("allocations", ctypes.c_uint64),
+        ("live_nodes", ctypes.c_uint64),
+        ("live_bytes", ctypes.c_uint64),
+    ]
+
+
 class Node(ctypes.Structure):
     pass
 
@@ -118,6 +129,8 @@ def load_library() -> ctypes.CDLL:
     lib_layout.clear_layout.argtypes = [Layout]
     lib_layout.draw_layout.argtypes = [Layout, Rect]
     lib_layout.get_layout_root.argtypes = [Layout, ctypes.POINTER(ctypes.POINTER(Node))]
+    lib_layout.get_layout_counters.argtypes = [ctypes.POINTER(LayoutCounters)]
+    lib_layout.reset_layout_counters.argtypes = []
 
     lib_layout.append_text.argtypes = [ctypes.POINTER(Node), ctypes.c_char_p]
     lib_layout.append_styled_text.argtypes = [
@@ -180,5 +193,21 @@ class Library:
             layout, Rect(0, 0, scr.width, scr.height)
         ), "draw_layout failed"
 
+    def clear_children(self, parent: NodePointer) -> None:
+        assert not self._library.clear_children(parent), "clear_children failed"
+
+    def free_layout(self, layout: Layout) -> None:
+        assert not self._library.free_layout(layout), "free_layout failed"
+
+    def get_counters(self) -> LayoutCounters:
+        counters = LayoutCounters()
+        assert not self._library.get_layout_counters(
+            ctypes.byref(counters)
+        ), "get_layout_counters failed"
+        return counters
+
+    def reset_counters(self) -> None:
+        assert not self._library.reset_layout_counters(), "reset_layout_counters failed"
+
     def clear(self):
         self._not_garbage = []
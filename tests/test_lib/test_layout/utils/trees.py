@@ -0,0 +1,49 @@
+from .library import (
+    NODE_DIRECTION_COLS,
+    NODE_DIRECTION_ROWS,
+    NODE_WRAP,
+    Library,
+    NodePointer,
+)
+
+
+def build_list(library: Library, root: NodePointer, size: int) -> None:
+    root.contents.nodes_direction = NODE_DIRECTION_ROWS
+    for i in range(size):
+        library.append_text(root, b"row %d" % i)
+
+
+def build_columns(library: Library, root: NodePointer, size: int) -> None:
+    root.contents.nodes_direction = NODE_DIRECTION_COLS
+    for i in range(size // 10):
+        column = library.append_child(root)
+        column.contents.nodes_direction = NODE_DIRECTION_ROWS
+        column.contents.fit_content = True
+        for j in range(9):
+            library.append_text(column, b"%d.%d" % (i, j))
+
+
+def build_wrapped_rows(library: Library, root: NodePointer, size: int) -> None:
+    # the status panel
+    root.contents.nodes_direction = NODE_DIRECTION_ROWS
+    grid = library.append_child(root)
+    grid.contents.nodes_direction = NODE_DIRECTION_ROWS
+    grid.contents.wrap = NODE_WRAP
+    grid.contents.fit_content = True
+    grid.contents.expand = 1
+    for i in range(size):
+        library.append_text(grid, b"   modified: file_%d.c" % i)
+
+
+def build_wrapped_columns(library: Library, root: NodePointer, size: int) -> None:
+    root.contents.nodes_direction = NODE_DIRECTION_ROWS
+    grid = library.append_child(root)
+    grid.contents.nodes_direction = NODE_DIRECTION_COLS
+    grid.contents.wrap = NODE_WRAP
+    grid.contents.fit_content = True
+    grid.contents.expand = 1
+    for i in range(size):
+        library.append_text(grid, b"f%d " % i)
+
+
+BUILDERS = [build_list, build_columns, build_wrapped_rows, build_wrapped_columns]